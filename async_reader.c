@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "async_reader.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+enum extent_state_t { EXTENT_FREE, EXTENT_QUEUED, EXTENT_READING, EXTENT_DONE };
+
+struct extent_t {
+    off_t offset;
+    size_t len;
+    size_t filled;
+    uint8_t *data;
+    enum extent_state_t state;
+    int error;
+};
+
+/* Extents form a ring in file order starting at `head`, `count` of them are
+ * queued, being read or done. The read thread, if any, owns the extents in
+ * EXTENT_READING and takes EXTENT_QUEUED ones in order; everything else is
+ * only touched by the consumer. */
+struct async_reader_t {
+    int fd;
+    off_t size;
+    size_t extent_size;
+    int depth;
+    uint8_t *buffer;
+    struct extent_t *extents;
+    int head;
+    int count;
+    off_t next;
+    off_t position;
+    int eof;
+    int error;
+
+    enum async_reader_backend_t backend;
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+#endif
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+};
+
+static struct extent_t *extent_at(struct async_reader_t *reader, int i) {
+    return &reader->extents[(reader->head + i) % reader->depth];
+}
+
+/* Reads the rest of an extent, short only at the end of the file. */
+static void read_extent(int fd, struct extent_t *extent) {
+    while (extent->filled < extent->len) {
+        ssize_t n = pread(fd, extent->data + extent->filled,
+                          extent->len - extent->filled,
+                          extent->offset + extent->filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) extent->error = errno;
+        if (n <= 0) break;
+        extent->filled += n;
+    }
+}
+
+static void *read_thread(void *arg) {
+    struct async_reader_t *reader = arg;
+    pthread_mutex_lock(&reader->lock);
+    for (;;) {
+        struct extent_t *extent = NULL;
+        for (int i = 0; i < reader->count && extent == NULL; i++)
+            if (extent_at(reader, i)->state == EXTENT_QUEUED)
+                extent = extent_at(reader, i);
+        if (extent == NULL) {
+            if (reader->stop) break;
+            pthread_cond_wait(&reader->cond, &reader->lock);
+            continue;
+        }
+        extent->state = EXTENT_READING;
+        pthread_mutex_unlock(&reader->lock);
+        read_extent(reader->fd, extent);
+        pthread_mutex_lock(&reader->lock);
+        extent->state = EXTENT_DONE;
+        pthread_cond_broadcast(&reader->cond);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+#ifdef HAVE_LIBURING
+/* Queues a read of the rest of an extent. With the ring full, which takes
+ * more reads than extents, the rest is read right away instead, so every
+ * extent in EXTENT_READING has a read in the ring and waiting on it ends. */
+static void uring_submit(struct async_reader_t *reader,
+                         struct extent_t *extent) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&reader->ring);
+    if (sqe == NULL) {
+        read_extent(reader->fd, extent);
+        extent->state = EXTENT_DONE;
+        return;
+    }
+    io_uring_prep_read(sqe, reader->fd, extent->data + extent->filled,
+                       extent->len - extent->filled,
+                       extent->offset + extent->filled);
+    io_uring_sqe_set_data(sqe, extent);
+    extent->state = EXTENT_READING;
+    // a failed submit leaves the read queued for uring_complete to retry
+    io_uring_submit(&reader->ring);
+}
+
+/* Completes one read, resubmitting the rest of short reads. */
+static int uring_complete(struct async_reader_t *reader) {
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_submit_and_wait(&reader->ring, 1);
+    if (ret == -EINTR) return 0;
+    if (ret < 0) return -1;
+    ret = io_uring_peek_cqe(&reader->ring, &cqe);
+    if (ret == -EAGAIN) return 0;
+    if (ret < 0) return -1;
+    struct extent_t *extent = io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&reader->ring, cqe);
+    if (res == -EINTR || res == -EAGAIN) {
+        uring_submit(reader, extent);
+        return 0;
+    }
+    if (res < 0) extent->error = -res;
+    if (res > 0) extent->filled += res;
+    // nothing read means the end of the file, leave the extent short
+    if (res <= 0 || extent->filled == extent->len)
+        extent->state = EXTENT_DONE;
+    else
+        uring_submit(reader, extent);
+    return 0;
+}
+#endif
+
+static int submit(struct async_reader_t *reader, struct extent_t *extent) {
+#ifdef HAVE_LIBURING
+    if (reader->backend == ASYNC_READER_URING) {
+        uring_submit(reader, extent);
+        return 0;
+    }
+#endif
+    pthread_mutex_lock(&reader->lock);
+    extent->state = EXTENT_QUEUED;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+    return 0;
+}
+
+/* Queues extents past the last one until `depth` are in flight. */
+static int fill(struct async_reader_t *reader) {
+    while (reader->count < reader->depth && reader->next < reader->size) {
+        struct extent_t *extent = extent_at(reader, reader->count);
+        off_t left = reader->size - reader->next;
+        extent->offset = reader->next;
+        extent->len = left < (off_t)reader->extent_size
+                          ? (size_t)left : reader->extent_size;
+        extent->filled = 0;
+        extent->error = 0;
+        if (reader->backend == ASYNC_READER_THREAD)
+            pthread_mutex_lock(&reader->lock);
+        reader->count++;
+        if (reader->backend == ASYNC_READER_THREAD)
+            pthread_mutex_unlock(&reader->lock);
+        reader->next += extent->len;
+        if (submit(reader, extent) != 0) return -1;
+    }
+    return 0;
+}
+
+static int wait_head(struct async_reader_t *reader) {
+    struct extent_t *extent = extent_at(reader, 0);
+#ifdef HAVE_LIBURING
+    if (reader->backend == ASYNC_READER_URING) {
+        while (extent->state != EXTENT_DONE)
+            if (uring_complete(reader) != 0) return -1;
+        return 0;
+    }
+#endif
+    pthread_mutex_lock(&reader->lock);
+    while (extent->state != EXTENT_DONE)
+        pthread_cond_wait(&reader->cond, &reader->lock);
+    pthread_mutex_unlock(&reader->lock);
+    return 0;
+}
+
+static void release_head(struct async_reader_t *reader) {
+    if (reader->backend == ASYNC_READER_THREAD)
+        pthread_mutex_lock(&reader->lock);
+    extent_at(reader, 0)->state = EXTENT_FREE;
+    reader->head = (reader->head + 1) % reader->depth;
+    reader->count--;
+    if (reader->backend == ASYNC_READER_THREAD)
+        pthread_mutex_unlock(&reader->lock);
+}
+
+/* Waits for the extents before `offset` and drops them, or all of them if
+ * `offset` is -1. Buffers can't be reused while a read into them is in
+ * flight, so even dropped extents are waited for. */
+static int drop_before(struct async_reader_t *reader, off_t offset) {
+    while (reader->count > 0) {
+        struct extent_t *extent = extent_at(reader, 0);
+        if (offset >= 0 && offset < extent->offset + (off_t)extent->len)
+            break;
+        if (wait_head(reader) != 0) return -1;
+        release_head(reader);
+    }
+    if (reader->count == 0 && offset >= 0) reader->next = offset;
+    return 0;
+}
+
+static size_t async_read(void *context, void *buffer, size_t size) {
+    struct async_reader_t *reader = context;
+    size_t done = 0;
+    while (done < size && !reader->error) {
+        if (reader->count == 0 && fill(reader) != 0) reader->error = 1;
+        if (reader->count == 0 || reader->error) break;
+        if (wait_head(reader) != 0) {
+            reader->error = 1;
+            break;
+        }
+        struct extent_t *extent = extent_at(reader, 0);
+        if (extent->error) {
+            reader->error = 1;
+            break;
+        }
+        off_t end = extent->offset + extent->filled;
+        if (reader->position < end) {
+            size_t n = end - reader->position;
+            if (n > size - done) n = size - done;
+            memcpy((uint8_t *)buffer + done,
+                   extent->data + (reader->position - extent->offset), n);
+            reader->position += n;
+            done += n;
+        }
+        if (reader->position < end) break;
+        if (extent->filled < extent->len) {
+            // the file shrank since it was opened
+            reader->size = end;
+            drop_before(reader, -1);
+            break;
+        }
+        release_head(reader);
+        if (fill(reader) != 0) reader->error = 1;
+    }
+    if (done < size && !reader->error) reader->eof = 1;
+    return done;
+}
+
+static int async_seek(void *context, off_t offset, sl_seek_whence_t whence) {
+    struct async_reader_t *reader = context;
+    if (whence == SL_SEEK_CUR)
+        offset += reader->position;
+    else if (whence == SL_SEEK_END)
+        offset += reader->size;
+    if (offset < 0) return -1;
+
+    // forward seeks within the extents in flight keep them
+    struct extent_t *head = reader->count > 0 ? extent_at(reader, 0) : NULL;
+    int keep = head != NULL && offset >= head->offset && offset < reader->next;
+    if (drop_before(reader, keep ? offset : -1) != 0) return -1;
+    if (!keep) reader->next = offset;
+    reader->position = offset;
+    reader->eof = 0;
+    return 0;
+}
+
+static off_t async_tell(void *context) {
+    return ((struct async_reader_t *)context)->position;
+}
+
+static int async_eof(void *context) {
+    return ((struct async_reader_t *)context)->eof;
+}
+
+static int async_error(void *context) {
+    return ((struct async_reader_t *)context)->error;
+}
+
+static off_t async_length(void *context) {
+    return ((struct async_reader_t *)context)->size;
+}
+
+static sl_seekable_t async_seekable(void *context) {
+    (void)context;
+    return SL_SEEKING_EXACT;
+}
+
+static void destroy_reader(struct async_reader_t *reader) {
+    if (reader->fd >= 0) close(reader->fd);
+    free(reader->buffer);
+    free(reader->extents);
+    free(reader);
+}
+
+static int start_backend(struct async_reader_t *reader) {
+#ifdef HAVE_LIBURING
+    // seccomp filters and old kernels refuse io_uring, use a thread then
+    if (io_uring_queue_init(reader->depth, &reader->ring, 0) == 0) {
+        reader->backend = ASYNC_READER_URING;
+        return 0;
+    }
+#endif
+    reader->backend = ASYNC_READER_THREAD;
+    if (pthread_mutex_init(&reader->lock, NULL) != 0) return -1;
+    if (pthread_cond_init(&reader->cond, NULL) != 0) {
+        pthread_mutex_destroy(&reader->lock);
+        return -1;
+    }
+    if (pthread_create(&reader->thread, NULL, read_thread, reader) != 0) {
+        pthread_cond_destroy(&reader->cond);
+        pthread_mutex_destroy(&reader->lock);
+        return -1;
+    }
+    return 0;
+}
+
+streamlike_t *async_reader_open(const char *path, size_t extent_size,
+                                int depth) {
+    if (extent_size == 0 || depth < 1) return NULL;
+    struct async_reader_t *reader = calloc(1, sizeof(*reader));
+    streamlike_t *stream = calloc(1, sizeof(*stream));
+    if (reader != NULL) reader->fd = -1;
+    if (reader == NULL || stream == NULL) goto fail;
+    reader->fd = open(path, O_RDONLY);
+    reader->extent_size = extent_size;
+    reader->depth = depth;
+    reader->buffer = malloc(extent_size * depth);
+    reader->extents = calloc(depth, sizeof(*reader->extents));
+    if (reader->buffer == NULL || reader->extents == NULL) goto fail;
+    struct stat st;
+    if (reader->fd < 0 || fstat(reader->fd, &st) != 0) goto fail;
+    reader->size = st.st_size;
+    for (int i = 0; i < depth; i++)
+        reader->extents[i].data = reader->buffer + extent_size * i;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (start_backend(reader) != 0) goto fail;
+
+    stream->context = reader;
+    stream->read = async_read;
+    stream->seek = async_seek;
+    stream->tell = async_tell;
+    stream->eof = async_eof;
+    stream->error = async_error;
+    stream->length = async_length;
+    stream->seekable = async_seekable;
+    return stream;
+
+fail:
+    if (reader) destroy_reader(reader);
+    free(stream);
+    return NULL;
+}
+
+int async_reader_close(streamlike_t *stream) {
+    struct async_reader_t *reader = stream->context;
+    int ret = drop_before(reader, -1);
+#ifdef HAVE_LIBURING
+    if (reader->backend == ASYNC_READER_URING)
+        io_uring_queue_exit(&reader->ring);
+#endif
+    if (reader->backend == ASYNC_READER_THREAD) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = 1;
+        pthread_cond_broadcast(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->thread, NULL);
+        pthread_cond_destroy(&reader->cond);
+        pthread_mutex_destroy(&reader->lock);
+    }
+    destroy_reader(reader);
+    free(stream);
+    return ret;
+}
+
+enum async_reader_backend_t async_reader_backend(const streamlike_t *stream) {
+    return ((const struct async_reader_t *)stream->context)->backend;
+}
@@ -0,0 +1,28 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <stddef.h>
+
+#include <streamlike.h>
+
+/* Read-ahead input for compressed files. A streamlike stream over a local
+ * file that keeps up to `depth` extents of `extent_size` bytes in flight past
+ * the read position, so inflating one extent overlaps with reading the next
+ * ones. Extents are read through io_uring when built with HAVE_LIBURING and
+ * the kernel allows it, otherwise by a read thread per stream.
+ *
+ * Sequential reads and forward seeks within the extents in flight are served
+ * from them. Any other seek drains them and reading restarts at the new
+ * position. */
+
+enum async_reader_backend_t { ASYNC_READER_URING, ASYNC_READER_THREAD };
+
+#define ASYNC_READER_DEFAULT_DEPTH 4
+#define ASYNC_READER_DEFAULT_EXTENT_SIZE (1 << 20)
+
+streamlike_t *async_reader_open(const char *path, size_t extent_size,
+                                int depth);
+int async_reader_close(streamlike_t *stream);
+enum async_reader_backend_t async_reader_backend(const streamlike_t *stream);
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <arpa/inet.h>
+
+//
+#include "mrt_columns.h"
+
+/* Per prefix aggregates over the columns written by pfxdump
+ * --export-columns. Only the columns a query needs are mapped. */
+
+enum query_t { QUERY_PEERS, QUERY_ORIGINS };
+
+static void errexit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+static void usageexit(const char *program) {
+    errexit(
+        "usage: %s <columns-dir> <peers|origins>\n"
+        "\tpeers: number of RIB entries of every prefix\n"
+        "\torigins: distinct origin ASes of every prefix\n",
+        program);
+}
+
+static void open_column(struct mrt_column_t *column, const char *dir,
+                        enum mrt_column_id_t id) {
+    char *path = mrt_column_path(dir, id);
+    if (path == NULL ||
+        mrt_column_open(column, path, mrt_column_elem_size(id)) != 0)
+        errexit("error: couldn't open column '%s'\n", path ? path : "");
+    free(path);
+}
+
+static void print_prefix(const struct prefix_key_t *key) {
+    char dst[INET6_ADDRSTRLEN];
+    inet_ntop(key->afi ? AF_INET6 : AF_INET, key->addr, dst, sizeof(dst));
+    printf("%s/%u", dst, key->len);
+}
+
+static uint64_t get_u64(struct mrt_column_t *column, uint64_t row) {
+    const void *p = mrt_column_row(column, row);
+    if (p == NULL)
+        errexit("error: couldn't read row %llu\n", (unsigned long long)row);
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+int main(int argc, char **argv) {
+    const char *program = argv[0];
+    if (argc != 3) usageexit(program);
+    const char *dir = argv[1];
+    enum query_t query;
+    if (!strcmp(argv[2], "peers"))
+        query = QUERY_PEERS;
+    else if (!strcmp(argv[2], "origins"))
+        query = QUERY_ORIGINS;
+    else
+        usageexit(program);
+
+    struct mrt_column_t prefixes, entries, origins;
+    open_column(&prefixes, dir, MRT_COLUMN_PREFIX);
+    open_column(&entries, dir, MRT_COLUMN_ENTRIES);
+    if (query == QUERY_ORIGINS)
+        open_column(&origins, dir, MRT_COLUMN_ORIGIN_AS);
+    if (entries.row_count != prefixes.row_count + 1)
+        errexit("error: prefix and entries columns don't match\n");
+
+    // origins of a prefix are few, a linear dedup is enough
+    uint32_t *seen = NULL;
+    size_t seen_cap = 0;
+    uint64_t first = get_u64(&entries, 0);
+    for (uint64_t i = 0; i < prefixes.row_count; i++) {
+        const struct prefix_key_t *key = mrt_column_row(&prefixes, i);
+        uint64_t last = get_u64(&entries, i + 1);
+        if (key == NULL || last < first)
+            errexit("error: corrupt record %llu\n", (unsigned long long)i);
+        print_prefix(key);
+
+        if (query == QUERY_PEERS) {
+            printf(" %llu\n", (unsigned long long)(last - first));
+        } else {
+            if (last - first > seen_cap) {
+                seen_cap = last - first;
+                seen = realloc(seen, seen_cap * sizeof(*seen));
+                if (seen == NULL) errexit("error: out of memory\n");
+            }
+            size_t seen_len = 0;
+            for (uint64_t row = first; row < last; row++) {
+                const void *p = mrt_column_row(&origins, row);
+                if (p == NULL) errexit("error: couldn't read origin AS\n");
+                uint32_t asn;
+                memcpy(&asn, p, sizeof(asn));
+                size_t j = 0;
+                while (j < seen_len && seen[j] != asn) j++;
+                if (j < seen_len) continue;
+                seen[seen_len++] = asn;
+                printf(" AS%u", (unsigned)asn);
+            }
+            printf("\n");
+        }
+        first = last;
+    }
+
+    free(seen);
+    if (query == QUERY_ORIGINS) mrt_column_close(&origins);
+    mrt_column_close(&entries);
+    mrt_column_close(&prefixes);
+    return 0;
+}
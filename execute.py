@@ -7,6 +7,7 @@ import os
 import re
 import shutil
 import subprocess
+import zlib
 
 import pandas as pd
 import matplotlib.pyplot as plt
@@ -21,6 +22,8 @@ cwd = Path(__file__).parent
 
 zidx_bin = cwd / "bin" / "zidx"
 pfxdump_bin = cwd / "bin" / "pfxdump"
+mrtgen_bin = cwd / "bin" / "mrtgen"
+ingest_bin = cwd / "bin" / "pfxdump-ingest"
 
 data_dir = cwd / "data"
 experiment_dir = cwd / "experiment"
@@ -182,6 +185,20 @@ def copy(date_range, collectors, from_path, to_path):
         logger.info(f"Copying '{from_file}' to '{to_file}'...")
         shutil.copy(from_file, to_file)
 
+def generate(date_range, collectors, to_path, ipv4, ipv6, peers, entries,
+        attr_size, level, seed):
+    for path in _mrt_path_range(date_range, collectors, to_path, is_output=True):
+        # Derive a per-file seed from its place in the tree so every snapshot
+        # differs but regenerating the tree is reproducible.
+        file_seed = zlib.crc32(str(path.relative_to(to_path)).encode(), seed)
+        logger.info(f"Generating '{path}' with seed {file_seed}...")
+        p = _run([str(mrtgen_bin), str(path), "-4", str(ipv4), "-6", str(ipv6),
+                  "-p", str(peers), "-e", str(entries), "-a", str(attr_size),
+                  "-z", str(level), "-s", str(file_seed)])
+        if p.returncode != 0:
+            raise RuntimeError(p.stderr.decode())
+        logger.debug(p.stderr.decode().rstrip())
+
 def run_zidx(*args):
     return _timed_run([str(zidx_bin), *args])
 
@@ -190,37 +207,71 @@ def run_pfxdump(remote, *args):
         return _timed_network_run([str(pfxdump_bin), *args])
     return _timed_run([str(pfxdump_bin), *args])
 
-def zidx(date_range, collectors, from_path, to_path, spans, softlink_span):
+def zidx(date_range, collectors, from_path, to_path, spans, softlink_span,
+        mrt_aware, self_contained, max_lookups, max_index_sizes):
     if to_path is None:
         to_path = from_path
     assert str(softlink_span) in spans
+    extra = ["-m"] if mrt_aware else []
     for from_file, to_file in _mrt_path_pairs_range(
             date_range, collectors, from_path, to_path):
         for span in spans:
-            logger.debug(run_zidx(from_file, to_file + f"_{span}_uncomp.zx", int(span)*1024, "1"))
-            logger.debug(run_zidx(from_file, to_file + f"_{span}_comp.zx", int(span)*1024, "0"))
+            logger.debug(run_zidx(from_file, to_file + f"_{span}_uncomp.zx", int(span)*1024, "1", *extra))
+            logger.debug(run_zidx(from_file, to_file + f"_{span}_comp.zx", int(span)*1024, "0", *extra))
+            # Self-contained index with compressed windows, no .zx needed.
+            if self_contained:
+                logger.debug(run_zidx(from_file, to_file + f"_{span}_comp.mrtx", int(span)*1024, "0", "-z"))
+        # Adaptive variants place checkpoints by estimated lookup cost
+        # instead of a fixed span; these always get a .mrtx sidecar.
+        for max_lookup in max_lookups or []:
+            logger.debug(run_zidx(from_file, to_file + f"_lookup{max_lookup}.zx", 0, "1", "-l", int(max_lookup)*1024))
+        for max_size in max_index_sizes or []:
+            logger.debug(run_zidx(from_file, to_file + f"_size{max_size}.zx", 0, "1", "-s", int(max_size)*1024*1024))
         symlink = to_file + ".zx"
         if symlink.exists():
             symlink.unlink()
         symlink.symlink_to((to_file + f"_{softlink_span}_comp.zx").name)
+        if mrt_aware:
+            symlink = to_file + ".zx.mrtx"
+            if symlink.exists():
+                symlink.unlink()
+            symlink.symlink_to(
+                    (to_file + f"_{softlink_span}_comp.zx.mrtx").name)
+
+def ingest(date_range, collectors, from_path, to_path, spans, softlink_span,
+        keys):
+    # Like copy followed by zidx -z for every span, but each file is read
+    # and inflated once for all of them.
+    assert str(softlink_span) in spans
+    for from_file, to_file in _mrt_path_pairs_range(
+            date_range, collectors, from_path, to_path):
+        logger.info(f"Ingesting '{from_file}' to '{to_file}'...")
+        args = [str(from_file), str(to_file)]
+        for span in spans:
+            args += ["-i", str(to_file + f"_{span}_comp.mrtx"), str(int(span)*1024)]
+        if keys:
+            args += ["-k", str(to_file + ".keys")]
+        logger.debug(_timed_run([str(ingest_bin), *args]))
+        symlink = to_file + ".mrtx"
+        if symlink.exists():
+            symlink.unlink()
+        symlink.symlink_to((to_file + f"_{softlink_span}_comp.mrtx").name)
 
 def sample_prefixes(
         date_range, collectors, gzip_path, output_path, num):
-    r = re.compile(rb'debug: (.+?)\n')
     first_path = True
     order = {}
     for path in _mrt_path_range(date_range, collectors, gzip_path):
-        p = _run([str(pfxdump_bin), str(path), "-", "255.255.255.255/32", "-i", "-d"])
-        all_prefixes = r.finditer(p.stdout)
+        p = _run([str(pfxdump_bin), str(path), "-", "--list-prefixes", "-i"])
+        all_prefixes = p.stdout.splitlines()
         if first_path:
             for prefix in all_prefixes:
-                prefix = prefix.group(1)
                 order[prefix] = len(order)
             s = set(order)
             first_path = False
         else:
             logger.debug("Size before: %d", len(s))
-            s &= set(prefix.group(1) for prefix in all_prefixes)
+            s &= set(all_prefixes)
             logger.debug("Size after: %d", len(s))
 
     s = sorted(list(s), key=lambda v: order[v])
@@ -363,6 +414,23 @@ def main(args=None):
             func=_args_callback(copy,
                 ["date_range", "collectors", "from_path", "to_path"]))
 
+    subparser = subparsers.add_parser("generate")
+    subparser.add_argument("to_path", nargs="?", default=data_dir, type=Path)
+    subparser.add_argument("-4", "--ipv4", default=800000, type=int)
+    subparser.add_argument("-6", "--ipv6", default=60000, type=int)
+    subparser.add_argument("-p", "--peers", default=32, type=int)
+    subparser.add_argument("-e", "--entries", default=24, type=int)
+    subparser.add_argument("-a", "--attr-size", default=0, type=int)
+    subparser.add_argument("-z", "--level", default=6, type=int)
+    subparser.add_argument("--seed", default=1, type=int)
+    subparser.add_argument(
+            "-d", "--date-range", default=default_date_range,
+            type=_arg_date_range)
+    subparser.set_defaults(
+            func=_args_callback(generate,
+                ["date_range", "collectors", "to_path", "ipv4", "ipv6",
+                    "peers", "entries", "attr_size", "level", "seed"]))
+
     subparser = subparsers.add_parser("zidx")
     subparser.add_argument("from_path", nargs="?", default=data_dir, type=Path)
     subparser.add_argument(
@@ -371,13 +439,40 @@ def main(args=None):
             "-s", "--spans", default=default_spans, type=_arg_split(","))
     subparser.add_argument(
             "--softlink-span", default=default_softlinked_span)
+    subparser.add_argument("-m", "--mrt-aware", action="store_true")
+    subparser.add_argument("-z", "--self-contained", action="store_true")
+    subparser.add_argument(
+            "--max-lookup", dest="max_lookups", type=_arg_split(","),
+            help="comma separated max KiB inflated per lookup")
+    subparser.add_argument(
+            "--max-index-size", dest="max_index_sizes", type=_arg_split(","),
+            help="comma separated max index sizes in MiB")
     subparser.add_argument(
             "-d", "--date-range", default=default_date_range,
             type=_arg_date_range)
     subparser.set_defaults(
             func=_args_callback(zidx,
                 ["date_range", "collectors", "from_path", "to_path", "spans",
-                    "softlink_span"]))
+                    "softlink_span", "mrt_aware", "self_contained",
+                    "max_lookups", "max_index_sizes"]))
+
+    subparser = subparsers.add_parser("ingest")
+    subparser.add_argument("from_path", type=PathOrUrl)
+    subparser.add_argument("to_path", nargs="?", default=data_dir, type=Path)
+    subparser.add_argument(
+            "-s", "--spans", default=default_spans, type=_arg_split(","))
+    subparser.add_argument(
+            "--softlink-span", default=default_softlinked_span)
+    subparser.add_argument(
+            "-k", "--keys", action="store_true",
+            help="also write the prefix key table of every file")
+    subparser.add_argument(
+            "-d", "--date-range", default=default_date_range,
+            type=_arg_date_range)
+    subparser.set_defaults(
+            func=_args_callback(ingest,
+                ["date_range", "collectors", "from_path", "to_path", "spans",
+                    "softlink_span", "keys"]))
 
     subparser = subparsers.add_parser("sample_prefixes")
     from urlpath import URL
@@ -7,12 +7,17 @@
 
 //
 #include <arpa/inet.h>
+#include <pthread.h>
 
 //
 #include <zidx.h>
 
+//
+#include "mrt_index.h"
+
 enum {
     TABLE_DUMP_V2 = 13,
+    TABLE_DUMP_V2_PEER_INDEX_TABLE = 1,
     TABLE_DUMP_V2_RIB_IPV4_UNICAST = 2,
     TABLE_DUMP_V2_RIB_IPV4_MULTICAST = 3,
     TABLE_DUMP_V2_RIB_IPV6_UNICAST = 4,
@@ -20,7 +25,10 @@ enum {
     TABLE_DUMP_V2_RIB_GENERIC = 6,
 
     TABLE_DUMP_V2_SUBTYPE_BEGIN = TABLE_DUMP_V2_RIB_IPV4_UNICAST,
-    TABLE_DUMP_V2_SUBTYPE_END = TABLE_DUMP_V2_RIB_GENERIC
+    TABLE_DUMP_V2_SUBTYPE_END = TABLE_DUMP_V2_RIB_GENERIC,
+
+    BGP4MP = 16,
+    BGP4MP_ET = 17
 };
 
 typedef struct prefix_checkpoint_t prefix_checkpoint_t;
@@ -78,6 +86,17 @@ static off_t align_to_first_header(const char* window, size_t len) {
     return -1;
 }
 
+/* Whether a record known to start at `off` is a RIB record whose prefix lies
+ * within the window, i.e. it can be compared without inflating anything. */
+static int tdv2_prefix_fits(const char* window, off_t off, size_t len) {
+    size_t prefix_off = off + offsetof(tdv2_minimal_t, prefix_length);
+    if (prefix_off >= len) return 0;
+    mrt_header_t header = get_header(window + off);
+    if (!is_tdv2_rib_header(&header)) return 0;
+    uint8_t prefix_len = window[prefix_off];
+    return prefix_off + 1 + (prefix_len + 7) / 8 <= len;
+}
+
 static int prefix_cmp(const struct prefix_t* lhs, const struct prefix_t* rhs) {
     uint8_t cmp_len = lhs->len < rhs->len ? lhs->len : rhs->len;
     uint8_t bytes = cmp_len / 8;
@@ -87,18 +106,42 @@ static int prefix_cmp(const struct prefix_t* lhs, const struct prefix_t* rhs) {
     if (cmp != 0) return cmp;
 
     if (bits) {
-        uint8_t msb = 0xFFU << bits;
+        uint8_t msb = 0xFFU << (8 - bits);
         int cmp = (int)(lhs->addr[bytes] & msb) - (int)(rhs->addr[bytes] & msb);
         if (cmp != 0) return cmp;
     }
     return (int)lhs->len - (int)rhs->len;
 }
 
+/* Dumps hold all IPv4 RIB records before the IPv6 ones. */
 int afi_prefix_cmp(const struct afi_prefix_t* lhs,
                    const struct afi_prefix_t* rhs) {
-    int cmp = prefix_cmp(&lhs->prefix, &rhs->prefix);
-    if (cmp != 0) return cmp;
-    return (int)lhs->type - (int)rhs->type;
+    if (lhs->type != rhs->type) return (int)lhs->type - (int)rhs->type;
+    return prefix_cmp(&lhs->prefix, &rhs->prefix);
+}
+
+static struct prefix_key_t make_key(enum afi_type_t type, uint8_t len,
+                                    const uint8_t* addr) {
+    struct prefix_key_t key;
+    memset(&key, 0, sizeof(key));
+    if (len > 128) len = 128;
+    key.afi = type;
+    key.len = len;
+    memcpy(key.addr, addr, (len + 7) / 8);
+    if (len % 8) key.addr[len / 8] &= 0xFFU << (8 - len % 8);
+    return key;
+}
+
+struct prefix_key_t prefix_key_make(const struct afi_prefix_t* pfx) {
+    return make_key(pfx->type, pfx->prefix.len, pfx->prefix.addr);
+}
+
+struct afi_prefix_t prefix_key_prefix(const struct prefix_key_t* key) {
+    struct afi_prefix_t pfx;
+    pfx.type = key->afi ? AFI_TYPE_IPV6 : AFI_TYPE_IPV4;
+    pfx.prefix.len = key->len;
+    memcpy(pfx.prefix.addr, key->addr, sizeof(key->addr));
+    return pfx;
 }
 
 static enum afi_type_t get_tdv2_afi_type(const char* window) {
@@ -118,6 +161,50 @@ static enum afi_type_t get_tdv2_afi_type(const char* window) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 
+int afi_prefix_parse(const char* str, struct afi_prefix_t* pfx,
+                     const char** error) {
+    char addr[INET6_ADDRSTRLEN];
+    const char* len_str = strchr(str, '/');
+    if (len_str == NULL) {
+        *error = "couldn't find '/' denoting prefix length";
+        return -1;
+    }
+    if ((size_t)(len_str - str) >= sizeof(addr)) {
+        *error = "couldn't parse ip address";
+        return -1;
+    }
+    memcpy(addr, str, len_str - str);
+    addr[len_str - str] = '\0';
+    len_str++;
+    for (const char* d = len_str; *d; d++) {
+        if (*d < '0' || *d > '9') {
+            *error = "prefix length should consist of digits only";
+            return -1;
+        }
+    }
+
+    long len = strtol(len_str, NULL, 10);
+    if (*len_str == '\0' || len < 0 || len > 128) {
+        *error = "prefix length should be in the range of [0, 128]";
+        return -1;
+    }
+    memset(pfx, 0, sizeof(*pfx));
+    pfx->prefix.len = len;
+    if (inet_pton(AF_INET, addr, pfx->prefix.addr)) {
+        if (len > 32) {
+            *error = "prefix length shouldn't be more than 32 for IPv4";
+            return -1;
+        }
+        pfx->type = AFI_TYPE_IPV4;
+    } else if (inet_pton(AF_INET6, addr, pfx->prefix.addr)) {
+        pfx->type = AFI_TYPE_IPV6;
+    } else {
+        *error = "couldn't parse ip address";
+        return -1;
+    }
+    return 0;
+}
+
 void prefix_printf(struct afi_prefix_t afi_prefix) {
     char dst[255];
     uint8_t bytes = afi_prefix.prefix.len / 8;
@@ -147,9 +234,32 @@ void prefix_printf(struct afi_prefix_t afi_prefix) {
     }
 }
 
+/* Offset of the first record in the window of checkpoint `k` whose prefix
+ * can be read from the window, -1 if there is none and -2 on error. */
+static off_t probe_checkpoint(zidx_index* index,
+                              struct mrt_index_t* mrt_index, int k,
+                              const char** window) {
+    size_t len;
+    if (index) {
+        zidx_checkpoint* chkp = zidx_get_checkpoint(index, k);
+        if (chkp == NULL) return -2;
+        len = zidx_get_checkpoint_window(chkp, (const void**)window);
+    } else {
+        len = mrt_index_window(mrt_index, k, (const void**)window);
+        if (*window == NULL) return -2;
+    }
+    assert(*window);
+    off_t off = mrt_index ? mrt_index_window_offset(mrt_index, k, len)
+                          : align_to_first_header(*window, len);
+    if (off >= 0 && mrt_index && !tdv2_prefix_fits(*window, off, len))
+        off = -1;
+    return off;
+}
+
 struct prefix_checkpoint_t find_prefix_checkpoint(
-    const struct afi_prefix_t* pfx, zidx_index* index) {
-    int chkp_cnt = zidx_checkpoint_count(index);
+    const struct afi_prefix_t* pfx, zidx_index* index,
+    struct mrt_index_t* mrt_index) {
+    int chkp_cnt = index ? zidx_checkpoint_count(index) : mrt_index->count;
     if (chkp_cnt < 0) return (prefix_checkpoint_t){-2};
 
     /* invariant: i <= k < j, k is inclusive upperbound. */
@@ -157,23 +267,16 @@ struct prefix_checkpoint_t find_prefix_checkpoint(
     int j = chkp_cnt;
     int shift = 0;
     prefix_checkpoint_t ret = {-1, 0};
+    const struct prefix_key_t key = prefix_key_make(pfx);
 
     while (j - i > shift * 2) {
       int k = i + (j - i) / 2 - shift;
       const char* window;
-      zidx_checkpoint* chkp = zidx_get_checkpoint(index, k);
-      if (chkp == NULL) return (prefix_checkpoint_t){-3};
-      size_t len = zidx_get_checkpoint_window(chkp, (const void**)&window);
-      assert(window);
-      off_t off = align_to_first_header(window, len);
+      off_t off = probe_checkpoint(index, mrt_index, k, &window);
+      if (off < -1) return (prefix_checkpoint_t){-3};
       if (off >= 0) {
-          const struct prefix_t* off_pfx = get_pfx_from_tdv2(window + off);
-          int cmp = prefix_cmp(off_pfx, &pfx->prefix);
-
-          if (cmp == 0) {
-              enum afi_type_t mrt_afi_type = get_tdv2_afi_type(window + off);
-              cmp = mrt_afi_type - pfx->type;
-          }
+          const struct prefix_key_t off_key = get_prefix_key(window + off);
+          int cmp = prefix_key_cmp(&off_key, &key);
           if (cmp < 0) {
               ret = (prefix_checkpoint_t){k, off};
               i = k + 1;
@@ -190,12 +293,139 @@ struct prefix_checkpoint_t find_prefix_checkpoint(
     return ret;  // return last candidate
 }
 
+/* One pivot of a k-ary round: the last checkpoint in (`lo`, `k`] whose
+ * window has a record to compare against, walking down from `k` the way the
+ * bisection shifts. */
+struct pivot_probe_t {
+    zidx_index* index;
+    struct mrt_index_t* mrt_index;
+    int lo;
+    int k;
+    /* -1 if no checkpoint in range could be probed */
+    int found;
+    /* -2 on error */
+    off_t off;
+    struct prefix_key_t key;
+};
+
+static void* pivot_probe_procedure(void* vargs) {
+    struct pivot_probe_t* probe = vargs;
+    probe->found = -1;
+    probe->off = -1;
+    for (int k = probe->k; k > probe->lo; k--) {
+        const char* window;
+        off_t off =
+            probe_checkpoint(probe->index, probe->mrt_index, k, &window);
+        if (off < -1) {
+            probe->off = off;
+            break;
+        }
+        if (off >= 0) {
+            probe->found = k;
+            probe->off = off;
+            probe->key = get_prefix_key(window + off);
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct prefix_checkpoint_t find_prefix_checkpoint_kary(
+    const struct afi_prefix_t* pfx, zidx_index* index,
+    struct mrt_index_t* mrt_index, int ways) {
+    if (ways < 3) return find_prefix_checkpoint(pfx, index, mrt_index);
+    if (ways > FIND_PREFIX_MAX_WAYS) ways = FIND_PREFIX_MAX_WAYS;
+    int chkp_cnt = index ? zidx_checkpoint_count(index) : mrt_index->count;
+    if (chkp_cnt < 0) return (prefix_checkpoint_t){-2};
+
+    struct pivot_probe_t probes[FIND_PREFIX_MAX_WAYS - 1];
+    pthread_t threads[FIND_PREFIX_MAX_WAYS - 1];
+    prefix_checkpoint_t ret = {-1, 0};
+    const struct prefix_key_t key = prefix_key_make(pfx);
+
+    /* the answer is the last probed checkpoint before `key` in [lo, hi) if
+     * there is one, else `ret` */
+    int lo = 0;
+    int hi = chkp_cnt;
+    while (lo < hi) {
+        int n = hi - lo;
+        int m = n < ways - 1 ? n : ways - 1;
+        for (int t = 0; t < m; t++) {
+            probes[t].index = index;
+            probes[t].mrt_index = mrt_index;
+            probes[t].lo = t > 0 ? probes[t - 1].k : lo - 1;
+            probes[t].k = lo + (int)((long long)(t + 1) * n / (m + 1));
+        }
+
+        // the last pivot is probed here, as are any a thread can't start for
+        int started = 0;
+        while (started < m - 1 &&
+               pthread_create(&threads[started], NULL, pivot_probe_procedure,
+                              &probes[started]) == 0)
+            started++;
+        for (int t = started; t < m; t++) pivot_probe_procedure(&probes[t]);
+        for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+
+        int above = m;
+        for (int t = 0; t < m; t++) {
+            if (probes[t].off < -1) return (prefix_checkpoint_t){-3};
+            if (probes[t].found < 0) continue;
+            int cmp = prefix_key_cmp(&probes[t].key, &key);
+            if (cmp == 0)
+                return (prefix_checkpoint_t){probes[t].found, probes[t].off};
+            if (cmp > 0) {
+                above = t;
+                break;
+            }
+            ret = (prefix_checkpoint_t){probes[t].found, probes[t].off};
+        }
+        /* nothing up to the pivot before `above` is left to probe: those
+         * found are before `key` and the rest have no record to compare */
+        if (above > 0) lo = probes[above - 1].k + 1;
+        if (above < m) hi = probes[above].found;
+    }
+    return ret;
+}
+
+int find_checkpoint_prefix_key(zidx_index* index,
+                               struct mrt_index_t* mrt_index, int k,
+                               struct prefix_key_t* key) {
+    const char* window;
+    off_t off = probe_checkpoint(index, mrt_index, k, &window);
+    if (off < 0) return off < -1 ? -2 : -1;
+    *key = get_prefix_key(window + off);
+    return 0;
+}
+
 struct afi_prefix_t get_prefix(const void* mrt_data) {
     assert(mrt_data);
     return (struct afi_prefix_t){get_tdv2_afi_type(mrt_data),
                                  *get_pfx_from_tdv2(mrt_data)};
 }
 
+/* Unlike get_prefix, only reads the address bytes the record has. */
+struct prefix_key_t get_prefix_key(const void* mrt_data) {
+    assert(mrt_data);
+    const tdv2_minimal_t* msg = mrt_data;
+    return make_key(get_tdv2_afi_type(mrt_data), msg->prefix_length,
+                    (const uint8_t*)msg->addr);
+}
+
+int is_tdv2_rib_header(const struct mrt_header_t* header) {
+    return header->type == TABLE_DUMP_V2 &&
+           header->subtype >= TABLE_DUMP_V2_SUBTYPE_BEGIN &&
+           header->subtype < TABLE_DUMP_V2_SUBTYPE_END;
+}
+
+int is_tdv2_peer_index_header(const struct mrt_header_t* header) {
+    return header->type == TABLE_DUMP_V2 &&
+           header->subtype == TABLE_DUMP_V2_PEER_INDEX_TABLE;
+}
+
+int is_bgp4mp_header(const struct mrt_header_t* header) {
+    return header->type == BGP4MP || header->type == BGP4MP_ET;
+}
+
 struct mrt_header_t get_header(const void* mrt_data) {
     const mrt_header_t* headerp = mrt_data;
     return (mrt_header_t){ntohl(headerp->timestamp), ntohs(headerp->type),
@@ -1,6 +1,9 @@
 #ifndef FIND_PREFIX_H
 #define FIND_PREFIX_H
 
+#include <stdint.h>
+#include <string.h>
+
 #include <streamlike.h>
 #include <zidx.h>
 
@@ -16,6 +19,19 @@ struct afi_prefix_t {
     struct prefix_t prefix;
 };
 
+/* Canonical prefix key: AFI, address with the host bits cleared, then length.
+ * Keys are ordered like afi_prefix_cmp by a plain byte-wise compare, so they
+ * are built once per record and compared with prefix_key_cmp. */
+struct prefix_key_t {
+    uint8_t afi;
+    uint8_t addr[16];
+    uint8_t len;
+};
+
+#define PREFIX_KEY_SIZE 18
+typedef char prefix_key_size_check[sizeof(struct prefix_key_t) ==
+                                   PREFIX_KEY_SIZE ? 1 : -1];
+
 struct prefix_checkpoint_t {
     int index;
     size_t first_mrt_offset;
@@ -28,12 +44,62 @@ struct mrt_header_t {
     uint32_t length;
 };
 
+struct mrt_index_t;
+
+/* Parses "<address>/<length>", or returns -1 and points `error` at a static
+ * message. */
+int afi_prefix_parse(const char *str, struct afi_prefix_t *pfx,
+                     const char **error);
 void prefix_printf(struct afi_prefix_t afi_prefix);
 struct prefix_checkpoint_t find_prefix_checkpoint(
-    const struct afi_prefix_t *pfx, zidx_index *index);
+    const struct afi_prefix_t *pfx, zidx_index *index,
+    struct mrt_index_t *mrt_index);
+/* Like find_prefix_checkpoint, but each round probes `ways` - 1 pivots at
+ * once, one per thread, and narrows to one of the `ways` intervals between
+ * them, so a search takes log_ways rather than log2 of the checkpoint count
+ * rounds. Pays off where windows are slow to get at, such as those inflated
+ * on demand from a self-contained index. Below 3 ways it bisects. */
+#define FIND_PREFIX_MAX_WAYS 16
+struct prefix_checkpoint_t find_prefix_checkpoint_kary(
+    const struct afi_prefix_t *pfx, zidx_index *index,
+    struct mrt_index_t *mrt_index, int ways);
+/* Prefix of the record find_prefix_checkpoint compares against at checkpoint
+ * `k`. Returns 0, -1 if the window has no such record and -2 on error. */
+int find_checkpoint_prefix_key(zidx_index *index,
+                               struct mrt_index_t *mrt_index, int k,
+                               struct prefix_key_t *key);
 struct afi_prefix_t get_prefix(const void *mrt_data);
+struct prefix_key_t get_prefix_key(const void *mrt_data);
+struct prefix_key_t prefix_key_make(const struct afi_prefix_t *pfx);
+struct afi_prefix_t prefix_key_prefix(const struct prefix_key_t *key);
 struct mrt_header_t get_header(const void *mrt_data);
+int is_tdv2_rib_header(const struct mrt_header_t *header);
+int is_tdv2_peer_index_header(const struct mrt_header_t *header);
+int is_bgp4mp_header(const struct mrt_header_t *header);
 int afi_prefix_cmp(const struct afi_prefix_t *lhs,
                    const struct afi_prefix_t *rhs);
 
+static inline uint64_t prefix_key_load64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = v << 8 | p[i];
+    return v;
+}
+
+/* Two 64-bit and one 16-bit big-endian compare, combined without
+ * branching. Keys are copied out as their 18 bytes, all members being bytes,
+ * which compilers turn into plain loads. */
+static inline int prefix_key_cmp(const struct prefix_key_t *lhs,
+                                 const struct prefix_key_t *rhs) {
+    uint8_t l[PREFIX_KEY_SIZE], r[PREFIX_KEY_SIZE];
+    memcpy(l, lhs, sizeof(l));
+    memcpy(r, rhs, sizeof(r));
+    uint64_t l0 = prefix_key_load64(l), r0 = prefix_key_load64(r);
+    uint64_t l1 = prefix_key_load64(l + 8), r1 = prefix_key_load64(r + 8);
+    unsigned l2 = l[16] << 8 | l[17], r2 = r[16] << 8 | r[17];
+    int c0 = (l0 > r0) - (l0 < r0);
+    int c1 = (l1 > r1) - (l1 < r1);
+    int c2 = (l2 > r2) - (l2 < r2);
+    return 4 * c0 + 2 * c1 + c2;
+}
+
 #endif
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Needs self-contained indexes, e.g. bin/zidx $f $f.mrtx 1048576 1 -z, and a
+# gunzip_zidx built with INFLATE_BACKENDS listing the backends below.
+FILES=$(ls -1 data/*/2018.01/bview.20180101.????.gz)
+BACKENDS=${BACKENDS:-zlib zlib-ng isal}
+
+export TIMEFORMAT="%E"
+echo "size,chunks,backend,filename,time"
+for j in 1 2 3
+do
+  for b in $BACKENDS
+  do
+    for i in 1 2 3 4 5 6 7 8
+    do
+      for f in $FILES
+      do
+        echo "$(stat -c %s $f),$i,$b,$f,$((time bin/gunzip_zidx $i $f $f.mrtx /dev/null -b $b) 2>&1)"
+      done
+    done
+  done
+done
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -5,11 +7,154 @@
 #include <streamlike.h>
 #include <streamlike/file.h>
 #include <string.h>
+#include <time.h>
 #include <zidx.h>
 #include <zlib.h>
 
+#include "async_reader.h"
+#include "inflate_backend.h"
+#include "mapped_input.h"
+#include "mrt_frames.h"
+#include "mrt_index.h"
+#include "mrt_reader.h"
+
 #define DEBUG_PRINT(...)
 
+/* Compressed extents each worker keeps in flight, 0 reads synchronously. */
+static int read_ahead = ASYNC_READER_DEFAULT_DEPTH;
+/* Workers map the compressed file instead, see mapped_input.h. */
+static int use_mmap = 0;
+
+/* Where one thread of a run spent its time, in seconds, reported by
+ * --bench. Every thread fills one, benchmarking or not, the clock is cheap
+ * next to inflating a read. */
+struct thread_stats_t {
+    double start;
+    double end;
+    /* creating and importing its own index, opening the file */
+    double setup;
+    /* waiting for compressed input, excluded from inflate */
+    double read;
+    double inflate;
+    double write;
+    off_t comp_bytes;
+    off_t uncomp_bytes;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Compressed input is wrapped to time reads apart from the inflate calls
+ * they happen in. Mapped files are left alone for readers to find the
+ * mapping, their page faults count as inflating. */
+struct timed_stream_t {
+    streamlike_t *input;
+    struct thread_stats_t *stats;
+};
+
+static size_t timed_read(void *context, void *buffer, size_t size) {
+    struct timed_stream_t *timed = context;
+    double start = now();
+    size_t read = sl_read(timed->input, buffer, size);
+    timed->stats->read += now() - start;
+    return read;
+}
+
+static int timed_seek(void *context, off_t offset, sl_seek_whence_t whence) {
+    struct timed_stream_t *timed = context;
+    double start = now();
+    int ret = sl_seek(timed->input, offset, whence);
+    timed->stats->read += now() - start;
+    return ret;
+}
+
+static off_t timed_tell(void *context) {
+    return sl_tell(((struct timed_stream_t *)context)->input);
+}
+
+static int timed_eof(void *context) {
+    return sl_eof(((struct timed_stream_t *)context)->input);
+}
+
+static int timed_error(void *context) {
+    return sl_error(((struct timed_stream_t *)context)->input);
+}
+
+static off_t timed_length(void *context) {
+    return sl_length(((struct timed_stream_t *)context)->input);
+}
+
+static sl_seekable_t timed_seekable(void *context) {
+    streamlike_t *input = ((struct timed_stream_t *)context)->input;
+    return input->seekable(input->context);
+}
+
+static void close_input(streamlike_t *stream) {
+    size_t len;
+    if (mapped_input_data(stream, &len))
+        mapped_input_close(stream);
+    else if (read_ahead == 0)
+        sl_fclose(stream);
+    else
+        async_reader_close(stream);
+}
+
+static streamlike_t *open_gzip(const char *path, size_t extent_size,
+                               struct thread_stats_t *stats) {
+    streamlike_t *input = NULL;
+    if (use_mmap) input = mapped_input_open(path, MAPPED_INPUT_SEQUENTIAL);
+    if (input) return input;
+    if (read_ahead == 0)
+        input = sl_fopen(path, "rb");
+    else
+        input = async_reader_open(path, extent_size, read_ahead);
+    if (!input) return NULL;
+
+    struct timed_stream_t *timed = malloc(sizeof(*timed));
+    streamlike_t *stream = calloc(1, sizeof(*stream));
+    if (!timed || !stream) {
+        free(timed);
+        free(stream);
+        close_input(input);
+        return NULL;
+    }
+    timed->input = input;
+    timed->stats = stats;
+    stream->context = timed;
+    stream->read = timed_read;
+    stream->seek = timed_seek;
+    stream->tell = timed_tell;
+    stream->eof = timed_eof;
+    stream->error = timed_error;
+    stream->length = timed_length;
+    stream->seekable = timed_seekable;
+    return stream;
+}
+
+static void close_gzip(streamlike_t *stream) {
+    if (stream->read != timed_read) {
+        close_input(stream);
+        return;
+    }
+    struct timed_stream_t *timed = stream->context;
+    close_input(timed->input);
+    free(timed);
+    free(stream);
+}
+
+/* Read-ahead extents span about as much compressed input as `count`
+ * checkpoints or frames over `comp_size` bytes do, so one extent feeds one
+ * inflate call. */
+static size_t extent_size(off_t comp_size, int count) {
+    off_t size = count > 0 ? comp_size / count : 0;
+    if (size < 64 * 1024) size = 64 * 1024;
+    if (size > 16 * 1024 * 1024) size = 16 * 1024 * 1024;
+    return size;
+}
+
 typedef struct chunk_args_s {
     zidx_index *opt_index;
     const char *gzip_file_name;
@@ -17,6 +162,7 @@ typedef struct chunk_args_s {
     const char *output_file_name;
     off_t cur;
     off_t end;
+    struct thread_stats_t *stats;
 } chunk_args_t;
 
 static int *new_int(int code) {
@@ -41,6 +187,8 @@ static int *new_int(int code) {
 
 void *decompress_procedure(void *vargs) {
     const chunk_args_t *args = vargs;
+    struct thread_stats_t *stats = args->stats;
+    double start;
     int ret;
 
     char *buffer = NULL;
@@ -53,13 +201,16 @@ void *decompress_procedure(void *vargs) {
     FILE *outf = NULL;
     int read;
 
+    // an index passed in was imported by the caller, timed as this thread's
     if (args->opt_index) {
         index = args->opt_index;
     } else {
+        stats->start = now();
         index = zidx_index_create();
         if (!index) return new_int(-1025);
 
-        gzip_stream = sl_fopen(args->gzip_file_name, "rb");
+        gzip_stream = open_gzip(args->gzip_file_name,
+                                ASYNC_READER_DEFAULT_EXTENT_SIZE, stats);
         if (!gzip_stream) {
             free(index);
             return new_int(-1027);
@@ -73,6 +224,7 @@ void *decompress_procedure(void *vargs) {
             END_IF_NOT_OK(zidx_import(index, zx_stream));
         }
 
+        stats->setup = now() - stats->start;
     }
     buffer = malloc(bytes);
     DEBUG_PRINT("BYTES: %ld\n", bytes);
@@ -82,98 +234,706 @@ void *decompress_procedure(void *vargs) {
     if (!outf) END_WITH_CODE(-1028);
 
     if (args->cur == -1) {
-        while ((read = zidx_read(index, buffer, bytes)) > 0) {
-            if (fwrite(buffer, read, 1, outf) != 1)
-                return new_int(-1030);
+        for (;;) {
+            double reading = stats->read;
+            start = now();
+            read = zidx_read(index, buffer, bytes);
+            stats->inflate += now() - start - (stats->read - reading);
+            if (read <= 0) break;
+            start = now();
+            if (fwrite(buffer, read, 1, outf) != 1) END_WITH_CODE(-1030);
+            stats->write += now() - start;
+            stats->uncomp_bytes += read;
         }
         if (read < 0) END_WITH_CODE(zidx_error(index));
     } else {
+        double reading = stats->read;
+        start = now();
         END_IF_NOT_OK(zidx_seek(index, args->cur));
         if (zidx_read(index, buffer, bytes) < bytes)
             END_WITH_CODE(zidx_error(index));
+        stats->inflate += now() - start - (stats->read - reading);
+        start = now();
         if (fseek(outf, args->cur, SEEK_SET) != 0) END_WITH_CODE(-1029);
-        if (fwrite(buffer, bytes, 1, outf) != 1)
-            return new_int(-1030);
+        if (fwrite(buffer, bytes, 1, outf) != 1) END_WITH_CODE(-1030);
+        stats->write += now() - start;
+        stats->uncomp_bytes += bytes;
     }
 
     ret = 0;
 
 fail:
-    // leaks... leaks everywhere
-
-    /* free(buffer); */
-    /* zidx_index_destroy(index); */
-    /* free(index); */
-    /* if (gzip_stream) sl_fclose(gzip_stream); */
-    /* if (zx_stream) sl_fclose(zx_stream); */
-    /* if (outf) fclose(outf); */
+    stats->end = now();
+    // runs of --bench share the process, so nothing may leak; an index
+    // passed in belongs to the caller
+    free(buffer);
+    if (!args->opt_index) {
+        zidx_index_destroy(index);
+        free(index);
+    }
+    if (gzip_stream) close_gzip(gzip_stream);
+    if (zx_stream) sl_fclose(zx_stream);
+    if (outf) fclose(outf);
     return ret ? new_int(ret) : NULL;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr,
-                "Usage: %s <thread-count> <gzip-file> <zidx-file> <output-file>\n",
-                argv[0]);
-        return 1;
+typedef struct range_args_s {
+    struct mrt_index_t *index;
+    const char *gzip_file_name;
+    const char *output_file_name;
+    enum inflate_backend_t backend;
+    int first;
+    int last;
+    struct thread_stats_t *stats;
+} range_args_t;
+
+/* Streams [from, to) through zlib into the output file, to the end of the
+ * stream if `to` is -1. */
+static int stream_range(struct mrt_index_t *index, const char *gzip_file_name,
+                        FILE *outf, off_t from, off_t to,
+                        struct thread_stats_t *stats) {
+    struct mrt_reader_t reader;
+    streamlike_t *gzip_stream = NULL;
+    char *buffer = NULL;
+    const size_t bytes = 1024 * 1024;
+    long read = 0;
+    double start = now();
+    int ret;
+
+    gzip_stream = open_gzip(gzip_file_name, extent_size(
+        index->checkpoints[index->count - 1].comp_offset, index->count), stats);
+    if (!gzip_stream) return -1027;
+    if (mrt_reader_init(&reader, gzip_stream, index) != 0) {
+        close_gzip(gzip_stream);
+        return -1025;
     }
+    buffer = malloc(bytes);
+    if (!buffer) END_WITH_CODE(-1026);
+    stats->setup += now() - start;
+
+    double reading = stats->read;
+    start = now();
+    if (mrt_reader_seek(&reader, from) != 0) END_WITH_CODE(-1032);
+    stats->inflate += now() - start - (stats->read - reading);
+    if (fseek(outf, from, SEEK_SET) != 0) END_WITH_CODE(-1029);
+    while (to < 0 || from < to) {
+        size_t n = to < 0 || to - from > (off_t)bytes ? bytes : (size_t)(to - from);
+        reading = stats->read;
+        start = now();
+        read = mrt_reader_read(&reader, buffer, n);
+        stats->inflate += now() - start - (stats->read - reading);
+        if (read <= 0) break;
+        start = now();
+        if (fwrite(buffer, read, 1, outf) != 1) END_WITH_CODE(-1030);
+        stats->write += now() - start;
+        stats->uncomp_bytes += read;
+        from += read;
+    }
+    if (read < 0 || (to >= 0 && from < to)) END_WITH_CODE(-1033);
+    ret = 0;
+
+fail:
+    free(buffer);
+    mrt_reader_destroy(&reader);
+    close_gzip(gzip_stream);
+    return ret;
+}
+
+/* Inflates the range between two checkpoints of a self-contained MRT index
+ * in one call to the selected backend. The compressed bytes, the window and
+ * the output size are all known, so the range is handed over whole. Should
+ * the deflate stream end early, e.g. at a gzip member boundary, the rest is
+ * streamed through zlib. */
+void *decompress_range_procedure(void *vargs) {
+    const range_args_t *args = vargs;
+    struct mrt_index_t *index = args->index;
+    const struct mrt_checkpoint_t *first = &index->checkpoints[args->first];
+    const struct mrt_checkpoint_t *last =
+        args->last < index->count ? &index->checkpoints[args->last] : NULL;
+    off_t end = last ? last->offset : index->uncomp_size;
+    struct inflate_range_t range;
+    uint8_t *in = NULL;
+    uint8_t *out = NULL;
+    streamlike_t *inf = NULL;
+    FILE *outf = NULL;
+    off_t comp_start, comp_end;
+    long produced;
+    struct thread_stats_t *stats = args->stats;
+    double start;
+    int ret;
+
+    stats->start = now();
+    outf = fopen(args->output_file_name, "r+b");
+    if (!outf) return new_int(-1028);
+
+    if (end < 0) {
+        ret = stream_range(index, args->gzip_file_name, outf, first->offset, -1,
+                           stats);
+        goto fail;
+    }
+
+    memset(&range, 0, sizeof(range));
+    range.gzip = first->offset == 0;
+    range.bits = range.gzip ? 0 : first->comp_bits;
+    if (!range.gzip) {
+        start = now();
+        range.window_len = mrt_index_window(index, args->first, &range.window);
+        if (!range.window) END_WITH_CODE(-1031);
+        stats->inflate += now() - start;
+    }
+
+    start = now();
+    inf = open_gzip(args->gzip_file_name, extent_size(
+        index->checkpoints[index->count - 1].comp_offset, index->count), stats);
+    if (!inf) END_WITH_CODE(-1027);
+    stats->setup += now() - start;
+    comp_start = range.gzip ? 0 : first->comp_offset - (range.bits ? 1 : 0);
+    if (last) {
+        // the byte holding the next checkpoint's leftover bits is needed too
+        comp_end = last->comp_offset + 1;
+    } else {
+        comp_end = sl_length(inf);
+        if (comp_end < 0) END_WITH_CODE(-1029);
+    }
+    range.in_len = comp_end - comp_start;
+    range.out_len = end - first->offset;
+
+    out = malloc(range.out_len ? range.out_len : 1);
+    if (!out) END_WITH_CODE(-1026);
+    size_t mapped_len;
+    const uint8_t *mapped = mapped_input_data(inf, &mapped_len);
+    if (mapped) {
+        // inflate straight from the mapping
+        if ((size_t)comp_start > mapped_len) END_WITH_CODE(-1029);
+        if (range.in_len > mapped_len - comp_start)
+            range.in_len = mapped_len - comp_start;
+        range.in = mapped + comp_start;
+    } else {
+        in = malloc(range.in_len ? range.in_len : 1);
+        if (!in) END_WITH_CODE(-1026);
+        // with read-ahead, the extents of the range are all read at once
+        if (sl_seek(inf, comp_start, SL_SEEK_SET) != 0) END_WITH_CODE(-1029);
+        range.in_len = sl_read(inf, in, range.in_len);
+        range.in = in;
+    }
+    range.out = out;
+
+    start = now();
+    produced = inflate_range(args->backend, &range);
+    if (produced < 0) END_WITH_CODE(-1034);
+    stats->inflate += now() - start;
+
+    start = now();
+    if (fseek(outf, first->offset, SEEK_SET) != 0) END_WITH_CODE(-1029);
+    if (produced > 0 && fwrite(out, produced, 1, outf) != 1)
+        END_WITH_CODE(-1030);
+    stats->write += now() - start;
+    stats->uncomp_bytes += produced;
+    ret = 0;
+    if ((size_t)produced < range.out_len)
+        ret = stream_range(index, args->gzip_file_name, outf,
+                           first->offset + produced, end, stats);
+
+fail:
+    stats->end = now();
+    free(in);
+    free(out);
+    if (inf) close_gzip(inf);
+    fclose(outf);
+    return ret ? new_int(ret) : NULL;
+}
+
+/* Compressed bytes from checkpoint `first` up to checkpoint `last`, or to
+ * the end of the file. */
+static off_t checkpoints_comp_size(const struct mrt_index_t *index, int first,
+                                   int last, off_t comp_size) {
+    off_t from = first > 0 ? index->checkpoints[first].comp_offset : 0;
+    off_t to = last < index->count ? index->checkpoints[last].comp_offset
+                                   : comp_size;
+    return to - from;
+}
+
+static int decompress_mrt_index(int thread_count, const char *gzip_file_name,
+                                streamlike_t *index_stream,
+                                const char *output_file_name,
+                                enum inflate_backend_t backend,
+                                off_t comp_size,
+                                struct thread_stats_t *stats) {
+    struct mrt_index_t index;
     int *ret = NULL;
-    int thread_count = atoi(argv[1]);
-    chunk_args_t args = {NULL, argv[2], argv[3], argv[4], -1, -1};
+    int code = 0;
 
-    FILE *fp = fopen(argv[4], "wb");
-    if (!fp) return 8;
-    fclose(fp);
+    mrt_index_init(&index, ZX_DEFAULT_WINDOW_SIZE);
+    if (mrt_index_import(&index, index_stream) != 0 || !index.has_windows ||
+        index.count == 0) {
+        mrt_index_destroy(&index);
+        return 11;
+    }
 
     if (thread_count == 0) {
+        stats[0].start = now();
+        stats[0].comp_bytes = comp_size;
+        FILE *outf = fopen(output_file_name, "r+b");
+        if (!outf) code = 8;
+        else if (stream_range(&index, gzip_file_name, outf, 0, -1, stats) != 0) code = 12;
+        if (outf) fclose(outf);
+        stats[0].end = now();
+    } else {
+        pthread_t threads[thread_count];
+        range_args_t thread_args[thread_count];
+        int started = 0;
+
+        for (int i = 0; i < thread_count; i++) {
+            int first = i * index.count / thread_count;
+            int last = i == thread_count - 1 ? index.count : (i + 1) * index.count / thread_count;
+            if (first == last) continue;
+            stats[started].comp_bytes = checkpoints_comp_size(&index, first, last, comp_size);
+            thread_args[started] = (range_args_t){&index, gzip_file_name, output_file_name, backend, first, last, &stats[started]};
+            DEBUG_PRINT("Thread %i: checkpoints [%d, %d)\n", started, first, last);
+            if (pthread_create(&threads[started], NULL, decompress_range_procedure, &thread_args[started]) != 0) {
+                code = 6;
+                break;
+            }
+            started++;
+        }
+
+        for (int i = 0; i < started; i++) {
+            if (pthread_join(threads[i], (void**)&ret) != 0) {
+                code = 7;
+                continue;
+            }
+            if (ret) {
+                DEBUG_PRINT("Thread %d returned error %d.\n", i, *ret);
+                code = 12;
+            }
+            free(ret);
+        }
+    }
+
+    mrt_index_destroy(&index);
+    return code;
+}
+
+typedef struct frames_args_s {
+    const struct mrt_frames_t *frames;
+    const char *gzip_file_name;
+    const char *output_file_name;
+    int first;
+    int last;
+    struct thread_stats_t *stats;
+} frames_args_t;
+
+/* Frames of a transcoded file decompress on their own, no index needed. */
+void *decompress_frames_procedure(void *vargs) {
+    const frames_args_t *args = vargs;
+    struct mrt_frames_reader_t reader;
+    streamlike_t *stream = NULL;
+    FILE *outf = NULL;
+    const uint8_t *data;
+    long read;
+    int ret;
+
+    const struct mrt_frames_t *frames = args->frames;
+    const struct mrt_frame_t *tail = &frames->frames[frames->count - 1];
+    struct thread_stats_t *stats = args->stats;
+    double start = stats->start = now();
+    stream = open_gzip(args->gzip_file_name,
+                       extent_size(tail->comp_offset + tail->comp_size,
+                                   frames->count), stats);
+    if (!stream) return new_int(-1027);
+    if (mrt_frames_reader_init(&reader, args->frames, stream) != 0) {
+        close_gzip(stream);
+        return new_int(-1025);
+    }
+
+    outf = fopen(args->output_file_name, "r+b");
+    if (!outf) END_WITH_CODE(-1028);
+    if (fseek(outf, args->frames->frames[args->first].uncomp_offset, SEEK_SET) != 0)
+        END_WITH_CODE(-1029);
+    stats->setup = now() - start;
+    for (int i = args->first; i < args->last; i++) {
+        double reading = stats->read;
+        start = now();
+        read = mrt_frames_reader_frame(&reader, i, &data);
+        if (read < 0) END_WITH_CODE(-1034);
+        stats->inflate += now() - start - (stats->read - reading);
+        start = now();
+        if (read > 0 && fwrite(data, read, 1, outf) != 1) END_WITH_CODE(-1030);
+        stats->write += now() - start;
+        stats->uncomp_bytes += read;
+        stats->comp_bytes += frames->frames[i].comp_size;
+    }
+    ret = 0;
+
+fail:
+    stats->end = now();
+    if (outf) fclose(outf);
+    mrt_frames_reader_destroy(&reader);
+    close_gzip(stream);
+    return ret ? new_int(ret) : NULL;
+}
+
+static int decompress_frames(int thread_count, const struct mrt_frames_t *frames,
+                             const char *gzip_file_name,
+                             const char *output_file_name,
+                             struct thread_stats_t *stats) {
+    int *ret = NULL;
+    int code = 0;
+    if (thread_count < 1) thread_count = 1;
+
+    pthread_t threads[thread_count];
+    frames_args_t thread_args[thread_count];
+    int started = 0;
+
+    for (int i = 0; i < thread_count; i++) {
+        int first = i * frames->count / thread_count;
+        int last = (i + 1) * frames->count / thread_count;
+        if (first == last) continue;
+        thread_args[started] = (frames_args_t){frames, gzip_file_name, output_file_name, first, last, &stats[started]};
+        DEBUG_PRINT("Thread %i: frames [%d, %d)\n", started, first, last);
+        if (pthread_create(&threads[started], NULL, decompress_frames_procedure, &thread_args[started]) != 0) {
+            code = 6;
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        if (pthread_join(threads[i], (void**)&ret) != 0) {
+            code = 7;
+            continue;
+        }
+        if (ret) {
+            DEBUG_PRINT("Thread %d returned error %d.\n", i, *ret);
+            code = 12;
+        }
+        free(ret);
+    }
+    return code;
+}
+
+/* Decompresses `gzip_file_name` into `output_file_name`, which has to exist,
+ * with `thread_count` threads, 0 for one pass on the calling thread. Fills
+ * one entry of `stats` per thread that ran. Returns the exit code. */
+static int decompress_file(int thread_count, const char *gzip_file_name,
+                           const char *zidx_file_name,
+                           const char *output_file_name,
+                           enum inflate_backend_t backend,
+                           struct thread_stats_t *stats) {
+    int *ret = NULL;
+    int code = 0;
+    chunk_args_t args = {NULL, gzip_file_name, zidx_file_name, output_file_name, -1, -1, &stats[0]};
+
+    streamlike_t *gzip_stream = sl_fopen(gzip_file_name, "rb");
+    if (!gzip_stream) return 3;
+    off_t comp_size = sl_length(gzip_stream);
+    struct mrt_frames_t frames;
+    int is_framed = mrt_frames_open(&frames, gzip_stream);
+    sl_fclose(gzip_stream);
+    gzip_stream = NULL;
+    if (is_framed < 0) return 11;
+    if (is_framed) {
+        code = decompress_frames(thread_count, &frames, gzip_file_name, output_file_name, stats);
+        mrt_frames_destroy(&frames);
+        return code;
+    }
+
+    streamlike_t *index_stream = sl_fopen(zidx_file_name, "rb");
+    if (index_stream && mrt_index_is_mrt_index(index_stream)) {
+        code = decompress_mrt_index(thread_count, gzip_file_name, index_stream, output_file_name, backend, comp_size, stats);
+        sl_fclose(index_stream);
+        return code;
+    }
+    if (index_stream) sl_fclose(index_stream);
+    if (backend != INFLATE_BACKEND_ZLIB) {
+        fprintf(stderr, "Inflate backends need a self-contained index.\n");
+        return 1;
+    }
+
+    if (thread_count == 0) {
+        stats[0].comp_bytes = comp_size;
         ret = decompress_procedure(&args);
-        if (ret) DEBUG_PRINT("Program returned error %d.\n", *ret);
-        else DEBUG_PRINT("Program completed successfully.\n");
+        if (ret) {
+            DEBUG_PRINT("Program returned error %d.\n", *ret);
+            code = 12;
+        } else {
+            DEBUG_PRINT("Program completed successfully.\n");
+        }
         free(ret);
-    } else {
-        zidx_index *index = NULL;
-        streamlike_t *gzip_stream = NULL;
-        streamlike_t *zx_stream = NULL;
+        return code;
+    }
 
-        index = zidx_index_create();
-        if (!index) return 2;
+    zidx_index *index = NULL;
+    streamlike_t *zx_stream = NULL;
+    pthread_t threads[thread_count];
+    chunk_args_t thread_args[thread_count];
+    int started = 0;
 
-        gzip_stream = sl_fopen(args.gzip_file_name, "rb");
-        if (!gzip_stream) return 3;
+    // the first thread reads through this index, so it is timed as its own
+    stats[0].start = now();
+    index = zidx_index_create();
+    if (!index) return 2;
 
-        if (zidx_index_init(index, gzip_stream) != ZX_RET_OK) return 4;
+    gzip_stream = open_gzip(args.gzip_file_name,
+                            ASYNC_READER_DEFAULT_EXTENT_SIZE, &stats[0]);
+    if (!gzip_stream) {
+        code = 3;
+        goto done;
+    }
+    if (zidx_index_init(index, gzip_stream) != ZX_RET_OK) {
+        code = 4;
+        goto done;
+    }
 
-        zx_stream = sl_fopen(argv[3], "rb");
-        if (!zx_stream) return 10;
-        if(zidx_import(index, zx_stream) != ZX_RET_OK) return 11;
+    zx_stream = sl_fopen(zidx_file_name, "rb");
+    if (!zx_stream) {
+        code = 10;
+        goto done;
+    }
+    if (zidx_import(index, zx_stream) != ZX_RET_OK) {
+        code = 11;
+        goto done;
+    }
+    sl_fclose(zx_stream);
+    zx_stream = NULL;
 
-        off_t sz = zidx_uncomp_size(index);
-        if (sz < 0) return 5;
+    off_t sz = zidx_uncomp_size(index);
+    if (sz < 0) {
+        code = 5;
+        goto done;
+    }
+    stats[0].setup = now() - stats[0].start;
 
-        DEBUG_PRINT("SIZE: %ld\n", sz);
+    DEBUG_PRINT("SIZE: %ld\n", sz);
 
-        pthread_t threads[thread_count];
-        chunk_args_t thread_args[thread_count];
-        off_t prev = zidx_get_checkpoint_offset(zidx_get_checkpoint(index, zidx_checkpoint_count(index) / thread_count));
-
-        thread_args[0] = (chunk_args_t){index, NULL, NULL, argv[4], 0, prev};
-        DEBUG_PRINT("Thread 0: [0, %ld)\n", prev);
-        if (pthread_create(&threads[0], NULL, decompress_procedure, &thread_args[0]) != 0) return 6;
-        for(int i = 1; i < thread_count; i++) {
-            off_t next = i == thread_count - 1 ? sz : zidx_get_checkpoint_offset(zidx_get_checkpoint(index, (i + 1) * zidx_checkpoint_count(index) / thread_count));
-            thread_args[i] = (chunk_args_t){NULL, argv[2], argv[3], argv[4], prev, next};
-            DEBUG_PRINT("Thread %i: [%ld, %ld)\n", i, prev, next);
-            prev = next;
-            if (pthread_create(&threads[i], NULL, decompress_procedure, &thread_args[i]) != 0) return 6;
+    int count = zidx_checkpoint_count(index);
+    // a single thread has no checkpoint to stop at
+    zidx_checkpoint *first_ckp = thread_count == 1 ? NULL : zidx_get_checkpoint(index, count / thread_count);
+    off_t prev = first_ckp ? zidx_get_checkpoint_offset(first_ckp) : sz;
+    off_t prev_comp = first_ckp ? zidx_get_checkpoint_comp_offset(first_ckp) : comp_size;
+
+    stats[0].comp_bytes = prev_comp;
+    thread_args[0] = (chunk_args_t){index, NULL, NULL, output_file_name, 0, prev, &stats[0]};
+    for (int i = 1; i < thread_count; i++) {
+        zidx_checkpoint *next_ckp = i == thread_count - 1 ? NULL : zidx_get_checkpoint(index, (i + 1) * count / thread_count);
+        off_t next = next_ckp ? zidx_get_checkpoint_offset(next_ckp) : sz;
+        off_t next_comp = next_ckp ? zidx_get_checkpoint_comp_offset(next_ckp) : comp_size;
+        stats[i].comp_bytes = next_comp - prev_comp;
+        thread_args[i] = (chunk_args_t){NULL, gzip_file_name, zidx_file_name, output_file_name, prev, next, &stats[i]};
+        prev = next;
+        prev_comp = next_comp;
+    }
+
+    for (; started < thread_count; started++) {
+        DEBUG_PRINT("Thread %i: [%ld, %ld)\n", started, thread_args[started].cur, thread_args[started].end);
+        if (pthread_create(&threads[started], NULL, decompress_procedure, &thread_args[started]) != 0) {
+            code = 6;
+            break;
         }
+    }
 
-        for(int i = 0; i < thread_count; i++) {
-            if (pthread_join(threads[i], (void**)&ret) != 0) return 7;
-            if (ret) DEBUG_PRINT("Thread %d returned error %d.\n", i, *ret);
-            else DEBUG_PRINT("Thread %d completed successfully.\n", i);
-            /* free(ret); */
+    // threads point into thread_args and the first one into index, so all
+    // of them are joined before either goes away
+    for (int i = 0; i < started; i++) {
+        if (pthread_join(threads[i], (void**)&ret) != 0) {
+            code = 7;
+            continue;
+        }
+        if (ret) {
+            DEBUG_PRINT("Thread %d returned error %d.\n", i, *ret);
+            if (code == 0) code = 12;
+        } else {
+            DEBUG_PRINT("Thread %d completed successfully.\n", i);
         }
+        free(ret);
     }
 
+done:
+    if (zx_stream) sl_fclose(zx_stream);
+    zidx_index_destroy(index);
+    free(index);
+    if (gzip_stream) close_gzip(gzip_stream);
+    return code;
+}
+
+/* Appends the rows of one run of --bench: one per thread, then their totals
+ * over the wall time of the run. Idle is the part of the run a thread spent
+ * not started yet or already done, i.e. waiting on the others. */
+static void report_run(int json, int threads, int run, double wall,
+                       const struct thread_stats_t *stats, int count,
+                       int *rows) {
+    const double mib = 1024.0 * 1024.0;
+    struct thread_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i <= count; i++) {
+        const struct thread_stats_t *st = i < count ? &stats[i] : &total;
+        if (i < count && st->start == 0) continue;
+        double busy = i < count ? st->end - st->start : wall;
+        double idle = i < count ? wall - busy : 0;
+        if (i < count) {
+            total.setup += st->setup;
+            total.read += st->read;
+            total.inflate += st->inflate;
+            total.write += st->write;
+            total.comp_bytes += st->comp_bytes;
+            total.uncomp_bytes += st->uncomp_bytes;
+            total.start += idle;
+        } else {
+            idle = total.start;
+        }
+        char thread[16];
+        if (i < count)
+            snprintf(thread, sizeof(thread), "%d", i);
+        else
+            snprintf(thread, sizeof(thread), json ? "\"all\"" : "all");
+        const char *format = json
+            ? "%s  {\"threads\": %d, \"run\": %d, \"thread\": %s, "
+              "\"wall\": %.6f, \"busy\": %.6f, \"idle\": %.6f, "
+              "\"setup\": %.6f, \"read\": %.6f, \"inflate\": %.6f, "
+              "\"write\": %.6f, \"comp_bytes\": %lld, "
+              "\"uncomp_bytes\": %lld, \"comp_mib_s\": %.3f, "
+              "\"uncomp_mib_s\": %.3f}"
+            : "%s%d,%d,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%lld,%lld,"
+              "%.3f,%.3f";
+        printf(format, json ? (*rows ? ",\n" : "") : "", threads, run, thread,
+               wall, busy, idle, st->setup, st->read, st->inflate, st->write,
+               (long long)st->comp_bytes, (long long)st->uncomp_bytes,
+               busy > 0 ? st->comp_bytes / mib / busy : 0,
+               busy > 0 ? st->uncomp_bytes / mib / busy : 0);
+        if (!json) printf("\n");
+        (*rows)++;
+    }
+}
+
+/* Runs decompress_file for every thread count of `sweep`, `repeats` times
+ * each, truncating the output before every run. */
+static int bench(const int *sweep, int sweep_len, int repeats, int json,
+                 const char *gzip_file_name, const char *zidx_file_name,
+                 const char *output_file_name,
+                 enum inflate_backend_t backend) {
+    int rows = 0;
+    if (json)
+        printf("[\n");
+    else
+        printf("threads,run,thread,wall_s,busy_s,idle_s,setup_s,read_s,"
+               "inflate_s,write_s,comp_bytes,uncomp_bytes,comp_mib_s,"
+               "uncomp_mib_s\n");
+    for (int i = 0; i < sweep_len; i++) {
+        int count = sweep[i] > 0 ? sweep[i] : 1;
+        struct thread_stats_t stats[count];
+        for (int run = 0; run < repeats; run++) {
+            FILE *fp = fopen(output_file_name, "wb");
+            if (!fp) return 8;
+            fclose(fp);
+            memset(stats, 0, sizeof(stats));
+            double start = now();
+            int code = decompress_file(sweep[i], gzip_file_name, zidx_file_name, output_file_name, backend, stats);
+            double wall = now() - start;
+            if (code != 0) {
+                fprintf(stderr, "Run with %d threads failed with code %d.\n", sweep[i], code);
+                return code;
+            }
+            report_run(json, sweep[i], run, wall, stats, count, &rows);
+            fflush(stdout);
+        }
+    }
+    if (json) printf("\n]\n");
     return 0;
 }
+
+/* Parses a comma separated list of thread counts, like "0,1,2,4,8". */
+static int parse_sweep(const char *str, int *sweep, int capacity) {
+    int len = 0;
+    while (*str) {
+        char *end;
+        long count = strtol(str, &end, 10);
+        if (end == str || (*end && *end != ',') || count < 0 || count > 1024 || len == capacity)
+            return -1;
+        sweep[len++] = count;
+        str = *end ? end + 1 : end;
+    }
+    return len;
+}
+
+#define BENCH_MAX_SWEEP 64
+
+int main(int argc, char *argv[]) {
+    enum inflate_backend_t backend = INFLATE_BACKEND_ZLIB;
+    int is_bench = argc > 1 && !strcmp(argv[1], "--bench");
+    int sweep[BENCH_MAX_SWEEP] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+    int sweep_len = 9;
+    int repeats = 1;
+    int json = 0;
+    int bad_args = argc < 5;
+    for (int i = 5; i < argc && !bad_args; i++) {
+        if (!strcmp(argv[i], "-m")) {
+            use_mmap = 1;
+        } else if (is_bench && !strcmp(argv[i], "-j")) {
+            json = 1;
+        } else if (i + 1 == argc) {
+            bad_args = 1;
+        } else if (!strcmp(argv[i], "-b")) {
+            if (inflate_backend_parse(argv[++i], &backend) != 0 ||
+                !inflate_backend_available(backend)) {
+                fprintf(stderr, "Inflate backend '%s' isn't built in.\n", argv[i]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-r")) {
+            char *end;
+            read_ahead = strtol(argv[++i], &end, 10);
+            if (*end || read_ahead < 0 || read_ahead > 64) {
+                fprintf(stderr, "Read-ahead should be in [0, 64].\n");
+                return 1;
+            }
+        } else if (is_bench && !strcmp(argv[i], "-t")) {
+            sweep_len = parse_sweep(argv[++i], sweep, BENCH_MAX_SWEEP);
+            if (sweep_len <= 0) {
+                fprintf(stderr, "Thread counts should be a list like 0,1,2,4 of at most %d counts in [0, 1024].\n", BENCH_MAX_SWEEP);
+                return 1;
+            }
+        } else if (is_bench && !strcmp(argv[i], "-n")) {
+            char *end;
+            repeats = strtol(argv[++i], &end, 10);
+            if (*end || repeats < 1) {
+                fprintf(stderr, "Repeats should be at least 1.\n");
+                return 1;
+            }
+        } else {
+            bad_args = 1;
+        }
+    }
+    if (bad_args) {
+        fprintf(stderr,
+                "Usage: %s <thread-count> <gzip-file> <zidx-file> <output-file> [-b <backend>] [-r <extents>] [-m]\n"
+                "       %s --bench <gzip-file> <zidx-file> <output-file> [-t <thread-counts>] [-n <repeats>] [-j] [-b <backend>] [-r <extents>] [-m]\n"
+                "\t<zidx-file> may also be a self-contained index built by zidx -z, "
+                "and is ignored for files written by pfxdump-transcode\n"
+                "\t-r: compressed extents each thread reads ahead, through io_uring "
+                "if built with ASYNC_READ=uring, else a read thread, 0 to read "
+                "synchronously (default: %d)\n"
+                "\t-m: map the gzip file and inflate straight from the mapping, "
+                "overrides -r\n"
+                "\t--bench: decompress once per comma separated thread count of -t "
+                "(default: 0,1,2,3,4,5,6,7,8), -n times each (default: 1), and "
+                "print per thread seconds spent setting up, reading, inflating, "
+                "writing and idle, and MiB/s, as CSV or as JSON with -j\n"
+                "\t-b: inflate backend for checkpoint ranges of a self-contained index:",
+                argv[0], argv[0], ASYNC_READER_DEFAULT_DEPTH);
+        for (int i = 0; i < INFLATE_BACKEND_COUNT; i++)
+            if (inflate_backend_available(i))
+                fprintf(stderr, " %s", inflate_backend_name(i));
+        fprintf(stderr, " (default: zlib)\n");
+        return 1;
+    }
+    if (is_bench)
+        return bench(sweep, sweep_len, repeats, json, argv[2], argv[3], argv[4], backend);
+
+    int thread_count = atoi(argv[1]);
+    FILE *fp = fopen(argv[4], "wb");
+    if (!fp) return 8;
+    fclose(fp);
+
+    struct thread_stats_t stats[thread_count > 0 ? thread_count : 1];
+    memset(stats, 0, sizeof(stats));
+    return decompress_file(thread_count, argv[2], argv[3], argv[4], backend, stats);
+}
@@ -0,0 +1,177 @@
+#include "inflate_backend.h"
+
+#include <limits.h>
+#include <string.h>
+
+//
+#include <zlib.h>
+#ifdef HAVE_ZLIBNG
+#include <zlib-ng.h>
+#endif
+#ifdef HAVE_ISAL
+#include <isa-l/igzip_lib.h>
+#endif
+
+static const char *const backend_names[INFLATE_BACKEND_COUNT] = {
+    "zlib", "zlib-ng", "isal"};
+
+const char *inflate_backend_name(enum inflate_backend_t backend) {
+    if (backend < 0 || backend >= INFLATE_BACKEND_COUNT) return NULL;
+    return backend_names[backend];
+}
+
+int inflate_backend_parse(const char *name, enum inflate_backend_t *backend) {
+    for (int i = 0; i < INFLATE_BACKEND_COUNT; i++) {
+        if (!strcmp(name, backend_names[i])) {
+            *backend = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int inflate_backend_available(enum inflate_backend_t backend) {
+    switch (backend) {
+        case INFLATE_BACKEND_ZLIB:
+            return 1;
+#ifdef HAVE_ZLIBNG
+        case INFLATE_BACKEND_ZLIBNG:
+            return 1;
+#endif
+#ifdef HAVE_ISAL
+        case INFLATE_BACKEND_ISAL:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* Input and output sizes have to fit the 32-bit counters of all backends. */
+static int range_fits(const struct inflate_range_t *range) {
+    return range->in_len <= UINT_MAX && range->out_len <= UINT_MAX &&
+           (range->gzip || range->bits == 0 || range->in_len > 0);
+}
+
+static long inflate_range_zlib(const struct inflate_range_t *range) {
+    const uint8_t *in = range->in;
+    size_t in_len = range->in_len;
+    long ret = -1;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, range->gzip ? 15 + 16 : -15) != Z_OK) return -1;
+
+    if (!range->gzip) {
+        if (range->bits) {
+            if (inflatePrime(&strm, range->bits, in[0] >> (8 - range->bits)) !=
+                Z_OK)
+                goto done;
+            in++;
+            in_len--;
+        }
+        if (range->window_len &&
+            inflateSetDictionary(&strm, range->window, range->window_len) !=
+                Z_OK)
+            goto done;
+    }
+
+    strm.next_in = (Bytef *)in;
+    strm.avail_in = in_len;
+    strm.next_out = range->out;
+    strm.avail_out = range->out_len;
+    int err = inflate(&strm, Z_FINISH);
+    if (err == Z_STREAM_END || err == Z_BUF_ERROR || err == Z_OK)
+        ret = range->out_len - strm.avail_out;
+
+done:
+    inflateEnd(&strm);
+    return ret;
+}
+
+#ifdef HAVE_ZLIBNG
+static long inflate_range_zlibng(const struct inflate_range_t *range) {
+    const uint8_t *in = range->in;
+    size_t in_len = range->in_len;
+    long ret = -1;
+    zng_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (zng_inflateInit2(&strm, range->gzip ? 15 + 16 : -15) != Z_OK)
+        return -1;
+
+    if (!range->gzip) {
+        if (range->bits) {
+            if (zng_inflatePrime(&strm, range->bits,
+                                 in[0] >> (8 - range->bits)) != Z_OK)
+                goto done;
+            in++;
+            in_len--;
+        }
+        if (range->window_len &&
+            zng_inflateSetDictionary(&strm, range->window,
+                                     range->window_len) != Z_OK)
+            goto done;
+    }
+
+    strm.next_in = in;
+    strm.avail_in = in_len;
+    strm.next_out = range->out;
+    strm.avail_out = range->out_len;
+    int err = zng_inflate(&strm, Z_FINISH);
+    if (err == Z_STREAM_END || err == Z_BUF_ERROR || err == Z_OK)
+        ret = range->out_len - strm.avail_out;
+
+done:
+    zng_inflateEnd(&strm);
+    return ret;
+}
+#endif
+
+#ifdef HAVE_ISAL
+static long inflate_range_isal(const struct inflate_range_t *range) {
+    const uint8_t *in = range->in;
+    size_t in_len = range->in_len;
+    struct inflate_state state;
+    isal_inflate_init(&state);
+    state.crc_flag = range->gzip ? ISAL_GZIP : ISAL_DEFLATE;
+
+    if (!range->gzip) {
+        // same as inflatePrime, bits are consumed from the low end
+        if (range->bits) {
+            state.read_in = in[0] >> (8 - range->bits);
+            state.read_in_length = range->bits;
+            in++;
+            in_len--;
+        }
+        if (range->window_len &&
+            isal_inflate_set_dict(&state, (uint8_t *)range->window,
+                                  range->window_len) != ISAL_DECOMP_OK)
+            return -1;
+    }
+
+    state.next_in = (uint8_t *)in;
+    state.avail_in = in_len;
+    state.next_out = range->out;
+    state.avail_out = range->out_len;
+    if (isal_inflate(&state) != ISAL_DECOMP_OK) return -1;
+    return range->out_len - state.avail_out;
+}
+#endif
+
+long inflate_range(enum inflate_backend_t backend,
+                   const struct inflate_range_t *range) {
+    if (!range_fits(range)) return -1;
+    switch (backend) {
+        case INFLATE_BACKEND_ZLIB:
+            return inflate_range_zlib(range);
+#ifdef HAVE_ZLIBNG
+        case INFLATE_BACKEND_ZLIBNG:
+            return inflate_range_zlibng(range);
+#endif
+#ifdef HAVE_ISAL
+        case INFLATE_BACKEND_ISAL:
+            return inflate_range_isal(range);
+#endif
+        default:
+            return -1;
+    }
+}
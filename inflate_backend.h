@@ -0,0 +1,39 @@
+#ifndef INFLATE_BACKEND_H
+#define INFLATE_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Inflaters for a bounded range between two checkpoints, where the input, the
+ * dictionary window and the output size are all known up front. Backends
+ * other than zlib are compiled in with HAVE_ZLIBNG and HAVE_ISAL, see the
+ * Makefile. Streaming reads keep going through zlib. */
+enum inflate_backend_t {
+    INFLATE_BACKEND_ZLIB,
+    INFLATE_BACKEND_ZLIBNG,
+    INFLATE_BACKEND_ISAL,
+    INFLATE_BACKEND_COUNT
+};
+
+struct inflate_range_t {
+    /* Compressed input. Unless `gzip` is set, the first byte holds the last
+     * `bits` bits of the byte before the checkpoint, like in zran. */
+    const uint8_t *in;
+    size_t in_len;
+    int gzip;
+    int bits;
+    const void *window;
+    size_t window_len;
+    uint8_t *out;
+    size_t out_len;
+};
+
+const char *inflate_backend_name(enum inflate_backend_t backend);
+int inflate_backend_parse(const char *name, enum inflate_backend_t *backend);
+int inflate_backend_available(enum inflate_backend_t backend);
+/* Returns the number of bytes inflated, which is less than `out_len` only if
+ * the deflate stream ended first, or -1 on error. */
+long inflate_range(enum inflate_backend_t backend,
+                   const struct inflate_range_t *range);
+
+#endif
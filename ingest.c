@@ -0,0 +1,355 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <streamlike.h>
+#include <streamlike/file.h>
+#include <streamlike/http.h>
+#include <zidx.h>
+#include <zlib.h>
+
+//
+#include "find_prefix.h"
+#include "mrt_index.h"
+#include "mrt_walker.h"
+
+/* Fetches a gzipped MRT file, keeps a copy of it and indexes it in a single
+ * inflate pass. The compressed stream is read once, from a URL or a local
+ * file, and every compressed byte read is written to the copy on the way.
+ * The inflated bytes are fed to any number of self-contained MRT indexes,
+ * each with its own checkpoint spacing, and optionally to a key table with
+ * the prefix of every RIB record in the 18-byte format of mrt_keys.h. */
+
+/* Reads through to `input` and writes what it reads to `copy` at the same
+ * offset, so the copy is complete once every byte has been read once, even
+ * if the reader seeks around. */
+struct tee_t {
+    streamlike_t *input;
+    streamlike_t *copy;
+    off_t position;
+    off_t copied;
+    int error;
+};
+
+struct ingest_index_t {
+    const char *path;
+    struct mrt_index_t index;
+    struct mrt_index_builder_t builder;
+    struct mrt_spacing_t spacing;
+};
+
+struct ingest_t {
+    struct ingest_index_t *indexes;
+    int index_count;
+    const uint8_t *buf;
+    FILE *keys;
+    uint64_t key_count;
+};
+
+static void errexit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+static void usageexit(const char *program) {
+    errexit(
+        "usage: %s <gzipped-mrt-file-or-url> <copy-file> "
+        "[-i <index-file> <checkpoint-span>]... [-u] [-k <key-file>]\n"
+        "\t<copy-file>: where the compressed input is stored, - for none\n"
+        "\t-i: write a self-contained MRT index with a checkpoint about "
+        "every\n\t\t<checkpoint-span> compressed bytes, as zidx -z does, can "
+        "be\n\t\trepeated for several spans\n"
+        "\t-u: spans count uncompressed bytes instead\n"
+        "\t-k: write the prefix of every RIB record as 18-byte keys, see "
+        "mrt_keys.h\n",
+        program);
+}
+
+static int startswith(const char *string, const char *prefix) {
+    while (*prefix)
+        if (*prefix++ != *string++) return 0;
+    return 1;
+}
+
+static size_t tee_read(void *context, void *buffer, size_t size) {
+    struct tee_t *tee = context;
+    size_t read = sl_read(tee->input, buffer, size);
+    off_t end = tee->position + read;
+    if (read > 0 && end > tee->copied) {
+        // only bytes not copied yet, reads behind them are rereads
+        off_t from = tee->position > tee->copied ? tee->position : tee->copied;
+        size_t skip = from - tee->position;
+        if (sl_seek(tee->copy, from, SL_SEEK_SET) != 0 ||
+            sl_write(tee->copy, (uint8_t *)buffer + skip, read - skip) !=
+                read - skip)
+            tee->error = 1;
+        if (tee->position <= tee->copied) tee->copied = end;
+    }
+    tee->position = end;
+    return read;
+}
+
+static int tee_seek(void *context, off_t offset, sl_seek_whence_t whence) {
+    struct tee_t *tee = context;
+    if (sl_seek(tee->input, offset, whence) != 0) return -1;
+    tee->position = sl_tell(tee->input);
+    return 0;
+}
+
+static off_t tee_tell(void *context) {
+    return ((struct tee_t *)context)->position;
+}
+
+static int tee_eof(void *context) {
+    return sl_eof(((struct tee_t *)context)->input);
+}
+
+static int tee_error(void *context) {
+    struct tee_t *tee = context;
+    return tee->error || sl_error(tee->input);
+}
+
+static off_t tee_length(void *context) {
+    return sl_length(((struct tee_t *)context)->input);
+}
+
+static sl_seekable_t tee_seekable(void *context) {
+    (void)context;
+    return SL_SEEKING_EXACT;
+}
+
+/* Places checkpoints of every index by its own spacing, like zidx -z does
+ * for a single one. */
+static int ingest_block_callback(void *context, zidx_index *zidx,
+                                 zidx_checkpoint_offset *offset,
+                                 int is_last_block) {
+    (void)zidx;
+    struct ingest_t *ingest = context;
+    if (is_last_block) return ZX_RET_OK;
+    for (int i = 0; i < ingest->index_count; i++) {
+        struct ingest_index_t *idx = &ingest->indexes[i];
+        if (!mrt_spacing_should_checkpoint(&idx->spacing, &idx->builder,
+                                           offset->uncomp, offset->comp))
+            continue;
+        // bytes of the current read before the checkpoint, not yet fed
+        size_t tail_len =
+            offset->uncomp - mrt_index_builder_position(&idx->builder);
+        if (mrt_index_builder_checkpoint(&idx->builder, offset->uncomp,
+                                         offset->comp,
+                                         offset->comp_bits_count,
+                                         ingest->buf, tail_len) != 0)
+            return -1;
+        mrt_spacing_placed(&idx->spacing, &idx->builder, offset->uncomp,
+                           offset->comp);
+    }
+    return ZX_RET_OK;
+}
+
+static int key_record(void *context, off_t offset,
+                      const struct mrt_header_t *header,
+                      const uint8_t *record) {
+    (void)offset;
+    struct ingest_t *ingest = context;
+    if (!is_tdv2_rib_header(header)) return 0;
+    struct prefix_key_t key = get_prefix_key(record);
+    if (fwrite(&key, sizeof(key), 1, ingest->keys) != 1) return -1;
+    ingest->key_count++;
+    return 0;
+}
+
+static unsigned long long parse_number(const char *program, const char *arg) {
+    if (arg == NULL) usageexit(program);
+    char *end;
+    unsigned long long v = strtoull(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || *arg == '-')
+        errexit("error: expected a non-negative number, got '%s'\n", arg);
+    return v;
+}
+
+int main(int argc, char **argv) {
+    const char *program = argv[0];
+    if (argc < 3) usageexit(program);
+
+    const char *input_path = argv[1];
+    const char *copy_path = strcmp(argv[2], "-") ? argv[2] : NULL;
+    const char *key_path = NULL;
+    int is_uncompressed = 0;
+    struct ingest_t ingest;
+    memset(&ingest, 0, sizeof(ingest));
+    ingest.indexes = calloc(argc, sizeof(*ingest.indexes));
+    if (ingest.indexes == NULL) errexit("error: out of memory\n");
+
+    for (int i = 3; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "-u")) {
+            is_uncompressed = 1;
+            continue;
+        }
+        if (value == NULL) usageexit(program);
+        if (!strcmp(argv[i], "-i")) {
+            struct ingest_index_t *idx =
+                &ingest.indexes[ingest.index_count++];
+            idx->path = value;
+            idx->spacing.span =
+                parse_number(program, i + 2 < argc ? argv[i + 2] : NULL);
+            if (idx->spacing.span == 0)
+                errexit("error: checkpoint span should be positive\n");
+            i++;
+        } else if (!strcmp(argv[i], "-k")) {
+            key_path = value;
+        } else {
+            usageexit(program);
+        }
+        i++;
+    }
+    if (copy_path == NULL && ingest.index_count == 0 && key_path == NULL)
+        usageexit(program);
+
+    streamlike_t *input;
+    int is_url = startswith(input_path, "http") &&
+                 (startswith(input_path + 4, "://") ||
+                  startswith(input_path + 4, "s://"));
+    if (is_url)
+        input = sl_http_create(input_path);
+    else
+        input = sl_fopen(input_path, "rb");
+    if (input == NULL) errexit("error: couldn't open '%s'\n", input_path);
+
+    struct tee_t tee = {input, NULL, 0, 0, 0};
+    streamlike_t tee_stream;
+    memset(&tee_stream, 0, sizeof(tee_stream));
+    streamlike_t *stream = input;
+    if (copy_path) {
+        tee.copy = sl_fopen(copy_path, "wb");
+        if (tee.copy == NULL) errexit("error: couldn't open '%s'\n", copy_path);
+        tee_stream.context = &tee;
+        tee_stream.read = tee_read;
+        tee_stream.seek = tee_seek;
+        tee_stream.tell = tee_tell;
+        tee_stream.eof = tee_eof;
+        tee_stream.error = tee_error;
+        tee_stream.length = tee_length;
+        tee_stream.seekable = tee_seekable;
+        stream = &tee_stream;
+    }
+    if (key_path) {
+        ingest.keys = fopen(key_path, "wb");
+        if (ingest.keys == NULL)
+            errexit("error: couldn't open '%s'\n", key_path);
+    }
+
+    const size_t len = 128 * 1024;
+    zidx_index *zidx = zidx_index_create();
+    if (zidx == NULL ||
+        zidx_index_init_ex(zidx, stream, ZX_STREAM_GZIP_OR_ZLIB,
+                           ZX_CHECKSUM_DEFAULT, NULL,
+                           ZX_DEFAULT_INITIAL_LIST_CAPACITY,
+                           ZX_DEFAULT_WINDOW_SIZE, len, len) != ZX_RET_OK)
+        errexit("error: couldn't initialize zidx index\n");
+
+    for (int i = 0; i < ingest.index_count; i++) {
+        struct ingest_index_t *idx = &ingest.indexes[i];
+        off_t span = idx->spacing.span;
+        mrt_spacing_init(&idx->spacing, is_uncompressed ? MRT_SPACING_UNCOMP
+                                                        : MRT_SPACING_COMP);
+        idx->spacing.span = span;
+        if (mrt_index_init(&idx->index, ZX_DEFAULT_WINDOW_SIZE) != 0 ||
+            mrt_index_builder_init(&idx->builder, &idx->index) != 0 ||
+            mrt_index_builder_capture_windows(&idx->builder,
+                                              Z_BEST_COMPRESSION) != 0)
+            errexit("error: couldn't initialize index '%s'\n", idx->path);
+    }
+    struct mrt_walker_t walker;
+    mrt_walker_init(&walker, 0, key_record, &ingest);
+
+    /* Reads are kept short so record density seen by the spacing policy is
+     * current, as in zidx. */
+    const size_t read_len = 16 * 1024;
+    uint8_t *buf = malloc(read_len);
+    if (buf == NULL) errexit("error: out of memory\n");
+    ingest.buf = buf;
+    int read;
+    off_t uncomp_size = 0;
+    uint32_t uncomp_crc = crc32(0, NULL, 0);
+    while ((read = zidx_read_ex(zidx, buf, read_len, ingest_block_callback,
+                                &ingest)) > 0) {
+        for (int i = 0; i < ingest.index_count; i++)
+            if (mrt_index_builder_feed(&ingest.indexes[i].builder, buf,
+                                       read) != 0)
+                errexit("error: couldn't index records\n");
+        if (ingest.keys && mrt_walker_feed(&walker, buf, read) != 0)
+            errexit("error: couldn't write '%s'\n", key_path);
+        uncomp_size += read;
+        uncomp_crc = crc32(uncomp_crc, buf, read);
+    }
+    if (read < 0) errexit("error: couldn't inflate '%s'\n", input_path);
+    if (copy_path) {
+        // anything after the last gzip member is copied as well
+        while (sl_read(stream, buf, read_len) > 0) continue;
+        off_t length = sl_length(input);
+        if (tee.error || (length >= 0 && tee.copied != length))
+            errexit("error: couldn't write '%s'\n", copy_path);
+    }
+
+    // lets zidx -e extend the indexes once members are appended to the file;
+    // the tail is read back from the copy, a URL would be downloaded again
+    off_t comp_size = copy_path ? tee.copied : sl_length(input);
+    uint32_t comp_tail_crc = 0;
+    if (comp_size >= 0 && ingest.index_count > 0) {
+        streamlike_t *tail = input;
+        if (copy_path) {
+            int ret = sl_fclose(tee.copy);
+            tee.copy = NULL;
+            if (ret != 0) errexit("error: couldn't write '%s'\n", copy_path);
+            tail = sl_fopen(copy_path, "rb");
+            if (tail == NULL)
+                errexit("error: couldn't open '%s'\n", copy_path);
+        }
+        if (mrt_index_tail_crc(tail, comp_size, &comp_tail_crc) != 0)
+            comp_size = -1;
+        if (tail != input) sl_fclose(tail);
+    }
+
+    for (int i = 0; i < ingest.index_count; i++) {
+        struct ingest_index_t *idx = &ingest.indexes[i];
+        idx->index.uncomp_size = uncomp_size;
+        idx->index.uncomp_crc = uncomp_crc;
+        idx->index.comp_size = comp_size;
+        idx->index.comp_tail_crc = comp_tail_crc;
+        streamlike_t *out = sl_fopen(idx->path, "wb");
+        if (out == NULL || mrt_index_export(&idx->index, out) != 0 ||
+            sl_fclose(out) != 0)
+            errexit("error: couldn't write '%s'\n", idx->path);
+        fprintf(stderr, "%s: %d checkpoints\n", idx->path, idx->index.count);
+        mrt_index_builder_destroy(&idx->builder);
+        mrt_index_destroy(&idx->index);
+    }
+    if (ingest.keys) {
+        if (fclose(ingest.keys) != 0)
+            errexit("error: couldn't write '%s'\n", key_path);
+        fprintf(stderr, "%s: %llu keys\n", key_path,
+                (unsigned long long)ingest.key_count);
+    }
+    if (copy_path)
+        fprintf(stderr, "%s: %lld bytes\n", copy_path, (long long)tee.copied);
+    fprintf(stderr, "%lld bytes inflated\n", (long long)uncomp_size);
+
+    mrt_walker_destroy(&walker);
+    free(buf);
+    free(ingest.indexes);
+    zidx_index_destroy(zidx);
+    free(zidx);
+    if (tee.copy && sl_fclose(tee.copy) != 0)
+        errexit("error: couldn't write '%s'\n", copy_path);
+    if (is_url)
+        sl_http_destroy(input);
+    else
+        sl_fclose(input);
+    return 0;
+}
@@ -1,11 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 //
 #include <arpa/inet.h>
+#include <unistd.h>
 
 //
 #include <parsebgp.h>
@@ -14,7 +19,22 @@
 #include <zidx.h>
 
 //
+#include "async_reader.h"
 #include "find_prefix.h"
+#include "mapped_input.h"
+#include "mrt_as_index.h"
+#include "mrt_columns.h"
+#include "mrt_decoder.h"
+#include "mrt_diff.h"
+#include "mrt_frames.h"
+#include "mrt_index.h"
+#include "mrt_keys.h"
+#include "mrt_peers.h"
+#include "mrt_reader.h"
+#include "mrt_rib_image.h"
+#include "mrt_updates.h"
+#include "mrt_walker.h"
+#include "pfxdump.h"
 
 #include <sys/time.h>
 #if 0
@@ -52,201 +72,1397 @@ static void errexit(const char *format, ...) {
 void usageexit(const char *program) {
     errexit(
         "usage: %s <gzipped-mrt-file-or-url> <zidx-file> "
-        "<ip-address>/<prefix-length> [-i] [-d]\n"
+        "<ip-address>/<prefix-length> [-c <cache-file>] [-k <ways>] [-i] "
+        "[-d]\n"
+        "       %s <gzipped-mrt-file-or-url> <zidx-file> --updates <from> "
+        "<until> [-p <ip-address>/<prefix-length>] [-a <asn>] [-i]\n"
+        "       %s <gzipped-mrt-file-or-url> <zidx-file> --list-prefixes "
+        "[-k <count>] [-s <seed>] [-t <threads>] [-b] [-i]\n"
+        "       %s <gzipped-mrt-file-or-url> <zidx-file> --diff "
+        "<gzipped-mrt-file-or-url> <zidx-file> [-t <threads>] [-i]\n"
+        "       %s <gzipped-mrt-file-or-url> <zidx-file> --origin-as <asn>\n"
+        "       %s <gzipped-mrt-file-or-url> <zidx-file> --path-as <asn>\n"
+        "       %s <gzipped-mrt-file-or-url> --export-columns <dir>\n"
+        "       %s <gzipped-mrt-file-or-url> --build-image <image-file>\n"
+        "       %s --image <image-file> <ip-address>/<prefix-length>...\n"
+        "\t<zidx-file> may also be a self-contained index built by zidx -z, "
+        "and is ignored for files written by pfxdump-transcode\n"
         "\t-i: ignore zidx file provided (optional)\n"
-        "\t-d: debug print (optional)\n",
-        program);
+        "\t-d: debug print (optional)\n"
+        "\t-c: share inflated spans with other lookups through <cache-file>, "
+        "e.g.\n\t\t/dev/shm/pfxdump-spans, created if missing, see "
+        "span_cache.h\n"
+        "\t-k: search checkpoints <ways> at a time on as many threads, for "
+        "indexes\n\t\tslow to probe, see find_prefix.h\n"
+        "\t--updates: dump BGP4MP records between <from> and <until>, given "
+        "as unix\n\t\ttimes or YYYY-MM-DDTHH:MM[:SS] in UTC, optionally "
+        "only those\n\t\tfor a prefix or its more specifics, or with an "
+        "AS in the path\n"
+        "\t--list-prefixes: print the prefix of every RIB record, or of a "
+        "uniform\n\t\tsample of <count> of them seeded by <seed>, using "
+        "<threads>\n\t\tthreads (default: all cores), as 18-byte keys with "
+        "-b, see\n\t\tmrt_keys.h\n"
+        "\t--diff: print the prefixes added (+), removed (-) or changed (~) "
+        "in the\n\t\tsecond RIB dump, using <threads> threads, see "
+        "mrt_diff.h\n"
+        "\t--origin-as, --path-as: dump the RIB records with <asn> as an "
+        "origin or\n\t\tanywhere in a path, using the AS index written by "
+        "zidx -a or -A\n"
+        "\t--export-columns: write RIB entries as columns into <dir>, see "
+        "mrt_columns.h\n"
+        "\t--build-image: decode all RIB records into <image-file>, see "
+        "mrt_rib_image.h\n"
+        "\t--image: dump the longest match of every prefix from "
+        "<image-file>\n",
+        program, program, program, program, program, program, program,
+        program, program);
 }
 
-int main(int argc, char **argv) {
-    const char *program = argv[0];
-    if (argc < 4) usageexit(program);
+/* Input is read through zidx, through an MRT reader with a self-contained
+ * MRT index, or frame by frame for transcoded files. */
+struct input_t {
+    zidx_index *index;
+    struct mrt_reader_t *reader;
+    struct mrt_frames_reader_t *frames;
+};
 
-    const char *gzipped_mrt_path = argv[1];
-    const char *zidx_path = argv[2];
-    char *addr_str = argv[3];
-    char *prefix_len_str = strchr(addr_str, '/');
+static int input_read(const struct input_t *input, void *buffer, size_t len) {
+    if (input->frames)
+        return mrt_frames_reader_read(input->frames, buffer, len);
+    if (input->reader) return mrt_reader_read(input->reader, buffer, len);
+    return zidx_read(input->index, buffer, len);
+}
 
-    _Bool debug = 0;
-    _Bool ignore_zidx = 0;
+static int input_seek(const struct input_t *input, off_t offset) {
+    if (input->reader) return mrt_reader_seek(input->reader, offset);
+    return zidx_seek(input->index, offset) == ZX_RET_OK ? 0 : -1;
+}
 
-    for (int i = 4; i < argc; i++) {
-        if (!strcmp(argv[i], "-d"))
-            debug = 1;
-        else if (!strcmp(argv[i], "-i"))
-            ignore_zidx = 1;
-        else
-            usageexit(program);
+enum input_stream_t { INPUT_URL, INPUT_READ_AHEAD, INPUT_MAPPED, INPUT_FILE };
+
+static int is_url(const char *path) {
+    return startswith(path, "http") &&
+           (startswith(path + 4, "://") || startswith(path + 4, "s://"));
+}
+
+/* Local files read from end to end are read ahead, see async_reader.h.
+ * Lookups go through pfxdump.h, which maps them instead. */
+static streamlike_t *open_input_stream(const char *path,
+                                       enum input_stream_t *kind) {
+    if (is_url(path)) {
+        *kind = INPUT_URL;
+        return sl_http_create(path);
     }
+    *kind = INPUT_READ_AHEAD;
+    streamlike_t *stream = async_reader_open(
+        path, ASYNC_READER_DEFAULT_EXTENT_SIZE, ASYNC_READER_DEFAULT_DEPTH);
+    if (stream) return stream;
+    // read-ahead only saves waiting, e.g. io_uring may be denied by seccomp
+    *kind = INPUT_FILE;
+    stream = sl_fopen(path, "rb");
+    if (stream)
+        fprintf(stderr, "warning: reading '%s' without read-ahead\n", path);
+    return stream;
+}
 
-    if (prefix_len_str == NULL)
-        errexit("error: couldn't find '/' denoting prefix length\n");
-    *prefix_len_str++ = '\0';
-    for (char *d = prefix_len_str; *d; d++)
-        if (*d < '0' || *d > '9')
-            errexit(
-                "error: prefix length should consist of digits only: '%c'\n",
-                *d);
+/* Records scattered over the file are read from a mapping, like lookups. */
+static streamlike_t *open_scattered_input_stream(const char *path,
+                                                 enum input_stream_t *kind) {
+    if (!is_url(path)) {
+        streamlike_t *stream = mapped_input_open(path, MAPPED_INPUT_RANDOM);
+        *kind = INPUT_MAPPED;
+        if (stream) return stream;
+    }
+    return open_input_stream(path, kind);
+}
 
-    long prefix_len_long = strtol(prefix_len_str, NULL, 10);
-    if (prefix_len_long < 0 || prefix_len_long > 128)
-        errexit("error: prefix length should be in the range of [0, 128]\n");
+static void close_input_stream(streamlike_t *stream, enum input_stream_t kind) {
+    if (kind == INPUT_URL)
+        sl_http_destroy(stream);
+    else if (kind == INPUT_MAPPED)
+        mapped_input_close(stream);
+    else if (kind == INPUT_FILE)
+        sl_fclose(stream);
+    else
+        async_reader_close(stream);
+}
 
+static struct afi_prefix_t parse_prefix(const char *str) {
     struct afi_prefix_t pfx;
-    pfx.prefix.len = prefix_len_long;
-    if (inet_pton(AF_INET, addr_str, pfx.prefix.addr)) {
-        if (pfx.prefix.len > 32)
-            errexit(
-                "error: prefix length shouldn't be more than 32 for IPv4\n");
-        pfx.type = AFI_TYPE_IPV4;
-    } else if (inet_pton(AF_INET6, addr_str, pfx.prefix.addr)) {
-        pfx.type = AFI_TYPE_IPV6;
-    } else {
-        errexit("error: couldn't parse ip address\n");
+    const char *error;
+    if (afi_prefix_parse(str, &pfx, &error) != 0)
+        errexit("error: %s: '%s'\n", error, str);
+    return pfx;
+}
+
+/* Dumps a record, returns -1 if it doesn't decode. */
+static int dump_record(struct mrt_decoder_t *decoder, const uint8_t *record,
+                       size_t len) {
+    parsebgp_msg_t *msg = mrt_decoder_decode(decoder, record, len);
+    if (msg == NULL) return -1;
+    parsebgp_dump_msg(msg);
+    return 0;
+}
+
+/* Dumps the record found by a lookup and keeps a copy of it in the
+ * decoder's arena, so its peers can be printed once the lookup is done with
+ * the handle. */
+struct lookup_result_t {
+    struct mrt_decoder_t *decoder;
+    const uint8_t *record;
+    size_t len;
+};
+
+static int lookup_record(void *context, const uint8_t *record, size_t len) {
+    struct lookup_result_t *result = context;
+    if (dump_record(result->decoder, record, len) != 0)
+        errexit("error: prefix found, but failed to decode\n");
+
+    uint8_t *copy = mrt_decoder_alloc(result->decoder, len);
+    if (copy == NULL) errexit("error: out of memory\n");
+    memcpy(copy, record, len);
+    result->record = copy;
+    result->len = len;
+    return 0;
+}
+
+static int export_record(void *context, off_t offset,
+                         const struct mrt_header_t *header,
+                         const uint8_t *record) {
+    (void)offset;
+    return mrt_columns_writer_record(context, header, record);
+}
+
+/* Full scan of the file, no index needed. */
+static int export_columns(const char *path, const char *dir) {
+    enum input_stream_t kind;
+    streamlike_t *stream = open_input_stream(path, &kind);
+    if (stream == NULL)
+        errexit("error: couldn't open gzip stream '%s'\n", path);
+
+    int ret = 1;
+    zidx_index *index = zidx_index_create();
+    struct mrt_frames_t frames;
+    struct mrt_frames_reader_t frames_reader;
+    int is_framed = 0;
+    struct input_t input = {index, NULL, NULL};
+    struct mrt_columns_writer_t writer;
+    _Bool has_writer = 0;
+    struct mrt_walker_t walker;
+    mrt_walker_init(&walker, 0, export_record, &writer);
+    uint8_t *buffer = malloc(1 << 20);
+
+    if (index == NULL || buffer == NULL) errfail("error: out of memory\n");
+    if (zidx_index_init(index, stream) != ZX_RET_OK)
+        errfail("error: couldn't initialize zidx index\n");
+    is_framed = mrt_frames_open(&frames, stream);
+    if (is_framed < 0) errfail("error: couldn't read frame tables\n");
+    if (is_framed) {
+        if (mrt_frames_reader_init(&frames_reader, &frames, stream) != 0)
+            errfail("error: couldn't initialize frame reader\n");
+        input.frames = &frames_reader;
     }
+    if (mrt_columns_writer_open(&writer, dir, 3) != 0)
+        errfail("error: couldn't create columns in '%s'\n", dir);
+    has_writer = 1;
 
-    streamlike_t *gzip_stream;
-    int is_url = startswith(gzipped_mrt_path, "http") &&
-                 (startswith(gzipped_mrt_path + 4, "://") ||
-                  startswith(gzipped_mrt_path + 4, "s://"));
-    gzip_stream = is_url ? sl_http_create(gzipped_mrt_path)
-                         : sl_fopen(gzipped_mrt_path, "rb");
+    int read;
+    while ((read = input_read(&input, buffer, 1 << 20)) > 0)
+        if (mrt_walker_feed(&walker, buffer, read) != 0)
+            errfail("error: couldn't export record\n");
+    if (read < 0) errfail("error: while reading '%s'\n", path);
+    if (walker.pending_len > 0)
+        fprintf(stderr, "warning: ignoring truncated last record\n");
 
-    if (gzip_stream == NULL)
-        errexit("error: couldn't open gzip stream '%s'\n", gzipped_mrt_path);
+    has_writer = 0;
+    if (mrt_columns_writer_close(&writer) != 0)
+        errfail("error: couldn't write columns in '%s'\n", dir);
+    fprintf(stderr, "%llu entries\n", (unsigned long long)writer.entry_count);
+    ret = 0;
 
-    // errfail on error after this point
+fail:
+    if (has_writer) mrt_columns_writer_close(&writer);
+    mrt_walker_destroy(&walker);
+    free(buffer);
+    if (input.frames) mrt_frames_reader_destroy(input.frames);
+    if (is_framed > 0) mrt_frames_destroy(&frames);
+    if (index) zidx_index_destroy(index);
+    free(index);
+    close_input_stream(stream, kind);
+    return ret;
+}
 
+static int image_record(void *context, off_t offset,
+                        const struct mrt_header_t *header,
+                        const uint8_t *record) {
+    (void)offset;
+    return mrt_rib_image_builder_record(context, header, record);
+}
+
+/* Full scan of the file like export_columns, see mrt_rib_image.h. */
+static int build_image(const char *path, const char *image_path) {
+    enum input_stream_t kind;
+    streamlike_t *stream = open_input_stream(path, &kind);
+    if (stream == NULL)
+        errexit("error: couldn't open gzip stream '%s'\n", path);
+
+    int ret = 1;
     zidx_index *index = zidx_index_create();
-    streamlike_t *index_stream = NULL;
-    struct prefix_checkpoint_t pfx_chkp = {-1, 0};
+    struct mrt_frames_t frames;
+    struct mrt_frames_reader_t frames_reader;
+    int is_framed = 0;
+    struct input_t input = {index, NULL, NULL};
+    struct mrt_rib_image_builder_t builder;
+    mrt_rib_image_builder_init(&builder);
+    struct mrt_walker_t walker;
+    mrt_walker_init(&walker, 0, image_record, &builder);
+    uint8_t *buffer = malloc(1 << 20);
+
+    if (index == NULL || buffer == NULL) errfail("error: out of memory\n");
+    if (zidx_index_init(index, stream) != ZX_RET_OK)
+        errfail("error: couldn't initialize zidx index\n");
+    is_framed = mrt_frames_open(&frames, stream);
+    if (is_framed < 0) errfail("error: couldn't read frame tables\n");
+    if (is_framed) {
+        if (mrt_frames_reader_init(&frames_reader, &frames, stream) != 0)
+            errfail("error: couldn't initialize frame reader\n");
+        input.frames = &frames_reader;
+    }
+
+    int read;
+    while ((read = input_read(&input, buffer, 1 << 20)) > 0)
+        if (mrt_walker_feed(&walker, buffer, read) != 0)
+            errfail("error: couldn't add record to image\n");
+    if (read < 0) errfail("error: while reading '%s'\n", path);
+    if (walker.pending_len > 0)
+        fprintf(stderr, "warning: ignoring truncated last record\n");
+    if (builder.peer_index_table == NULL)
+        fprintf(stderr, "warning: no peer index table\n");
 
-    if (index == NULL) errfail("error: couldn't create zidx index\n");
+    if (mrt_rib_image_builder_write(&builder, image_path) != 0)
+        errfail("error: couldn't write image '%s'\n", image_path);
+    fprintf(stderr, "%llu prefixes, %llu entries, %llu attribute sets\n",
+            (unsigned long long)builder.route_count,
+            (unsigned long long)builder.entry_count,
+            (unsigned long long)builder.attribute_count);
+    ret = 0;
 
-    if (zidx_index_init(index, gzip_stream) != ZX_RET_OK)
+fail:
+    mrt_rib_image_builder_destroy(&builder);
+    mrt_walker_destroy(&walker);
+    free(buffer);
+    if (input.frames) mrt_frames_reader_destroy(input.frames);
+    if (is_framed > 0) mrt_frames_destroy(&frames);
+    if (index) zidx_index_destroy(index);
+    free(index);
+    close_input_stream(stream, kind);
+    return ret;
+}
+
+/* Dumps the longest match of every prefix from an image, as a lookup in the
+ * MRT file would for prefixes it has. */
+static int lookup_image(const char *image_path, int count,
+                        char *const *prefixes) {
+    struct mrt_rib_image_t image;
+    if (mrt_rib_image_open(&image, image_path) != 0)
+        errexit("error: couldn't open image '%s'\n", image_path);
+    struct mrt_peer_table_t peers = {{0}, 0, NULL};
+    int has_peers =
+        image.peer_index_table != NULL &&
+        mrt_peer_table_parse(&peers, image.peer_index_table,
+                             image.peer_index_table_len) == 0;
+
+    int ret = 0;
+    struct mrt_decoder_t decoder;
+    if (mrt_decoder_init(&decoder) != 0) errexit("error: out of memory\n");
+    for (int i = 0; i < count; i++) {
+        struct afi_prefix_t pfx = parse_prefix(prefixes[i]);
+        struct prefix_key_t key = prefix_key_make(&pfx);
+        uint32_t route = mrt_rib_image_lookup(&image, &key);
+        if (route == MRT_RIB_IMAGE_NO_ROUTE) {
+            fprintf(stderr, "Prefix not found: %s\n", prefixes[i]);
+            ret = 1;
+            continue;
+        }
+        mrt_decoder_reset(&decoder);
+        size_t len = mrt_rib_image_record(&image, route, NULL, 0);
+        if (len == 0) errexit("error: image '%s' is corrupt\n", image_path);
+        uint8_t *record = mrt_decoder_alloc(&decoder, len);
+        if (record == NULL) errexit("error: out of memory\n");
+        mrt_rib_image_record(&image, route, record, len);
+        if (dump_record(&decoder, record, len) != 0)
+            errexit("error: prefix found, but failed to decode\n");
+        if (has_peers) mrt_peer_table_print_rib(&peers, record, len);
+    }
+
+    mrt_decoder_destroy(&decoder);
+    mrt_peer_table_destroy(&peers);
+    mrt_rib_image_close(&image);
+    return ret;
+}
+
+/* Seconds since the epoch, or a UTC date as YYYY-MM-DDTHH:MM[:SS]. */
+static uint32_t parse_time(const char *str) {
+    char *end;
+    unsigned long long seconds = strtoull(str, &end, 10);
+    if (*str >= '0' && *str <= '9' && *end == '\0' && seconds <= UINT32_MAX)
+        return seconds;
+
+    int y, m, d, hh, mm, ss = 0, n = 0;
+    if (sscanf(str, "%4d-%2d-%2dT%2d:%2d%n:%2d%n", &y, &m, &d, &hh, &mm, &n,
+               &ss, &n) < 5 ||
+        str[n] != '\0' || y < 1970 || m < 1 || m > 12 || d < 1 || d > 31 ||
+        hh > 23 || mm > 59 || ss > 60)
+        errexit("error: couldn't parse time '%s'\n", str);
+
+    // days from civil, counting years from March so leap days come last
+    y -= m <= 2;
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long long days = (long long)era * 146097 + doe - 719468;
+    long long t = days * 86400 + hh * 3600 + mm * 60 + ss;
+    if (t > UINT32_MAX) errexit("error: time '%s' out of range\n", str);
+    return t;
+}
+
+/* Frames of updates files are in time order, so the first record of every
+ * frame bounds the times in it. Returns the last frame starting before
+ * `timestamp`, 0 if there is none, -1 on error. */
+static int find_frame_by_time(struct mrt_frames_reader_t *reader,
+                              uint32_t timestamp) {
+    int i = 0;
+    int j = reader->frames->count;
+    while (i < j) {
+        int k = i + (j - i) / 2;
+        const uint8_t *data;
+        long len = mrt_frames_reader_frame(reader, k, &data);
+        if (len < 0) return -1;
+        if (len >= (long)sizeof(struct mrt_header_t) &&
+            get_header(data).timestamp < timestamp)
+            i = k + 1;
+        else
+            j = k;
+    }
+    return i > 0 ? i - 1 : 0;
+}
+
+struct updates_scan_t {
+    uint32_t from;
+    uint32_t until;
+    const struct mrt_update_filter_t *filter;
+    uint64_t matches;
+    uint64_t malformed;
+    struct mrt_decoder_t decoder;
+};
+
+static int updates_record(void *context, off_t offset,
+                          const struct mrt_header_t *header,
+                          const uint8_t *record) {
+    (void)offset;
+    struct updates_scan_t *scan = context;
+    if (!is_bgp4mp_header(header) || header->timestamp < scan->from) return 0;
+    if (header->timestamp > scan->until) return 1;
+
+    int match = mrt_update_matches(scan->filter, header, record);
+    if (match < 0) scan->malformed++;
+    if (match <= 0) return 0;
+
+    size_t len = sizeof(struct mrt_header_t) + header->length;
+    if (dump_record(&scan->decoder, record, len) != 0) scan->malformed++;
+    scan->matches++;
+    return 0;
+}
+
+/* Dumps the BGP4MP records of [from, until] matching `filter`. Scanning
+ * starts at the last checkpoint whose next record is older than `from`, so
+ * indexes need the TIME section written by zidx -m or -z; without it the
+ * whole file up to `until` is read. */
+static int dump_updates(const char *path, const char *zidx_path,
+                        _Bool ignore_zidx, uint32_t from, uint32_t until,
+                        const struct mrt_update_filter_t *filter) {
+    enum input_stream_t kind;
+    streamlike_t *stream = open_input_stream(path, &kind);
+    if (stream == NULL)
+        errexit("error: couldn't open gzip stream '%s'\n", path);
+
+    int ret = 1;
+    zidx_index *index = zidx_index_create();
+    streamlike_t *index_stream = NULL;
+    struct mrt_index_t mrt_index;
+    _Bool has_mrt_index = 0;
+    char *mrt_index_file = NULL;
+    struct mrt_reader_t mrt_reader;
+    struct mrt_frames_t frames;
+    struct mrt_frames_reader_t frames_reader;
+    int is_framed = 0;
+    struct input_t input = {index, NULL, NULL};
+    struct updates_scan_t scan = {from, until, filter, 0, 0,
+                                  {{0}, NULL, NULL}};
+    off_t start = 0;
+    struct mrt_walker_t walker;
+    uint8_t *buffer = malloc(1 << 20);
+
+    mrt_index_init(&mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+    if (index == NULL || buffer == NULL ||
+        mrt_decoder_init(&scan.decoder) != 0)
+        errfail("error: out of memory\n");
+    if (zidx_index_init(index, stream) != ZX_RET_OK)
         errfail("error: couldn't initialize zidx index\n");
 
-    if (!ignore_zidx) {
+    is_framed = mrt_frames_open(&frames, stream);
+    if (is_framed < 0) errfail("error: couldn't read frame tables\n");
+    if (is_framed) {
+        if (mrt_frames_reader_init(&frames_reader, &frames, stream) != 0)
+            errfail("error: couldn't initialize frame reader\n");
+        input.frames = &frames_reader;
+        int frame = ignore_zidx ? 0 : find_frame_by_time(&frames_reader, from);
+        if (frame < 0 || mrt_frames_reader_seek_frame(&frames_reader, frame))
+            errfail("error: couldn't seek to frame\n");
+        if (frames.count > 0) start = frames.frames[frame].uncomp_offset;
+    } else if (!ignore_zidx) {
         index_stream = sl_fopen(zidx_path, "rb");
         if (index_stream == NULL)
             errfail("error: couldn't open index stream '%s'\n", zidx_path);
-        if (zidx_import(index, index_stream) != ZX_RET_OK)
-            errfail("error: couldn't import zidx index\n");
-        sl_fclose(index_stream);
+
+        if (mrt_index_is_mrt_index(index_stream)) {
+            if (mrt_index_import(&mrt_index, index_stream) != 0 ||
+                !mrt_index.has_windows)
+                errfail("error: couldn't import mrt index\n");
+            if (mrt_reader_init(&mrt_reader, stream, &mrt_index) != 0)
+                errfail("error: couldn't initialize mrt reader\n");
+            input.reader = &mrt_reader;
+            has_mrt_index = 1;
+        } else {
+            if (zidx_import(index, index_stream) != ZX_RET_OK)
+                errfail("error: couldn't import zidx index\n");
+            mrt_index_file = mrt_index_path(zidx_path);
+            if (mrt_index_file == NULL) errfail("error: out of memory\n");
+            sl_fclose(index_stream);
+            index_stream = sl_fopen(mrt_index_file, "rb");
+            if (index_stream != NULL) {
+                has_mrt_index =
+                    mrt_index_import(&mrt_index, index_stream) == 0 &&
+                    mrt_index_matches(&mrt_index, index);
+                if (!has_mrt_index)
+                    fprintf(stderr,
+                            "warning: ignoring stale or invalid '%s'\n",
+                            mrt_index_file);
+            }
+        }
+        if (index_stream) sl_fclose(index_stream);
         index_stream = NULL;
 
-        pfx_chkp = find_prefix_checkpoint(&pfx, index);
-        if (pfx_chkp.index < -1) errfail("error: couldn't find checkpoint");
+        if (!has_mrt_index || !mrt_index.has_timestamps) {
+            fprintf(stderr,
+                    "warning: index has no timestamps, scanning from the "
+                    "start\n");
+        } else {
+            int idx = mrt_index_find_time(&mrt_index, from);
+            if (idx >= 0) start = mrt_index.checkpoints[idx].next_record;
+            if (start > 0 && input_seek(&input, start) != 0)
+                errfail("error: couldn't seek to mrt record\n");
+        }
     }
 
-    zidx_checkpoint *chkp = NULL;
-    if (pfx_chkp.index >= 0) chkp = zidx_get_checkpoint(index, pfx_chkp.index);
+    mrt_walker_init(&walker, start, updates_record, &scan);
+    int read;
+    int walked = 0;
+    while (walked == 0 &&
+           (read = input_read(&input, buffer, 1 << 20)) > 0)
+        walked = mrt_walker_feed(&walker, buffer, read);
+    mrt_walker_destroy(&walker);
+    if (walked < 0) errfail("error: couldn't dump record\n");
+    if (walked == 0 && read < 0) errfail("error: while reading '%s'\n", path);
 
-    uint8_t buffer[1 << 20];
-    const void *bufferp;
-    _Bool seek_needed = pfx_chkp.index >= 0;
-    enum { SEARCHING, EXACT_MATCH_FOUND, NOT_FOUND } status = SEARCHING;
+    if (scan.malformed > 0)
+        fprintf(stderr, "warning: %llu malformed records\n",
+                (unsigned long long)scan.malformed);
+    fprintf(stderr, "%llu matching records\n",
+            (unsigned long long)scan.matches);
+    ret = 0;
 
-    size_t off;
+fail:
+    mrt_decoder_destroy(&scan.decoder);
+    free(buffer);
+    if (index_stream) sl_fclose(index_stream);
+    if (input.reader) mrt_reader_destroy(input.reader);
+    if (input.frames) mrt_frames_reader_destroy(input.frames);
+    if (is_framed > 0) mrt_frames_destroy(&frames);
+    if (index) zidx_index_destroy(index);
+    free(index);
+    mrt_index_destroy(&mrt_index);
+    free(mrt_index_file);
+    close_input_stream(stream, kind);
+    return ret;
+}
+
+/* Indexes of a file read in spans by several threads, loaded once by the
+ * main thread. Frames and self-contained MRT indexes are shared with the
+ * threads, so any window they need has to be inflated before they start.
+ * zidx indexes keep the read position, so threads import their own. */
+struct span_index_t {
+    zidx_index *index;
+    struct mrt_index_t mrt_index;
+    _Bool has_mrt_index;
+    _Bool self_contained;
+    struct mrt_frames_t frames;
+    int is_framed;
+};
+
+static int span_index_open(struct span_index_t *si, streamlike_t *stream,
+                           const char *zidx_path, _Bool ignore_zidx) {
+    streamlike_t *index_stream = NULL;
+    char *mrt_index_file = NULL;
+    int ret = -1;
+    si->index = zidx_index_create();
+    mrt_index_init(&si->mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+    si->has_mrt_index = 0;
+    si->self_contained = 0;
+    si->is_framed = 0;
+
+    if (si->index == NULL) errfail("error: out of memory\n");
+    if (zidx_index_init(si->index, stream) != ZX_RET_OK)
+        errfail("error: couldn't initialize zidx index\n");
+    si->is_framed = mrt_frames_open(&si->frames, stream);
+    if (si->is_framed < 0) errfail("error: couldn't read frame tables\n");
+    if (!si->is_framed && !ignore_zidx) {
+        index_stream = sl_fopen(zidx_path, "rb");
+        if (index_stream == NULL)
+            errfail("error: couldn't open index stream '%s'\n", zidx_path);
+        if (mrt_index_is_mrt_index(index_stream)) {
+            if (mrt_index_import(&si->mrt_index, index_stream) != 0 ||
+                !si->mrt_index.has_windows)
+                errfail("error: couldn't import mrt index\n");
+            si->has_mrt_index = 1;
+            si->self_contained = 1;
+        } else {
+            if (zidx_import(si->index, index_stream) != ZX_RET_OK)
+                errfail("error: couldn't import zidx index\n");
+            mrt_index_file = mrt_index_path(zidx_path);
+            if (mrt_index_file == NULL) errfail("error: out of memory\n");
+            sl_fclose(index_stream);
+            index_stream = sl_fopen(mrt_index_file, "rb");
+            if (index_stream != NULL) {
+                si->has_mrt_index =
+                    mrt_index_import(&si->mrt_index, index_stream) == 0 &&
+                    mrt_index_matches(&si->mrt_index, si->index);
+                if (!si->has_mrt_index)
+                    fprintf(stderr,
+                            "warning: ignoring stale or invalid '%s'\n",
+                            mrt_index_file);
+            }
+        }
+    }
+    ret = 0;
+
+fail:
+    if (index_stream) sl_fclose(index_stream);
+    free(mrt_index_file);
+    return ret;
+}
+
+static void span_index_destroy(struct span_index_t *si) {
+    if (si->is_framed > 0) mrt_frames_destroy(&si->frames);
+    if (si->index) zidx_index_destroy(si->index);
+    free(si->index);
+    mrt_index_destroy(&si->mrt_index);
+}
+
+/* A file as read by one of those threads, see span_input_open. */
+struct span_input_t {
+    enum input_stream_t kind;
+    streamlike_t *stream;
+    zidx_index *index;
+    struct mrt_reader_t mrt_reader;
+    struct mrt_frames_reader_t frames_reader;
+    struct input_t input;
+};
+
+/* Opens `path` at the uncompressed offset `start`, or at the start of
+ * `frame` for framed files. `zidx_path` is the zidx index to import for
+ * seeking, NULL if none is needed. */
+static int span_input_open(struct span_input_t *in, const char *path,
+                           const char *zidx_path,
+                           struct mrt_index_t *mrt_index,
+                           const struct mrt_frames_t *frames, int frame,
+                           off_t start) {
+    streamlike_t *index_stream = NULL;
+    int ret = -1;
+    in->stream = open_input_stream(path, &in->kind);
+    in->index = NULL;
+    in->input = (struct input_t){NULL, NULL, NULL};
+    if (in->stream == NULL)
+        errfail("error: couldn't open gzip stream '%s'\n", path);
+
+    in->index = zidx_index_create();
+    in->input.index = in->index;
+    if (in->index == NULL) errfail("error: out of memory\n");
+    if (zidx_index_init(in->index, in->stream) != ZX_RET_OK)
+        errfail("error: couldn't initialize zidx index\n");
+    if (frames) {
+        if (mrt_frames_reader_init(&in->frames_reader, frames, in->stream) !=
+            0)
+            errfail("error: couldn't initialize frame reader\n");
+        in->input.frames = &in->frames_reader;
+        if (mrt_frames_reader_seek_frame(&in->frames_reader, frame) != 0)
+            errfail("error: couldn't seek to frame\n");
+    } else if (mrt_index) {
+        if (mrt_reader_init(&in->mrt_reader, in->stream, mrt_index) != 0)
+            errfail("error: couldn't initialize mrt reader\n");
+        in->input.reader = &in->mrt_reader;
+    } else if (zidx_path) {
+        index_stream = sl_fopen(zidx_path, "rb");
+        if (index_stream == NULL ||
+            zidx_import(in->index, index_stream) != ZX_RET_OK)
+            errfail("error: couldn't import zidx index\n");
+    }
+    if (!frames && start > 0 && input_seek(&in->input, start) != 0)
+        errfail("error: couldn't seek to mrt record\n");
+    ret = 0;
+
+fail:
+    if (index_stream) sl_fclose(index_stream);
+    return ret;
+}
+
+static void span_input_close(struct span_input_t *in) {
+    if (in->input.reader) mrt_reader_destroy(in->input.reader);
+    if (in->input.frames) mrt_frames_reader_destroy(in->input.frames);
+    if (in->index) zidx_index_destroy(in->index);
+    free(in->index);
+    if (in->stream) close_input_stream(in->stream, in->kind);
+}
+
+/* Records of one thread of --list-prefixes, [start, end) in uncompressed
+ * offsets with `end` -1 for the end of the file. Both are record boundaries,
+ * taken from frame offsets or from the record offsets of an MRT index. */
+struct list_span_t {
+    const char *path;
+    /* zidx index to import for seeking, NULL if none is needed */
+    const char *zidx_path;
+    struct mrt_index_t *mrt_index;
+    const struct mrt_frames_t *frames;
+    int frame;
+    off_t start;
+    off_t end;
+    struct mrt_keys_t *keys;
+    int ret;
+};
+
+static int list_record(void *context, off_t offset,
+                       const struct mrt_header_t *header,
+                       const uint8_t *record) {
+    struct list_span_t *span = context;
+    if (span->end >= 0 && offset >= span->end) return 1;
+    if (!is_tdv2_rib_header(header)) return 0;
+    // only the prefix is read, attributes are skipped over with the record
+    struct prefix_key_t key = get_prefix_key(record);
+    return mrt_keys_add(span->keys, &key) != 0 ? -1 : 0;
+}
+
+static void *list_span_procedure(void *vargs) {
+    struct list_span_t *span = vargs;
+    struct span_input_t in;
+    struct mrt_walker_t walker;
+    mrt_walker_init(&walker, span->start, list_record, span);
+    uint8_t *buffer = malloc(1 << 20);
+    span->ret = 1;
+
+    if (span_input_open(&in, span->path, span->zidx_path, span->mrt_index,
+                        span->frames, span->frame, span->start) != 0)
+        goto fail;
+    if (buffer == NULL) errfail("error: out of memory\n");
+
+    int read;
+    int walked = 0;
+    while (walked == 0 && (read = input_read(&in.input, buffer, 1 << 20)) > 0)
+        walked = mrt_walker_feed(&walker, buffer, read);
+    if (walked < 0) errfail("error: couldn't list record\n");
+    if (walked == 0 && read < 0)
+        errfail("error: while reading '%s'\n", span->path);
+    if (walked == 0 && walker.pending_len > 0)
+        fprintf(stderr, "warning: ignoring truncated last record\n");
+    span->ret = 0;
+
+fail:
+    mrt_walker_destroy(&walker);
+    free(buffer);
+    span_input_close(&in);
+    return NULL;
+}
+
+static int write_keys(const struct prefix_key_t *keys, size_t count,
+                      _Bool binary) {
+    if (binary) return fwrite(keys, sizeof(*keys), count, stdout) == count;
+    char text[MRT_KEY_TEXT_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        int len = mrt_key_format(&keys[i], text);
+        if (len < 0) return 0;
+        text[len++] = '\n';
+        if (fwrite(text, len, 1, stdout) != 1) return 0;
+    }
+    return 1;
+}
+
+/* Lists the prefixes of all RIB records in file order, or a uniform sample
+ * of `sample` of them in RIB order. The file is split into as many spans as
+ * there are threads, which needs record offsets: frames have them, zidx
+ * indexes need an MRT index next to them, see zidx -m and -z. Otherwise a
+ * single thread reads the whole file. */
+static int list_prefixes(const char *path, const char *zidx_path,
+                         _Bool ignore_zidx, int threads, size_t sample,
+                         uint64_t seed, _Bool binary) {
+    enum input_stream_t kind;
+    streamlike_t *stream = open_input_stream(path, &kind);
+    if (stream == NULL)
+        errexit("error: couldn't open gzip stream '%s'\n", path);
+
+    int ret = 1;
+    struct span_index_t si;
+    struct list_span_t *spans = calloc(threads, sizeof(*spans));
+    struct mrt_keys_t *keys = calloc(threads, sizeof(*keys));
+    pthread_t *workers = calloc(threads, sizeof(*workers));
+    int span_count = 0;
+    int started = 0;
+    struct prefix_key_t *sampled = NULL;
+    uint64_t listed = 0;
+
+    if (span_index_open(&si, stream, zidx_path, ignore_zidx) != 0) goto fail;
+    if (spans == NULL || keys == NULL || workers == NULL)
+        errfail("error: out of memory\n");
+    if (!si.is_framed && !si.has_mrt_index && threads > 1)
+        fprintf(stderr,
+                "warning: index has no record offsets, listing in one "
+                "thread\n");
+
+    int units = si.is_framed       ? si.frames.count
+                : si.has_mrt_index ? si.mrt_index.count
+                                   : 0;
+    int count = units < threads ? units : threads;
+    if (count < 1) count = 1;
+    for (int i = 0; i < count; i++) {
+        int first = i * units / count;
+        off_t start = 0;
+        if (si.is_framed && i > 0)
+            start = si.frames.frames[first].uncomp_offset;
+        else if (i > 0)
+            start = si.mrt_index.checkpoints[first].next_record;
+        if (i > 0 && (start == MRT_INDEX_NO_RECORD ||
+                      start <= spans[span_count - 1].start))
+            continue;
+        if (span_count > 0) spans[span_count - 1].end = start;
+
+        struct list_span_t *span = &spans[span_count++];
+        span->path = path;
+        span->zidx_path =
+            si.has_mrt_index && !si.self_contained ? zidx_path : NULL;
+        span->mrt_index = si.self_contained ? &si.mrt_index : NULL;
+        span->frames = si.is_framed ? &si.frames : NULL;
+        span->frame = first;
+        span->start = start;
+        span->end = -1;
+        span->keys = &keys[span_count - 1];
+        mrt_keys_init(span->keys, sample, seed + i);
+        // windows are inflated on first use, not from several threads
+        if (si.self_contained && start > 0) {
+            const void *window;
+            mrt_index_window(&si.mrt_index,
+                             mrt_index_find_checkpoint(&si.mrt_index, start),
+                             &window);
+        }
+    }
+
+    for (; started < span_count; started++)
+        if (pthread_create(&workers[started], NULL, list_span_procedure,
+                           &spans[started]) != 0)
+            errfail("error: couldn't start thread\n");
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    started = 0;
+    for (int i = 0; i < span_count; i++)
+        if (spans[i].ret != 0) goto fail;
+
+    if (sample > 0) {
+        long drawn = mrt_keys_merge_samples(keys, span_count, sample,
+                                            seed + threads, &sampled);
+        if (drawn < 0) errfail("error: out of memory\n");
+        if (!write_keys(sampled, drawn, binary))
+            errfail("error: couldn't write prefixes\n");
+        listed = drawn;
+    } else {
+        for (int i = 0; i < span_count; i++) {
+            if (!write_keys(keys[i].keys, keys[i].count, binary))
+                errfail("error: couldn't write prefixes\n");
+            listed += keys[i].count;
+        }
+    }
+    if (fflush(stdout) != 0) errfail("error: couldn't write prefixes\n");
+    fprintf(stderr, "%llu prefixes\n", (unsigned long long)listed);
+    ret = 0;
+
+fail:
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    for (int i = 0; i < span_count; i++) mrt_keys_destroy(&keys[i]);
+    free(sampled);
+    free(keys);
+    free(spans);
+    free(workers);
+    span_index_destroy(&si);
+    close_input_stream(stream, kind);
+    return ret;
+}
+
+/* Where one thread of --diff starts reading one of the files, found by the
+ * main thread: a frame, or an uncompressed offset and the bytes of the
+ * checkpoint window before it to start with. */
+struct diff_side_t {
+    const char *path;
+    /* zidx index to import for seeking, NULL if none is needed */
+    const char *zidx_path;
+    struct mrt_index_t *mrt_index;
+    const struct mrt_frames_t *frames;
+    int frame;
+    off_t start;
+    const uint8_t *prime;
+    size_t prime_len;
+};
+
+/* Prefixes of [from, to) of both files, unbounded where has_from or has_to
+ * isn't set. Output is kept in memory to be written in order. */
+struct diff_part_t {
+    struct diff_side_t sides[2];
+    _Bool has_from;
+    _Bool has_to;
+    struct prefix_key_t from;
+    struct prefix_key_t to;
+    char *output;
+    size_t output_len;
+    struct mrt_diff_stats_t stats;
+    int ret;
+};
+
+/* Positions `side` before the records of `key` and after, or at the start
+ * of the file for no key or when there is no index to search. */
+static int diff_locate(struct span_index_t *si, const struct prefix_key_t *key,
+                       struct diff_side_t *side) {
+    side->frame = 0;
+    side->start = 0;
+    side->prime = NULL;
+    side->prime_len = 0;
+    if (key == NULL) return 0;
+    if (si->is_framed) {
+        side->frame = mrt_frames_find(&si->frames, key);
+        return 0;
+    }
+
+    struct afi_prefix_t pfx = prefix_key_prefix(key);
+    struct prefix_checkpoint_t pfx_chkp = find_prefix_checkpoint(
+        &pfx, si->self_contained ? NULL : si->index,
+        si->has_mrt_index ? &si->mrt_index : NULL);
+    if (pfx_chkp.index < -1) return -1;
+    if (pfx_chkp.index < 0) return 0;
+
+    // the window holds the records right before the checkpoint
+    const void *window;
     size_t len;
-    if (pfx_chkp.index >= 0) {
-        // seek into window
-        off = pfx_chkp.first_mrt_offset;
-        len = zidx_get_checkpoint_window(chkp, &bufferp);
-        memcpy(buffer, bufferp + off, len - off);
-        len -= off;
-        off = 0;
+    if (si->self_contained) {
+        len = mrt_index_window(&si->mrt_index, pfx_chkp.index, &window);
+        side->start = si->mrt_index.checkpoints[pfx_chkp.index].offset;
     } else {
-        int ret = zidx_read(index, buffer, sizeof(buffer));
-        if (ret < 0) errfail("error: couldn't make initial read");
-        len = ret;
-        off = 0;
-    }
-
-    while (len > 0 && status == SEARCHING) {
-        assert(off + sizeof(struct mrt_header_t) <= len);
-        while (status == SEARCHING) {
-            if (sizeof(struct mrt_header_t) > len) {
-                memmove(buffer, buffer + off, len);
-                off = len;
-                break;
-            }
+        zidx_checkpoint *chkp = zidx_get_checkpoint(si->index, pfx_chkp.index);
+        len = zidx_get_checkpoint_window(chkp, &window);
+        side->start = zidx_get_checkpoint_offset(chkp);
+    }
+    if (pfx_chkp.first_mrt_offset < len) {
+        side->prime = (const uint8_t *)window + pfx_chkp.first_mrt_offset;
+        side->prime_len = len - pfx_chkp.first_mrt_offset;
+    }
+    return 0;
+}
 
-            struct mrt_header_t header = get_header(buffer + off);
+static long diff_read(void *context, void *buffer, size_t len) {
+    return input_read(context, buffer, len);
+}
 
-            if (sizeof(struct mrt_header_t) + header.length > len) {
-                memmove(buffer, buffer + off, len);
-                off = len;
-                break;
-            }
+static int diff_record(void *context, enum mrt_diff_type_t type,
+                       const struct prefix_key_t *key, const uint8_t *before,
+                       size_t before_len, const uint8_t *after,
+                       size_t after_len) {
+    (void)before;
+    (void)before_len;
+    (void)after;
+    (void)after_len;
+    static const char marks[] = {'+', '-', '~'};
+    char text[MRT_KEY_TEXT_SIZE];
+    if (mrt_key_format(key, text) < 0) return -1;
+    return fprintf(context, "%c %s\n", marks[type], text) < 0 ? -1 : 0;
+}
 
-            if (header.subtype == 1) {  // skip peer_index_table
-                off += sizeof(struct mrt_header_t) + header.length;
-                len -= sizeof(struct mrt_header_t) + header.length;
-                continue;
-            }
+static void *diff_part_procedure(void *vargs) {
+    struct diff_part_t *part = vargs;
+    struct span_input_t in[2];
+    struct mrt_cursor_t cursors[2];
+    int opened = 0;
+    FILE *out = open_memstream(&part->output, &part->output_len);
+    int failed = out == NULL;
+    part->ret = 1;
 
-            struct afi_prefix_t mrt_prefix = get_prefix(buffer + off);
-            if (debug) {
-                printf("debug: ");
-                prefix_printf(mrt_prefix);
-                printf("\n");
-            }
-            int cmp = afi_prefix_cmp(&mrt_prefix, &pfx);
-            if (cmp == 0) {
-                status = EXACT_MATCH_FOUND;
-
-                parsebgp_opts_t opts;
-                parsebgp_opts_init(&opts);
-                opts.ignore_not_implemented = 1;
-                parsebgp_msg_t *msg = parsebgp_create_msg();
-                if (parsebgp_decode(opts, PARSEBGP_MSG_TYPE_MRT, msg,
-                                    buffer + off, &len) != PARSEBGP_OK) {
-                    parsebgp_destroy_msg(msg);
-                    errfail("error: prefix found, but failed to decode");
-                }
-                parsebgp_dump_msg(msg);
-                parsebgp_destroy_msg(msg);
-            } else if (cmp > 0) {
-                status = NOT_FOUND;
-            } else {
-                off += sizeof(struct mrt_header_t) + header.length;
-                len -= sizeof(struct mrt_header_t) + header.length;
-            }
+    for (int i = 0; i < 2; i++)
+        failed |= mrt_cursor_init(&cursors[i], diff_read, &in[i].input) != 0;
+    if (failed) errfail("error: out of memory\n");
+    for (; opened < 2; opened++) {
+        struct diff_side_t *side = &part->sides[opened];
+        if (span_input_open(&in[opened], side->path, side->zidx_path,
+                            side->mrt_index, side->frames, side->frame,
+                            side->start) != 0) {
+            opened++;
+            goto fail;
         }
-        if (status == SEARCHING) {
-            if (seek_needed) {
-                if (zidx_seek(index, zidx_get_checkpoint_offset(chkp)) !=
-                    ZX_RET_OK)
-                    errfail("error: couldn't seek to mrt record");
-                seek_needed = 0;
-            }
-            int ret = zidx_read(index, buffer + off, sizeof(buffer) - off);
-            if (ret < 0) errfail("error: while reading zidx stream");
-            len = off + ret;
-            off = 0;
+        if (side->prime_len > 0 &&
+            mrt_cursor_prime(&cursors[opened], side->prime,
+                             side->prime_len) != 0)
+            errfail("error: out of memory\n");
+    }
+
+    if (mrt_diff_join(&cursors[0], &cursors[1],
+                      part->has_from ? &part->from : NULL,
+                      part->has_to ? &part->to : NULL, diff_record, out,
+                      &part->stats) != 0)
+        errfail("error: couldn't compare records\n");
+    for (int i = 0; i < 2; i++)
+        if (mrt_cursor_truncated(&cursors[i]))
+            fprintf(stderr,
+                    "warning: ignoring truncated last record of '%s'\n",
+                    part->sides[i].path);
+    part->ret = 0;
+
+fail:
+    // a failed part is not printed, but the stream is closed all the same
+    if (out && fclose(out) != 0) part->ret = 1;
+    for (int i = 0; i < 2; i++) mrt_cursor_destroy(&cursors[i]);
+    for (int i = 0; i < opened; i++) span_input_close(&in[i]);
+    return NULL;
+}
+
+/* Prints the prefixes added, removed or changed from `paths[0]` to
+ * `paths[1]`, dumps sorted the same way such as bviews of one collector.
+ * The prefix space is cut at the first prefixes of checkpoints of the first
+ * file into as many parts as there are threads, and each thread finds the
+ * start of its part in both files like a lookup would, then merge-joins
+ * them, see mrt_diff.h. */
+static int diff_files(const char *paths[2], const char *zidx_paths[2],
+                      _Bool ignore_zidx, int threads) {
+    enum input_stream_t kinds[2];
+    streamlike_t *streams[2] = {NULL, NULL};
+    struct span_index_t si[2];
+    int opened = 0;
+    int ret = 1;
+    struct diff_part_t *parts = calloc(threads, sizeof(*parts));
+    pthread_t *workers = calloc(threads, sizeof(*workers));
+    int part_count = 0;
+    int started = 0;
+    struct mrt_diff_stats_t stats = {0, 0, 0, 0};
+
+    if (parts == NULL || workers == NULL) errfail("error: out of memory\n");
+    for (; opened < 2; opened++) {
+        streams[opened] = open_input_stream(paths[opened], &kinds[opened]);
+        if (streams[opened] == NULL)
+            errfail("error: couldn't open gzip stream '%s'\n", paths[opened]);
+        if (span_index_open(&si[opened], streams[opened], zidx_paths[opened],
+                            ignore_zidx) != 0) {
+            opened++;
+            goto fail;
         }
     }
 
-    if (status != EXACT_MATCH_FOUND) errfail("Prefix not found");
+    // entries refer to peers by position, see mrt_diff.h
+    const uint8_t *tables[2];
+    size_t table_lens[2];
+    for (int i = 0; i < 2; i++) {
+        tables[i] = si[i].is_framed ? si[i].frames.peer_index_table
+                                    : si[i].mrt_index.peer_index_table;
+        table_lens[i] = si[i].is_framed
+                            ? si[i].frames.peer_index_table_len
+                            : si[i].mrt_index.peer_index_table_len;
+    }
+    // tables start with the MRT header, whose timestamp is skipped
+    if (tables[0] && tables[1] &&
+        (table_lens[0] != table_lens[1] ||
+         memcmp(tables[0] + 4, tables[1] + 4, table_lens[0] - 4) != 0))
+        fprintf(stderr,
+                "warning: peer index tables differ, entries of renumbered "
+                "peers show up as changed\n");
 
-    if (is_url)
-        sl_http_destroy(gzip_stream);
-    else
-        sl_fclose(gzip_stream);
-    zidx_index_destroy(index);
-    free(index);
+    int units = si[0].is_framed         ? si[0].frames.count
+                : si[0].self_contained ? si[0].mrt_index.count
+                                       : zidx_checkpoint_count(si[0].index);
+    int count = units < threads ? units : threads;
+    if (count < 1) count = 1;
+    for (int i = 0; i < count; i++) {
+        struct diff_part_t *part = &parts[part_count];
+        part->has_from = i > 0;
+        if (si[0].is_framed && i > 0) {
+            const struct mrt_frame_t *frame =
+                &si[0].frames.frames[i * units / count];
+            if (!frame->has_key) continue;
+            part->from = frame->key;
+        } else if (i > 0) {
+            int found = find_checkpoint_prefix_key(
+                si[0].self_contained ? NULL : si[0].index,
+                si[0].has_mrt_index ? &si[0].mrt_index : NULL,
+                i * units / count, &part->from);
+            if (found < -1) errfail("error: couldn't find checkpoint\n");
+            if (found < 0) continue;
+        }
+        // cut points have to increase, windows without a RIB record don't
+        if (i > 0 && parts[part_count - 1].has_from &&
+            prefix_key_cmp(&part->from, &parts[part_count - 1].from) <= 0)
+            continue;
+
+        for (int j = 0; j < 2; j++) {
+            struct diff_side_t *side = &part->sides[j];
+            side->path = paths[j];
+            side->zidx_path =
+                !ignore_zidx && !si[j].is_framed && !si[j].self_contained
+                    ? zidx_paths[j]
+                    : NULL;
+            side->mrt_index = si[j].self_contained ? &si[j].mrt_index : NULL;
+            side->frames = si[j].is_framed ? &si[j].frames : NULL;
+            if (diff_locate(&si[j], part->has_from ? &part->from : NULL,
+                            side) != 0)
+                errfail("error: couldn't find checkpoint\n");
+        }
+        if (part_count > 0) {
+            parts[part_count - 1].has_to = 1;
+            parts[part_count - 1].to = part->from;
+        }
+        part_count++;
+    }
+
+    for (; started < part_count; started++)
+        if (pthread_create(&workers[started], NULL, diff_part_procedure,
+                           &parts[started]) != 0)
+            errfail("error: couldn't start thread\n");
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    started = 0;
+    for (int i = 0; i < part_count; i++)
+        if (parts[i].ret != 0) goto fail;
+
+    for (int i = 0; i < part_count; i++) {
+        if (fwrite(parts[i].output, 1, parts[i].output_len, stdout) !=
+            parts[i].output_len)
+            errfail("error: couldn't write differences\n");
+        stats.added += parts[i].stats.added;
+        stats.removed += parts[i].stats.removed;
+        stats.changed += parts[i].stats.changed;
+        stats.unchanged += parts[i].stats.unchanged;
+    }
+    if (fflush(stdout) != 0) errfail("error: couldn't write differences\n");
+    fprintf(stderr, "%llu added, %llu removed, %llu changed, %llu unchanged\n",
+            (unsigned long long)stats.added,
+            (unsigned long long)stats.removed,
+            (unsigned long long)stats.changed,
+            (unsigned long long)stats.unchanged);
+    ret = 0;
+
+fail:
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    for (int i = 0; i < part_count; i++) free(parts[i].output);
+    free(parts);
+    free(workers);
+    for (int i = 0; i < opened; i++) span_index_destroy(&si[i]);
+    for (int i = 0; i < 2; i++)
+        if (streams[i]) close_input_stream(streams[i], kinds[i]);
+    return ret;
+}
 
+static int read_exactly(const struct input_t *input, void *buffer, size_t len) {
+    for (size_t done = 0; done < len;) {
+        int read = input_read(input, (uint8_t *)buffer + done, len - done);
+        if (read <= 0) return -1;
+        done += read;
+    }
     return 0;
+}
+
+/* Dumps the RIB records carrying `asn` in `scope`, see mrt_as_index.h.
+ * Offsets come from the AS index next to the index, so only those records
+ * are inflated: each is sought to like a lookup would, unless it lies past
+ * the last one within the same checkpoint span, in which case reading on is
+ * cheaper. Records listed by an index of paths are checked for their origin
+ * when origins are asked for. Records of a span are read into the decoder's
+ * arena, which is reset on every seek. */
+static int dump_as_records(const char *path, const char *zidx_path,
+                           uint32_t asn, enum mrt_as_scope_t scope) {
+    enum input_stream_t kind;
+    streamlike_t *stream = open_scattered_input_stream(path, &kind);
+    if (stream == NULL)
+        errexit("error: couldn't open gzip stream '%s'\n", path);
+
+    int ret = 1;
+    struct span_index_t si;
+    struct mrt_as_index_t as_index;
+    _Bool has_as_index = 0;
+    char *as_index_file = mrt_as_index_path(zidx_path);
+    streamlike_t *as_index_stream = NULL;
+    struct mrt_reader_t mrt_reader;
+    struct input_t input = {NULL, NULL, NULL};
+    off_t *offsets = NULL;
+    struct mrt_decoder_t decoder = {{0}, NULL, NULL};
+    uint8_t *skipped = malloc(1 << 16);
+    uint64_t matches = 0;
+    uint64_t malformed = 0;
+
+    if (span_index_open(&si, stream, zidx_path, 0) != 0) goto fail;
+    if (as_index_file == NULL || skipped == NULL ||
+        mrt_decoder_init(&decoder) != 0)
+        errfail("error: out of memory\n");
+    if (si.is_framed)
+        errfail("error: AS indexes are built by zidx for gzip files only\n");
+    if (!si.has_mrt_index)
+        errfail("error: index has no record offsets, see zidx -a\n");
+    as_index_stream = sl_fopen(as_index_file, "rb");
+    if (as_index_stream == NULL)
+        errfail("error: couldn't open AS index '%s', see zidx -a\n",
+                as_index_file);
+    if (mrt_as_index_import(&as_index, as_index_stream) != 0)
+        errfail("error: couldn't import AS index '%s'\n", as_index_file);
+    has_as_index = 1;
+    if (si.mrt_index.uncomp_size >= 0 &&
+        as_index.uncomp_size != si.mrt_index.uncomp_size)
+        errfail("error: AS index '%s' is stale\n", as_index_file);
+    if (scope == MRT_AS_INDEX_PATH && as_index.scope != MRT_AS_INDEX_PATH)
+        errfail("error: AS index '%s' only has origins, see zidx -A\n",
+                as_index_file);
+
+    input.index = si.index;
+    if (si.self_contained) {
+        if (mrt_reader_init(&mrt_reader, stream, &si.mrt_index) != 0)
+            errfail("error: couldn't initialize mrt reader\n");
+        input.reader = &mrt_reader;
+    }
+
+    long count = mrt_as_index_lookup(&as_index, asn, &offsets);
+    if (count < 0) errfail("error: couldn't read AS index\n");
+    off_t position = -1;
+    for (long i = 0; i < count; i++) {
+        off_t offset = offsets[i];
+        if (position < 0 || offset < position ||
+            mrt_index_find_checkpoint(&si.mrt_index, offset) >
+                mrt_index_find_checkpoint(&si.mrt_index, position)) {
+            if (input_seek(&input, offset) != 0)
+                errfail("error: couldn't seek to mrt record\n");
+            position = offset;
+            mrt_decoder_reset(&decoder);
+        }
+        while (position < offset) {
+            size_t len = offset - position < (1 << 16) ? offset - position
+                                                        : (1 << 16);
+            if (read_exactly(&input, skipped, len) != 0)
+                errfail("error: while reading '%s'\n", path);
+            position += len;
+        }
+
+        uint8_t header_buf[12];
+        if (read_exactly(&input, header_buf, sizeof(header_buf)) != 0)
+            errfail("error: while reading '%s'\n", path);
+        struct mrt_header_t header = get_header(header_buf);
+        size_t len = sizeof(header_buf) + (size_t)header.length;
+        if (!is_tdv2_rib_header(&header) || header.length > (1 << 28))
+            errfail("error: no RIB record at %lld, AS index is stale\n",
+                    (long long)offset);
+        uint8_t *record = mrt_decoder_alloc(&decoder, len);
+        if (record == NULL) errfail("error: out of memory\n");
+        memcpy(record, header_buf, sizeof(header_buf));
+        if (read_exactly(&input, record + sizeof(header_buf),
+                         header.length) != 0)
+            errfail("error: while reading '%s'\n", path);
+        position = offset + len;
+
+        if (as_index.scope != scope) {
+            int match = mrt_rib_has_as(record, len, asn, scope);
+            if (match < 0) malformed++;
+            if (match <= 0) continue;
+        }
+        if (dump_record(&decoder, record, len) != 0) malformed++;
+        matches++;
+    }
+
+    if (malformed > 0)
+        fprintf(stderr, "warning: %llu malformed records\n",
+                (unsigned long long)malformed);
+    fprintf(stderr, "%llu matching records\n", (unsigned long long)matches);
+    ret = 0;
 
 fail:
-    if (is_url)
-        sl_http_destroy(gzip_stream);
-    else
-        sl_fclose(gzip_stream);
+    free(offsets);
+    mrt_decoder_destroy(&decoder);
+    free(skipped);
+    if (input.reader) mrt_reader_destroy(input.reader);
+    if (has_as_index) mrt_as_index_destroy(&as_index);
+    if (as_index_stream) sl_fclose(as_index_stream);
+    free(as_index_file);
+    span_index_destroy(&si);
+    close_input_stream(stream, kind);
+    return ret;
+}
 
-    if (index_stream) sl_fclose(index_stream);
-    if (index) zidx_index_destroy(index);
-    free(index);
-    return 1;
+int main(int argc, char **argv) {
+    const char *program = argv[0];
+    if (argc == 4 && !strcmp(argv[2], "--export-columns"))
+        return export_columns(argv[1], argv[3]);
+    if (argc == 4 && !strcmp(argv[2], "--build-image"))
+        return build_image(argv[1], argv[3]);
+    if (argc >= 4 && !strcmp(argv[1], "--image"))
+        return lookup_image(argv[2], argc - 3, argv + 3);
+    if (argc >= 4 && !strcmp(argv[3], "--list-prefixes")) {
+        _Bool ignore_zidx = 0;
+        _Bool binary = 0;
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned long long sample = 0;
+        uint64_t seed = time(NULL);
+        for (int i = 4; i < argc; i++) {
+            char *end = NULL;
+            if (!strcmp(argv[i], "-i"))
+                ignore_zidx = 1;
+            else if (!strcmp(argv[i], "-b"))
+                binary = 1;
+            else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+                threads = strtol(argv[++i], &end, 10);
+            else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+                sample = strtoull(argv[++i], &end, 10);
+            else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+                seed = strtoull(argv[++i], &end, 10);
+            else
+                usageexit(program);
+            if (end && (*end || end == argv[i]))
+                errexit("error: couldn't parse number '%s'\n", argv[i]);
+        }
+        if (threads < 1 || threads > 1024)
+            errexit("error: thread count should be in [1, 1024]\n");
+        return list_prefixes(argv[1], argv[2], ignore_zidx, threads, sample,
+                             seed, binary);
+    }
+    if (argc >= 6 && !strcmp(argv[3], "--diff")) {
+        const char *paths[2] = {argv[1], argv[4]};
+        const char *zidx_paths[2] = {argv[2], argv[5]};
+        _Bool ignore_zidx = 0;
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 6; i < argc; i++) {
+            char *end = NULL;
+            if (!strcmp(argv[i], "-i"))
+                ignore_zidx = 1;
+            else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+                threads = strtol(argv[++i], &end, 10);
+            else
+                usageexit(program);
+            if (end && (*end || end == argv[i]))
+                errexit("error: couldn't parse number '%s'\n", argv[i]);
+        }
+        if (threads < 1 || threads > 1024)
+            errexit("error: thread count should be in [1, 1024]\n");
+        return diff_files(paths, zidx_paths, ignore_zidx, threads);
+    }
+    if (argc == 5 && (!strcmp(argv[3], "--origin-as") ||
+                      !strcmp(argv[3], "--path-as"))) {
+        char *end;
+        const char *asn = argv[4];
+        unsigned long long v = strtoull(asn, &end, 10);
+        if (*asn < '0' || *asn > '9' || *end || v > UINT32_MAX)
+            errexit("error: couldn't parse AS number '%s'\n", asn);
+        return dump_as_records(argv[1], argv[2], v,
+                               !strcmp(argv[3], "--path-as")
+                                   ? MRT_AS_INDEX_PATH
+                                   : MRT_AS_INDEX_ORIGIN);
+    }
+    if (argc >= 6 && !strcmp(argv[3], "--updates")) {
+        struct mrt_update_filter_t filter = {0};
+        _Bool ignore_zidx = 0;
+        for (int i = 6; i < argc; i++) {
+            if (!strcmp(argv[i], "-i")) {
+                ignore_zidx = 1;
+            } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+                struct afi_prefix_t pfx = parse_prefix(argv[++i]);
+                filter.has_prefix = 1;
+                filter.prefix = prefix_key_make(&pfx);
+            } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+                char *end;
+                const char *asn = argv[++i];
+                unsigned long long v = strtoull(asn, &end, 10);
+                if (*asn < '0' || *asn > '9' || *end || v > UINT32_MAX)
+                    errexit("error: couldn't parse AS number '%s'\n", asn);
+                filter.has_asn = 1;
+                filter.asn = v;
+            } else {
+                usageexit(program);
+            }
+        }
+        uint32_t from = parse_time(argv[4]);
+        uint32_t until = parse_time(argv[5]);
+        return dump_updates(argv[1], argv[2], ignore_zidx, from, until,
+                            &filter);
+    }
+    if (argc < 4) usageexit(program);
+
+    const char *gzipped_mrt_path = argv[1];
+    const char *zidx_path = argv[2];
+    const char *prefix = argv[3];
+    parse_prefix(prefix);
+
+    _Bool debug = 0;
+    _Bool ignore_zidx = 0;
+    const char *cache_path = NULL;
+    long ways = 2;
+
+    for (int i = 4; i < argc; i++) {
+        char *end = NULL;
+        if (!strcmp(argv[i], "-d"))
+            debug = 1;
+        else if (!strcmp(argv[i], "-i"))
+            ignore_zidx = 1;
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            cache_path = argv[++i];
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+            ways = strtol(argv[++i], &end, 10);
+        else
+            usageexit(program);
+        if (end && (*end || end == argv[i]))
+            errexit("error: couldn't parse number '%s'\n", argv[i]);
+    }
+    if (ways < 2 || ways > FIND_PREFIX_MAX_WAYS)
+        errexit("error: ways should be in [2, %d]\n", FIND_PREFIX_MAX_WAYS);
+
+    const char *error;
+    struct pfxdump_t *handle = pfxdump_open(
+        gzipped_mrt_path, ignore_zidx ? NULL : zidx_path, &error);
+    if (handle == NULL) errexit("error: %s\n", error);
+    pfxdump_set_debug(handle, debug);
+    pfxdump_set_probe_ways(handle, ways);
+    // lookups still work without the cache, only slower
+    if (cache_path && pfxdump_set_span_cache(handle, cache_path) != 0)
+        fprintf(stderr, "warning: not caching spans: %s\n",
+                pfxdump_error(handle));
+
+    struct mrt_decoder_t decoder;
+    if (mrt_decoder_init(&decoder) != 0) errexit("error: out of memory\n");
+    struct lookup_result_t result = {&decoder, NULL, 0};
+    int found = pfxdump_lookup(handle, prefix, lookup_record, &result);
+    if (found < 0)
+        fprintf(stderr, "error: %s\n", pfxdump_error(handle));
+    else if (!found)
+        fprintf(stderr, "Prefix not found");
+
+    // the record is checked against peers read on the way to it
+    size_t table_len;
+    const uint8_t *table = pfxdump_peer_index_table(handle, &table_len);
+    struct mrt_peer_table_t peers = {{0}, 0, NULL};
+    if (found > 0 && table != NULL &&
+        mrt_peer_table_parse(&peers, table, table_len) == 0)
+        mrt_peer_table_print_rib(&peers, result.record, result.len);
+
+    mrt_peer_table_destroy(&peers);
+    mrt_decoder_destroy(&decoder);
+    pfxdump_close(handle);
+    return found > 0 ? 0 : 1;
 }
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapped_input.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mapped_input_t {
+    uint8_t *data;
+    size_t len;
+    size_t position;
+    enum mapped_input_advice_t advice;
+    int eof;
+};
+
+static size_t mapped_read(void *context, void *buffer, size_t size) {
+    struct mapped_input_t *input = context;
+    size_t left = input->len - input->position;
+    if (size > left) {
+        size = left;
+        input->eof = 1;
+    }
+    memcpy(buffer, input->data + input->position, size);
+    input->position += size;
+    return size;
+}
+
+static void will_need(struct mapped_input_t *input, off_t offset, size_t len) {
+    if (offset < 0 || (size_t)offset >= input->len) return;
+    if (len > input->len - offset) len = input->len - offset;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    posix_madvise(input->data + start, offset - start + len,
+                  POSIX_MADV_WILLNEED);
+}
+
+static int mapped_seek(void *context, off_t offset, sl_seek_whence_t whence) {
+    struct mapped_input_t *input = context;
+    if (whence == SL_SEEK_CUR)
+        offset += input->position;
+    else if (whence == SL_SEEK_END)
+        offset += input->len;
+    if (offset < 0 || (size_t)offset > input->len) return -1;
+    input->position = offset;
+    input->eof = 0;
+    if (input->advice == MAPPED_INPUT_RANDOM)
+        will_need(input, offset, MAPPED_INPUT_WILLNEED_SIZE);
+    return 0;
+}
+
+static off_t mapped_tell(void *context) {
+    return ((struct mapped_input_t *)context)->position;
+}
+
+static int mapped_eof(void *context) {
+    return ((struct mapped_input_t *)context)->eof;
+}
+
+static int mapped_error(void *context) {
+    (void)context;
+    return 0;
+}
+
+static off_t mapped_length(void *context) {
+    return ((struct mapped_input_t *)context)->len;
+}
+
+static sl_seekable_t mapped_seekable(void *context) {
+    (void)context;
+    return SL_SEEKING_EXACT;
+}
+
+streamlike_t *mapped_input_open(const char *path,
+                                enum mapped_input_advice_t advice) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    struct mapped_input_t *input = calloc(1, sizeof(*input));
+    streamlike_t *stream = calloc(1, sizeof(*stream));
+    if (input == NULL || stream == NULL) {
+        munmap(data, st.st_size);
+        free(input);
+        free(stream);
+        return NULL;
+    }
+    input->data = data;
+    input->len = st.st_size;
+    input->advice = advice;
+    posix_madvise(data, input->len, advice == MAPPED_INPUT_RANDOM
+                                        ? POSIX_MADV_RANDOM
+                                        : POSIX_MADV_SEQUENTIAL);
+
+    stream->context = input;
+    stream->read = mapped_read;
+    stream->seek = mapped_seek;
+    stream->tell = mapped_tell;
+    stream->eof = mapped_eof;
+    stream->error = mapped_error;
+    stream->length = mapped_length;
+    stream->seekable = mapped_seekable;
+    return stream;
+}
+
+int mapped_input_close(streamlike_t *stream) {
+    struct mapped_input_t *input = stream->context;
+    int ret = munmap(input->data, input->len);
+    free(input);
+    free(stream);
+    return ret;
+}
+
+const uint8_t *mapped_input_data(const streamlike_t *stream, size_t *len) {
+    if (stream->read != mapped_read) return NULL;
+    const struct mapped_input_t *input = stream->context;
+    *len = input->len;
+    return input->data;
+}
+
+void mapped_input_will_need(const streamlike_t *stream, off_t offset,
+                            size_t len) {
+    if (stream->read == mapped_read) will_need(stream->context, offset, len);
+}
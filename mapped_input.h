@@ -0,0 +1,32 @@
+#ifndef MAPPED_INPUT_H
+#define MAPPED_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <streamlike.h>
+
+/* Local compressed files mapped into memory, as a streamlike stream. Reads
+ * through the stream are copies out of the mapping without any syscall, and
+ * readers that look for the mapping with mapped_input_data, like mrt_reader
+ * and the frame reader, hand zlib and zstd pointers into it instead.
+ *
+ * Full scans map with MAPPED_INPUT_SEQUENTIAL. Lookups map with
+ * MAPPED_INPUT_RANDOM, where every seek also asks the kernel to read in the
+ * extent after the target, so the next inflate doesn't fault page by page. */
+
+enum mapped_input_advice_t { MAPPED_INPUT_SEQUENTIAL, MAPPED_INPUT_RANDOM };
+
+#define MAPPED_INPUT_WILLNEED_SIZE (256 * 1024)
+
+/* Returns NULL if the file can't be mapped, e.g. if it is empty or a pipe. */
+streamlike_t *mapped_input_open(const char *path,
+                                enum mapped_input_advice_t advice);
+int mapped_input_close(streamlike_t *stream);
+/* The whole mapping if `stream` was opened by mapped_input_open, else NULL. */
+const uint8_t *mapped_input_data(const streamlike_t *stream, size_t *len);
+void mapped_input_will_need(const streamlike_t *stream, off_t offset,
+                            size_t len);
+
+#endif
@@ -0,0 +1,338 @@
+#include "mrt_as_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include "mrt_attributes.h"
+
+enum {
+    MRT_AS_INDEX_VERSION = 1,
+    MRT_AS_INDEX_HEADER_SIZE = 32,
+    MRT_AS_INDEX_ENTRY_SIZE = 16,
+    MRT_AS_INDEX_INITIAL_TABLE_SIZE = 1 << 12
+};
+
+#define MRT_AS_INDEX_MAGIC "ASIX"
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+typedef int (*as_callback)(void *context, uint32_t asn);
+
+/* Calls `callback` with every AS of the AS_PATH and AS4_PATH of an entry. A
+ * non-zero return value stops the walk and is passed back. */
+static int walk_paths(const uint8_t *p, size_t len, as_callback callback,
+                      void *context) {
+    struct mrt_attribute_iter_t attrs;
+    struct mrt_attribute_t attr;
+    int ret;
+    mrt_attribute_iter_init(&attrs, p, len);
+    while ((ret = mrt_attribute_next(&attrs, &attr)) == 1) {
+        if (attr.type != ATTR_AS_PATH && attr.type != ATTR_AS4_PATH) continue;
+        struct mrt_as_path_iter_t path;
+        struct mrt_as_segment_t segment;
+        mrt_as_path_iter_init(&path, attr.value, attr.len, 4);
+        while ((ret = mrt_as_path_next(&path, &segment)) == 1) {
+            for (size_t i = 0; i < segment.count; i++) {
+                ret = callback(context, mrt_as_segment_asn(&segment, i));
+                if (ret != 0) return ret;
+            }
+        }
+        if (ret != 0) return ret;
+    }
+    return ret;
+}
+
+/* Calls `callback` with the ASes in `scope` of every entry of a RIB record,
+ * as often as they appear. */
+static int walk_rib(const uint8_t *record, size_t len,
+                    enum mrt_as_scope_t scope, as_callback callback,
+                    void *context) {
+    const uint8_t *end = record + len;
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    if (len < MRT_HEADER_SIZE + 5) return -1;
+    size_t prefix_bytes = (p[4] + 7) / 8;
+    if ((size_t)(end - p) < 5 + prefix_bytes + 2) return -1;
+    p += 5 + prefix_bytes;
+    int entry_count = get_be16(p);
+    p += 2;
+
+    for (int i = 0; i < entry_count; i++) {
+        if (end - p < 8) return -1;
+        size_t attr_len = get_be16(p + 6);
+        p += 8;
+        if ((size_t)(end - p) < attr_len) return -1;
+        int ret;
+        if (scope == MRT_AS_INDEX_PATH) {
+            ret = walk_paths(p, attr_len, callback, context);
+        } else {
+            uint32_t origin;
+            ret = mrt_attributes_origin(p, attr_len, &origin);
+            if (ret == 0 && origin != 0) ret = callback(context, origin);
+        }
+        if (ret != 0) return ret;
+        p += attr_len;
+    }
+    return 0;
+}
+
+static int matches_as(void *context, uint32_t asn) {
+    return asn == *(const uint32_t *)context;
+}
+
+int mrt_rib_has_as(const uint8_t *record, size_t len, uint32_t asn,
+                   enum mrt_as_scope_t scope) {
+    return walk_rib(record, len, scope, matches_as, &asn);
+}
+
+int mrt_as_index_builder_init(struct mrt_as_index_builder_t *builder,
+                              enum mrt_as_scope_t scope) {
+    builder->scope = scope;
+    builder->table_size = MRT_AS_INDEX_INITIAL_TABLE_SIZE;
+    builder->as_count = 0;
+    builder->table = calloc(builder->table_size, sizeof(*builder->table));
+    builder->offset = 0;
+    return builder->table == NULL ? -1 : 0;
+}
+
+static struct mrt_as_postings_t *find_slot(struct mrt_as_postings_t *table,
+                                           size_t size, uint32_t asn) {
+    // Fibonacci hashing, ASes are dense in places
+    size_t i = (uint32_t)(asn * 2654435769U) & (size - 1);
+    while (table[i].count > 0 && table[i].asn != asn) i = (i + 1) & (size - 1);
+    return &table[i];
+}
+
+static int grow_table(struct mrt_as_index_builder_t *builder) {
+    size_t size = builder->table_size * 2;
+    struct mrt_as_postings_t *table = calloc(size, sizeof(*table));
+    if (table == NULL) return -1;
+    for (size_t i = 0; i < builder->table_size; i++) {
+        struct mrt_as_postings_t *postings = &builder->table[i];
+        if (postings->count > 0)
+            *find_slot(table, size, postings->asn) = *postings;
+    }
+    free(builder->table);
+    builder->table = table;
+    builder->table_size = size;
+    return 0;
+}
+
+static int add_posting(void *context, uint32_t asn) {
+    struct mrt_as_index_builder_t *builder = context;
+    struct mrt_as_postings_t *postings =
+        find_slot(builder->table, builder->table_size, asn);
+    if (postings->count > 0 && postings->last == builder->offset) return 0;
+    if (postings->count == 0) {
+        if (2 * (builder->as_count + 1) > builder->table_size) {
+            if (grow_table(builder) != 0) return -1;
+            postings = find_slot(builder->table, builder->table_size, asn);
+        }
+        postings->asn = asn;
+        postings->last = 0;
+        builder->as_count++;
+    }
+
+    if (postings->len + 10 > postings->capacity) {
+        size_t capacity = postings->capacity ? postings->capacity * 2 : 16;
+        uint8_t *data = realloc(postings->data, capacity);
+        if (data == NULL) return -1;
+        postings->data = data;
+        postings->capacity = capacity;
+    }
+    uint64_t delta = builder->offset - postings->last;
+    do {
+        uint8_t byte = delta & 0x7F;
+        delta >>= 7;
+        postings->data[postings->len++] = byte | (delta ? 0x80 : 0);
+    } while (delta);
+    postings->last = builder->offset;
+    postings->count++;
+    return 0;
+}
+
+int mrt_as_index_builder_record(struct mrt_as_index_builder_t *builder,
+                                off_t offset,
+                                const struct mrt_header_t *header,
+                                const uint8_t *record) {
+    if (!is_tdv2_rib_header(header)) return 0;
+    builder->offset = offset;
+    return walk_rib(record, MRT_HEADER_SIZE + (size_t)header->length,
+                    builder->scope, add_posting, builder) != 0
+               ? -1
+               : 0;
+}
+
+static int postings_cmp(const void *lhs, const void *rhs) {
+    uint32_t l = ((const struct mrt_as_postings_t *)lhs)->asn;
+    uint32_t r = ((const struct mrt_as_postings_t *)rhs)->asn;
+    return (l > r) - (l < r);
+}
+
+static int write_all(streamlike_t *stream, const void *data, size_t len) {
+    return sl_write(stream, data, len) == len ? 0 : -1;
+}
+
+int mrt_as_index_builder_export(struct mrt_as_index_builder_t *builder,
+                                off_t uncomp_size, streamlike_t *stream) {
+    // the table isn't needed any more, so it is sorted in place
+    struct mrt_as_postings_t *table = builder->table;
+    size_t count = 0;
+    uint64_t postings_len = 0;
+    for (size_t i = 0; i < builder->table_size; i++) {
+        if (table[i].count == 0) continue;
+        postings_len += table[i].len;
+        table[count++] = table[i];
+    }
+    for (size_t i = count; i < builder->table_size; i++)
+        memset(&table[i], 0, sizeof(table[i]));
+    qsort(table, count, sizeof(*table), postings_cmp);
+
+    uint8_t header[MRT_AS_INDEX_HEADER_SIZE];
+    memcpy(header, MRT_AS_INDEX_MAGIC, 4);
+    put_le32(header + 4, MRT_AS_INDEX_VERSION);
+    put_le32(header + 8, builder->scope);
+    put_le32(header + 12, count);
+    put_le64(header + 16, uncomp_size);
+    put_le64(header + 24, postings_len);
+    if (write_all(stream, header, sizeof(header)) != 0) return -1;
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t entry[MRT_AS_INDEX_ENTRY_SIZE];
+        put_le32(entry, table[i].asn);
+        put_le32(entry + 4, table[i].count);
+        put_le64(entry + 8, offset);
+        if (write_all(stream, entry, sizeof(entry)) != 0) return -1;
+        offset += table[i].len;
+    }
+    for (size_t i = 0; i < count; i++)
+        if (write_all(stream, table[i].data, table[i].len) != 0) return -1;
+    return 0;
+}
+
+void mrt_as_index_builder_destroy(struct mrt_as_index_builder_t *builder) {
+    for (size_t i = 0; i < builder->table_size; i++)
+        free(builder->table[i].data);
+    free(builder->table);
+    builder->table = NULL;
+    builder->table_size = 0;
+    builder->as_count = 0;
+}
+
+static int read_all(streamlike_t *stream, void *data, size_t len) {
+    return sl_read(stream, data, len) == len ? 0 : -1;
+}
+
+int mrt_as_index_import(struct mrt_as_index_t *index, streamlike_t *stream) {
+    memset(index, 0, sizeof(*index));
+    uint8_t header[MRT_AS_INDEX_HEADER_SIZE];
+    if (read_all(stream, header, sizeof(header)) != 0 ||
+        memcmp(header, MRT_AS_INDEX_MAGIC, 4) != 0 ||
+        get_le32(header + 4) != MRT_AS_INDEX_VERSION)
+        return -1;
+    uint32_t scope = get_le32(header + 8);
+    if (scope != MRT_AS_INDEX_ORIGIN && scope != MRT_AS_INDEX_PATH) return -1;
+    index->scope = scope;
+    index->as_count = get_le32(header + 12);
+    index->uncomp_size = get_le64(header + 16);
+    index->postings_len = get_le64(header + 24);
+    if (index->postings_len > SIZE_MAX / 2) return -1;
+
+    size_t directory_len = (size_t)index->as_count * MRT_AS_INDEX_ENTRY_SIZE;
+    index->directory = malloc(directory_len ? directory_len : 1);
+    index->postings = malloc(index->postings_len ? index->postings_len : 1);
+    if (index->directory == NULL || index->postings == NULL ||
+        read_all(stream, index->directory, directory_len) != 0 ||
+        read_all(stream, index->postings, index->postings_len) != 0) {
+        mrt_as_index_destroy(index);
+        return -1;
+    }
+    return 0;
+}
+
+void mrt_as_index_destroy(struct mrt_as_index_t *index) {
+    free(index->directory);
+    free(index->postings);
+    index->directory = NULL;
+    index->postings = NULL;
+    index->as_count = 0;
+    index->postings_len = 0;
+}
+
+long mrt_as_index_lookup(const struct mrt_as_index_t *index, uint32_t asn,
+                         off_t **offsets) {
+    *offsets = NULL;
+    uint32_t i = 0;
+    uint32_t j = index->as_count;
+    while (i < j) {
+        uint32_t k = i + (j - i) / 2;
+        if (get_le32(index->directory + (size_t)k * MRT_AS_INDEX_ENTRY_SIZE) <
+            asn)
+            i = k + 1;
+        else
+            j = k;
+    }
+    const uint8_t *entry =
+        index->directory + (size_t)i * MRT_AS_INDEX_ENTRY_SIZE;
+    if (i == index->as_count || get_le32(entry) != asn) return 0;
+
+    uint32_t count = get_le32(entry + 4);
+    uint64_t start = get_le64(entry + 8);
+    uint64_t end = i + 1 < index->as_count
+                       ? get_le64(entry + MRT_AS_INDEX_ENTRY_SIZE + 8)
+                       : index->postings_len;
+    // every posting takes a byte at least, so a corrupt count is caught
+    // before it is allocated for
+    if (start > end || end > index->postings_len || count > end - start)
+        return -1;
+    *offsets = malloc((count ? count : 1) * sizeof(**offsets));
+    if (*offsets == NULL) return -1;
+
+    const uint8_t *p = index->postings + start;
+    const uint8_t *p_end = index->postings + end;
+    uint64_t offset = 0;
+    for (uint32_t n = 0; n < count; n++) {
+        uint64_t delta = 0;
+        int shift = 0;
+        do {
+            if (p == p_end || shift > 56) {
+                free(*offsets);
+                *offsets = NULL;
+                return -1;
+            }
+            delta |= (uint64_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        offset += delta;
+        (*offsets)[n] = offset;
+    }
+    return count;
+}
+
+char *mrt_as_index_path(const char *index_path) {
+    size_t len = strlen(index_path);
+    char *path = malloc(len + sizeof(MRT_AS_INDEX_SUFFIX));
+    if (path == NULL) return NULL;
+    memcpy(path, index_path, len);
+    memcpy(path + len, MRT_AS_INDEX_SUFFIX, sizeof(MRT_AS_INDEX_SUFFIX));
+    return path;
+}
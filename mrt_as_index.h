@@ -0,0 +1,87 @@
+#ifndef MRT_AS_INDEX_H
+#define MRT_AS_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <streamlike.h>
+
+#include "find_prefix.h"
+
+/* Inverted index from AS numbers to the RIB records that carry them, stored
+ * next to an index as "<index-file>.asx" by zidx -a or -A. Records are
+ * listed by the uncompressed offset of their header, so they are read with
+ * a seek each instead of scanning the file.
+ *
+ * MRT_AS_INDEX_ORIGIN lists a record under the origin AS of every entry, as
+ * found by mrt_attributes_origin; MRT_AS_INDEX_PATH under every AS of every
+ * AS_PATH and AS4_PATH.
+ *
+ * The file is a header, a directory of (AS, record count, postings offset)
+ * sorted by AS and the postings: per AS, the offsets in ascending order as
+ * LEB128 varints of their differences, the first one from 0. */
+
+#define MRT_AS_INDEX_SUFFIX ".asx"
+
+enum mrt_as_scope_t { MRT_AS_INDEX_ORIGIN, MRT_AS_INDEX_PATH };
+
+struct mrt_as_postings_t {
+    uint32_t asn;
+    uint32_t count;
+    off_t last;
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+};
+
+/* Records are added in file order, so an AS carried by several entries of a
+ * record only gets one posting and differences are never negative. */
+struct mrt_as_index_builder_t {
+    enum mrt_as_scope_t scope;
+    /* Open addressing by AS, empty slots have no postings. */
+    struct mrt_as_postings_t *table;
+    size_t table_size;
+    size_t as_count;
+    /* Offset of the record being added. */
+    off_t offset;
+};
+
+int mrt_as_index_builder_init(struct mrt_as_index_builder_t *builder,
+                              enum mrt_as_scope_t scope);
+/* Adds a record starting at `offset`, only RIB records are indexed. Returns
+ * 0, or -1 if the record is malformed or memory runs out. */
+int mrt_as_index_builder_record(struct mrt_as_index_builder_t *builder,
+                                off_t offset,
+                                const struct mrt_header_t *header,
+                                const uint8_t *record);
+/* `uncomp_size` is the size of the whole uncompressed file, which the index
+ * is checked against when it is used. */
+int mrt_as_index_builder_export(struct mrt_as_index_builder_t *builder,
+                                off_t uncomp_size, streamlike_t *stream);
+void mrt_as_index_builder_destroy(struct mrt_as_index_builder_t *builder);
+
+struct mrt_as_index_t {
+    enum mrt_as_scope_t scope;
+    uint32_t as_count;
+    off_t uncomp_size;
+    uint8_t *directory;
+    uint8_t *postings;
+    uint64_t postings_len;
+};
+
+int mrt_as_index_import(struct mrt_as_index_t *index, streamlike_t *stream);
+void mrt_as_index_destroy(struct mrt_as_index_t *index);
+/* Points `offsets` at a malloc'ed array of the offsets of the records listed
+ * under `asn`, in file order. Returns their number, or -1 on error. */
+long mrt_as_index_lookup(const struct mrt_as_index_t *index, uint32_t asn,
+                         off_t **offsets);
+/* Returns a malloc'ed "<index_path>.asx". */
+char *mrt_as_index_path(const char *index_path);
+
+/* Whether a RIB record carries `asn` within `scope`: 1 if it does, 0 if it
+ * doesn't and -1 if it is malformed. `record` is the whole MRT record. */
+int mrt_rib_has_as(const uint8_t *record, size_t len, uint32_t asn,
+                   enum mrt_as_scope_t scope);
+
+#endif
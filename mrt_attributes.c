@@ -0,0 +1,79 @@
+#include "mrt_attributes.h"
+
+void mrt_attribute_iter_init(struct mrt_attribute_iter_t *iter,
+                             const uint8_t *p, size_t len) {
+    iter->p = p;
+    iter->len = len;
+}
+
+int mrt_attribute_next(struct mrt_attribute_iter_t *iter,
+                       struct mrt_attribute_t *attr) {
+    if (iter->len == 0) return 0;
+    const uint8_t *p = iter->p;
+    if (iter->len < 3) return -1;
+    size_t header_len = p[0] & ATTR_FLAG_EXTENDED ? 4 : 3;
+    if (iter->len < header_len) return -1;
+    size_t len = header_len == 4 ? get_be16(p + 2) : p[2];
+    if (iter->len - header_len < len) return -1;
+    attr->type = p[1];
+    attr->value = p + header_len;
+    attr->len = len;
+    iter->p += header_len + len;
+    iter->len -= header_len + len;
+    return 1;
+}
+
+void mrt_as_path_iter_init(struct mrt_as_path_iter_t *iter, const uint8_t *p,
+                           size_t len, size_t as_len) {
+    iter->p = p;
+    iter->len = len;
+    iter->as_len = as_len;
+}
+
+int mrt_as_path_next(struct mrt_as_path_iter_t *iter,
+                     struct mrt_as_segment_t *segment) {
+    if (iter->len == 0) return 0;
+    if (iter->len < 2) return -1;
+    size_t count = iter->p[1];
+    if (iter->len - 2 < count * iter->as_len) return -1;
+    segment->type = iter->p[0];
+    segment->count = count;
+    segment->asns = iter->p + 2;
+    segment->as_len = iter->as_len;
+    iter->p += 2 + count * iter->as_len;
+    iter->len -= 2 + count * iter->as_len;
+    return 1;
+}
+
+static int path_origin(const uint8_t *p, size_t len, uint32_t *origin) {
+    struct mrt_as_path_iter_t iter;
+    struct mrt_as_segment_t segment;
+    int ret;
+    *origin = 0;
+    mrt_as_path_iter_init(&iter, p, len, 4);
+    while ((ret = mrt_as_path_next(&iter, &segment)) == 1)
+        *origin = segment.type == AS_SEQUENCE && segment.count > 0
+                      ? mrt_as_segment_asn(&segment, segment.count - 1)
+                      : 0;
+    return ret;
+}
+
+int mrt_attributes_origin(const uint8_t *p, size_t len, uint32_t *origin) {
+    struct mrt_attribute_iter_t iter;
+    struct mrt_attribute_t attr;
+    uint32_t as4_origin = 0;
+    int ret;
+    *origin = 0;
+    mrt_attribute_iter_init(&iter, p, len);
+    while ((ret = mrt_attribute_next(&iter, &attr)) == 1) {
+        if (attr.type == ATTR_AS_PATH &&
+            path_origin(attr.value, attr.len, origin) != 0)
+            return -1;
+        if (attr.type == ATTR_AS4_PATH &&
+            path_origin(attr.value, attr.len, &as4_origin) != 0)
+            return -1;
+    }
+    if (ret != 0) return -1;
+    if (*origin == AS_TRANS && as4_origin != 0) *origin = as4_origin;
+    return 0;
+}
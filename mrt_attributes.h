@@ -0,0 +1,83 @@
+#ifndef MRT_ATTRIBUTES_H
+#define MRT_ATTRIBUTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Big-endian fields of MRT records and the BGP path attributes of RIB
+ * entries and BGP4MP updates, walked without copying. Lengths are checked
+ * against the given buffer, a malformed attribute or AS_PATH stops a walk
+ * with -1. */
+
+enum {
+    MRT_HEADER_SIZE = 12,
+
+    ATTR_FLAG_EXTENDED = 0x10,
+    ATTR_AS_PATH = 2,
+    ATTR_AS4_PATH = 17,
+    AS_SET = 1,
+    AS_SEQUENCE = 2,
+    /* Stands in for 4-byte ASes on 2-byte paths, see RFC 6793. */
+    AS_TRANS = 23456
+};
+
+static inline uint16_t get_be16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+struct mrt_attribute_t {
+    int type;
+    const uint8_t *value;
+    size_t len;
+};
+
+struct mrt_attribute_iter_t {
+    const uint8_t *p;
+    size_t len;
+};
+
+void mrt_attribute_iter_init(struct mrt_attribute_iter_t *iter,
+                             const uint8_t *p, size_t len);
+/* Returns 1 with the next attribute in `attr`, 0 at the end of the set and
+ * -1 if it is malformed. */
+int mrt_attribute_next(struct mrt_attribute_iter_t *iter,
+                       struct mrt_attribute_t *attr);
+
+struct mrt_as_segment_t {
+    int type;
+    size_t count;
+    /* `count` ASes of `as_len` bytes, read with mrt_as_segment_asn. */
+    const uint8_t *asns;
+    size_t as_len;
+};
+
+struct mrt_as_path_iter_t {
+    const uint8_t *p;
+    size_t len;
+    size_t as_len;
+};
+
+/* `as_len` is 4 for AS4_PATH and TABLE_DUMP_V2 AS_PATH, 2 for the AS_PATH
+ * of updates between 2-byte speakers. */
+void mrt_as_path_iter_init(struct mrt_as_path_iter_t *iter, const uint8_t *p,
+                           size_t len, size_t as_len);
+/* Returns 1 with the next segment in `segment`, 0 at the end of the path and
+ * -1 if it is malformed. */
+int mrt_as_path_next(struct mrt_as_path_iter_t *iter,
+                     struct mrt_as_segment_t *segment);
+
+static inline uint32_t mrt_as_segment_asn(
+    const struct mrt_as_segment_t *segment, size_t i) {
+    const uint8_t *p = segment->asns + i * segment->as_len;
+    return segment->as_len == 4 ? get_be32(p) : get_be16(p);
+}
+
+/* Origin AS of an attribute set with 4-byte AS_PATH, as in TABLE_DUMP_V2:
+ * the last AS of a trailing AS_SEQUENCE, or 0 if the path ends in an AS_SET
+ * or there is none. An AS_TRANS origin is replaced by that of an AS4_PATH,
+ * which RIBs keep as received. Returns 0, or -1 if the set is malformed. */
+int mrt_attributes_origin(const uint8_t *p, size_t len, uint32_t *origin);
+
+#endif
@@ -0,0 +1,440 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mrt_columns.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#include <zstd.h>
+
+//
+#include "mrt_attributes.h"
+
+enum {
+    TABLE_DUMP_V2 = 13,
+    TABLE_DUMP_V2_PEER_INDEX_TABLE = 1,
+    TABLE_DUMP_V2_RIB_IPV4_UNICAST = 2,
+    TABLE_DUMP_V2_RIB_IPV6_UNICAST = 4,
+    TABLE_DUMP_V2_RIB_IPV6_MULTICAST = 5,
+    COLUMN_VERSION = 1,
+    COLUMN_HEADER_SIZE = 40,
+    COLUMN_BLOCK_SIZE = 16,
+    COLUMN_BLOCK_STORED = 0,
+    COLUMN_BLOCK_ZSTD = 1
+};
+
+#define COLUMN_MAGIC "PFXC"
+#define COLUMN_BYTE_ORDER 0x01020304U
+#define PEER_INDEX_TABLE_NAME "peer_index_table.mrt"
+
+static const char *const column_names[MRT_COLUMN_COUNT] = {
+    "prefix",    "entries",         "peer_index", "originated",
+    "origin_as", "as_path_offsets", "as_path"};
+
+static const size_t column_sizes[MRT_COLUMN_COUNT] = {
+    sizeof(struct prefix_key_t),
+    sizeof(uint64_t),
+    sizeof(uint16_t),
+    sizeof(uint32_t),
+    sizeof(uint32_t),
+    sizeof(uint64_t),
+    sizeof(uint32_t)};
+
+const char *mrt_column_name(enum mrt_column_id_t id) {
+    if (id < 0 || id >= MRT_COLUMN_COUNT) return NULL;
+    return column_names[id];
+}
+
+size_t mrt_column_elem_size(enum mrt_column_id_t id) {
+    if (id < 0 || id >= MRT_COLUMN_COUNT) return 0;
+    return column_sizes[id];
+}
+
+static char *join_path(const char *dir, const char *name, const char *ext) {
+    size_t len = strlen(dir) + strlen(name) + strlen(ext) + 2;
+    char *path = malloc(len);
+    if (path != NULL) snprintf(path, len, "%s/%s%s", dir, name, ext);
+    return path;
+}
+
+char *mrt_column_path(const char *dir, enum mrt_column_id_t id) {
+    const char *name = mrt_column_name(id);
+    return name ? join_path(dir, name, ".col") : NULL;
+}
+
+char *mrt_columns_peer_index_table_path(const char *dir) {
+    return join_path(dir, PEER_INDEX_TABLE_NAME, "");
+}
+
+int mrt_column_writer_open(struct mrt_column_writer_t *writer,
+                           const char *path, size_t elem_size, int level) {
+    uint8_t header[COLUMN_HEADER_SIZE] = {0};
+    memset(writer, 0, sizeof(*writer));
+    writer->elem_size = elem_size;
+    writer->level = level;
+    writer->offset = COLUMN_HEADER_SIZE;
+    writer->cctx = ZSTD_createCCtx();
+    writer->rows = malloc(elem_size * MRT_COLUMN_BLOCK_ROWS);
+    writer->file = fopen(path, "wb");
+    // the header is written once the block table is in place
+    if (writer->cctx == NULL || writer->rows == NULL || writer->file == NULL ||
+        fwrite(header, sizeof(header), 1, writer->file) != 1) {
+        if (writer->file) fclose(writer->file);
+        writer->file = NULL;
+        ZSTD_freeCCtx(writer->cctx);
+        free(writer->rows);
+        return -1;
+    }
+    return 0;
+}
+
+static int flush_block(struct mrt_column_writer_t *writer) {
+    size_t len = writer->block_len * writer->elem_size;
+    if (len == 0) return 0;
+    if (writer->block_count == writer->block_cap) {
+        uint32_t cap = writer->block_cap ? writer->block_cap * 2 : 64;
+        struct mrt_column_block_t *blocks =
+            realloc(writer->blocks, cap * sizeof(*blocks));
+        if (blocks == NULL) return -1;
+        writer->blocks = blocks;
+        writer->block_cap = cap;
+    }
+    size_t bound = ZSTD_compressBound(len);
+    if (bound > writer->comp_cap) {
+        uint8_t *comp = realloc(writer->comp, bound);
+        if (comp == NULL) return -1;
+        writer->comp = comp;
+        writer->comp_cap = bound;
+    }
+
+    struct mrt_column_block_t *block = &writer->blocks[writer->block_count];
+    const uint8_t *out = writer->comp;
+    size_t out_len = ZSTD_compressCCtx(writer->cctx, writer->comp,
+                                       writer->comp_cap, writer->rows, len,
+                                       writer->level);
+    block->flags = COLUMN_BLOCK_ZSTD;
+    if (ZSTD_isError(out_len) || out_len >= len) {
+        // incompressible, keep it readable in place
+        out = writer->rows;
+        out_len = len;
+        block->flags = COLUMN_BLOCK_STORED;
+    }
+    if (fwrite(out, 1, out_len, writer->file) != out_len) return -1;
+    block->offset = writer->offset;
+    block->comp_size = out_len;
+    writer->offset += out_len;
+    writer->block_count++;
+    writer->block_len = 0;
+    return 0;
+}
+
+int mrt_column_writer_append(struct mrt_column_writer_t *writer,
+                             const void *values, size_t count) {
+    const uint8_t *p = values;
+    while (count > 0) {
+        size_t n = MRT_COLUMN_BLOCK_ROWS - writer->block_len;
+        if (n > count) n = count;
+        memcpy(writer->rows + writer->block_len * writer->elem_size, p,
+               n * writer->elem_size);
+        writer->block_len += n;
+        writer->row_count += n;
+        p += n * writer->elem_size;
+        count -= n;
+        if (writer->block_len == MRT_COLUMN_BLOCK_ROWS &&
+            flush_block(writer) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int mrt_column_writer_close(struct mrt_column_writer_t *writer) {
+    if (writer->file == NULL) return -1;
+    int ret = flush_block(writer);
+
+    uint8_t header[COLUMN_HEADER_SIZE];
+    uint32_t u32[5] = {COLUMN_VERSION, COLUMN_BYTE_ORDER, writer->elem_size,
+                       MRT_COLUMN_BLOCK_ROWS, writer->block_count};
+    memcpy(header, COLUMN_MAGIC, 4);
+    memcpy(header + 4, u32, sizeof(u32));
+    memcpy(header + 24, &writer->row_count, 8);
+    memcpy(header + 32, &writer->offset, 8);
+    if (ret == 0 && writer->block_count > 0 &&
+        fwrite(writer->blocks, COLUMN_BLOCK_SIZE, writer->block_count,
+               writer->file) != writer->block_count)
+        ret = -1;
+    if (ret == 0 && (fseek(writer->file, 0, SEEK_SET) != 0 ||
+                     fwrite(header, sizeof(header), 1, writer->file) != 1))
+        ret = -1;
+    if (fclose(writer->file) != 0) ret = -1;
+
+    writer->file = NULL;
+    ZSTD_freeCCtx(writer->cctx);
+    free(writer->rows);
+    free(writer->comp);
+    free(writer->blocks);
+    writer->cctx = NULL;
+    writer->rows = NULL;
+    writer->comp = NULL;
+    writer->blocks = NULL;
+    return ret;
+}
+
+int mrt_columns_writer_open(struct mrt_columns_writer_t *writer,
+                            const char *dir, int level) {
+    memset(writer, 0, sizeof(*writer));
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+    writer->dir = malloc(strlen(dir) + 1);
+    if (writer->dir == NULL) return -1;
+    strcpy(writer->dir, dir);
+
+    for (int i = 0; i < MRT_COLUMN_COUNT; i++) {
+        char *path = mrt_column_path(dir, i);
+        int ret = path ? mrt_column_writer_open(&writer->columns[i], path,
+                                                column_sizes[i], level)
+                       : -1;
+        free(path);
+        if (ret != 0) {
+            while (i-- > 0) mrt_column_writer_close(&writer->columns[i]);
+            free(writer->dir);
+            writer->dir = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int save_peer_index_table(struct mrt_columns_writer_t *writer,
+                                 const uint8_t *record, size_t len) {
+    char *path = mrt_columns_peer_index_table_path(writer->dir);
+    if (path == NULL) return -1;
+    FILE *file = fopen(path, "wb");
+    free(path);
+    if (file == NULL) return -1;
+    int ret = fwrite(record, 1, len, file) == len ? 0 : -1;
+    if (fclose(file) != 0) ret = -1;
+    writer->has_peer_index_table = 1;
+    return ret;
+}
+
+/* Appends the flattened AS_PATH of an entry, 4-byte in TABLE_DUMP_V2. */
+static int split_as_path(struct mrt_columns_writer_t *writer,
+                         const uint8_t *p, size_t len) {
+    struct mrt_as_path_iter_t iter;
+    struct mrt_as_segment_t segment;
+    uint32_t asns[255];
+    int ret;
+    mrt_as_path_iter_init(&iter, p, len, 4);
+    while ((ret = mrt_as_path_next(&iter, &segment)) == 1) {
+        for (size_t i = 0; i < segment.count; i++)
+            asns[i] = mrt_as_segment_asn(&segment, i);
+        if (mrt_column_writer_append(&writer->columns[MRT_COLUMN_AS_PATH],
+                                     asns, segment.count) != 0)
+            return -1;
+        writer->path_len += segment.count;
+    }
+    return ret;
+}
+
+static int split_attributes(struct mrt_columns_writer_t *writer,
+                            const uint8_t *p, size_t len, uint32_t *origin) {
+    struct mrt_attribute_iter_t iter;
+    struct mrt_attribute_t attr;
+    int ret;
+    if (mrt_attributes_origin(p, len, origin) != 0) return -1;
+    mrt_attribute_iter_init(&iter, p, len);
+    while ((ret = mrt_attribute_next(&iter, &attr)) == 1)
+        if (attr.type == ATTR_AS_PATH &&
+            split_as_path(writer, attr.value, attr.len) != 0)
+            return -1;
+    return ret;
+}
+
+static int split_rib(struct mrt_columns_writer_t *writer, int is_ipv6,
+                     const uint8_t *record, size_t len) {
+    struct mrt_column_writer_t *columns = writer->columns;
+    const uint8_t *end = record + len;
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    if (len < MRT_HEADER_SIZE + 5) return -1;
+    size_t prefix_len = p[4];
+    size_t prefix_bytes = (prefix_len + 7) / 8;
+    if (prefix_bytes > 16 || (size_t)(end - p) < 5 + prefix_bytes + 2)
+        return -1;
+
+    struct prefix_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.afi = is_ipv6 ? AFI_TYPE_IPV6 : AFI_TYPE_IPV4;
+    key.len = prefix_len;
+    memcpy(key.addr, p + 5, prefix_bytes);
+    if (prefix_len % 8)
+        key.addr[prefix_bytes - 1] &= 0xFFU << (8 - prefix_len % 8);
+    if (mrt_column_writer_append(&columns[MRT_COLUMN_PREFIX], &key, 1) != 0 ||
+        mrt_column_writer_append(&columns[MRT_COLUMN_ENTRIES],
+                                 &writer->entry_count, 1) != 0)
+        return -1;
+    p += 5 + prefix_bytes;
+    int entry_count = get_be16(p);
+    p += 2;
+
+    for (int i = 0; i < entry_count; i++) {
+        if (end - p < 8) return -1;
+        uint16_t peer_index = get_be16(p);
+        uint32_t originated = get_be32(p + 2);
+        size_t attr_len = get_be16(p + 6);
+        p += 8;
+        if ((size_t)(end - p) < attr_len) return -1;
+
+        uint32_t origin;
+        if (mrt_column_writer_append(&columns[MRT_COLUMN_PATH_OFFSET],
+                                     &writer->path_len, 1) != 0 ||
+            split_attributes(writer, p, attr_len, &origin) != 0 ||
+            mrt_column_writer_append(&columns[MRT_COLUMN_PEER_INDEX],
+                                     &peer_index, 1) != 0 ||
+            mrt_column_writer_append(&columns[MRT_COLUMN_ORIGINATED],
+                                     &originated, 1) != 0 ||
+            mrt_column_writer_append(&columns[MRT_COLUMN_ORIGIN_AS], &origin,
+                                     1) != 0)
+            return -1;
+        p += attr_len;
+        writer->entry_count++;
+    }
+    return 0;
+}
+
+int mrt_columns_writer_record(struct mrt_columns_writer_t *writer,
+                              const struct mrt_header_t *header,
+                              const uint8_t *record) {
+    size_t len = MRT_HEADER_SIZE + (size_t)header->length;
+    if (header->type != TABLE_DUMP_V2) return 0;
+    if (header->subtype >= TABLE_DUMP_V2_RIB_IPV4_UNICAST &&
+        header->subtype <= TABLE_DUMP_V2_RIB_IPV6_MULTICAST)
+        return split_rib(writer,
+                         header->subtype >= TABLE_DUMP_V2_RIB_IPV6_UNICAST,
+                         record, len);
+    if (header->subtype == TABLE_DUMP_V2_PEER_INDEX_TABLE &&
+        !writer->has_peer_index_table)
+        return save_peer_index_table(writer, record, len);
+    return 0;
+}
+
+int mrt_columns_writer_close(struct mrt_columns_writer_t *writer) {
+    // the row columns get their closing sentinel
+    int ret =
+        mrt_column_writer_append(&writer->columns[MRT_COLUMN_ENTRIES],
+                                 &writer->entry_count, 1) != 0 ||
+                mrt_column_writer_append(
+                    &writer->columns[MRT_COLUMN_PATH_OFFSET],
+                    &writer->path_len, 1) != 0
+            ? -1
+            : 0;
+    for (int i = 0; i < MRT_COLUMN_COUNT; i++)
+        if (mrt_column_writer_close(&writer->columns[i]) != 0) ret = -1;
+    free(writer->dir);
+    writer->dir = NULL;
+    return ret;
+}
+
+int mrt_column_open(struct mrt_column_t *column, const char *path,
+                    size_t elem_size) {
+    memset(column, 0, sizeof(*column));
+    column->current = -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= COLUMN_HEADER_SIZE)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    column->map = map;
+    column->map_len = st.st_size;
+
+    uint32_t u32[5];
+    uint64_t table_offset;
+    memcpy(u32, column->map + 4, sizeof(u32));
+    memcpy(&column->row_count, column->map + 24, 8);
+    memcpy(&table_offset, column->map + 32, 8);
+    column->elem_size = u32[2];
+    column->block_count = u32[4];
+    uint64_t max_rows = (uint64_t)column->block_count * MRT_COLUMN_BLOCK_ROWS;
+    if (memcmp(column->map, COLUMN_MAGIC, 4) != 0 ||
+        u32[0] != COLUMN_VERSION || u32[1] != COLUMN_BYTE_ORDER ||
+        u32[3] != MRT_COLUMN_BLOCK_ROWS || column->elem_size == 0 ||
+        column->elem_size != elem_size ||
+        column->row_count > max_rows ||
+        column->row_count + MRT_COLUMN_BLOCK_ROWS <= max_rows ||
+        table_offset > column->map_len ||
+        (column->map_len - table_offset) / COLUMN_BLOCK_SIZE <
+            column->block_count)
+        goto fail;
+    column->blocks = column->map + table_offset;
+
+    column->dctx = ZSTD_createDCtx();
+    column->data = malloc(column->elem_size * MRT_COLUMN_BLOCK_ROWS);
+    if (column->dctx == NULL || column->data == NULL) goto fail;
+    // blocks are inflated front to back by scans
+    posix_madvise((void *)column->map, column->map_len,
+                  POSIX_MADV_SEQUENTIAL);
+    return 0;
+
+fail:
+    mrt_column_close(column);
+    return -1;
+}
+
+long mrt_column_block(struct mrt_column_t *column, uint32_t idx,
+                      const void **data) {
+    if (idx >= column->block_count) return -1;
+    struct mrt_column_block_t block;
+    memcpy(&block, column->blocks + (size_t)idx * COLUMN_BLOCK_SIZE,
+           sizeof(block));
+    uint64_t first = (uint64_t)idx * MRT_COLUMN_BLOCK_ROWS;
+    uint64_t rows = column->row_count - first;
+    if (rows > MRT_COLUMN_BLOCK_ROWS) rows = MRT_COLUMN_BLOCK_ROWS;
+    size_t len = rows * column->elem_size;
+    if (block.offset > column->map_len ||
+        block.comp_size > column->map_len - block.offset)
+        return -1;
+
+    const uint8_t *in = column->map + block.offset;
+    if (block.flags == COLUMN_BLOCK_STORED) {
+        if (block.comp_size != len) return -1;
+        *data = in;
+        return rows;
+    }
+    size_t ret = ZSTD_decompressDCtx(column->dctx, column->data, len, in,
+                                     block.comp_size);
+    if (ZSTD_isError(ret) || ret != len) return -1;
+    *data = column->data;
+    return rows;
+}
+
+const void *mrt_column_row(struct mrt_column_t *column, uint64_t row) {
+    if (row >= column->row_count) return NULL;
+    int64_t idx = row / MRT_COLUMN_BLOCK_ROWS;
+    if (idx != column->current) {
+        const void *data;
+        column->current = -1;
+        if (mrt_column_block(column, idx, &data) < 0) return NULL;
+        column->current = idx;
+        column->current_data = data;
+    }
+    return column->current_data +
+           (row % MRT_COLUMN_BLOCK_ROWS) * column->elem_size;
+}
+
+void mrt_column_close(struct mrt_column_t *column) {
+    if (column->map) munmap((void *)column->map, column->map_len);
+    ZSTD_freeDCtx(column->dctx);
+    free(column->data);
+    column->map = NULL;
+    column->dctx = NULL;
+    column->data = NULL;
+}
@@ -0,0 +1,119 @@
+#ifndef MRT_COLUMNS_H
+#define MRT_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "find_prefix.h"
+
+/* Columnar export of TABLE_DUMP_V2 RIB records for analytic scans. Every
+ * column is a file of its own in the export directory, so a scan only maps
+ * and inflates the columns it touches.
+ *
+ * A column file is a header, zstd compressed blocks of MRT_COLUMN_BLOCK_ROWS
+ * fixed size values in host byte order and a block table at the end. Blocks
+ * which don't shrink are stored as is and read in place from the mapping.
+ *
+ * Per RIB record columns: the prefix key and the row of the record's first
+ * entry. Per RIB entry columns: peer index, originated time, origin AS and the
+ * row of the entry's first AS in the flattened AS path column. The row
+ * columns have one more value than rows, so entries of record `i` are rows
+ * [entries[i], entries[i + 1]). The PEER_INDEX_TABLE record is copied next to
+ * the columns as is. */
+
+enum { MRT_COLUMN_BLOCK_ROWS = 1 << 16 };
+
+enum mrt_column_id_t {
+    MRT_COLUMN_PREFIX,       // struct prefix_key_t
+    MRT_COLUMN_ENTRIES,      // uint64_t
+    MRT_COLUMN_PEER_INDEX,   // uint16_t
+    MRT_COLUMN_ORIGINATED,   // uint32_t
+    MRT_COLUMN_ORIGIN_AS,    // uint32_t, see mrt_attributes_origin
+    MRT_COLUMN_PATH_OFFSET,  // uint64_t
+    MRT_COLUMN_AS_PATH,      // uint32_t
+    MRT_COLUMN_COUNT
+};
+
+const char *mrt_column_name(enum mrt_column_id_t id);
+/* Size of the values of column `id`, 0 if there is no such column. */
+size_t mrt_column_elem_size(enum mrt_column_id_t id);
+/* Returns a malloc'ed "<dir>/<name>.col". */
+char *mrt_column_path(const char *dir, enum mrt_column_id_t id);
+/* Returns a malloc'ed path of the PEER_INDEX_TABLE copy in `dir`. */
+char *mrt_columns_peer_index_table_path(const char *dir);
+
+struct mrt_column_block_t {
+    uint64_t offset;
+    uint32_t comp_size;
+    uint32_t flags;
+};
+
+struct mrt_column_writer_t {
+    FILE *file;
+    size_t elem_size;
+    int level;
+    void *cctx;
+    uint8_t *rows;
+    size_t block_len;
+    uint8_t *comp;
+    size_t comp_cap;
+    uint64_t row_count;
+    uint64_t offset;
+    struct mrt_column_block_t *blocks;
+    uint32_t block_count;
+    uint32_t block_cap;
+};
+
+int mrt_column_writer_open(struct mrt_column_writer_t *writer,
+                           const char *path, size_t elem_size, int level);
+int mrt_column_writer_append(struct mrt_column_writer_t *writer,
+                             const void *values, size_t count);
+/* Flushes the last block, writes the block table and closes the file. */
+int mrt_column_writer_close(struct mrt_column_writer_t *writer);
+
+struct mrt_columns_writer_t {
+    struct mrt_column_writer_t columns[MRT_COLUMN_COUNT];
+    char *dir;
+    uint64_t entry_count;
+    uint64_t path_len;
+    int has_peer_index_table;
+};
+
+/* Creates `dir` if needed and opens all columns in it. */
+int mrt_columns_writer_open(struct mrt_columns_writer_t *writer,
+                            const char *dir, int level);
+/* Splits a RIB record into the columns and saves the first PEER_INDEX_TABLE,
+ * anything else is skipped. `record` is the whole MRT record. */
+int mrt_columns_writer_record(struct mrt_columns_writer_t *writer,
+                              const struct mrt_header_t *header,
+                              const uint8_t *record);
+int mrt_columns_writer_close(struct mrt_columns_writer_t *writer);
+
+struct mrt_column_t {
+    const uint8_t *map;
+    size_t map_len;
+    size_t elem_size;
+    uint64_t row_count;
+    uint32_t block_count;
+    const uint8_t *blocks;
+    void *dctx;
+    uint8_t *data;
+    int64_t current;
+    const uint8_t *current_data;
+};
+
+/* Fails unless the values of the column are `elem_size` bytes, e.g.
+ * mrt_column_elem_size of the column expected at `path`. */
+int mrt_column_open(struct mrt_column_t *column, const char *path,
+                    size_t elem_size);
+/* Returns the number of rows in block `idx` and points `data` at them, either
+ * into the mapping or into a buffer valid until the next call. -1 on error. */
+long mrt_column_block(struct mrt_column_t *column, uint32_t idx,
+                      const void **data);
+/* Value at `row`, loading its block if it isn't the last one loaded. Valid
+ * until a row of another block is requested, NULL on error. */
+const void *mrt_column_row(struct mrt_column_t *column, uint64_t row);
+void mrt_column_close(struct mrt_column_t *column);
+
+#endif
@@ -0,0 +1,98 @@
+#include "mrt_decoder.h"
+
+#include <stdlib.h>
+
+enum { ARENA_MIN_CHUNK_SIZE = 1 << 16, ARENA_ALIGNMENT = 16 };
+
+struct mrt_arena_chunk_t {
+    struct mrt_arena_chunk_t *next;
+    size_t cap;
+    size_t len;
+    uint8_t *data;
+};
+
+static struct mrt_arena_chunk_t *create_chunk(size_t cap) {
+    struct mrt_arena_chunk_t *chunk = malloc(sizeof(*chunk) + cap);
+    if (chunk == NULL) return NULL;
+    chunk->next = NULL;
+    chunk->cap = cap;
+    chunk->len = 0;
+    chunk->data = (uint8_t *)(chunk + 1);
+    return chunk;
+}
+
+int mrt_decoder_init(struct mrt_decoder_t *decoder) {
+    parsebgp_opts_init(&decoder->opts);
+    decoder->opts.ignore_not_implemented = 1;
+    decoder->msg = parsebgp_create_msg();
+    decoder->chunks = create_chunk(ARENA_MIN_CHUNK_SIZE);
+    if (decoder->msg == NULL || decoder->chunks == NULL) {
+        mrt_decoder_destroy(decoder);
+        return -1;
+    }
+    return 0;
+}
+
+parsebgp_msg_t *mrt_decoder_decode(struct mrt_decoder_t *decoder,
+                                   const uint8_t *record, size_t len) {
+    parsebgp_clear_msg(decoder->msg);
+    size_t decoded = len;
+    if (parsebgp_decode(decoder->opts, PARSEBGP_MSG_TYPE_MRT, decoder->msg,
+                        record, &decoded) != PARSEBGP_OK)
+        return NULL;
+    return decoder->msg;
+}
+
+uint8_t *mrt_decoder_alloc(struct mrt_decoder_t *decoder, size_t len) {
+    struct mrt_arena_chunk_t *chunk = decoder->chunks;
+    size_t start = (chunk->len + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT *
+                   ARENA_ALIGNMENT;
+    if (start > chunk->cap || chunk->cap - start < len) {
+        size_t cap = chunk->cap * 2;
+        while (cap < len) cap *= 2;
+        chunk = create_chunk(cap);
+        if (chunk == NULL) return NULL;
+        chunk->next = decoder->chunks;
+        decoder->chunks = chunk;
+        start = 0;
+    }
+    chunk->len = start + len;
+    return chunk->data + start;
+}
+
+void mrt_decoder_reset(struct mrt_decoder_t *decoder) {
+    struct mrt_arena_chunk_t *chunk = decoder->chunks;
+    if (chunk->next == NULL) {
+        chunk->len = 0;
+        return;
+    }
+    size_t cap = 0;
+    for (; chunk != NULL; chunk = chunk->next) cap += chunk->cap;
+    struct mrt_arena_chunk_t *merged = create_chunk(cap);
+    chunk = decoder->chunks;
+    if (merged == NULL) {
+        // keep the newest chunk, which is the largest
+        merged = chunk;
+        chunk = chunk->next;
+        merged->next = NULL;
+        merged->len = 0;
+    }
+    while (chunk != NULL) {
+        struct mrt_arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    decoder->chunks = merged;
+}
+
+void mrt_decoder_destroy(struct mrt_decoder_t *decoder) {
+    struct mrt_arena_chunk_t *chunk = decoder->chunks;
+    while (chunk != NULL) {
+        struct mrt_arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    if (decoder->msg) parsebgp_destroy_msg(decoder->msg);
+    decoder->msg = NULL;
+    decoder->chunks = NULL;
+}
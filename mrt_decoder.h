@@ -0,0 +1,42 @@
+#ifndef MRT_DECODER_H
+#define MRT_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <parsebgp.h>
+
+/* Decoding of many MRT records in a row without going through the allocator
+ * for each of them. One message is decoded into over and over: it is
+ * cleared rather than destroyed, so parsebgp keeps the nested arrays it
+ * grew for earlier records. Copies of records live in an arena, which is
+ * reset once the records of a checkpoint span, or of a lookup, are done
+ * with.
+ *
+ * A decoder is not thread safe, threads decoding records have one each. */
+
+struct mrt_arena_chunk_t;
+
+struct mrt_decoder_t {
+    parsebgp_opts_t opts;
+    parsebgp_msg_t *msg;
+    /* Chunks in use, the newest first. */
+    struct mrt_arena_chunk_t *chunks;
+};
+
+int mrt_decoder_init(struct mrt_decoder_t *decoder);
+/* Decodes a whole MRT record into the decoder's message and returns it, or
+ * NULL if the record is malformed. The message is valid until the next
+ * call. */
+parsebgp_msg_t *mrt_decoder_decode(struct mrt_decoder_t *decoder,
+                                   const uint8_t *record, size_t len);
+/* Returns `len` bytes from the arena, valid until the next reset, or NULL
+ * if memory runs out. */
+uint8_t *mrt_decoder_alloc(struct mrt_decoder_t *decoder, size_t len);
+/* Releases everything allocated from the arena. Chunks filled since the
+ * last reset are merged into one, so the arena stops growing once it has
+ * seen its largest span. */
+void mrt_decoder_reset(struct mrt_decoder_t *decoder);
+void mrt_decoder_destroy(struct mrt_decoder_t *decoder);
+
+#endif
@@ -0,0 +1,177 @@
+#include "mrt_diff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    MRT_HEADER_SIZE = 12,
+    /* Header, sequence number and prefix length of a RIB record. */
+    RIB_PREFIX_OFFSET = MRT_HEADER_SIZE + 4,
+    MRT_CURSOR_READ_SIZE = 1 << 20,
+    /* Same bound as mrt_walker.c. */
+    MRT_CURSOR_MAX_RECORD = 1 << 28
+};
+
+int mrt_cursor_init(struct mrt_cursor_t *cursor, mrt_cursor_read read,
+                    void *context) {
+    cursor->read = read;
+    cursor->context = context;
+    cursor->buffer = malloc(MRT_CURSOR_READ_SIZE);
+    cursor->capacity = MRT_CURSOR_READ_SIZE;
+    cursor->start = 0;
+    cursor->end = 0;
+    cursor->eof = 0;
+    return cursor->buffer == NULL ? -1 : 0;
+}
+
+/* Moves what is left to the front and makes room for `len` more bytes. */
+static int reserve(struct mrt_cursor_t *cursor, size_t len) {
+    if (cursor->start > 0) {
+        memmove(cursor->buffer, cursor->buffer + cursor->start,
+                cursor->end - cursor->start);
+        cursor->end -= cursor->start;
+        cursor->start = 0;
+    }
+    if (cursor->end + len <= cursor->capacity) return 0;
+    size_t capacity = cursor->capacity;
+    while (capacity < cursor->end + len) capacity *= 2;
+    uint8_t *grown = realloc(cursor->buffer, capacity);
+    if (grown == NULL) return -1;
+    cursor->buffer = grown;
+    cursor->capacity = capacity;
+    return 0;
+}
+
+int mrt_cursor_prime(struct mrt_cursor_t *cursor, const void *data,
+                     size_t len) {
+    if (reserve(cursor, len) != 0) return -1;
+    memcpy(cursor->buffer + cursor->end, data, len);
+    cursor->end += len;
+    return 0;
+}
+
+/* Reads until `need` bytes are buffered. Returns 1, 0 if the stream ended
+ * first and -1 on error. */
+static int fill(struct mrt_cursor_t *cursor, size_t need) {
+    while (cursor->end - cursor->start < need) {
+        if (cursor->eof) return 0;
+        size_t missing = need - (cursor->end - cursor->start);
+        if (reserve(cursor, missing > MRT_CURSOR_READ_SIZE
+                                ? missing
+                                : MRT_CURSOR_READ_SIZE) != 0)
+            return -1;
+        long read = cursor->read(cursor->context,
+                                 cursor->buffer + cursor->end,
+                                 cursor->capacity - cursor->end);
+        if (read < 0) return -1;
+        if (read == 0) cursor->eof = 1;
+        cursor->end += read;
+    }
+    return 1;
+}
+
+int mrt_cursor_next(struct mrt_cursor_t *cursor, const uint8_t **record,
+                    size_t *len) {
+    for (;;) {
+        int ret = fill(cursor, MRT_HEADER_SIZE);
+        if (ret <= 0) return ret;
+        struct mrt_header_t header =
+            get_header(cursor->buffer + cursor->start);
+        if (header.length > MRT_CURSOR_MAX_RECORD) return -1;
+        size_t total = MRT_HEADER_SIZE + (size_t)header.length;
+        ret = fill(cursor, total);
+        if (ret <= 0) return ret;
+
+        const uint8_t *p = cursor->buffer + cursor->start;
+        cursor->start += total;
+        if (!is_tdv2_rib_header(&header)) continue;
+        // the prefix is read without further checks by get_prefix_key
+        if (total <= RIB_PREFIX_OFFSET ||
+            total < RIB_PREFIX_OFFSET + 1 + (p[RIB_PREFIX_OFFSET] + 7) / 8)
+            return -1;
+        *record = p;
+        *len = total;
+        return 1;
+    }
+}
+
+int mrt_cursor_truncated(const struct mrt_cursor_t *cursor) {
+    return cursor->eof && cursor->end > cursor->start;
+}
+
+void mrt_cursor_destroy(struct mrt_cursor_t *cursor) {
+    free(cursor->buffer);
+    cursor->buffer = NULL;
+    cursor->capacity = 0;
+    cursor->start = 0;
+    cursor->end = 0;
+}
+
+/* Timestamps and sequence numbers differ between dumps even for unchanged
+ * prefixes, everything else is compared as is. */
+static int same_record(const uint8_t *lhs, size_t lhs_len, const uint8_t *rhs,
+                       size_t rhs_len) {
+    return lhs_len == rhs_len && memcmp(lhs + 4, rhs + 4, 4) == 0 &&
+           memcmp(lhs + RIB_PREFIX_OFFSET, rhs + RIB_PREFIX_OFFSET,
+                  lhs_len - RIB_PREFIX_OFFSET) == 0;
+}
+
+struct join_side_t {
+    struct mrt_cursor_t *cursor;
+    const uint8_t *record;
+    size_t len;
+    struct prefix_key_t key;
+    int valid;
+};
+
+static int advance(struct join_side_t *side, const struct prefix_key_t *from,
+                   const struct prefix_key_t *to) {
+    for (;;) {
+        int ret = mrt_cursor_next(side->cursor, &side->record, &side->len);
+        side->valid = ret > 0;
+        if (ret <= 0) return ret;
+        side->key = get_prefix_key(side->record);
+        if (from && prefix_key_cmp(&side->key, from) < 0) continue;
+        side->valid = !to || prefix_key_cmp(&side->key, to) < 0;
+        return 0;
+    }
+}
+
+int mrt_diff_join(struct mrt_cursor_t *before, struct mrt_cursor_t *after,
+                  const struct prefix_key_t *from,
+                  const struct prefix_key_t *to, mrt_diff_callback callback,
+                  void *context, struct mrt_diff_stats_t *stats) {
+    struct join_side_t lhs = {before, NULL, 0, {0, {0}, 0}, 0};
+    struct join_side_t rhs = {after, NULL, 0, {0, {0}, 0}, 0};
+    if (advance(&lhs, from, to) < 0 || advance(&rhs, from, to) < 0)
+        return -1;
+
+    int ret = 0;
+    while (ret == 0 && (lhs.valid || rhs.valid)) {
+        int cmp = !rhs.valid   ? -1
+                  : !lhs.valid ? 1
+                               : prefix_key_cmp(&lhs.key, &rhs.key);
+        if (cmp < 0) {
+            stats->removed++;
+            ret = callback(context, MRT_DIFF_REMOVED, &lhs.key, lhs.record,
+                           lhs.len, NULL, 0);
+            if (advance(&lhs, from, to) < 0) return -1;
+        } else if (cmp > 0) {
+            stats->added++;
+            ret = callback(context, MRT_DIFF_ADDED, &rhs.key, NULL, 0,
+                           rhs.record, rhs.len);
+            if (advance(&rhs, from, to) < 0) return -1;
+        } else {
+            if (same_record(lhs.record, lhs.len, rhs.record, rhs.len)) {
+                stats->unchanged++;
+            } else {
+                stats->changed++;
+                ret = callback(context, MRT_DIFF_CHANGED, &lhs.key,
+                               lhs.record, lhs.len, rhs.record, rhs.len);
+            }
+            if (advance(&lhs, from, to) < 0 || advance(&rhs, from, to) < 0)
+                return -1;
+        }
+    }
+    return ret;
+}
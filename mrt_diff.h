@@ -0,0 +1,74 @@
+#ifndef MRT_DIFF_H
+#define MRT_DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "find_prefix.h"
+
+/* Differences between two TABLE_DUMP_V2 dumps sorted the same way, e.g. two
+ * bviews of one collector taken hours apart. Both are walked side by side in
+ * prefix_key_cmp order and only prefixes added, removed or changed are
+ * reported. Records of a prefix present in both are compared byte by byte,
+ * from the subtype to the end without the sequence number, so unchanged ones
+ * are never decoded. The comparison assumes both dumps number their peers
+ * the same way, which bviews of one collector usually do. */
+
+/* Reads up to `len` uncompressed bytes, returns 0 at the end and a negative
+ * value on error, like zidx_read. */
+typedef long (*mrt_cursor_read)(void *context, void *buffer, size_t len);
+
+/* Hands out the RIB records of an uncompressed MRT stream one at a time.
+ * Unlike mrt_walker_t it is pulled from, so two of them can be advanced in
+ * step with each other. */
+struct mrt_cursor_t {
+    mrt_cursor_read read;
+    void *context;
+    uint8_t *buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int eof;
+};
+
+int mrt_cursor_init(struct mrt_cursor_t *cursor, mrt_cursor_read read,
+                    void *context);
+/* Queues `len` bytes to be handed out before anything read, e.g. the part of
+ * a checkpoint window following the first record boundary in it. */
+int mrt_cursor_prime(struct mrt_cursor_t *cursor, const void *data,
+                     size_t len);
+/* Points `record` at the next RIB record, header included, which is valid
+ * until the next call. Returns 1, 0 at the end of the stream and -1 on
+ * error. */
+int mrt_cursor_next(struct mrt_cursor_t *cursor, const uint8_t **record,
+                    size_t *len);
+/* Whether the stream ended in the middle of a record. */
+int mrt_cursor_truncated(const struct mrt_cursor_t *cursor);
+void mrt_cursor_destroy(struct mrt_cursor_t *cursor);
+
+enum mrt_diff_type_t { MRT_DIFF_ADDED, MRT_DIFF_REMOVED, MRT_DIFF_CHANGED };
+
+/* `before` is NULL for added prefixes and `after` for removed ones. A
+ * non-zero return value stops the join and is passed back by mrt_diff_join. */
+typedef int (*mrt_diff_callback)(void *context, enum mrt_diff_type_t type,
+                                 const struct prefix_key_t *key,
+                                 const uint8_t *before, size_t before_len,
+                                 const uint8_t *after, size_t after_len);
+
+struct mrt_diff_stats_t {
+    uint64_t added;
+    uint64_t removed;
+    uint64_t changed;
+    uint64_t unchanged;
+};
+
+/* Joins the records of both cursors with prefixes from `from` up to but not
+ * including `to`, either of which may be NULL for no bound. Records before
+ * `from` are skipped, so cursors may start anywhere before it. Adds to
+ * `stats` and returns 0, or -1 on error. */
+int mrt_diff_join(struct mrt_cursor_t *before, struct mrt_cursor_t *after,
+                  const struct prefix_key_t *from,
+                  const struct prefix_key_t *to, mrt_diff_callback callback,
+                  void *context, struct mrt_diff_stats_t *stats);
+
+#endif
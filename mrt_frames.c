@@ -0,0 +1,666 @@
+#include "mrt_frames.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <zstd.h>
+
+//
+#include "mapped_input.h"
+
+enum {
+    ZSTD_SKIPPABLE_HEADER_SIZE = 8,
+    SEEK_TABLE_FOOTER_SIZE = 9,
+    SEEK_TABLE_ENTRY_SIZE = 8,
+    SEEK_TABLE_CHECKSUM_FLAG = 0x80,
+    KEY_TABLE_VERSION = 1,
+    KEY_TABLE_HEADER_SIZE = 12,
+    KEY_ENTRY_SIZE = 20,
+    GZIP_HEADER_SIZE = 12,  // with XLEN
+    GZIP_SUBFIELD_HEADER_SIZE = 4,
+    GZIP_EMPTY_TAIL_SIZE = 10,  // empty final block, CRC32 and ISIZE
+    GZIP_INDEX_CHUNK = 0xff00,
+    GZIP_INDEX_HEADER_SIZE = 12,
+    GZIP_FOOTER_DATA_SIZE = 16,
+    GZIP_FOOTER_SIZE = GZIP_HEADER_SIZE + GZIP_SUBFIELD_HEADER_SIZE +
+                       GZIP_FOOTER_DATA_SIZE + GZIP_EMPTY_TAIL_SIZE
+};
+
+#define ZSTD_SKIPPABLE_KEYS_MAGIC 0x184D2A50U
+#define ZSTD_SKIPPABLE_SEEK_TABLE_MAGIC 0x184D2A5EU
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1U
+#define KEY_TABLE_MAGIC "PFXK"
+#define GZIP_INDEX_MAGIC "PFXG"
+#define GZIP_FOOTER_MAGIC "PFXF"
+/* Extra field subfield ids of the index and footer members. */
+#define GZIP_INDEX_SUBFIELD "PX"
+#define GZIP_FOOTER_SUBFIELD "PF"
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static int write_all(streamlike_t *stream, const void *data, size_t len) {
+    return sl_write(stream, data, len) == len ? 0 : -1;
+}
+
+static int read_all(streamlike_t *stream, void *data, size_t len) {
+    return sl_read(stream, data, len) == len ? 0 : -1;
+}
+
+static int reserve(void **buffer, size_t *cap, size_t len) {
+    if (len <= *cap) return 0;
+    size_t new_cap = *cap ? *cap : 1 << 16;
+    while (new_cap < len) new_cap *= 2;
+    void *p = realloc(*buffer, new_cap);
+    if (p == NULL) return -1;
+    *buffer = p;
+    *cap = new_cap;
+    return 0;
+}
+
+static void put_key(uint8_t *p, const struct mrt_frame_t *frame) {
+    memset(p, 0, KEY_ENTRY_SIZE);
+    if (!frame->has_key) return;
+    p[0] = 1;
+    p[1] = frame->key.afi;
+    p[2] = frame->key.len;
+    memcpy(p + 4, frame->key.addr, 16);
+}
+
+static void get_key(const uint8_t *p, struct mrt_frame_t *frame) {
+    frame->has_key = p[0] != 0;
+    struct afi_prefix_t pfx;
+    pfx.type = p[1] ? AFI_TYPE_IPV6 : AFI_TYPE_IPV4;
+    pfx.prefix.len = p[2];
+    memcpy(pfx.prefix.addr, p + 4, 16);
+    // normalized again, the table may come from a corrupt or foreign file
+    frame->key = prefix_key_make(&pfx);
+}
+
+static int parse_key_table(struct mrt_frames_t *frames, const uint8_t *p,
+                           size_t len) {
+    if (len < KEY_TABLE_HEADER_SIZE || memcmp(p, KEY_TABLE_MAGIC, 4) != 0 ||
+        get_le32(p + 4) != KEY_TABLE_VERSION ||
+        get_le32(p + 8) != (uint32_t)frames->count)
+        return -1;
+    size_t keys_len = (size_t)frames->count * KEY_ENTRY_SIZE;
+    if (len < KEY_TABLE_HEADER_SIZE + keys_len + 4) return -1;
+    p += KEY_TABLE_HEADER_SIZE;
+    for (int i = 0; i < frames->count; i++, p += KEY_ENTRY_SIZE)
+        get_key(p, &frames->frames[i]);
+
+    size_t pit_len = get_le32(p);
+    if (len != KEY_TABLE_HEADER_SIZE + keys_len + 4 + pit_len) return -1;
+    if (pit_len == 0) return 0;
+    frames->peer_index_table = malloc(pit_len);
+    if (frames->peer_index_table == NULL) return -1;
+    memcpy(frames->peer_index_table, p + 4, pit_len);
+    frames->peer_index_table_len = pit_len;
+    return 0;
+}
+
+/* The key table is optional, seekable zstd files from other tools just get
+ * scanned from the first frame. */
+static int open_key_table(struct mrt_frames_t *frames, streamlike_t *stream,
+                          off_t data_end, off_t table_start) {
+    uint8_t header[ZSTD_SKIPPABLE_HEADER_SIZE];
+    if (table_start - data_end < ZSTD_SKIPPABLE_HEADER_SIZE) return 0;
+    if (sl_seek(stream, data_end, SL_SEEK_SET) != 0 ||
+        read_all(stream, header, sizeof(header)) != 0)
+        return -1;
+    uint32_t len = get_le32(header + 4);
+    if (get_le32(header) != ZSTD_SKIPPABLE_KEYS_MAGIC ||
+        len > table_start - data_end - ZSTD_SKIPPABLE_HEADER_SIZE)
+        return 0;
+
+    uint8_t *payload = malloc(len ? len : 1);
+    if (payload == NULL) return -1;
+    int ret = read_all(stream, payload, len) == 0 &&
+                      parse_key_table(frames, payload, len) == 0
+                  ? 0
+                  : -1;
+    free(payload);
+    return ret;
+}
+
+static int open_zstd(struct mrt_frames_t *frames, streamlike_t *stream,
+                     off_t len, const uint8_t *footer) {
+    uint32_t count = get_le32(footer);
+    size_t entry_size = SEEK_TABLE_ENTRY_SIZE +
+                        (footer[4] & SEEK_TABLE_CHECKSUM_FLAG ? 4 : 0);
+    uint64_t table_len = ZSTD_SKIPPABLE_HEADER_SIZE +
+                         (uint64_t)count * entry_size + SEEK_TABLE_FOOTER_SIZE;
+    if (count > INT32_MAX || table_len > (uint64_t)len) return -1;
+
+    uint8_t *table = malloc(table_len);
+    if (table == NULL) return -1;
+    off_t table_start = len - table_len;
+    if (sl_seek(stream, table_start, SL_SEEK_SET) != 0 ||
+        read_all(stream, table, table_len) != 0 ||
+        get_le32(table) != ZSTD_SKIPPABLE_SEEK_TABLE_MAGIC ||
+        get_le32(table + 4) != table_len - ZSTD_SKIPPABLE_HEADER_SIZE) {
+        free(table);
+        return -1;
+    }
+
+    frames->type = MRT_FRAMES_ZSTD;
+    frames->frames = calloc(count ? count : 1, sizeof(*frames->frames));
+    if (frames->frames == NULL) {
+        free(table);
+        return -1;
+    }
+    frames->count = count;
+    off_t comp = 0;
+    off_t uncomp = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *entry = table + ZSTD_SKIPPABLE_HEADER_SIZE +
+                               i * entry_size;
+        struct mrt_frame_t *frame = &frames->frames[i];
+        frame->comp_offset = comp;
+        frame->comp_size = get_le32(entry);
+        frame->uncomp_offset = uncomp;
+        frame->uncomp_size = get_le32(entry + 4);
+        comp += frame->comp_size;
+        uncomp += frame->uncomp_size;
+    }
+    free(table);
+    if (comp > table_start) return -1;
+    return open_key_table(frames, stream, comp, table_start);
+}
+
+/* Header of an empty gzip member whose extra field is a single subfield. */
+static void put_gzip_header(uint8_t *p, const char *id, size_t len) {
+    static const uint8_t header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255};
+    memcpy(p, header, sizeof(header));
+    p[10] = (len + GZIP_SUBFIELD_HEADER_SIZE) & 0xff;
+    p[11] = (len + GZIP_SUBFIELD_HEADER_SIZE) >> 8;
+    p[12] = id[0];
+    p[13] = id[1];
+    p[14] = len & 0xff;
+    p[15] = len >> 8;
+}
+
+/* Returns the subfield length, or -1 if `p` isn't a header written by
+ * put_gzip_header with the subfield `id`. */
+static long get_gzip_header(const uint8_t *p, const char *id) {
+    if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || p[3] != 4 ||
+        p[12] != id[0] || p[13] != id[1])
+        return -1;
+    size_t xlen = p[10] | p[11] << 8;
+    size_t len = p[14] | p[15] << 8;
+    return xlen == len + GZIP_SUBFIELD_HEADER_SIZE ? (long)len : -1;
+}
+
+/* An empty final fixed block, then a zero CRC32 and ISIZE. */
+static const uint8_t gzip_empty_tail[GZIP_EMPTY_TAIL_SIZE] = {3, 0};
+
+static int parse_gzip_index(struct mrt_frames_t *frames, const uint8_t *p,
+                            size_t len, off_t data_end) {
+    if (len < GZIP_INDEX_HEADER_SIZE || memcmp(p, GZIP_INDEX_MAGIC, 4) != 0 ||
+        get_le32(p + 4) != KEY_TABLE_VERSION)
+        return -1;
+    uint32_t count = get_le32(p + 8);
+    if (count > INT32_MAX ||
+        (len - GZIP_INDEX_HEADER_SIZE) / SEEK_TABLE_ENTRY_SIZE < count)
+        return -1;
+
+    frames->type = MRT_FRAMES_GZIP;
+    frames->frames = calloc(count ? count : 1, sizeof(*frames->frames));
+    if (frames->frames == NULL) return -1;
+    frames->count = count;
+    p += GZIP_INDEX_HEADER_SIZE;
+    off_t comp = 0;
+    off_t uncomp = 0;
+    for (uint32_t i = 0; i < count; i++, p += SEEK_TABLE_ENTRY_SIZE) {
+        struct mrt_frame_t *frame = &frames->frames[i];
+        frame->comp_offset = comp;
+        frame->comp_size = get_le32(p);
+        frame->uncomp_offset = uncomp;
+        frame->uncomp_size = get_le32(p + 4);
+        comp += frame->comp_size;
+        uncomp += frame->uncomp_size;
+    }
+    if (comp != data_end) return -1;
+    size_t table_len = (size_t)count * SEEK_TABLE_ENTRY_SIZE;
+    return parse_key_table(frames, p, len - GZIP_INDEX_HEADER_SIZE - table_len);
+}
+
+/* The index is split over the extra fields of empty members between the data
+ * and the footer. */
+static int open_gzip(struct mrt_frames_t *frames, streamlike_t *stream,
+                     off_t len, const uint8_t *footer) {
+    const uint8_t *data = footer + GZIP_HEADER_SIZE + GZIP_SUBFIELD_HEADER_SIZE;
+    off_t index_start = get_le64(data);
+    size_t index_len = get_le32(data + 8);
+    off_t footer_start = len - GZIP_FOOTER_SIZE;
+    if (index_start < 0 || index_start > footer_start ||
+        index_len > (uint64_t)(footer_start - index_start))
+        return -1;
+
+    uint8_t *index = malloc(index_len ? index_len : 1);
+    if (index == NULL) return -1;
+    uint8_t header[GZIP_HEADER_SIZE + GZIP_SUBFIELD_HEADER_SIZE];
+    uint8_t tail[GZIP_EMPTY_TAIL_SIZE];
+    size_t filled = 0;
+    int ret = sl_seek(stream, index_start, SL_SEEK_SET);
+    while (ret == 0 && filled < index_len) {
+        long chunk = read_all(stream, header, sizeof(header)) == 0
+                         ? get_gzip_header(header, GZIP_INDEX_SUBFIELD)
+                         : -1;
+        if (chunk < 0 || (size_t)chunk > index_len - filled ||
+            read_all(stream, index + filled, chunk) != 0 ||
+            read_all(stream, tail, sizeof(tail)) != 0 ||
+            memcmp(tail, gzip_empty_tail, sizeof(tail)) != 0)
+            ret = -1;
+        else
+            filled += chunk;
+    }
+    if (ret == 0) ret = parse_gzip_index(frames, index, index_len, index_start);
+    free(index);
+    return ret;
+}
+
+int mrt_frames_open(struct mrt_frames_t *frames, streamlike_t *stream) {
+    uint8_t footer[GZIP_FOOTER_SIZE];
+    uint8_t *zstd_footer = footer + GZIP_FOOTER_SIZE - SEEK_TABLE_FOOTER_SIZE;
+    int ret = 0;
+    memset(frames, 0, sizeof(*frames));
+
+    // both footers are fixed size and at the very end, one read covers both
+    off_t len = sl_length(stream);
+    off_t footer_len = len < GZIP_FOOTER_SIZE ? len : GZIP_FOOTER_SIZE;
+    if (footer_len >= ZSTD_SKIPPABLE_HEADER_SIZE + SEEK_TABLE_FOOTER_SIZE &&
+        sl_seek(stream, len - footer_len, SL_SEEK_SET) == 0 &&
+        read_all(stream, footer + GZIP_FOOTER_SIZE - footer_len,
+                 footer_len) == 0) {
+        const uint8_t *data =
+            footer + GZIP_HEADER_SIZE + GZIP_SUBFIELD_HEADER_SIZE;
+        if (footer_len == GZIP_FOOTER_SIZE &&
+            get_gzip_header(footer, GZIP_FOOTER_SUBFIELD) ==
+                GZIP_FOOTER_DATA_SIZE &&
+            memcmp(data + 12, GZIP_FOOTER_MAGIC, 4) == 0)
+            ret = open_gzip(frames, stream, len, footer) == 0 ? 1 : -1;
+        else if (get_le32(zstd_footer + 5) == ZSTD_SEEKABLE_MAGIC)
+            ret = open_zstd(frames, stream, len, zstd_footer) == 0 ? 1 : -1;
+    }
+
+    if (sl_seek(stream, 0, SL_SEEK_SET) != 0) ret = -1;
+    if (ret < 0) mrt_frames_destroy(frames);
+    return ret;
+}
+
+void mrt_frames_destroy(struct mrt_frames_t *frames) {
+    free(frames->frames);
+    free(frames->peer_index_table);
+    frames->frames = NULL;
+    frames->count = 0;
+    frames->peer_index_table = NULL;
+    frames->peer_index_table_len = 0;
+}
+
+int mrt_frames_find(const struct mrt_frames_t *frames,
+                    const struct prefix_key_t *key) {
+    /* invariant: frames before i start at or below key, from j on above. */
+    int i = 0;
+    int j = frames->count;
+    while (i < j) {
+        int k = i + (j - i) / 2;
+        const struct mrt_frame_t *frame = &frames->frames[k];
+        if (!frame->has_key || prefix_key_cmp(&frame->key, key) <= 0)
+            i = k + 1;
+        else
+            j = k;
+    }
+    return i > 0 ? i - 1 : 0;
+}
+
+off_t mrt_frames_uncomp_size(const struct mrt_frames_t *frames) {
+    if (frames->count == 0) return 0;
+    const struct mrt_frame_t *last = &frames->frames[frames->count - 1];
+    return last->uncomp_offset + last->uncomp_size;
+}
+
+int mrt_frames_reader_init(struct mrt_frames_reader_t *reader,
+                           const struct mrt_frames_t *frames,
+                           streamlike_t *stream) {
+    memset(reader, 0, sizeof(*reader));
+    reader->frames = frames;
+    reader->stream = stream;
+    if (frames->type == MRT_FRAMES_GZIP) {
+        reader->zstrm = calloc(1, sizeof(*reader->zstrm));
+        if (reader->zstrm == NULL) return -1;
+        if (inflateInit2(reader->zstrm, 15 + 16) != Z_OK) {
+            free(reader->zstrm);
+            reader->zstrm = NULL;
+            return -1;
+        }
+        return 0;
+    }
+    reader->dctx = ZSTD_createDCtx();
+    return reader->dctx ? 0 : -1;
+}
+
+static long inflate_member(z_stream *strm, uint8_t *out, size_t out_len,
+                           const uint8_t *in, size_t in_len) {
+    if (inflateReset(strm) != Z_OK) return -1;
+    strm->next_in = (Bytef *)in;
+    strm->avail_in = in_len;
+    strm->next_out = out;
+    strm->avail_out = out_len;
+    if (inflate(strm, Z_FINISH) != Z_STREAM_END || strm->avail_in != 0)
+        return -1;
+    return out_len - strm->avail_out;
+}
+
+long mrt_frames_reader_frame(struct mrt_frames_reader_t *reader, int idx,
+                             const uint8_t **data) {
+    if (idx < 0 || idx >= reader->frames->count) return -1;
+    const struct mrt_frame_t *frame = &reader->frames->frames[idx];
+    if (reserve((void **)&reader->data, &reader->data_cap, frame->uncomp_size))
+        return -1;
+    // mapped files decompress straight from the mapping
+    size_t mapped_len;
+    const uint8_t *comp = mapped_input_data(reader->stream, &mapped_len);
+    if (comp != NULL) {
+        if ((uint64_t)frame->comp_offset + frame->comp_size > mapped_len)
+            return -1;
+        comp += frame->comp_offset;
+    } else {
+        if (reserve((void **)&reader->comp, &reader->comp_cap,
+                    frame->comp_size) ||
+            sl_seek(reader->stream, frame->comp_offset, SL_SEEK_SET) != 0 ||
+            read_all(reader->stream, reader->comp, frame->comp_size) != 0)
+            return -1;
+        comp = reader->comp;
+    }
+
+    if (reader->zstrm) {
+        long ret = inflate_member(reader->zstrm, reader->data,
+                                  frame->uncomp_size, comp, frame->comp_size);
+        if (ret != frame->uncomp_size) return -1;
+    } else {
+        size_t ret = ZSTD_decompressDCtx(reader->dctx, reader->data,
+                                         frame->uncomp_size, comp,
+                                         frame->comp_size);
+        if (ZSTD_isError(ret) || ret != frame->uncomp_size) return -1;
+    }
+    *data = reader->data;
+    return frame->uncomp_size;
+}
+
+int mrt_frames_reader_seek_frame(struct mrt_frames_reader_t *reader,
+                                 int idx) {
+    if (idx < 0 || idx > reader->frames->count) return -1;
+    reader->next = idx;
+    reader->data_len = 0;
+    reader->data_off = 0;
+    return 0;
+}
+
+long mrt_frames_reader_read(struct mrt_frames_reader_t *reader, void *buffer,
+                            size_t len) {
+    uint8_t *out = buffer;
+    size_t produced = 0;
+    while (produced < len) {
+        if (reader->data_off == reader->data_len) {
+            if (reader->next >= reader->frames->count) break;
+            const uint8_t *data;
+            long ret = mrt_frames_reader_frame(reader, reader->next++, &data);
+            if (ret < 0) return -1;
+            reader->data_len = ret;
+            reader->data_off = 0;
+            continue;
+        }
+        size_t n = reader->data_len - reader->data_off;
+        if (n > len - produced) n = len - produced;
+        memcpy(out + produced, reader->data + reader->data_off, n);
+        reader->data_off += n;
+        produced += n;
+    }
+    return produced;
+}
+
+void mrt_frames_reader_destroy(struct mrt_frames_reader_t *reader) {
+    ZSTD_freeDCtx(reader->dctx);
+    if (reader->zstrm) inflateEnd(reader->zstrm);
+    free(reader->zstrm);
+    free(reader->comp);
+    free(reader->data);
+    reader->dctx = NULL;
+    reader->zstrm = NULL;
+    reader->comp = NULL;
+    reader->data = NULL;
+}
+
+int mrt_frames_writer_init(struct mrt_frames_writer_t *writer,
+                           streamlike_t *stream, enum mrt_frames_type_t type,
+                           int level) {
+    memset(writer, 0, sizeof(*writer));
+    writer->frames.type = type;
+    writer->stream = stream;
+    writer->level = level;
+    if (type == MRT_FRAMES_GZIP) {
+        writer->zstrm = calloc(1, sizeof(*writer->zstrm));
+        if (writer->zstrm == NULL) return -1;
+        if (deflateInit2(writer->zstrm, level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(writer->zstrm);
+            writer->zstrm = NULL;
+            return -1;
+        }
+        return 0;
+    }
+    writer->cctx = ZSTD_createCCtx();
+    return writer->cctx ? 0 : -1;
+}
+
+/* Compresses `data` into `writer->comp`, returns the compressed length or -1
+ * on error. */
+static long compress_frame(struct mrt_frames_writer_t *writer,
+                           const uint8_t *data, size_t len) {
+    if (writer->zstrm) {
+        z_stream *strm = writer->zstrm;
+        if (deflateReset(strm) != Z_OK ||
+            reserve((void **)&writer->comp, &writer->comp_cap,
+                    deflateBound(strm, len)) != 0)
+            return -1;
+        strm->next_in = (Bytef *)data;
+        strm->avail_in = len;
+        strm->next_out = writer->comp;
+        strm->avail_out = writer->comp_cap > UINT32_MAX ? UINT32_MAX
+                                                        : writer->comp_cap;
+        if (deflate(strm, Z_FINISH) != Z_STREAM_END) return -1;
+        return strm->total_out;
+    }
+
+    if (reserve((void **)&writer->comp, &writer->comp_cap,
+                ZSTD_compressBound(len)) != 0)
+        return -1;
+    size_t comp_len = ZSTD_compressCCtx(writer->cctx, writer->comp,
+                                        writer->comp_cap, data, len,
+                                        writer->level);
+    return ZSTD_isError(comp_len) ? -1 : (long)comp_len;
+}
+
+int mrt_frames_writer_frame(struct mrt_frames_writer_t *writer,
+                            const uint8_t *data, size_t len,
+                            const struct prefix_key_t *key) {
+    struct mrt_frames_t *frames = &writer->frames;
+    if (len > UINT32_MAX) return -1;
+    if (frames->count == writer->capacity) {
+        int capacity = writer->capacity ? writer->capacity * 2 : 256;
+        struct mrt_frame_t *p =
+            realloc(frames->frames, capacity * sizeof(*frames->frames));
+        if (p == NULL) return -1;
+        frames->frames = p;
+        writer->capacity = capacity;
+    }
+
+    long comp_len = compress_frame(writer, data, len);
+    if (comp_len < 0 || (unsigned long)comp_len > UINT32_MAX ||
+        write_all(writer->stream, writer->comp, comp_len) != 0)
+        return -1;
+
+    struct mrt_frame_t *frame = &frames->frames[frames->count++];
+    frame->comp_offset = writer->comp_offset;
+    frame->comp_size = comp_len;
+    frame->uncomp_offset = writer->uncomp_offset;
+    frame->uncomp_size = len;
+    frame->has_key = key != NULL;
+    if (key) frame->key = *key;
+    writer->comp_offset += comp_len;
+    writer->uncomp_offset += len;
+    return 0;
+}
+
+int mrt_frames_writer_set_peer_index_table(struct mrt_frames_writer_t *writer,
+                                           const uint8_t *record, size_t len) {
+    struct mrt_frames_t *frames = &writer->frames;
+    uint8_t *copy = malloc(len ? len : 1);
+    if (copy == NULL || len > UINT32_MAX) {
+        free(copy);
+        return -1;
+    }
+    memcpy(copy, record, len);
+    free(frames->peer_index_table);
+    frames->peer_index_table = copy;
+    frames->peer_index_table_len = len;
+    return 0;
+}
+
+static int write_skippable(streamlike_t *stream, uint32_t magic,
+                           const uint8_t *payload, size_t len) {
+    uint8_t header[ZSTD_SKIPPABLE_HEADER_SIZE];
+    put_le32(header, magic);
+    put_le32(header + 4, len);
+    if (write_all(stream, header, sizeof(header)) != 0) return -1;
+    return write_all(stream, payload, len);
+}
+
+static size_t key_table_size(const struct mrt_frames_t *frames) {
+    return KEY_TABLE_HEADER_SIZE + (size_t)frames->count * KEY_ENTRY_SIZE + 4 +
+           frames->peer_index_table_len;
+}
+
+static void put_key_table(uint8_t *p, const struct mrt_frames_t *frames) {
+    memcpy(p, KEY_TABLE_MAGIC, 4);
+    put_le32(p + 4, KEY_TABLE_VERSION);
+    put_le32(p + 8, frames->count);
+    p += KEY_TABLE_HEADER_SIZE;
+    for (int i = 0; i < frames->count; i++, p += KEY_ENTRY_SIZE)
+        put_key(p, &frames->frames[i]);
+    put_le32(p, frames->peer_index_table_len);
+    if (frames->peer_index_table_len)
+        memcpy(p + 4, frames->peer_index_table, frames->peer_index_table_len);
+}
+
+static int write_gzip_member(streamlike_t *stream, const char *id,
+                             const uint8_t *data, size_t len) {
+    uint8_t header[GZIP_HEADER_SIZE + GZIP_SUBFIELD_HEADER_SIZE];
+    put_gzip_header(header, id, len);
+    if (write_all(stream, header, sizeof(header)) != 0 ||
+        write_all(stream, data, len) != 0)
+        return -1;
+    return write_all(stream, gzip_empty_tail, sizeof(gzip_empty_tail));
+}
+
+/* The index is the frame sizes followed by the key table, chunked over as
+ * many members as their 64 KiB extra fields need. */
+static int finish_gzip(struct mrt_frames_writer_t *writer) {
+    const struct mrt_frames_t *frames = &writer->frames;
+    size_t len = GZIP_INDEX_HEADER_SIZE +
+                 (size_t)frames->count * SEEK_TABLE_ENTRY_SIZE +
+                 key_table_size(frames);
+    if (len > UINT32_MAX) return -1;
+    uint8_t *index = malloc(len);
+    if (index == NULL) return -1;
+
+    uint8_t *p = index;
+    memcpy(p, GZIP_INDEX_MAGIC, 4);
+    put_le32(p + 4, KEY_TABLE_VERSION);
+    put_le32(p + 8, frames->count);
+    p += GZIP_INDEX_HEADER_SIZE;
+    for (int i = 0; i < frames->count; i++, p += SEEK_TABLE_ENTRY_SIZE) {
+        put_le32(p, frames->frames[i].comp_size);
+        put_le32(p + 4, frames->frames[i].uncomp_size);
+    }
+    put_key_table(p, frames);
+
+    int ret = 0;
+    for (size_t off = 0; ret == 0 && off < len; off += GZIP_INDEX_CHUNK) {
+        size_t chunk = len - off < GZIP_INDEX_CHUNK ? len - off
+                                                    : GZIP_INDEX_CHUNK;
+        ret = write_gzip_member(writer->stream, GZIP_INDEX_SUBFIELD,
+                                index + off, chunk);
+    }
+    free(index);
+
+    uint8_t footer[GZIP_FOOTER_DATA_SIZE];
+    put_le64(footer, writer->comp_offset);
+    put_le32(footer + 8, len);
+    memcpy(footer + 12, GZIP_FOOTER_MAGIC, 4);
+    if (ret == 0)
+        ret = write_gzip_member(writer->stream, GZIP_FOOTER_SUBFIELD, footer,
+                                sizeof(footer));
+    return ret;
+}
+
+int mrt_frames_writer_finish(struct mrt_frames_writer_t *writer) {
+    if (writer->frames.type == MRT_FRAMES_GZIP) return finish_gzip(writer);
+
+    const struct mrt_frames_t *frames = &writer->frames;
+    size_t keys_len = key_table_size(frames);
+    size_t seek_len = (size_t)frames->count * SEEK_TABLE_ENTRY_SIZE +
+                      SEEK_TABLE_FOOTER_SIZE;
+    if (keys_len > UINT32_MAX || seek_len > UINT32_MAX) return -1;
+
+    uint8_t *payload = malloc(keys_len > seek_len ? keys_len : seek_len);
+    if (payload == NULL) return -1;
+
+    put_key_table(payload, frames);
+    int ret = write_skippable(writer->stream, ZSTD_SKIPPABLE_KEYS_MAGIC,
+                              payload, keys_len);
+
+    uint8_t *p = payload;
+    for (int i = 0; i < frames->count; i++, p += SEEK_TABLE_ENTRY_SIZE) {
+        put_le32(p, frames->frames[i].comp_size);
+        put_le32(p + 4, frames->frames[i].uncomp_size);
+    }
+    put_le32(p, frames->count);
+    p[4] = 0;  // no checksums
+    put_le32(p + 5, ZSTD_SEEKABLE_MAGIC);
+    if (ret == 0)
+        ret = write_skippable(writer->stream, ZSTD_SKIPPABLE_SEEK_TABLE_MAGIC,
+                              payload, seek_len);
+    free(payload);
+    return ret;
+}
+
+void mrt_frames_writer_destroy(struct mrt_frames_writer_t *writer) {
+    mrt_frames_destroy(&writer->frames);
+    ZSTD_freeCCtx(writer->cctx);
+    if (writer->zstrm) deflateEnd(writer->zstrm);
+    free(writer->zstrm);
+    free(writer->comp);
+    writer->cctx = NULL;
+    writer->zstrm = NULL;
+    writer->comp = NULL;
+}
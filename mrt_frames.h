@@ -0,0 +1,110 @@
+#ifndef MRT_FRAMES_H
+#define MRT_FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <streamlike.h>
+#include <zlib.h>
+
+#include "find_prefix.h"
+
+/* MRT files rewritten by pfxdump-transcode into independently compressed
+ * frames, each starting on a record boundary. Any frame can be decompressed
+ * on its own, so neither checkpoint windows nor a separate index are needed.
+ *
+ * MRT_FRAMES_ZSTD follows the zstd seekable format: data frames, a skippable
+ * frame with the key table and the seek table as the last frame, so plain
+ * `zstd -d` still restores the original file. The key table holds the first
+ * RIB prefix of every frame and a copy of the PEER_INDEX_TABLE record.
+ *
+ * MRT_FRAMES_GZIP is a concatenation of independent gzip members, one per
+ * frame, for consumers without zstd. The frame sizes and the key table are
+ * carried in the extra fields of empty members appended after the data, and
+ * a fixed size empty member at the very end points at them. gunzip inflates
+ * the empty members to nothing, so it still restores the original file. */
+
+enum mrt_frames_type_t { MRT_FRAMES_ZSTD, MRT_FRAMES_GZIP };
+
+struct mrt_frame_t {
+    off_t comp_offset;
+    uint32_t comp_size;
+    off_t uncomp_offset;
+    uint32_t uncomp_size;
+    /* First RIB prefix in the frame, if the frame has any. */
+    int has_key;
+    struct prefix_key_t key;
+};
+
+struct mrt_frames_t {
+    enum mrt_frames_type_t type;
+    int count;
+    struct mrt_frame_t *frames;
+    uint8_t *peer_index_table;
+    size_t peer_index_table_len;
+};
+
+/* Returns 1 and fills in `frames` if `stream` is a frame container, 0 if it
+ * isn't, -1 on error. The stream is rewound either way. */
+int mrt_frames_open(struct mrt_frames_t *frames, streamlike_t *stream);
+void mrt_frames_destroy(struct mrt_frames_t *frames);
+/* Last frame whose key isn't greater than `key`, 0 if there is none. */
+int mrt_frames_find(const struct mrt_frames_t *frames,
+                    const struct prefix_key_t *key);
+off_t mrt_frames_uncomp_size(const struct mrt_frames_t *frames);
+
+struct mrt_frames_reader_t {
+    const struct mrt_frames_t *frames;
+    streamlike_t *stream;
+    void *dctx;
+    z_stream *zstrm;
+    int next;
+    uint8_t *comp;
+    size_t comp_cap;
+    uint8_t *data;
+    size_t data_cap;
+    size_t data_len;
+    size_t data_off;
+};
+
+int mrt_frames_reader_init(struct mrt_frames_reader_t *reader,
+                           const struct mrt_frames_t *frames,
+                           streamlike_t *stream);
+/* Decompresses frame `idx` whole, `data` stays valid until the next call. */
+long mrt_frames_reader_frame(struct mrt_frames_reader_t *reader, int idx,
+                             const uint8_t **data);
+int mrt_frames_reader_seek_frame(struct mrt_frames_reader_t *reader, int idx);
+/* Reads sequentially from the frame last sought to. */
+long mrt_frames_reader_read(struct mrt_frames_reader_t *reader, void *buffer,
+                            size_t len);
+void mrt_frames_reader_destroy(struct mrt_frames_reader_t *reader);
+
+struct mrt_frames_writer_t {
+    struct mrt_frames_t frames;
+    streamlike_t *stream;
+    int level;
+    void *cctx;
+    z_stream *zstrm;
+    uint8_t *comp;
+    size_t comp_cap;
+    off_t comp_offset;
+    off_t uncomp_offset;
+    int capacity;
+};
+
+/* `level` is the zstd or zlib compression level. */
+int mrt_frames_writer_init(struct mrt_frames_writer_t *writer,
+                           streamlike_t *stream, enum mrt_frames_type_t type,
+                           int level);
+/* `key` is the first RIB prefix of `data`, or NULL if there is none. */
+int mrt_frames_writer_frame(struct mrt_frames_writer_t *writer,
+                            const uint8_t *data, size_t len,
+                            const struct prefix_key_t *key);
+int mrt_frames_writer_set_peer_index_table(struct mrt_frames_writer_t *writer,
+                                           const uint8_t *record, size_t len);
+/* Writes the key and seek tables, or the index members. */
+int mrt_frames_writer_finish(struct mrt_frames_writer_t *writer);
+void mrt_frames_writer_destroy(struct mrt_frames_writer_t *writer);
+
+#endif
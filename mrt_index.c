@@ -0,0 +1,808 @@
+#include "mrt_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    MRT_INDEX_VERSION = 1,
+    MRT_INDEX_HEADER_SIZE = 16,
+    MRT_INDEX_SECTION_HEADER_SIZE = 12,
+    MRT_INDEX_CHECKPOINT_SIZE = 24,
+    MRT_INDEX_WINDOW_ENTRY_SIZE = 20,
+    MRT_INDEX_FILE_SIZE = 16
+};
+
+/* Sections are tagged so later additions can be skipped by older readers. */
+#define MRT_INDEX_MAGIC "MRTX"
+#define MRT_SECTION_CHECKPOINTS "CKPT"
+#define MRT_SECTION_WINDOWS "WIND"
+#define MRT_SECTION_PEER_INDEX_TABLE "PEER"
+#define MRT_SECTION_SIZE "SIZE"
+#define MRT_SECTION_TIMESTAMPS "TIME"
+#define MRT_SECTION_FILE "FILE"
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static int write_all(streamlike_t *stream, const void *data, size_t len) {
+    return sl_write(stream, data, len) == len ? 0 : -1;
+}
+
+static int read_all(streamlike_t *stream, void *data, size_t len) {
+    return sl_read(stream, data, len) == len ? 0 : -1;
+}
+
+static int skip_bytes(streamlike_t *stream, uint64_t len) {
+    uint8_t buffer[4096];
+    while (len > 0) {
+        size_t n = len < sizeof(buffer) ? len : sizeof(buffer);
+        if (read_all(stream, buffer, n) != 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+int mrt_index_init(struct mrt_index_t *index, uint32_t window_size) {
+    index->window_size = window_size;
+    index->count = 0;
+    index->capacity = 0;
+    index->checkpoints = NULL;
+    index->uncomp_size = -1;
+    index->comp_size = -1;
+    index->comp_tail_crc = 0;
+    index->uncomp_crc = 0;
+    index->has_timestamps = 0;
+    index->has_windows = 0;
+    index->packed = NULL;
+    index->packed_len = 0;
+    index->packed_cap = 0;
+    index->peer_index_table = NULL;
+    index->peer_index_table_len = 0;
+    return 0;
+}
+
+void mrt_index_destroy(struct mrt_index_t *index) {
+    for (int i = 0; i < index->count; i++) free(index->checkpoints[i].window);
+    free(index->checkpoints);
+    free(index->packed);
+    free(index->peer_index_table);
+    index->checkpoints = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    index->uncomp_size = -1;
+    index->comp_size = -1;
+    index->comp_tail_crc = 0;
+    index->uncomp_crc = 0;
+    index->has_timestamps = 0;
+    index->has_windows = 0;
+    index->packed = NULL;
+    index->packed_len = 0;
+    index->packed_cap = 0;
+    index->peer_index_table = NULL;
+    index->peer_index_table_len = 0;
+}
+
+static int reserve_checkpoints(struct mrt_index_t *index, int count) {
+    if (count <= index->capacity) return 0;
+    int capacity = index->capacity ? index->capacity : 64;
+    while (capacity < count) capacity *= 2;
+    struct mrt_checkpoint_t *checkpoints =
+        realloc(index->checkpoints, capacity * sizeof(*checkpoints));
+    if (checkpoints == NULL) return -1;
+    index->checkpoints = checkpoints;
+    index->capacity = capacity;
+    return 0;
+}
+
+int mrt_index_add_checkpoint(struct mrt_index_t *index, off_t offset) {
+    if (index->count > 0 &&
+        index->checkpoints[index->count - 1].offset >= offset)
+        return -1;
+    if (reserve_checkpoints(index, index->count + 1) != 0) return -1;
+    index->checkpoints[index->count++] = (struct mrt_checkpoint_t){
+        offset, MRT_INDEX_NO_RECORD, MRT_INDEX_NO_RECORD, 0};
+    return 0;
+}
+
+int mrt_index_set_peer_index_table(struct mrt_index_t *index,
+                                   const uint8_t *record, size_t len) {
+    uint8_t *copy = malloc(len ? len : 1);
+    if (copy == NULL) return -1;
+    memcpy(copy, record, len);
+    free(index->peer_index_table);
+    index->peer_index_table = copy;
+    index->peer_index_table_len = len;
+    return 0;
+}
+
+static uint64_t encode_offset(off_t offset) {
+    return offset < 0 ? UINT64_MAX : (uint64_t)offset;
+}
+
+static off_t decode_offset(uint64_t offset) {
+    return offset == UINT64_MAX ? MRT_INDEX_NO_RECORD : (off_t)offset;
+}
+
+static int export_windows(const struct mrt_index_t *index,
+                          streamlike_t *stream) {
+    uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE + 4];
+    memcpy(section, MRT_SECTION_WINDOWS, 4);
+    uint64_t entries_len =
+        (uint64_t)index->count * MRT_INDEX_WINDOW_ENTRY_SIZE;
+    put_le64(section + 4, 4 + entries_len + index->packed_len);
+    put_le32(section + 12, index->count);
+    if (write_all(stream, section, sizeof(section)) != 0) return -1;
+
+    for (int i = 0; i < index->count; i++) {
+        const struct mrt_checkpoint_t *ckp = &index->checkpoints[i];
+        uint8_t entry[MRT_INDEX_WINDOW_ENTRY_SIZE] = {0};
+        put_le64(entry, ckp->comp_offset);
+        entry[8] = ckp->comp_bits;
+        put_le32(entry + 12, ckp->window_len);
+        put_le32(entry + 16, ckp->packed_len);
+        if (write_all(stream, entry, sizeof(entry)) != 0) return -1;
+    }
+    return write_all(stream, index->packed, index->packed_len);
+}
+
+static int export_peer_index_table(const struct mrt_index_t *index,
+                                   streamlike_t *stream) {
+    uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE];
+    memcpy(section, MRT_SECTION_PEER_INDEX_TABLE, 4);
+    put_le64(section + 4, index->peer_index_table_len);
+    if (write_all(stream, section, sizeof(section)) != 0) return -1;
+    return write_all(stream, index->peer_index_table,
+                     index->peer_index_table_len);
+}
+
+static int export_timestamps(const struct mrt_index_t *index,
+                             streamlike_t *stream) {
+    uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE + 4];
+    memcpy(section, MRT_SECTION_TIMESTAMPS, 4);
+    put_le64(section + 4, 4 + (uint64_t)index->count * 4);
+    put_le32(section + 12, index->count);
+    if (write_all(stream, section, sizeof(section)) != 0) return -1;
+    for (int i = 0; i < index->count; i++) {
+        uint8_t entry[4];
+        put_le32(entry, index->checkpoints[i].next_timestamp);
+        if (write_all(stream, entry, sizeof(entry)) != 0) return -1;
+    }
+    return 0;
+}
+
+static int export_file(const struct mrt_index_t *index, streamlike_t *stream) {
+    uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE + MRT_INDEX_FILE_SIZE];
+    memcpy(section, MRT_SECTION_FILE, 4);
+    put_le64(section + 4, MRT_INDEX_FILE_SIZE);
+    put_le64(section + 12, index->comp_size);
+    put_le32(section + 20, index->comp_tail_crc);
+    put_le32(section + 24, index->uncomp_crc);
+    return write_all(stream, section, sizeof(section));
+}
+
+int mrt_index_export(const struct mrt_index_t *index, streamlike_t *stream) {
+    uint32_t sections = 1 + (index->has_windows != 0) +
+                        (index->peer_index_table != NULL) +
+                        (index->uncomp_size >= 0) +
+                        (index->has_timestamps != 0) +
+                        (index->comp_size >= 0);
+    uint8_t header[MRT_INDEX_HEADER_SIZE];
+    memcpy(header, MRT_INDEX_MAGIC, 4);
+    put_le32(header + 4, MRT_INDEX_VERSION);
+    put_le32(header + 8, index->window_size);
+    put_le32(header + 12, sections);
+    if (write_all(stream, header, sizeof(header)) != 0) return -1;
+
+    uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE + 4];
+    memcpy(section, MRT_SECTION_CHECKPOINTS, 4);
+    put_le64(section + 4,
+             4 + (uint64_t)index->count * MRT_INDEX_CHECKPOINT_SIZE);
+    put_le32(section + 12, index->count);
+    if (write_all(stream, section, sizeof(section)) != 0) return -1;
+
+    for (int i = 0; i < index->count; i++) {
+        const struct mrt_checkpoint_t *ckp = &index->checkpoints[i];
+        uint8_t entry[MRT_INDEX_CHECKPOINT_SIZE];
+        put_le64(entry, encode_offset(ckp->offset));
+        put_le64(entry + 8, encode_offset(ckp->window_record));
+        put_le64(entry + 16, encode_offset(ckp->next_record));
+        if (write_all(stream, entry, sizeof(entry)) != 0) return -1;
+    }
+    if (index->has_windows && export_windows(index, stream) != 0) return -1;
+    if (index->peer_index_table != NULL &&
+        export_peer_index_table(index, stream) != 0)
+        return -1;
+    if (index->uncomp_size >= 0) {
+        uint8_t size[MRT_INDEX_SECTION_HEADER_SIZE + 8];
+        memcpy(size, MRT_SECTION_SIZE, 4);
+        put_le64(size + 4, 8);
+        put_le64(size + 12, index->uncomp_size);
+        if (write_all(stream, size, sizeof(size)) != 0) return -1;
+    }
+    if (index->has_timestamps && export_timestamps(index, stream) != 0)
+        return -1;
+    if (index->comp_size >= 0 && export_file(index, stream) != 0) return -1;
+    return 0;
+}
+
+static int import_checkpoints(struct mrt_index_t *index, streamlike_t *stream,
+                              uint64_t len) {
+    uint8_t count_buf[4];
+    if (len < 4 || read_all(stream, count_buf, 4) != 0) return -1;
+    uint32_t count = get_le32(count_buf);
+    if (count > INT32_MAX ||
+        len != 4 + (uint64_t)count * MRT_INDEX_CHECKPOINT_SIZE)
+        return -1;
+    if (reserve_checkpoints(index, count) != 0) return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t entry[MRT_INDEX_CHECKPOINT_SIZE];
+        if (read_all(stream, entry, sizeof(entry)) != 0) return -1;
+        index->checkpoints[i] = (struct mrt_checkpoint_t){
+            decode_offset(get_le64(entry)), decode_offset(get_le64(entry + 8)),
+            decode_offset(get_le64(entry + 16)), 0};
+    }
+    index->count = count;
+    return 0;
+}
+
+/* Only the deflated windows are read here, they are inflated on first use by
+ * mrt_index_window. */
+static int import_windows(struct mrt_index_t *index, streamlike_t *stream,
+                          uint64_t len) {
+    uint8_t count_buf[4];
+    if (len < 4 || read_all(stream, count_buf, 4) != 0) return -1;
+    uint32_t count = get_le32(count_buf);
+    uint64_t entries_len = (uint64_t)count * MRT_INDEX_WINDOW_ENTRY_SIZE;
+    if (count != (uint32_t)index->count || len < 4 + entries_len) return -1;
+
+    size_t packed_len = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        struct mrt_checkpoint_t *ckp = &index->checkpoints[i];
+        uint8_t entry[MRT_INDEX_WINDOW_ENTRY_SIZE];
+        if (read_all(stream, entry, sizeof(entry)) != 0) return -1;
+        ckp->comp_offset = get_le64(entry);
+        ckp->comp_bits = entry[8];
+        ckp->window_len = get_le32(entry + 12);
+        ckp->packed_len = get_le32(entry + 16);
+        ckp->packed_offset = packed_len;
+        if (ckp->comp_bits > 7 || ckp->window_len > index->window_size)
+            return -1;
+        packed_len += ckp->packed_len;
+    }
+    if (len != 4 + entries_len + packed_len) return -1;
+
+    index->packed = malloc(packed_len ? packed_len : 1);
+    if (index->packed == NULL) return -1;
+    index->packed_len = packed_len;
+    index->packed_cap = packed_len;
+    if (read_all(stream, index->packed, packed_len) != 0) return -1;
+    index->has_windows = 1;
+    return 0;
+}
+
+static int import_peer_index_table(struct mrt_index_t *index,
+                                   streamlike_t *stream, uint64_t len) {
+    if (len > SIZE_MAX) return -1;
+    uint8_t *record = malloc(len ? len : 1);
+    if (record == NULL) return -1;
+    if (read_all(stream, record, len) != 0) {
+        free(record);
+        return -1;
+    }
+    free(index->peer_index_table);
+    index->peer_index_table = record;
+    index->peer_index_table_len = len;
+    return 0;
+}
+
+static int import_size(struct mrt_index_t *index, streamlike_t *stream,
+                       uint64_t len) {
+    uint8_t size[8];
+    if (len != sizeof(size) || read_all(stream, size, sizeof(size)) != 0)
+        return -1;
+    index->uncomp_size = decode_offset(get_le64(size));
+    return 0;
+}
+
+static int import_timestamps(struct mrt_index_t *index, streamlike_t *stream,
+                             uint64_t len) {
+    uint8_t count_buf[4];
+    if (len < 4 || read_all(stream, count_buf, 4) != 0) return -1;
+    uint32_t count = get_le32(count_buf);
+    if (count != (uint32_t)index->count || len != 4 + (uint64_t)count * 4)
+        return -1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t entry[4];
+        if (read_all(stream, entry, sizeof(entry)) != 0) return -1;
+        index->checkpoints[i].next_timestamp = get_le32(entry);
+    }
+    index->has_timestamps = 1;
+    return 0;
+}
+
+static int import_file(struct mrt_index_t *index, streamlike_t *stream,
+                       uint64_t len) {
+    uint8_t file[MRT_INDEX_FILE_SIZE];
+    if (len != sizeof(file) || read_all(stream, file, sizeof(file)) != 0)
+        return -1;
+    index->comp_size = decode_offset(get_le64(file));
+    index->comp_tail_crc = get_le32(file + 8);
+    index->uncomp_crc = get_le32(file + 12);
+    return 0;
+}
+
+int mrt_index_import(struct mrt_index_t *index, streamlike_t *stream) {
+    uint8_t header[MRT_INDEX_HEADER_SIZE];
+    if (read_all(stream, header, sizeof(header)) != 0) return -1;
+    if (memcmp(header, MRT_INDEX_MAGIC, 4) != 0 ||
+        get_le32(header + 4) != MRT_INDEX_VERSION)
+        return -1;
+    index->window_size = get_le32(header + 8);
+    uint32_t sections = get_le32(header + 12);
+
+    for (uint32_t s = 0; s < sections; s++) {
+        uint8_t section[MRT_INDEX_SECTION_HEADER_SIZE];
+        if (read_all(stream, section, sizeof(section)) != 0) return -1;
+        uint64_t len = get_le64(section + 4);
+        int ret;
+        if (!memcmp(section, MRT_SECTION_CHECKPOINTS, 4))
+            ret = import_checkpoints(index, stream, len);
+        else if (!memcmp(section, MRT_SECTION_WINDOWS, 4) &&
+                 !index->has_windows)
+            ret = import_windows(index, stream, len);
+        else if (!memcmp(section, MRT_SECTION_PEER_INDEX_TABLE, 4))
+            ret = import_peer_index_table(index, stream, len);
+        else if (!memcmp(section, MRT_SECTION_SIZE, 4))
+            ret = import_size(index, stream, len);
+        else if (!memcmp(section, MRT_SECTION_TIMESTAMPS, 4))
+            ret = import_timestamps(index, stream, len);
+        else if (!memcmp(section, MRT_SECTION_FILE, 4))
+            ret = import_file(index, stream, len);
+        else
+            ret = skip_bytes(stream, len);
+        if (ret != 0) return -1;
+    }
+    return 0;
+}
+
+char *mrt_index_path(const char *zidx_path) {
+    size_t len = strlen(zidx_path);
+    char *path = malloc(len + sizeof(MRT_INDEX_SUFFIX));
+    if (path == NULL) return NULL;
+    memcpy(path, zidx_path, len);
+    memcpy(path + len, MRT_INDEX_SUFFIX, sizeof(MRT_INDEX_SUFFIX));
+    return path;
+}
+
+int mrt_index_matches(const struct mrt_index_t *index, zidx_index *zidx) {
+    if (zidx_checkpoint_count(zidx) != index->count) return 0;
+    for (int i = 0; i < index->count; i++) {
+        zidx_checkpoint *ckp = zidx_get_checkpoint(zidx, i);
+        if (ckp == NULL ||
+            zidx_get_checkpoint_offset(ckp) != index->checkpoints[i].offset)
+            return 0;
+    }
+    return 1;
+}
+
+off_t mrt_index_window_offset(const struct mrt_index_t *index, int idx,
+                              size_t window_len) {
+    if (idx < 0 || idx >= index->count) return -1;
+    const struct mrt_checkpoint_t *ckp = &index->checkpoints[idx];
+    off_t window_start = ckp->offset - (off_t)window_len;
+    if (ckp->window_record == MRT_INDEX_NO_RECORD ||
+        ckp->window_record < window_start ||
+        ckp->window_record >= ckp->offset)
+        return -1;
+    return ckp->window_record - window_start;
+}
+
+int mrt_index_is_mrt_index(streamlike_t *stream) {
+    uint8_t magic[4];
+    int ret = read_all(stream, magic, sizeof(magic)) == 0 &&
+              !memcmp(magic, MRT_INDEX_MAGIC, sizeof(magic));
+    if (sl_seek(stream, 0, SL_SEEK_SET) != 0) return 0;
+    return ret;
+}
+
+int mrt_index_find_checkpoint(const struct mrt_index_t *index, off_t offset) {
+    int i = 0;
+    int j = index->count;
+    while (i < j) {
+        int k = i + (j - i) / 2;
+        if (index->checkpoints[k].offset <= offset)
+            i = k + 1;
+        else
+            j = k;
+    }
+    return i - 1;
+}
+
+int mrt_index_find_time(const struct mrt_index_t *index, uint32_t timestamp) {
+    /* checkpoints without a next record are all at the end */
+    int i = 0;
+    int j = index->count;
+    while (i < j) {
+        int k = i + (j - i) / 2;
+        const struct mrt_checkpoint_t *ckp = &index->checkpoints[k];
+        if (ckp->next_record != MRT_INDEX_NO_RECORD &&
+            ckp->next_timestamp < timestamp)
+            i = k + 1;
+        else
+            j = k;
+    }
+    return i - 1;
+}
+
+size_t mrt_index_window(struct mrt_index_t *index, int idx,
+                        const void **window) {
+    *window = NULL;
+    if (!index->has_windows || idx < 0 || idx >= index->count) return 0;
+    struct mrt_checkpoint_t *ckp = &index->checkpoints[idx];
+    if (ckp->window == NULL) {
+        uint8_t *data = malloc(ckp->window_len ? ckp->window_len : 1);
+        if (data == NULL) return 0;
+
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (inflateInit2(&strm, -15) != Z_OK) {
+            free(data);
+            return 0;
+        }
+        strm.next_in = index->packed + ckp->packed_offset;
+        strm.avail_in = ckp->packed_len;
+        strm.next_out = data;
+        strm.avail_out = ckp->window_len;
+        int ret = inflate(&strm, Z_FINISH);
+        inflateEnd(&strm);
+        if (ret != Z_STREAM_END || strm.avail_out != 0) {
+            free(data);
+            return 0;
+        }
+        ckp->window = data;
+    }
+    *window = ckp->window;
+    return ckp->window_len;
+}
+
+int mrt_index_tail_crc(streamlike_t *stream, off_t comp_size, uint32_t *crc) {
+    off_t start = comp_size > MRT_INDEX_TAIL_SIZE
+                      ? comp_size - MRT_INDEX_TAIL_SIZE
+                      : 0;
+    uint8_t *tail = malloc(MRT_INDEX_TAIL_SIZE);
+    if (tail == NULL) return -1;
+    int ret = -1;
+    if (sl_seek(stream, start, SL_SEEK_SET) == 0 &&
+        read_all(stream, tail, comp_size - start) == 0) {
+        *crc = crc32(crc32(0, NULL, 0), tail, comp_size - start);
+        ret = 0;
+    }
+    free(tail);
+    return ret;
+}
+
+/* Recently seen RIB or BGP4MP record offsets, oldest first. Covers at least
+ * one window, since a checkpoint may be announced after records in its window
+ * were walked. */
+static void recent_push(struct mrt_index_builder_t *builder, off_t offset) {
+    if (builder->recent_count > builder->recent_mask) {
+        builder->recent_head = (builder->recent_head + 1) & builder->recent_mask;
+        builder->recent_count--;
+    }
+    builder->recent[(builder->recent_head + builder->recent_count++) &
+                    builder->recent_mask] = offset;
+}
+
+static off_t recent_first_at_or_after(struct mrt_index_builder_t *builder,
+                                      off_t offset) {
+    while (builder->recent_count > 0) {
+        off_t r = builder->recent[builder->recent_head];
+        if (r >= offset) return r;
+        builder->recent_head = (builder->recent_head + 1) & builder->recent_mask;
+        builder->recent_count--;
+    }
+    return MRT_INDEX_NO_RECORD;
+}
+
+static off_t window_start(const struct mrt_index_t *index,
+                          const struct mrt_checkpoint_t *ckp) {
+    off_t start = ckp->offset - (off_t)index->window_size;
+    return start < 0 ? 0 : start;
+}
+
+static int builder_record(void *context, off_t offset,
+                          const struct mrt_header_t *header,
+                          const uint8_t *record) {
+    struct mrt_index_builder_t *builder = context;
+    struct mrt_index_t *index = builder->index;
+    builder->record_count++;
+    if (is_tdv2_peer_index_header(header) && index->peer_index_table == NULL)
+        return mrt_index_set_peer_index_table(
+            index, record, sizeof(struct mrt_header_t) + header->length);
+    if (!is_tdv2_rib_header(header) && !is_bgp4mp_header(header)) return 0;
+
+    recent_push(builder, offset);
+    while (builder->unresolved_window < index->count) {
+        struct mrt_checkpoint_t *ckp =
+            &index->checkpoints[builder->unresolved_window];
+        if (offset < window_start(index, ckp)) break;
+        ckp->window_record = offset;
+        builder->unresolved_window++;
+    }
+    while (builder->unresolved_next < index->count) {
+        struct mrt_checkpoint_t *ckp =
+            &index->checkpoints[builder->unresolved_next];
+        if (offset < ckp->offset) break;
+        ckp->next_record = offset;
+        ckp->next_timestamp = header->timestamp;
+        builder->unresolved_next++;
+    }
+    return 0;
+}
+
+int mrt_index_builder_init(struct mrt_index_builder_t *builder,
+                           struct mrt_index_t *index) {
+    /* Smallest RIB record is 19 bytes and BGP4MP ones are larger, so this
+     * bounds records per window. */
+    size_t cap = 64;
+    while (cap < index->window_size / 16 + 2) cap *= 2;
+    builder->recent = malloc(cap * sizeof(*builder->recent));
+    if (builder->recent == NULL) return -1;
+    builder->index = index;
+    builder->record_count = 0;
+    index->has_timestamps = 1;
+    builder->recent_mask = cap - 1;
+    builder->recent_head = 0;
+    builder->recent_count = 0;
+    builder->unresolved_window = index->count;
+    builder->unresolved_next = index->count;
+    builder->history = NULL;
+    builder->history_len = 0;
+    builder->history_head = 0;
+    builder->window = NULL;
+    builder->packed = NULL;
+    builder->packed_cap = 0;
+    mrt_walker_init(&builder->walker, 0, builder_record, builder);
+    return 0;
+}
+
+int mrt_index_builder_capture_windows(struct mrt_index_builder_t *builder,
+                                      int level) {
+    struct mrt_index_t *index = builder->index;
+    memset(&builder->deflater, 0, sizeof(builder->deflater));
+    if (deflateInit2(&builder->deflater, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    builder->packed_cap = deflateBound(&builder->deflater, index->window_size);
+    builder->history = malloc(index->window_size);
+    builder->window = malloc(index->window_size);
+    builder->packed = malloc(builder->packed_cap);
+    if (builder->history == NULL || builder->window == NULL ||
+        builder->packed == NULL)
+        return -1;
+    index->has_windows = 1;
+    return 0;
+}
+
+static int packed_append(struct mrt_index_t *index, const uint8_t *data,
+                         size_t len) {
+    if (index->packed_len + len > index->packed_cap) {
+        size_t cap = index->packed_cap ? index->packed_cap : 1 << 16;
+        while (cap < index->packed_len + len) cap *= 2;
+        uint8_t *packed = realloc(index->packed, cap);
+        if (packed == NULL) return -1;
+        index->packed = packed;
+        index->packed_cap = cap;
+    }
+    memcpy(index->packed + index->packed_len, data, len);
+    index->packed_len += len;
+    return 0;
+}
+
+/* Assembles the window ending at the checkpoint from the history ring and the
+ * tail of the current read, and deflates it on its own. */
+static int capture_window(struct mrt_index_builder_t *builder,
+                          struct mrt_checkpoint_t *ckp, const uint8_t *tail,
+                          size_t tail_len) {
+    struct mrt_index_t *index = builder->index;
+    size_t window_len = ckp->offset < (off_t)index->window_size
+                            ? (size_t)ckp->offset
+                            : index->window_size;
+    size_t from_tail = tail_len < window_len ? tail_len : window_len;
+    size_t from_history = window_len - from_tail;
+    if (from_history > builder->history_len) return -1;
+
+    size_t start = (builder->history_head + index->window_size -
+                    from_history) % index->window_size;
+    size_t first = index->window_size - start;
+    if (first > from_history) first = from_history;
+    memcpy(builder->window, builder->history + start, first);
+    memcpy(builder->window + first, builder->history, from_history - first);
+    memcpy(builder->window + from_history, tail + tail_len - from_tail,
+           from_tail);
+
+    z_stream *strm = &builder->deflater;
+    if (deflateReset(strm) != Z_OK) return -1;
+    strm->next_in = builder->window;
+    strm->avail_in = window_len;
+    strm->next_out = builder->packed;
+    strm->avail_out = builder->packed_cap;
+    if (deflate(strm, Z_FINISH) != Z_STREAM_END) return -1;
+
+    ckp->window_len = window_len;
+    ckp->packed_len = builder->packed_cap - strm->avail_out;
+    ckp->packed_offset = index->packed_len;
+    return packed_append(index, builder->packed, ckp->packed_len);
+}
+
+int mrt_index_builder_checkpoint(struct mrt_index_builder_t *builder,
+                                 off_t offset, off_t comp_offset,
+                                 uint8_t comp_bits, const uint8_t *tail,
+                                 size_t tail_len) {
+    struct mrt_index_t *index = builder->index;
+    if (mrt_index_add_checkpoint(index, offset) != 0) return -1;
+    struct mrt_checkpoint_t *ckp = &index->checkpoints[index->count - 1];
+    ckp->comp_offset = comp_offset;
+    ckp->comp_bits = comp_bits;
+    if (builder->unresolved_window == index->count - 1) {
+        ckp->window_record =
+            recent_first_at_or_after(builder, window_start(index, ckp));
+        if (ckp->window_record != MRT_INDEX_NO_RECORD)
+            builder->unresolved_window++;
+    }
+    if (builder->history != NULL &&
+        capture_window(builder, ckp, tail, tail_len) != 0)
+        return -1;
+    return 0;
+}
+
+static void history_append(struct mrt_index_builder_t *builder,
+                           const uint8_t *data, size_t len) {
+    size_t size = builder->index->window_size;
+    if (len > size) {
+        data += len - size;
+        len = size;
+    }
+    size_t first = size - builder->history_head;
+    if (first > len) first = len;
+    memcpy(builder->history + builder->history_head, data, first);
+    memcpy(builder->history, data + first, len - first);
+    builder->history_head = (builder->history_head + len) % size;
+    builder->history_len += len;
+    if (builder->history_len > size) builder->history_len = size;
+}
+
+int mrt_index_builder_feed(struct mrt_index_builder_t *builder,
+                           const void *data, size_t len) {
+    if (builder->history != NULL) history_append(builder, data, len);
+    return mrt_walker_feed(&builder->walker, data, len);
+}
+
+void mrt_index_builder_resume(struct mrt_index_builder_t *builder,
+                              off_t offset) {
+    struct mrt_index_t *index = builder->index;
+    mrt_walker_reset(&builder->walker, offset);
+    while (builder->unresolved_window > 0 &&
+           index->checkpoints[builder->unresolved_window - 1].window_record ==
+               MRT_INDEX_NO_RECORD)
+        builder->unresolved_window--;
+    while (builder->unresolved_next > 0 &&
+           index->checkpoints[builder->unresolved_next - 1].next_record ==
+               MRT_INDEX_NO_RECORD)
+        builder->unresolved_next--;
+}
+
+void mrt_index_builder_destroy(struct mrt_index_builder_t *builder) {
+    mrt_walker_destroy(&builder->walker);
+    free(builder->recent);
+    builder->recent = NULL;
+    if (builder->packed_cap) deflateEnd(&builder->deflater);
+    free(builder->history);
+    free(builder->window);
+    free(builder->packed);
+    builder->history = NULL;
+    builder->window = NULL;
+    builder->packed = NULL;
+    builder->packed_cap = 0;
+}
+
+off_t mrt_index_builder_position(const struct mrt_index_builder_t *builder) {
+    return builder->walker.offset + (off_t)builder->walker.pending_len;
+}
+
+enum {
+    /* Walked bytes needed before a span's own record density is trusted. */
+    MRT_SPACING_MIN_SAMPLE = 4096
+};
+
+void mrt_spacing_init(struct mrt_spacing_t *spacing,
+                      enum mrt_spacing_type_t type) {
+    memset(spacing, 0, sizeof(*spacing));
+    spacing->type = type;
+    spacing->record_cost = 32;
+}
+
+/* Records per uncompressed byte since the last checkpoint. The walker lags
+ * behind the inflater by at most one read, so the bytes it hasn't seen yet
+ * are assumed to be as dense as the ones it has. */
+static double spacing_density(const struct mrt_spacing_t *spacing,
+                              const struct mrt_index_builder_t *builder) {
+    off_t walked = mrt_index_builder_position(builder) - spacing->last_walked;
+    if (walked < MRT_SPACING_MIN_SAMPLE) return spacing->density;
+    return (double)(builder->record_count - spacing->last_records) / walked;
+}
+
+static double spacing_cost(const struct mrt_spacing_t *spacing, off_t bytes,
+                           double density) {
+    return bytes * (1 + spacing->record_cost * density);
+}
+
+int mrt_spacing_should_checkpoint(struct mrt_spacing_t *spacing,
+                                  const struct mrt_index_builder_t *builder,
+                                  off_t uncomp, off_t comp) {
+    if (spacing->count == 0) return 1;
+
+    double density = spacing_density(spacing, builder);
+    double cost = spacing_cost(spacing, uncomp - spacing->last_uncomp, density);
+    double block_cost =
+        spacing_cost(spacing, uncomp - spacing->last_block_uncomp, density);
+    spacing->last_block_uncomp = uncomp;
+
+    int place = 0;
+    switch (spacing->type) {
+        case MRT_SPACING_UNCOMP:
+            place = uncomp - spacing->last_uncomp >= spacing->span;
+            break;
+        case MRT_SPACING_COMP:
+            place = comp - spacing->last_comp >= spacing->span;
+            break;
+        case MRT_SPACING_LOOKUP_COST:
+            /* Checkpoints only fit on block boundaries, so stop before the
+             * next block would likely push the span over the limit. */
+            place = cost + block_cost > spacing->max_lookup_cost;
+            break;
+        case MRT_SPACING_INDEX_SIZE: {
+            int left = spacing->max_checkpoints - spacing->count;
+            if (left <= 0 || comp <= 0) break;
+            double rate = (spacing->placed_cost + cost) / comp;
+            double remaining = rate * (spacing->comp_size - comp);
+            place = cost >= (remaining + cost) / (left + 1);
+            break;
+        }
+    }
+    return place;
+}
+
+void mrt_spacing_placed(struct mrt_spacing_t *spacing,
+                        const struct mrt_index_builder_t *builder,
+                        off_t uncomp, off_t comp) {
+    if (spacing->count > 0) {
+        double density = spacing_density(spacing, builder);
+        spacing->placed_cost +=
+            spacing_cost(spacing, uncomp - spacing->last_uncomp, density);
+        spacing->density = density;
+    }
+    spacing->count++;
+    spacing->last_uncomp = uncomp;
+    spacing->last_comp = comp;
+    spacing->last_block_uncomp = uncomp;
+    spacing->last_walked = mrt_index_builder_position(builder);
+    spacing->last_records = builder->record_count;
+}
@@ -0,0 +1,196 @@
+#ifndef MRT_INDEX_H
+#define MRT_INDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <streamlike.h>
+#include <zidx.h>
+#include <zlib.h>
+
+#include "mrt_walker.h"
+
+/* Sidecar index stored next to a zidx index as "<index-file>.mrtx". It knows
+ * where MRT records start around every zidx checkpoint, so lookups don't have
+ * to rediscover record boundaries inside checkpoint windows heuristically.
+ *
+ * Built with windows, it is a self-contained replacement for the zidx index:
+ * every checkpoint then also carries its compressed stream position and its
+ * dictionary window, deflated independently so a window is only inflated
+ * when a probe or seek touches it. */
+
+#define MRT_INDEX_SUFFIX ".mrtx"
+#define MRT_INDEX_NO_RECORD ((off_t)-1)
+#define MRT_INDEX_TAIL_SIZE (64 * 1024)
+
+struct mrt_checkpoint_t {
+    /* Uncompressed offset of the matching zidx checkpoint. */
+    off_t offset;
+    /* First RIB or BGP4MP record starting at or after
+     * `offset - window_size`. */
+    off_t window_record;
+    /* First RIB or BGP4MP record starting at or after `offset`. */
+    off_t next_record;
+    /* MRT timestamp of `next_record`, only set if the index has timestamps. */
+    uint32_t next_timestamp;
+
+    /* Only set when the index has windows. Like zidx, `comp_offset` is the
+     * next compressed byte and `comp_bits` the bits of the byte before it
+     * still to be consumed. */
+    off_t comp_offset;
+    uint8_t comp_bits;
+    uint32_t window_len;
+    uint32_t packed_len;
+    size_t packed_offset;
+    uint8_t *window;
+};
+
+struct mrt_index_t {
+    uint32_t window_size;
+    int count;
+    int capacity;
+    struct mrt_checkpoint_t *checkpoints;
+
+    /* Total uncompressed size, -1 if unknown. */
+    off_t uncomp_size;
+
+    /* The compressed file the index was built over: its size, -1 if unknown,
+     * the CRC-32 of its last MRT_INDEX_TAIL_SIZE bytes and that of all of its
+     * uncompressed bytes. They tell whether a file that has grown since still
+     * starts with the indexed one, so the index can be extended over the
+     * gzip members appended to it, see zidx -e. */
+    off_t comp_size;
+    uint32_t comp_tail_crc;
+    uint32_t uncomp_crc;
+
+    /* Indexes built before timestamps were recorded don't have them. */
+    int has_timestamps;
+
+    int has_windows;
+    uint8_t *packed;
+    size_t packed_len;
+    size_t packed_cap;
+
+    /* Copy of the PEER_INDEX_TABLE record, header included, so peer indexes
+     * of RIB entries resolve without reading the head of the file. */
+    uint8_t *peer_index_table;
+    size_t peer_index_table_len;
+};
+
+int mrt_index_init(struct mrt_index_t *index, uint32_t window_size);
+void mrt_index_destroy(struct mrt_index_t *index);
+int mrt_index_add_checkpoint(struct mrt_index_t *index, off_t offset);
+int mrt_index_set_peer_index_table(struct mrt_index_t *index,
+                                   const uint8_t *record, size_t len);
+int mrt_index_import(struct mrt_index_t *index, streamlike_t *stream);
+int mrt_index_export(const struct mrt_index_t *index, streamlike_t *stream);
+char *mrt_index_path(const char *zidx_path);
+int mrt_index_matches(const struct mrt_index_t *index, zidx_index *zidx);
+off_t mrt_index_window_offset(const struct mrt_index_t *index, int idx,
+                              size_t window_len);
+int mrt_index_is_mrt_index(streamlike_t *stream);
+int mrt_index_find_checkpoint(const struct mrt_index_t *index, off_t offset);
+/* Last checkpoint whose next record is older than `timestamp`, -1 if there is
+ * none. For files ordered by time, like BGP4MP updates, a scan from its
+ * `next_record` sees every record at or after `timestamp`. */
+int mrt_index_find_time(const struct mrt_index_t *index, uint32_t timestamp);
+size_t mrt_index_window(struct mrt_index_t *index, int idx,
+                        const void **window);
+/* CRC-32 of the MRT_INDEX_TAIL_SIZE bytes of `stream` before `comp_size`, or
+ * of all of them if there are fewer. Leaves the stream anywhere. */
+int mrt_index_tail_crc(streamlike_t *stream, off_t comp_size, uint32_t *crc);
+
+/* Fills in record offsets while the stream is inflated once. Checkpoints are
+ * announced with mrt_index_builder_checkpoint as the inflater reaches them,
+ * and the uncompressed bytes are passed through mrt_index_builder_feed.
+ *
+ * After mrt_index_builder_capture_windows the builder also stores the window
+ * of every checkpoint. Since checkpoints are usually reached in the middle of
+ * a read, the bytes inflated by that read up to the checkpoint, which haven't
+ * been fed yet, are passed as `tail`. */
+struct mrt_index_builder_t {
+    struct mrt_index_t *index;
+    struct mrt_walker_t walker;
+    uint64_t record_count;
+    off_t *recent;
+    size_t recent_mask;
+    size_t recent_head;
+    size_t recent_count;
+    int unresolved_window;
+    int unresolved_next;
+
+    /* Last window_size bytes fed, only kept while capturing windows. */
+    uint8_t *history;
+    size_t history_len;
+    size_t history_head;
+    uint8_t *window;
+    uint8_t *packed;
+    size_t packed_cap;
+    z_stream deflater;
+};
+
+int mrt_index_builder_init(struct mrt_index_builder_t *builder,
+                           struct mrt_index_t *index);
+int mrt_index_builder_capture_windows(struct mrt_index_builder_t *builder,
+                                      int level);
+int mrt_index_builder_checkpoint(struct mrt_index_builder_t *builder,
+                                 off_t offset, off_t comp_offset,
+                                 uint8_t comp_bits, const uint8_t *tail,
+                                 size_t tail_len);
+int mrt_index_builder_feed(struct mrt_index_builder_t *builder,
+                           const void *data, size_t len);
+/* Continues an imported index with the records fed from `offset` on, which
+ * has to be where a record starts. Checkpoints no record was found after yet
+ * get theirs from those records. */
+void mrt_index_builder_resume(struct mrt_index_builder_t *builder,
+                              off_t offset);
+void mrt_index_builder_destroy(struct mrt_index_builder_t *builder);
+off_t mrt_index_builder_position(const struct mrt_index_builder_t *builder);
+
+/* Decides at which deflate block boundaries checkpoints are placed.
+ *
+ * MRT_SPACING_UNCOMP and MRT_SPACING_COMP are the fixed spans of
+ * zidx_build_index. The other two estimate the cost of a lookup that lands
+ * between two checkpoints as the bytes inflated plus `record_cost` bytes for
+ * every record parsed on the way, so spans get shorter where records are
+ * dense:
+ *
+ * MRT_SPACING_LOOKUP_COST keeps that cost under `max_lookup_cost`.
+ * MRT_SPACING_INDEX_SIZE spends at most `max_checkpoints` checkpoints and
+ * spreads them so that every span costs about the same, extrapolating the
+ * cost of the rest of the file from the compressed bytes left. */
+enum mrt_spacing_type_t {
+    MRT_SPACING_UNCOMP,
+    MRT_SPACING_COMP,
+    MRT_SPACING_LOOKUP_COST,
+    MRT_SPACING_INDEX_SIZE
+};
+
+struct mrt_spacing_t {
+    enum mrt_spacing_type_t type;
+    off_t span;
+    double max_lookup_cost;
+    int max_checkpoints;
+    double record_cost;
+    off_t comp_size;
+
+    int count;
+    off_t last_uncomp;
+    off_t last_comp;
+    off_t last_walked;
+    uint64_t last_records;
+    double density;
+    double placed_cost;
+    off_t last_block_uncomp;
+};
+
+void mrt_spacing_init(struct mrt_spacing_t *spacing,
+                      enum mrt_spacing_type_t type);
+int mrt_spacing_should_checkpoint(struct mrt_spacing_t *spacing,
+                                  const struct mrt_index_builder_t *builder,
+                                  off_t uncomp, off_t comp);
+void mrt_spacing_placed(struct mrt_spacing_t *spacing,
+                        const struct mrt_index_builder_t *builder,
+                        off_t uncomp, off_t comp);
+
+#endif
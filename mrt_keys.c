@@ -0,0 +1,101 @@
+#include "mrt_keys.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <arpa/inet.h>
+
+/* splitmix64, enough for sampling and cheap to seed per span. */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void mrt_keys_init(struct mrt_keys_t *keys, size_t sample, uint64_t seed) {
+    keys->keys = NULL;
+    keys->count = 0;
+    keys->capacity = 0;
+    keys->seen = 0;
+    keys->sample = sample;
+    keys->rng = seed;
+}
+
+static int reserve(struct mrt_keys_t *keys, size_t count) {
+    if (count <= keys->capacity) return 0;
+    size_t capacity = keys->capacity ? keys->capacity : 4096;
+    while (capacity < count) capacity *= 2;
+    if (keys->sample && capacity > keys->sample) capacity = keys->sample;
+    struct prefix_key_t *grown =
+        realloc(keys->keys, capacity * sizeof(*grown));
+    if (grown == NULL) return -1;
+    keys->keys = grown;
+    keys->capacity = capacity;
+    return 0;
+}
+
+int mrt_keys_add(struct mrt_keys_t *keys, const struct prefix_key_t *key) {
+    keys->seen++;
+    if (keys->sample == 0 || keys->count < keys->sample) {
+        if (reserve(keys, keys->count + 1) != 0) return -1;
+        keys->keys[keys->count++] = *key;
+        return 0;
+    }
+    // Algorithm R: the n-th key replaces a kept one with probability k/n
+    uint64_t slot = next_random(&keys->rng) % keys->seen;
+    if (slot < keys->sample) keys->keys[slot] = *key;
+    return 0;
+}
+
+void mrt_keys_destroy(struct mrt_keys_t *keys) {
+    free(keys->keys);
+    keys->keys = NULL;
+    keys->count = 0;
+    keys->capacity = 0;
+}
+
+static int key_cmp(const void *lhs, const void *rhs) {
+    return prefix_key_cmp(lhs, rhs);
+}
+
+long mrt_keys_merge_samples(struct mrt_keys_t *parts, int count, size_t sample,
+                            uint64_t seed, struct prefix_key_t **out) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) total += parts[i].seen;
+    if (total < sample) sample = total;
+    *out = malloc((sample ? sample : 1) * sizeof(**out));
+    if (*out == NULL) return -1;
+
+    /* Every draw picks a span with probability proportional to the keys it
+     * has left, then one of its kept keys. A span's sample is uniform over
+     * its keys, so drawing from it without replacement is as well. */
+    for (size_t drawn = 0; drawn < sample; drawn++) {
+        uint64_t pick = next_random(&seed) % total;
+        int i = 0;
+        while (pick >= parts[i].seen) pick -= parts[i++].seen;
+        struct mrt_keys_t *part = &parts[i];
+        size_t slot = next_random(&seed) % part->count;
+        (*out)[drawn] = part->keys[slot];
+        part->keys[slot] = part->keys[--part->count];
+        part->seen--;
+        total--;
+    }
+    qsort(*out, sample, sizeof(**out), key_cmp);
+    return sample;
+}
+
+int mrt_key_format(const struct prefix_key_t *key, char *text) {
+    if (!inet_ntop(key->afi ? AF_INET6 : AF_INET, key->addr, text,
+                   INET6_ADDRSTRLEN))
+        return -1;
+    size_t len = strlen(text);
+    // at most three digits, cheaper than another printf per key
+    text[len++] = '/';
+    if (key->len >= 100) text[len++] = '0' + key->len / 100;
+    if (key->len >= 10) text[len++] = '0' + key->len / 10 % 10;
+    text[len++] = '0' + key->len % 10;
+    text[len] = '\0';
+    return len;
+}
@@ -0,0 +1,43 @@
+#ifndef MRT_KEYS_H
+#define MRT_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "find_prefix.h"
+
+/* Prefix keys of RIB records, collected one span of a file at a time. With
+ * `sample` set, only a uniform random sample of that many keys is kept, by
+ * reservoir sampling, and the samples of all spans are merged into one for
+ * the whole file with mrt_keys_merge_samples.
+ *
+ * Binary output is the keys as they are in memory, i.e. 18 bytes each: the
+ * AFI (0 for IPv4, 1 for IPv6), 16 address bytes with the host bits cleared
+ * and the prefix length. Sorting them as byte strings sorts them like RIBs
+ * are. */
+struct mrt_keys_t {
+    struct prefix_key_t *keys;
+    size_t count;
+    size_t capacity;
+    /* Keys passed to mrt_keys_add, kept or not. */
+    uint64_t seen;
+    size_t sample;
+    uint64_t rng;
+};
+
+#define MRT_KEY_TEXT_SIZE 44
+
+/* `sample` is 0 to keep every key. */
+void mrt_keys_init(struct mrt_keys_t *keys, size_t sample, uint64_t seed);
+int mrt_keys_add(struct mrt_keys_t *keys, const struct prefix_key_t *key);
+void mrt_keys_destroy(struct mrt_keys_t *keys);
+/* Draws `sample` keys uniformly from all keys seen by `parts`, given each
+ * kept a sample of that size, into `out` in RIB order. Returns the number of
+ * keys drawn, -1 on failure. Empties the samples of `parts`. */
+long mrt_keys_merge_samples(struct mrt_keys_t *parts, int count, size_t sample,
+                            uint64_t seed, struct prefix_key_t **out);
+/* Writes "<address>/<length>" and a NUL into `text`, which holds at least
+ * MRT_KEY_TEXT_SIZE bytes, returns the length written. */
+int mrt_key_format(const struct prefix_key_t *key, char *text);
+
+#endif
@@ -0,0 +1,100 @@
+#include "mrt_peers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <arpa/inet.h>
+
+//
+#include "mrt_attributes.h"
+
+enum {
+    PEER_TYPE_IPV6 = 0x01,
+    PEER_TYPE_AS4 = 0x02
+};
+
+int mrt_peer_table_parse(struct mrt_peer_table_t *table, const uint8_t *record,
+                         size_t len) {
+    table->count = 0;
+    table->peers = NULL;
+    if (len < MRT_HEADER_SIZE + 8) return -1;
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    const uint8_t *end = record + len;
+
+    memcpy(table->collector_bgp_id, p, 4);
+    size_t view_name_len = get_be16(p + 4);
+    p += 6;
+    if ((size_t)(end - p) < view_name_len + 2) return -1;
+    p += view_name_len;
+    int count = get_be16(p);
+    p += 2;
+
+    table->peers = calloc(count ? count : 1, sizeof(*table->peers));
+    if (table->peers == NULL) return -1;
+    for (int i = 0; i < count; i++) {
+        struct mrt_peer_t *peer = &table->peers[i];
+        if (end - p < 5) goto fail;
+        uint8_t type = p[0];
+        memcpy(peer->bgp_id, p + 1, 4);
+        p += 5;
+
+        size_t ip_len = type & PEER_TYPE_IPV6 ? 16 : 4;
+        size_t asn_len = type & PEER_TYPE_AS4 ? 4 : 2;
+        if ((size_t)(end - p) < ip_len + asn_len) goto fail;
+        peer->is_ipv6 = (type & PEER_TYPE_IPV6) != 0;
+        memcpy(peer->ip, p, ip_len);
+        p += ip_len;
+        peer->asn = asn_len == 4 ? get_be32(p) : get_be16(p);
+        p += asn_len;
+    }
+    table->count = count;
+    return 0;
+
+fail:
+    mrt_peer_table_destroy(table);
+    return -1;
+}
+
+void mrt_peer_table_destroy(struct mrt_peer_table_t *table) {
+    free(table->peers);
+    table->peers = NULL;
+    table->count = 0;
+}
+
+int mrt_peer_table_print_rib(const struct mrt_peer_table_t *table,
+                             const uint8_t *record, size_t len) {
+    const uint8_t *end = record + len;
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    if (len < MRT_HEADER_SIZE + 5) return -1;
+    p += 4;  // sequence number
+    size_t prefix_bytes = (*p + 7) / 8;
+    p += 1 + prefix_bytes;
+    if (end - p < 2) return -1;
+    int entry_count = get_be16(p);
+    p += 2;
+
+    for (int i = 0; i < entry_count; i++) {
+        if (end - p < 8) return -1;
+        int peer_index = get_be16(p);
+        size_t attr_len = get_be16(p + 6);
+        p += 8;
+        if ((size_t)(end - p) < attr_len) return -1;
+        p += attr_len;
+
+        if (peer_index >= table->count) {
+            printf("peer_index %d: unknown\n", peer_index);
+            continue;
+        }
+        const struct mrt_peer_t *peer = &table->peers[peer_index];
+        char ip[INET6_ADDRSTRLEN];
+        char bgp_id[INET_ADDRSTRLEN];
+        inet_ntop(peer->is_ipv6 ? AF_INET6 : AF_INET, peer->ip, ip,
+                  sizeof(ip));
+        inet_ntop(AF_INET, peer->bgp_id, bgp_id, sizeof(bgp_id));
+        printf("peer_index %d: %s AS%u bgp_id %s\n", peer_index, ip,
+               (unsigned)peer->asn, bgp_id);
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef MRT_PEERS_H
+#define MRT_PEERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Peers of a TABLE_DUMP_V2 PEER_INDEX_TABLE, which RIB entries refer to by
+ * position. */
+struct mrt_peer_t {
+    uint8_t bgp_id[4];
+    int is_ipv6;
+    uint8_t ip[16];
+    uint32_t asn;
+};
+
+struct mrt_peer_table_t {
+    uint8_t collector_bgp_id[4];
+    int count;
+    struct mrt_peer_t *peers;
+};
+
+/* `record` is the whole MRT record, header included. */
+int mrt_peer_table_parse(struct mrt_peer_table_t *table, const uint8_t *record,
+                         size_t len);
+void mrt_peer_table_destroy(struct mrt_peer_table_t *table);
+/* Prints the peer of every entry of a RIB record. */
+int mrt_peer_table_print_rib(const struct mrt_peer_table_t *table,
+                             const uint8_t *record, size_t len);
+
+#endif
@@ -0,0 +1,144 @@
+#include "mrt_reader.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapped_input.h"
+
+enum {
+    MRT_READER_INPUT_SIZE = 1 << 16,
+    /* Automatic gzip or zlib header detection, see inflateInit2. */
+    MRT_READER_WINDOW_BITS = 15 + 32,
+    GZIP_TRAILER_SIZE = 8
+};
+
+int mrt_reader_init(struct mrt_reader_t *reader, streamlike_t *stream,
+                    struct mrt_index_t *index) {
+    memset(reader, 0, sizeof(*reader));
+    reader->stream = stream;
+    reader->index = index;
+    reader->input_size = MRT_READER_INPUT_SIZE;
+    reader->mapped = mapped_input_data(stream, &reader->mapped_len);
+    reader->input = malloc(reader->input_size);
+    if (reader->input == NULL) return -1;
+    if (inflateInit2(&reader->strm, MRT_READER_WINDOW_BITS) != Z_OK) {
+        free(reader->input);
+        reader->input = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void refill(struct mrt_reader_t *reader) {
+    if (reader->strm.avail_in > 0 || reader->eof) return;
+    if (reader->mapped) {
+        size_t n = reader->mapped_len - reader->mapped_pos;
+        if (n > UINT_MAX) n = UINT_MAX;
+        if (n == 0) reader->eof = 1;
+        reader->strm.next_in = (Bytef *)reader->mapped + reader->mapped_pos;
+        reader->strm.avail_in = n;
+        reader->mapped_pos += n;
+        return;
+    }
+    size_t n = sl_read(reader->stream, reader->input, reader->input_size);
+    if (n == 0) reader->eof = 1;
+    reader->strm.next_in = reader->input;
+    reader->strm.avail_in = n;
+}
+
+static int restart(struct mrt_reader_t *reader, off_t comp_offset,
+                   int window_bits) {
+    // seeking a mapped stream still hints the pages that come next
+    if (sl_seek(reader->stream, comp_offset, SL_SEEK_SET) != 0) return -1;
+    reader->mapped_pos = comp_offset;
+    if (inflateReset2(&reader->strm, window_bits) != Z_OK) return -1;
+    reader->strm.avail_in = 0;
+    reader->raw = window_bits < 0;
+    reader->skip = 0;
+    reader->eof = 0;
+    return 0;
+}
+
+long mrt_reader_read(struct mrt_reader_t *reader, void *buffer, size_t len) {
+    z_stream *strm = &reader->strm;
+    strm->next_out = buffer;
+    strm->avail_out = len;
+
+    while (strm->avail_out > 0) {
+        refill(reader);
+        if (strm->avail_in == 0) break;
+        if (reader->skip > 0) {
+            size_t n = reader->skip < strm->avail_in ? reader->skip
+                                                     : strm->avail_in;
+            strm->next_in += n;
+            strm->avail_in -= n;
+            reader->skip -= n;
+            continue;
+        }
+
+        int ret = inflate(strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // continue with the next member, if any
+            if (reader->raw) reader->skip = GZIP_TRAILER_SIZE;
+            reader->raw = 0;
+            if (inflateReset2(strm, MRT_READER_WINDOW_BITS) != Z_OK) return -1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return -1;
+        }
+    }
+
+    long produced = len - strm->avail_out;
+    reader->offset += produced;
+    return produced;
+}
+
+int mrt_reader_seek(struct mrt_reader_t *reader, off_t offset) {
+    struct mrt_index_t *index = reader->index;
+    int idx = mrt_index_find_checkpoint(index, offset);
+    const struct mrt_checkpoint_t *ckp =
+        idx >= 0 ? &index->checkpoints[idx] : NULL;
+
+    if (offset >= reader->offset &&
+        (ckp == NULL || ckp->offset <= reader->offset)) {
+        // no checkpoint gets closer than where we already are
+    } else if (ckp == NULL || ckp->offset == 0) {
+        if (restart(reader, 0, MRT_READER_WINDOW_BITS) != 0) return -1;
+        reader->offset = 0;
+    } else {
+        const void *window;
+        size_t window_len = mrt_index_window(index, idx, &window);
+        if (window == NULL) return -1;
+
+        /* Like zran, a checkpoint in the middle of a byte starts one byte
+         * early with the remaining bits primed. */
+        int bits = ckp->comp_bits;
+        if (restart(reader, ckp->comp_offset - (bits ? 1 : 0), -15) != 0)
+            return -1;
+        if (bits) {
+            refill(reader);
+            if (reader->strm.avail_in == 0) return -1;
+            int byte = *reader->strm.next_in++;
+            reader->strm.avail_in--;
+            if (inflatePrime(&reader->strm, bits, byte >> (8 - bits)) != Z_OK)
+                return -1;
+        }
+        if (inflateSetDictionary(&reader->strm, window, window_len) != Z_OK)
+            return -1;
+        reader->offset = ckp->offset;
+    }
+
+    uint8_t discard[1 << 14];
+    while (reader->offset < offset) {
+        size_t n = offset - reader->offset;
+        if (n > sizeof(discard)) n = sizeof(discard);
+        if (mrt_reader_read(reader, discard, n) <= 0) return -1;
+    }
+    return 0;
+}
+
+void mrt_reader_destroy(struct mrt_reader_t *reader) {
+    if (reader->input != NULL) inflateEnd(&reader->strm);
+    free(reader->input);
+    reader->input = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef MRT_READER_H
+#define MRT_READER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <streamlike.h>
+#include <zlib.h>
+
+#include "mrt_index.h"
+
+/* Random access into a gzipped MRT file through a self-contained MRT index,
+ * i.e. one built with windows. It plays the part zidx_seek and zidx_read play
+ * for a zidx index, inflating a checkpoint's window only when seeking to it. */
+struct mrt_reader_t {
+    streamlike_t *stream;
+    struct mrt_index_t *index;
+    z_stream strm;
+    /* Set while inflating a raw deflate stream resumed from a checkpoint, in
+     * which case the gzip trailer has to be skipped by hand. */
+    int raw;
+    size_t skip;
+    int eof;
+    off_t offset;
+    uint8_t *input;
+    size_t input_size;
+    /* Set for streams from mapped_input_open, which are inflated in place
+     * instead of being read into `input`. */
+    const uint8_t *mapped;
+    size_t mapped_len;
+    size_t mapped_pos;
+};
+
+int mrt_reader_init(struct mrt_reader_t *reader, streamlike_t *stream,
+                    struct mrt_index_t *index);
+int mrt_reader_seek(struct mrt_reader_t *reader, off_t offset);
+long mrt_reader_read(struct mrt_reader_t *reader, void *buffer, size_t len);
+void mrt_reader_destroy(struct mrt_reader_t *reader);
+
+#endif
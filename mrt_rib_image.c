@@ -0,0 +1,678 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mrt_rib_image.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#include "mrt_attributes.h"
+
+enum {
+    TABLE_DUMP_V2 = 13,
+    TABLE_DUMP_V2_PEER_INDEX_TABLE = 1,
+    TABLE_DUMP_V2_RIB_IPV4_UNICAST = 2,
+    TABLE_DUMP_V2_RIB_IPV6_UNICAST = 4,
+    IMAGE_VERSION = 1,
+    IMAGE_HEADER_SIZE = 64,
+    IMAGE_ALIGNMENT = 64,
+    IMAGE_INITIAL_TABLE_SIZE = 1 << 12,
+    /* Levels needed for 128 bits. */
+    TRIE_MAX_DEPTH = (128 + MRT_RIB_IMAGE_STRIDE - 1) / MRT_RIB_IMAGE_STRIDE
+};
+
+#define IMAGE_MAGIC 0x49584650 /* "PFXI" */
+#define IMAGE_BYTE_ORDER 0x01020304U
+
+struct image_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t route_count;
+    uint32_t entry_count;
+    uint32_t attribute_count;
+    uint32_t node_count;
+    uint32_t leaf_count;
+    uint32_t roots[2];
+    uint64_t arena_len;
+    uint64_t peer_index_table_len;
+};
+
+/* Offsets of the sections following the header, each starting at
+ * IMAGE_ALIGNMENT so nodes don't straddle more cache lines than needed. */
+struct image_layout_t {
+    size_t routes;
+    size_t entries;
+    size_t attribute_offsets;
+    size_t arena;
+    size_t nodes;
+    size_t leaves;
+    size_t peer_index_table;
+    size_t size;
+};
+
+static uint64_t get_be64(const uint8_t *p) {
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+static void put_be16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (24 - 8 * i);
+}
+
+static uint64_t fnv1a(const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static size_t align_up(size_t offset) {
+    return (offset + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+}
+
+static void layout(const struct image_header_t *header,
+                   struct image_layout_t *l) {
+    l->routes = IMAGE_HEADER_SIZE;
+    l->entries = align_up(
+        l->routes +
+        (size_t)header->route_count * sizeof(struct mrt_rib_image_route_t));
+    l->attribute_offsets = align_up(
+        l->entries +
+        (size_t)header->entry_count * sizeof(struct mrt_rib_image_entry_t));
+    l->arena = align_up(l->attribute_offsets +
+                        ((size_t)header->attribute_count + 1) *
+                            sizeof(uint64_t));
+    l->nodes = align_up(l->arena + header->arena_len);
+    l->leaves = align_up(
+        l->nodes +
+        (size_t)header->node_count * sizeof(struct mrt_rib_image_node_t));
+    l->peer_index_table =
+        align_up(l->leaves + (size_t)header->leaf_count * sizeof(uint32_t));
+    l->size = l->peer_index_table + header->peer_index_table_len;
+}
+
+/* The 6 bits of a 128 bit address, given as its two big-endian halves, that
+ * select the slot at `depth`. Addresses are zero past their last bit. */
+static inline unsigned trie_slot(uint64_t hi, uint64_t lo, int depth) {
+    int bit = depth * MRT_RIB_IMAGE_STRIDE;
+    if (bit + MRT_RIB_IMAGE_STRIDE <= 64) return hi >> (58 - bit) & 63;
+    if (bit < 64) return (hi << (bit - 58) | lo >> (122 - bit)) & 63;
+    bit -= 64;
+    if (bit + MRT_RIB_IMAGE_STRIDE <= 64) return lo >> (58 - bit) & 63;
+    return lo << (bit - 58) & 63;
+}
+
+/* Bits of `vector` up to and including `slot`. */
+static inline int rank(uint64_t vector, unsigned slot) {
+    return __builtin_popcountll(vector & ((2ULL << slot) - 1));
+}
+
+void mrt_rib_image_builder_init(struct mrt_rib_image_builder_t *builder) {
+    memset(builder, 0, sizeof(*builder));
+}
+
+static int grow(void **data, size_t *cap, size_t needed, size_t elem_size) {
+    if (needed <= *cap) return 0;
+    size_t new_cap = *cap ? *cap : 1024;
+    while (new_cap < needed) new_cap *= 2;
+    void *grown = realloc(*data, new_cap * elem_size);
+    if (grown == NULL) return -1;
+    *data = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static size_t attribute_len(const struct mrt_rib_image_builder_t *builder,
+                            size_t id) {
+    size_t end = id + 1 < builder->attribute_count
+                     ? builder->attribute_offsets[id + 1]
+                     : builder->arena_len;
+    return end - builder->attribute_offsets[id];
+}
+
+static uint32_t *find_attributes(uint32_t *table, size_t size,
+                                 const struct mrt_rib_image_builder_t *builder,
+                                 const uint8_t *p, size_t len,
+                                 uint64_t hash) {
+    size_t i = hash & (size - 1);
+    while (table[i] != 0) {
+        size_t id = table[i] - 1;
+        if (attribute_len(builder, id) == len &&
+            memcmp(builder->arena + builder->attribute_offsets[id], p, len) ==
+                0)
+            break;
+        i = (i + 1) & (size - 1);
+    }
+    return &table[i];
+}
+
+static int grow_table(struct mrt_rib_image_builder_t *builder) {
+    size_t size = builder->table_size ? builder->table_size * 2
+                                      : IMAGE_INITIAL_TABLE_SIZE;
+    uint32_t *table = calloc(size, sizeof(*table));
+    if (table == NULL) return -1;
+    for (size_t id = 0; id < builder->attribute_count; id++) {
+        const uint8_t *p = builder->arena + builder->attribute_offsets[id];
+        size_t len = attribute_len(builder, id);
+        *find_attributes(table, size, builder, p, len, fnv1a(p, len)) = id + 1;
+    }
+    free(builder->table);
+    builder->table = table;
+    builder->table_size = size;
+    return 0;
+}
+
+/* Returns the id of the attribute set `p`, copying it into the arena if it
+ * wasn't seen before, or -1 if memory runs out. */
+static long intern_attributes(struct mrt_rib_image_builder_t *builder,
+                              const uint8_t *p, size_t len) {
+    // keep the load under a half
+    if (2 * (builder->attribute_count + 1) > builder->table_size &&
+        grow_table(builder) != 0)
+        return -1;
+    uint64_t hash = fnv1a(p, len);
+    uint32_t *slot =
+        find_attributes(builder->table, builder->table_size, builder, p, len,
+                        hash);
+    if (*slot != 0) return *slot - 1;
+
+    if (builder->attribute_count >= UINT32_MAX - 1 ||
+        grow((void **)&builder->arena, &builder->arena_cap,
+             builder->arena_len + len, 1) != 0 ||
+        grow((void **)&builder->attribute_offsets, &builder->attribute_cap,
+             builder->attribute_count + 1, sizeof(uint64_t)) != 0)
+        return -1;
+    builder->attribute_offsets[builder->attribute_count] = builder->arena_len;
+    memcpy(builder->arena + builder->arena_len, p, len);
+    builder->arena_len += len;
+    *slot = ++builder->attribute_count;
+    return *slot - 1;
+}
+
+static int add_rib(struct mrt_rib_image_builder_t *builder,
+                   const struct mrt_header_t *header, const uint8_t *record,
+                   size_t len) {
+    int is_ipv6 = header->subtype >= TABLE_DUMP_V2_RIB_IPV6_UNICAST;
+    const uint8_t *end = record + len;
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    if (len < MRT_HEADER_SIZE + 5) return -1;
+    size_t prefix_len = p[4];
+    size_t prefix_bytes = (prefix_len + 7) / 8;
+    if (prefix_len > (is_ipv6 ? 128 : 32) ||
+        (size_t)(end - p) < 5 + prefix_bytes + 2)
+        return -1;
+
+    struct mrt_rib_image_route_t route;
+    memset(&route, 0, sizeof(route));
+    route.key.afi = is_ipv6 ? AFI_TYPE_IPV6 : AFI_TYPE_IPV4;
+    route.key.len = prefix_len;
+    memcpy(route.key.addr, p + 5, prefix_bytes);
+    if (prefix_len % 8)
+        route.key.addr[prefix_bytes - 1] &= 0xFFU << (8 - prefix_len % 8);
+    route.subtype = header->subtype;
+    route.timestamp = header->timestamp;
+    route.sequence = get_be32(p);
+    route.parent = MRT_RIB_IMAGE_NO_ROUTE;
+    route.first_entry = builder->entry_count;
+    p += 5 + prefix_bytes;
+    route.entry_count = get_be16(p);
+    p += 2;
+
+    if (builder->route_count >= UINT32_MAX - 1 ||
+        builder->entry_count + route.entry_count >= UINT32_MAX ||
+        grow((void **)&builder->routes, &builder->route_cap,
+             builder->route_count + 1, sizeof(route)) != 0 ||
+        grow((void **)&builder->entries, &builder->entry_cap,
+             builder->entry_count + route.entry_count,
+             sizeof(*builder->entries)) != 0)
+        return -1;
+    for (int i = 0; i < route.entry_count; i++) {
+        if (end - p < 8) return -1;
+        struct mrt_rib_image_entry_t *entry =
+            &builder->entries[route.first_entry + i];
+        memset(entry, 0, sizeof(*entry));
+        entry->peer_index = get_be16(p);
+        entry->originated = get_be32(p + 2);
+        size_t attr_len = get_be16(p + 6);
+        p += 8;
+        if ((size_t)(end - p) < attr_len ||
+            mrt_attributes_origin(p, attr_len, &entry->origin_as) != 0)
+            return -1;
+        long id = intern_attributes(builder, p, attr_len);
+        if (id < 0) return -1;
+        entry->attributes = id;
+        p += attr_len;
+    }
+    builder->entry_count += route.entry_count;
+    builder->routes[builder->route_count++] = route;
+    return 0;
+}
+
+int mrt_rib_image_builder_record(struct mrt_rib_image_builder_t *builder,
+                                 const struct mrt_header_t *header,
+                                 const uint8_t *record) {
+    size_t len = MRT_HEADER_SIZE + (size_t)header->length;
+    if (header->type != TABLE_DUMP_V2) return 0;
+    // multicast RIBs have the same prefixes as unicast ones, keys don't
+    // tell them apart
+    if (header->subtype == TABLE_DUMP_V2_RIB_IPV4_UNICAST ||
+        header->subtype == TABLE_DUMP_V2_RIB_IPV6_UNICAST)
+        return add_rib(builder, header, record, len);
+    if (header->subtype == TABLE_DUMP_V2_PEER_INDEX_TABLE &&
+        builder->peer_index_table == NULL) {
+        builder->peer_index_table = malloc(len);
+        if (builder->peer_index_table == NULL) return -1;
+        memcpy(builder->peer_index_table, record, len);
+        builder->peer_index_table_len = len;
+    }
+    return 0;
+}
+
+/* Key order, then file order, which entries are added in. */
+static int route_cmp(const void *lhs, const void *rhs) {
+    const struct mrt_rib_image_route_t *l = lhs, *r = rhs;
+    int cmp = prefix_key_cmp(&l->key, &r->key);
+    if (cmp != 0) return cmp;
+    return l->first_entry < r->first_entry ? -1
+                                           : l->first_entry > r->first_entry;
+}
+
+static int covers(const struct prefix_key_t *outer,
+                  const struct prefix_key_t *inner) {
+    if (outer->afi != inner->afi || outer->len >= inner->len) return 0;
+    int bytes = outer->len / 8, bits = outer->len % 8;
+    if (memcmp(outer->addr, inner->addr, bytes) != 0) return 0;
+    return bits == 0 ||
+           ((outer->addr[bytes] ^ inner->addr[bytes]) & 0xFFU << (8 - bits)) ==
+               0;
+}
+
+/* Sorted routes list every prefix before its more specifics, so the parent
+ * of a route is the innermost route on the stack still covering it. */
+static void link_parents(struct mrt_rib_image_route_t *routes, size_t count) {
+    uint32_t stack[129];
+    int depth = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (depth > 0 && !covers(&routes[stack[depth - 1]].key,
+                                    &routes[i].key))
+            depth--;
+        routes[i].parent =
+            depth > 0 ? stack[depth - 1] : MRT_RIB_IMAGE_NO_ROUTE;
+        stack[depth++] = i;
+    }
+}
+
+struct trie_builder_t {
+    const struct mrt_rib_image_route_t *routes;
+    struct mrt_rib_image_node_t *nodes;
+    size_t node_count;
+    size_t node_cap;
+    uint32_t *leaves;
+    size_t leaf_count;
+    size_t leaf_cap;
+};
+
+static unsigned route_slot(const struct mrt_rib_image_route_t *route,
+                           int depth) {
+    return trie_slot(get_be64(route->key.addr), get_be64(route->key.addr + 8),
+                     depth);
+}
+
+/* Fills node `idx` at `depth` from the sorted routes [lo, hi), all of them
+ * below the node's prefix. Routes ending within the node are expanded into
+ * its slots, which start out as `inherited`; more specifics go down into
+ * children. Routes are visited covering ones first, so later ones win. */
+static int build_node(struct trie_builder_t *tb, size_t idx, size_t lo,
+                      size_t hi, int depth, uint32_t inherited) {
+    uint32_t leaves[64];
+    uint64_t vector = 0;
+    int end_len = (depth + 1) * MRT_RIB_IMAGE_STRIDE;
+    for (int i = 0; i < 64; i++) leaves[i] = inherited;
+    for (size_t i = lo; i < hi; i++) {
+        const struct mrt_rib_image_route_t *route = &tb->routes[i];
+        unsigned slot = route_slot(route, depth);
+        if (route->key.len > end_len) {
+            vector |= 1ULL << slot;
+            continue;
+        }
+        int fixed = route->key.len - depth * MRT_RIB_IMAGE_STRIDE;
+        unsigned span = 1U << (MRT_RIB_IMAGE_STRIDE - (fixed > 0 ? fixed : 0));
+        for (unsigned s = slot; s < slot + span; s++) leaves[s] = i + 1;
+    }
+
+    uint64_t leafvec = 0;
+    size_t base0 = tb->leaf_count;
+    for (int i = 0, first = 1; i < 64; i++) {
+        if (vector >> i & 1) continue;
+        if (!first && leaves[i] == tb->leaves[tb->leaf_count - 1]) continue;
+        if (grow((void **)&tb->leaves, &tb->leaf_cap, tb->leaf_count + 1,
+                 sizeof(*tb->leaves)) != 0)
+            return -1;
+        tb->leaves[tb->leaf_count++] = leaves[i];
+        leafvec |= 1ULL << i;
+        first = 0;
+    }
+
+    // children of a node are contiguous
+    size_t base1 = tb->node_count;
+    size_t children = __builtin_popcountll(vector);
+    if (tb->node_count + children > UINT32_MAX ||
+        tb->leaf_count > UINT32_MAX ||
+        grow((void **)&tb->nodes, &tb->node_cap, tb->node_count + children,
+             sizeof(*tb->nodes)) != 0)
+        return -1;
+    tb->node_count += children;
+    struct mrt_rib_image_node_t *node = &tb->nodes[idx];
+    node->vector = vector;
+    node->leafvec = leafvec;
+    node->base0 = base0;
+    node->base1 = base1;
+
+    size_t child = base1;
+    for (size_t i = lo; i < hi;) {
+        if (tb->routes[i].key.len <= end_len) {
+            i++;
+            continue;
+        }
+        // routes ending here sort before the more specifics of their slot
+        unsigned slot = route_slot(&tb->routes[i], depth);
+        size_t j = i + 1;
+        while (j < hi && route_slot(&tb->routes[j], depth) == slot) {
+            assert(tb->routes[j].key.len > end_len);
+            j++;
+        }
+        if (build_node(tb, child++, i, j, depth + 1, leaves[slot]) != 0)
+            return -1;
+        i = j;
+    }
+    return 0;
+}
+
+static int write_section(FILE *file, const void *data, size_t len,
+                         size_t offset, size_t *written) {
+    static const uint8_t zeros[IMAGE_ALIGNMENT];
+    if (offset - *written > 0 &&
+        fwrite(zeros, 1, offset - *written, file) != offset - *written)
+        return -1;
+    if (len > 0 && fwrite(data, 1, len, file) != len) return -1;
+    *written = offset + len;
+    return 0;
+}
+
+static int write_image(FILE *file, const struct mrt_rib_image_builder_t *b,
+                       const struct image_header_t *header,
+                       const struct trie_builder_t *tb) {
+    struct image_layout_t l;
+    layout(header, &l);
+    size_t written = 0;
+    uint64_t arena_len = b->arena_len;
+    if (write_section(file, header, sizeof(*header), 0, &written) != 0 ||
+        write_section(file, b->routes, header->route_count * sizeof(*b->routes),
+                      l.routes, &written) != 0 ||
+        write_section(file, b->entries,
+                      header->entry_count * sizeof(*b->entries), l.entries,
+                      &written) != 0 ||
+        write_section(file, b->attribute_offsets,
+                      header->attribute_count * sizeof(uint64_t),
+                      l.attribute_offsets, &written) != 0 ||
+        write_section(file, &arena_len, sizeof(arena_len), written,
+                      &written) != 0 ||
+        write_section(file, b->arena, b->arena_len, l.arena, &written) != 0 ||
+        write_section(file, tb->nodes, header->node_count * sizeof(*tb->nodes),
+                      l.nodes, &written) != 0 ||
+        write_section(file, tb->leaves,
+                      header->leaf_count * sizeof(*tb->leaves), l.leaves,
+                      &written) != 0 ||
+        write_section(file, b->peer_index_table, b->peer_index_table_len,
+                      l.peer_index_table, &written) != 0)
+        return -1;
+    return 0;
+}
+
+int mrt_rib_image_builder_write(struct mrt_rib_image_builder_t *builder,
+                                const char *path) {
+    struct mrt_rib_image_route_t *routes = builder->routes;
+    size_t count = 0;
+    if (builder->route_count > 0) {
+        qsort(routes, builder->route_count, sizeof(*routes), route_cmp);
+        count = 1;
+    }
+    for (size_t i = 1; i < builder->route_count; i++)
+        if (prefix_key_cmp(&routes[i].key, &routes[count - 1].key) != 0)
+            routes[count++] = routes[i];
+    builder->route_count = count;
+    link_parents(routes, count);
+
+    int ret = -1;
+    struct trie_builder_t tb = {routes, NULL, 0, 0, NULL, 0, 0};
+    struct image_header_t header;
+    memset(&header, 0, sizeof(header));
+    size_t lo = 0;
+    for (int afi = AFI_TYPE_IPV4; afi <= AFI_TYPE_IPV6; afi++) {
+        size_t hi = lo;
+        while (hi < count && routes[hi].key.afi == afi) hi++;
+        if (grow((void **)&tb.nodes, &tb.node_cap, tb.node_count + 1,
+                 sizeof(*tb.nodes)) != 0)
+            goto fail;
+        header.roots[afi] = tb.node_count++;
+        if (build_node(&tb, header.roots[afi], lo, hi, 0, 0) != 0) goto fail;
+        lo = hi;
+    }
+
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.route_count = count;
+    header.entry_count = builder->entry_count;
+    header.attribute_count = builder->attribute_count;
+    header.node_count = tb.node_count;
+    header.leaf_count = tb.leaf_count;
+    header.arena_len = builder->arena_len;
+    header.peer_index_table_len = builder->peer_index_table_len;
+
+    // written aside and renamed, readers may have the old image mapped
+    char *temp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (temp == NULL) goto fail;
+    sprintf(temp, "%s.XXXXXX", path);
+    int fd = mkstemp(temp);
+    // mkstemp makes the file private, images are created like other files
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fd >= 0 && fchmod(fd, 0666 & ~mask) != 0) {
+        close(fd);
+        fd = -1;
+        unlink(temp);
+    }
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (file == NULL && fd >= 0) close(fd);
+    if (file != NULL) {
+        int error = write_image(file, builder, &header, &tb);
+        if (fclose(file) != 0) error = -1;
+        if (error == 0 && rename(temp, path) == 0)
+            ret = 0;
+        else
+            unlink(temp);
+    }
+    free(temp);
+
+fail:
+    free(tb.nodes);
+    free(tb.leaves);
+    return ret;
+}
+
+void mrt_rib_image_builder_destroy(struct mrt_rib_image_builder_t *builder) {
+    free(builder->routes);
+    free(builder->entries);
+    free(builder->arena);
+    free(builder->attribute_offsets);
+    free(builder->table);
+    free(builder->peer_index_table);
+    memset(builder, 0, sizeof(*builder));
+}
+
+int mrt_rib_image_open(struct mrt_rib_image_t *image, const char *path) {
+    memset(image, 0, sizeof(*image));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= IMAGE_HEADER_SIZE)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    image->map = map;
+    image->map_len = st.st_size;
+
+    struct image_header_t header;
+    struct image_layout_t l;
+    memcpy(&header, image->map, sizeof(header));
+    if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION ||
+        header.byte_order != IMAGE_BYTE_ORDER ||
+        header.arena_len > image->map_len ||
+        header.peer_index_table_len > image->map_len)
+        goto fail;
+    layout(&header, &l);
+    if (l.size != image->map_len) goto fail;
+
+    image->routes = (const void *)(image->map + l.routes);
+    image->route_count = header.route_count;
+    image->entries = (const void *)(image->map + l.entries);
+    image->entry_count = header.entry_count;
+    image->attribute_offsets = (const void *)(image->map + l.attribute_offsets);
+    image->attribute_count = header.attribute_count;
+    image->arena = image->map + l.arena;
+    image->nodes = (const void *)(image->map + l.nodes);
+    image->node_count = header.node_count;
+    image->leaves = (const void *)(image->map + l.leaves);
+    image->leaf_count = header.leaf_count;
+    memcpy(image->roots, header.roots, sizeof(image->roots));
+    image->peer_index_table = header.peer_index_table_len > 0
+                                  ? image->map + l.peer_index_table
+                                  : NULL;
+    image->peer_index_table_len = header.peer_index_table_len;
+    // nothing else is read here, the pages of large images are only touched
+    // by the lookups using them
+    if (image->attribute_offsets[image->attribute_count] != header.arena_len ||
+        image->roots[0] >= image->node_count ||
+        image->roots[1] >= image->node_count)
+        goto fail;
+    return 0;
+
+fail:
+    mrt_rib_image_close(image);
+    return -1;
+}
+
+void mrt_rib_image_close(struct mrt_rib_image_t *image) {
+    if (image->map) munmap((void *)image->map, image->map_len);
+    memset(image, 0, sizeof(*image));
+}
+
+uint32_t mrt_rib_image_lookup(const struct mrt_rib_image_t *image,
+                              const struct prefix_key_t *key) {
+    if (key->afi > AFI_TYPE_IPV6) return MRT_RIB_IMAGE_NO_ROUTE;
+    uint64_t hi = get_be64(key->addr), lo = get_be64(key->addr + 8);
+    const struct mrt_rib_image_node_t *node =
+        &image->nodes[image->roots[key->afi]];
+    uint32_t leaf = 0;
+    for (int depth = 0; depth < TRIE_MAX_DEPTH; depth++) {
+        unsigned slot = trie_slot(hi, lo, depth);
+        if (node->vector >> slot & 1) {
+            size_t child = (size_t)node->base1 + rank(node->vector, slot) - 1;
+            if (child >= image->node_count) return MRT_RIB_IMAGE_NO_ROUTE;
+            node = &image->nodes[child];
+            continue;
+        }
+        size_t at = (size_t)node->base0 + rank(node->leafvec, slot) - 1;
+        if (at >= image->leaf_count) return MRT_RIB_IMAGE_NO_ROUTE;
+        leaf = image->leaves[at];
+        break;
+    }
+
+    // the match may be longer than the key, its parents cover the key too;
+    // parents sort before their routes, which ends the walk on any image
+    uint32_t route = leaf - 1;
+    while (route < image->route_count &&
+           image->routes[route].key.len > key->len) {
+        uint32_t parent = image->routes[route].parent;
+        route = parent < route ? parent : MRT_RIB_IMAGE_NO_ROUTE;
+    }
+    return route < image->route_count ? route : MRT_RIB_IMAGE_NO_ROUTE;
+}
+
+const uint8_t *mrt_rib_image_attributes(const struct mrt_rib_image_t *image,
+                                        const struct mrt_rib_image_entry_t
+                                            *entry,
+                                        size_t *len) {
+    *len = 0;
+    if (entry->attributes >= image->attribute_count) return NULL;
+    // the offset past the last set is the arena length, checked on open
+    const uint64_t *offsets = image->attribute_offsets + entry->attributes;
+    if (offsets[0] > offsets[1] ||
+        offsets[1] > image->attribute_offsets[image->attribute_count])
+        return NULL;
+    *len = offsets[1] - offsets[0];
+    return image->arena + offsets[0];
+}
+
+size_t mrt_rib_image_record(const struct mrt_rib_image_t *image,
+                            uint32_t route, uint8_t *buffer,
+                            size_t capacity) {
+    if (route >= image->route_count) return 0;
+    const struct mrt_rib_image_route_t *r = &image->routes[route];
+    if (r->key.len > 128 || r->first_entry > image->entry_count ||
+        image->entry_count - r->first_entry < r->entry_count)
+        return 0;
+    const struct mrt_rib_image_entry_t *entries =
+        image->entries + r->first_entry;
+    size_t prefix_bytes = (r->key.len + 7) / 8;
+    size_t len = MRT_HEADER_SIZE + 5 + prefix_bytes + 2;
+    for (int i = 0; i < r->entry_count; i++) {
+        size_t attr_len;
+        if (mrt_rib_image_attributes(image, &entries[i], &attr_len) == NULL)
+            return 0;
+        len += 8 + attr_len;
+    }
+    if (len > capacity) return len;
+
+    uint8_t *p = buffer;
+    put_be32(p, r->timestamp);
+    put_be16(p + 4, TABLE_DUMP_V2);
+    put_be16(p + 6, r->subtype);
+    put_be32(p + 8, len - MRT_HEADER_SIZE);
+    p += MRT_HEADER_SIZE;
+    put_be32(p, r->sequence);
+    p[4] = r->key.len;
+    memcpy(p + 5, r->key.addr, prefix_bytes);
+    p += 5 + prefix_bytes;
+    put_be16(p, r->entry_count);
+    p += 2;
+    for (int i = 0; i < r->entry_count; i++) {
+        size_t attr_len;
+        const uint8_t *attributes =
+            mrt_rib_image_attributes(image, &entries[i], &attr_len);
+        put_be16(p, entries[i].peer_index);
+        put_be32(p + 2, entries[i].originated);
+        put_be16(p + 6, attr_len);
+        memcpy(p + 8, attributes, attr_len);
+        p += 8 + attr_len;
+    }
+    return len;
+}
@@ -0,0 +1,135 @@
+#ifndef MRT_RIB_IMAGE_H
+#define MRT_RIB_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "find_prefix.h"
+
+/* Decoded image of one TABLE_DUMP_V2 RIB dump for longest-prefix matches
+ * without inflating or parsing anything, built once by a full scan and
+ * mapped from a file afterwards.
+ *
+ * Routes, one per RIB record, are sorted by prefix key and point to their
+ * entries and to their parent, the longest shorter route covering them.
+ * Attributes of entries are stored once per distinct attribute set in one
+ * arena, so the many prefixes a peer announces with the same path share it.
+ *
+ * Longest matches go through a poptrie per AFI: nodes of stride
+ * MRT_RIB_IMAGE_STRIDE whose children and leaves are contiguous and found by
+ * counting bits of the node's vectors, so a walk touches one node per level
+ * and one leaf at the end. Leaves are run-length compressed within a node.
+ *
+ * The file is only meant for the machine that built it, its structures are
+ * laid out natively like those of span_cache.h and opened in place. */
+
+#define MRT_RIB_IMAGE_STRIDE 6
+#define MRT_RIB_IMAGE_NO_ROUTE UINT32_MAX
+
+struct mrt_rib_image_route_t {
+    struct prefix_key_t key;
+    uint8_t subtype;
+    uint16_t entry_count;
+    uint32_t timestamp;
+    uint32_t sequence;
+    /* MRT_RIB_IMAGE_NO_ROUTE for top-level routes. */
+    uint32_t parent;
+    uint32_t first_entry;
+};
+
+struct mrt_rib_image_entry_t {
+    uint16_t peer_index;
+    uint32_t originated;
+    /* Origin AS as found by mrt_attributes_origin. */
+    uint32_t origin_as;
+    uint32_t attributes;
+};
+
+/* Slot `i` of a node is a child if bit `i` of `vector` is set, and a leaf
+ * otherwise. Bit `i` of `leafvec` is set where a leaf differs from the one
+ * in the slot before it. Leaves are route indexes plus one, 0 for no route. */
+struct mrt_rib_image_node_t {
+    uint64_t vector;
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+};
+
+struct mrt_rib_image_builder_t {
+    struct mrt_rib_image_route_t *routes;
+    size_t route_count;
+    size_t route_cap;
+    struct mrt_rib_image_entry_t *entries;
+    size_t entry_count;
+    size_t entry_cap;
+    /* The attribute arena, sets start at `attribute_offsets`. */
+    uint8_t *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    uint64_t *attribute_offsets;
+    size_t attribute_count;
+    size_t attribute_cap;
+    /* Open addressing by attribute set, slots hold set ids plus one. */
+    uint32_t *table;
+    size_t table_size;
+    uint8_t *peer_index_table;
+    size_t peer_index_table_len;
+};
+
+void mrt_rib_image_builder_init(struct mrt_rib_image_builder_t *builder);
+/* Adds a unicast RIB record and keeps the first PEER_INDEX_TABLE, anything
+ * else is skipped. `record` is the whole MRT record. Returns -1 if the record
+ * is malformed or memory runs out. */
+int mrt_rib_image_builder_record(struct mrt_rib_image_builder_t *builder,
+                                 const struct mrt_header_t *header,
+                                 const uint8_t *record);
+/* Sorts the routes, builds the tries and writes the image to `path`, which
+ * is replaced at once so images mapped meanwhile stay valid. Of several
+ * records of a prefix, the first one is kept. */
+int mrt_rib_image_builder_write(struct mrt_rib_image_builder_t *builder,
+                                const char *path);
+void mrt_rib_image_builder_destroy(struct mrt_rib_image_builder_t *builder);
+
+struct mrt_rib_image_t {
+    const uint8_t *map;
+    size_t map_len;
+    const struct mrt_rib_image_route_t *routes;
+    uint32_t route_count;
+    const struct mrt_rib_image_entry_t *entries;
+    uint32_t entry_count;
+    const uint64_t *attribute_offsets;
+    uint32_t attribute_count;
+    const uint8_t *arena;
+    const struct mrt_rib_image_node_t *nodes;
+    uint32_t node_count;
+    const uint32_t *leaves;
+    uint32_t leaf_count;
+    uint32_t roots[2];
+    const uint8_t *peer_index_table;
+    size_t peer_index_table_len;
+};
+
+/* Maps the image at `path` and checks its header and the bounds of its
+ * sections. The rest is read by the calls below, which check each index they
+ * follow, so a corrupt image gives wrong answers but is never read past. */
+int mrt_rib_image_open(struct mrt_rib_image_t *image, const char *path);
+void mrt_rib_image_close(struct mrt_rib_image_t *image);
+
+/* Returns the route of the longest prefix covering `key`, its own included,
+ * or MRT_RIB_IMAGE_NO_ROUTE. */
+uint32_t mrt_rib_image_lookup(const struct mrt_rib_image_t *image,
+                              const struct prefix_key_t *key);
+/* Attribute set of an entry, as found in the RIB record, or NULL if the
+ * entry is corrupt. */
+const uint8_t *mrt_rib_image_attributes(const struct mrt_rib_image_t *image,
+                                        const struct mrt_rib_image_entry_t
+                                            *entry,
+                                        size_t *len);
+/* Writes the RIB record of `route` back into `buffer` of `capacity` bytes.
+ * Returns its length, which may be more than `capacity` if it didn't fit, or
+ * 0 if the route is corrupt. */
+size_t mrt_rib_image_record(const struct mrt_rib_image_t *image,
+                            uint32_t route, uint8_t *buffer,
+                            size_t capacity);
+
+#endif
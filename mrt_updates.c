@@ -0,0 +1,191 @@
+#include "mrt_updates.h"
+
+#include <stddef.h>
+#include <string.h>
+
+//
+#include "mrt_attributes.h"
+
+enum {
+    BGP4MP = 16,
+    BGP4MP_ET = 17,
+
+    BGP4MP_STATE_CHANGE = 0,
+    BGP4MP_MESSAGE = 1,
+    BGP4MP_MESSAGE_AS4 = 4,
+    BGP4MP_STATE_CHANGE_AS4 = 5,
+    BGP4MP_MESSAGE_LOCAL = 6,
+    BGP4MP_MESSAGE_AS4_LOCAL = 7,
+    BGP4MP_MESSAGE_ADDPATH = 8,
+    BGP4MP_MESSAGE_AS4_ADDPATH = 9,
+    BGP4MP_MESSAGE_LOCAL_ADDPATH = 10,
+    BGP4MP_MESSAGE_AS4_LOCAL_ADDPATH = 11,
+
+    AFI_IPV4 = 1,
+    AFI_IPV6 = 2,
+
+    BGP_HEADER_SIZE = 19,
+    BGP_UPDATE = 2,
+
+    ATTR_MP_REACH_NLRI = 14,
+    ATTR_MP_UNREACH_NLRI = 15
+};
+
+/* Parsing state of one BGP4MP message. */
+struct update_t {
+    const struct mrt_update_filter_t *filter;
+    int as4;
+    int addpath;
+};
+
+static int is_as4_subtype(int subtype) {
+    return subtype == BGP4MP_MESSAGE_AS4 ||
+           subtype == BGP4MP_STATE_CHANGE_AS4 ||
+           subtype == BGP4MP_MESSAGE_AS4_LOCAL ||
+           subtype == BGP4MP_MESSAGE_AS4_ADDPATH ||
+           subtype == BGP4MP_MESSAGE_AS4_LOCAL_ADDPATH;
+}
+
+static int is_message_subtype(int subtype) {
+    return subtype == BGP4MP_MESSAGE || subtype == BGP4MP_MESSAGE_AS4 ||
+           (subtype >= BGP4MP_MESSAGE_LOCAL &&
+            subtype <= BGP4MP_MESSAGE_AS4_LOCAL_ADDPATH);
+}
+
+/* Whether `len` bits of `addr` fall within the filter prefix. */
+static int covered(const struct prefix_key_t *outer, int is_ipv6, size_t len,
+                   const uint8_t *addr) {
+    if (outer->afi != (is_ipv6 ? AFI_TYPE_IPV6 : AFI_TYPE_IPV4) ||
+        len < outer->len)
+        return 0;
+    size_t bytes = outer->len / 8;
+    size_t bits = outer->len % 8;
+    if (memcmp(addr, outer->addr, bytes) != 0) return 0;
+    if (bits == 0) return 1;
+    uint8_t mask = 0xFFU << (8 - bits);
+    return (addr[bytes] & mask) == outer->addr[bytes];
+}
+
+/* Returns 1 if a prefix of the NLRI list is covered by the filter. */
+static int nlri_matches(const struct update_t *update, int is_ipv6,
+                        const uint8_t *p, size_t len) {
+    const uint8_t *end = p + len;
+    size_t max_len = is_ipv6 ? 128 : 32;
+    while (p < end) {
+        if (update->addpath) {
+            if (end - p < 4) return -1;
+            p += 4;
+        }
+        if (p == end) return -1;
+        size_t prefix_len = *p++;
+        size_t bytes = (prefix_len + 7) / 8;
+        if (prefix_len > max_len || (size_t)(end - p) < bytes) return -1;
+        uint8_t addr[16] = {0};
+        memcpy(addr, p, bytes);
+        if (covered(&update->filter->prefix, is_ipv6, prefix_len, addr))
+            return 1;
+        p += bytes;
+    }
+    return 0;
+}
+
+static int as_path_matches(uint32_t asn, size_t as_len, const uint8_t *p,
+                           size_t len) {
+    struct mrt_as_path_iter_t iter;
+    struct mrt_as_segment_t segment;
+    int ret;
+    mrt_as_path_iter_init(&iter, p, len, as_len);
+    while ((ret = mrt_as_path_next(&iter, &segment)) == 1)
+        for (size_t i = 0; i < segment.count; i++)
+            if (mrt_as_segment_asn(&segment, i) == asn) return 1;
+    return ret;
+}
+
+static int mp_nlri_matches(const struct update_t *update, int reach,
+                           const uint8_t *p, size_t len) {
+    if (len < 3) return -1;
+    int afi = get_be16(p);
+    size_t skip = 3;
+    if (reach) {
+        if (len < 5 || len < 5 + (size_t)p[3]) return -1;
+        skip = 5 + p[3];  // next hop and the reserved byte
+    }
+    if (afi != AFI_IPV4 && afi != AFI_IPV6) return 0;
+    return nlri_matches(update, afi == AFI_IPV6, p + skip, len - skip);
+}
+
+static int attribute_matches(const struct update_t *update, int type,
+                             const uint8_t *p, size_t len) {
+    const struct mrt_update_filter_t *filter = update->filter;
+    if (filter->has_asn && type == ATTR_AS_PATH)
+        return as_path_matches(filter->asn, update->as4 ? 4 : 2, p, len);
+    if (filter->has_asn && type == ATTR_AS4_PATH)
+        return as_path_matches(filter->asn, 4, p, len);
+    if (filter->has_prefix && (type == ATTR_MP_REACH_NLRI ||
+                               type == ATTR_MP_UNREACH_NLRI))
+        return mp_nlri_matches(update, type == ATTR_MP_REACH_NLRI, p, len);
+    return 0;
+}
+
+static int update_matches(const struct update_t *update, const uint8_t *p,
+                          size_t len) {
+    const struct mrt_update_filter_t *filter = update->filter;
+    if (len < 2 || len - 2 < get_be16(p)) return -1;
+    size_t withdrawn_len = get_be16(p);
+    p += 2;
+    int ret = filter->has_prefix ? nlri_matches(update, 0, p, withdrawn_len)
+                                 : 0;
+    if (ret != 0) return ret;
+    p += withdrawn_len;
+    len -= 2 + withdrawn_len;
+
+    if (len < 2 || len - 2 < get_be16(p)) return -1;
+    size_t attrs_len = get_be16(p);
+    const uint8_t *nlri = p + 2 + attrs_len;
+    size_t nlri_len = len - 2 - attrs_len;
+    struct mrt_attribute_iter_t iter;
+    struct mrt_attribute_t attr;
+    mrt_attribute_iter_init(&iter, p + 2, attrs_len);
+    while ((ret = mrt_attribute_next(&iter, &attr)) == 1) {
+        ret = attribute_matches(update, attr.type, attr.value, attr.len);
+        if (ret != 0) return ret;
+    }
+    if (ret != 0) return ret;
+    return filter->has_prefix ? nlri_matches(update, 0, nlri, nlri_len) : 0;
+}
+
+int mrt_update_matches(const struct mrt_update_filter_t *filter,
+                       const struct mrt_header_t *header,
+                       const uint8_t *record) {
+    if (header->type != BGP4MP && header->type != BGP4MP_ET) return 0;
+    if (!filter->has_prefix && !filter->has_asn) return 1;
+
+    const uint8_t *p = record + MRT_HEADER_SIZE;
+    size_t len = header->length;
+    if (header->type == BGP4MP_ET) {
+        if (len < 4) return -1;
+        p += 4;  // microseconds
+        len -= 4;
+    }
+
+    struct update_t update = {filter, is_as4_subtype(header->subtype),
+                              header->subtype >= BGP4MP_MESSAGE_ADDPATH};
+    size_t as_len = update.as4 ? 4 : 2;
+    if (len < 2 * as_len + 4) return -1;
+    uint32_t peer_as = as_len == 4 ? get_be32(p) : get_be16(p);
+    if (filter->has_asn && peer_as == filter->asn) return 1;
+    size_t ip_len = get_be16(p + 2 * as_len + 2) == AFI_IPV6 ? 16 : 4;
+    size_t peer_len = 2 * as_len + 4 + 2 * ip_len;
+    if (len < peer_len) return -1;
+    p += peer_len;
+    len -= peer_len;
+
+    // state changes only match on the peer AS
+    if (!is_message_subtype(header->subtype)) return 0;
+    if (len < BGP_HEADER_SIZE) return -1;
+    size_t msg_len = get_be16(p + 16);
+    if (msg_len < BGP_HEADER_SIZE || msg_len > len) return -1;
+    if (p[18] != BGP_UPDATE) return 0;
+    return update_matches(&update, p + BGP_HEADER_SIZE,
+                          msg_len - BGP_HEADER_SIZE);
+}
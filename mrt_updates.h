@@ -0,0 +1,26 @@
+#ifndef MRT_UPDATES_H
+#define MRT_UPDATES_H
+
+#include <stdint.h>
+
+#include "find_prefix.h"
+
+/* Filter over the BGP4MP records of updates files. Without any condition set,
+ * every BGP4MP record matches. Otherwise a record matches if its peer AS or
+ * any AS of its AS_PATH or AS4_PATH is `asn`, or if it is an UPDATE that
+ * announces or withdraws `prefix` or a more specific of it, in the IPv4 NLRI
+ * fields or in MP_REACH_NLRI/MP_UNREACH_NLRI. */
+struct mrt_update_filter_t {
+    int has_prefix;
+    struct prefix_key_t prefix;
+    int has_asn;
+    uint32_t asn;
+};
+
+/* Returns 1 if `record`, the whole MRT record, matches, 0 if it doesn't or
+ * isn't a BGP4MP record, and -1 if it is malformed. */
+int mrt_update_matches(const struct mrt_update_filter_t *filter,
+                       const struct mrt_header_t *header,
+                       const uint8_t *record);
+
+#endif
@@ -0,0 +1,107 @@
+#include "mrt_walker.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    MRT_HEADER_SIZE = 12,
+    /* Anything larger than this is treated as a corrupt length field rather
+     * than a reason to allocate. */
+    MRT_WALKER_MAX_RECORD = 1 << 28
+};
+
+void mrt_walker_init(struct mrt_walker_t *walker, off_t offset,
+                     mrt_record_callback callback, void *context) {
+    walker->callback = callback;
+    walker->context = context;
+    walker->offset = offset;
+    walker->pending = NULL;
+    walker->pending_len = 0;
+    walker->pending_cap = 0;
+}
+
+void mrt_walker_reset(struct mrt_walker_t *walker, off_t offset) {
+    walker->offset = offset;
+    walker->pending_len = 0;
+}
+
+static int pending_append(struct mrt_walker_t *walker, const uint8_t *data,
+                          size_t len) {
+    if (walker->pending_len + len > walker->pending_cap) {
+        size_t cap = walker->pending_cap ? walker->pending_cap : 4096;
+        while (cap < walker->pending_len + len) cap *= 2;
+        uint8_t *pending = realloc(walker->pending, cap);
+        if (pending == NULL) return -1;
+        walker->pending = pending;
+        walker->pending_cap = cap;
+    }
+    memcpy(walker->pending + walker->pending_len, data, len);
+    walker->pending_len += len;
+    return 0;
+}
+
+/* Completes the record carried over from previous chunks. Returns the number
+ * of bytes consumed from `data`, or a negative value on failure. */
+static long complete_pending(struct mrt_walker_t *walker, const uint8_t *data,
+                             size_t len, int *ret) {
+    size_t used = 0;
+    if (walker->pending_len < MRT_HEADER_SIZE) {
+        size_t need = MRT_HEADER_SIZE - walker->pending_len;
+        if (need > len) need = len;
+        if (pending_append(walker, data, need) != 0) return -1;
+        used += need;
+        if (walker->pending_len < MRT_HEADER_SIZE) return used;
+    }
+
+    struct mrt_header_t header = get_header(walker->pending);
+    if (header.length > MRT_WALKER_MAX_RECORD) return -1;
+    size_t total = MRT_HEADER_SIZE + (size_t)header.length;
+    size_t need = total - walker->pending_len;
+    if (need > len - used) need = len - used;
+    if (pending_append(walker, data + used, need) != 0) return -1;
+    used += need;
+    if (walker->pending_len < total) return used;
+
+    *ret = walker->callback(walker->context, walker->offset, &header,
+                            walker->pending);
+    walker->offset += total;
+    walker->pending_len = 0;
+    return used;
+}
+
+int mrt_walker_feed(struct mrt_walker_t *walker, const void *data,
+                    size_t len) {
+    const uint8_t *p = data;
+    int ret = 0;
+
+    if (walker->pending_len > 0) {
+        long used = complete_pending(walker, p, len, &ret);
+        if (used < 0) return -1;
+        if (ret != 0) return ret;
+        p += used;
+        len -= used;
+        if (walker->pending_len > 0) return 0;
+    }
+
+    while (len >= MRT_HEADER_SIZE) {
+        struct mrt_header_t header = get_header(p);
+        if (header.length > MRT_WALKER_MAX_RECORD) return -1;
+        size_t total = MRT_HEADER_SIZE + (size_t)header.length;
+        if (total > len) break;
+        ret = walker->callback(walker->context, walker->offset, &header, p);
+        walker->offset += total;
+        p += total;
+        len -= total;
+        if (ret != 0) return ret;
+    }
+
+    if (len > 0 && pending_append(walker, p, len) != 0) return -1;
+    return 0;
+}
+
+void mrt_walker_destroy(struct mrt_walker_t *walker) {
+    free(walker->pending);
+    walker->pending = NULL;
+    walker->pending_len = 0;
+    walker->pending_cap = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef MRT_WALKER_H
+#define MRT_WALKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "find_prefix.h"
+
+/* Called once for every complete MRT record. `offset` is the uncompressed
+ * offset of the record header, `record` points to the header followed by
+ * `header->length` bytes of body and is only valid during the call. A non-zero
+ * return value stops the walk and is passed back by mrt_walker_feed. */
+typedef int (*mrt_record_callback)(void *context, off_t offset,
+                                   const struct mrt_header_t *header,
+                                   const uint8_t *record);
+
+/* Splits an arbitrarily chunked uncompressed MRT stream into records. Records
+ * fully contained in a chunk are handed out in place, only records straddling
+ * chunk boundaries are copied. */
+struct mrt_walker_t {
+    mrt_record_callback callback;
+    void *context;
+    off_t offset;
+    uint8_t *pending;
+    size_t pending_len;
+    size_t pending_cap;
+};
+
+void mrt_walker_init(struct mrt_walker_t *walker, off_t offset,
+                     mrt_record_callback callback, void *context);
+/* Starts over at `offset`, dropping any partial record but keeping the
+ * buffer for it. */
+void mrt_walker_reset(struct mrt_walker_t *walker, off_t offset);
+int mrt_walker_feed(struct mrt_walker_t *walker, const void *data,
+                    size_t len);
+void mrt_walker_destroy(struct mrt_walker_t *walker);
+
+#endif
@@ -0,0 +1,503 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <arpa/inet.h>
+
+//
+#include <zlib.h>
+
+/* Synthetic TABLE_DUMP_V2 generator. Writes a peer index table followed by
+ * IPv4 and IPv6 unicast RIB records sorted the same way RIS bviews are, so the
+ * output can be fed to zidx, pfxdump and gunzip_zidx without any network
+ * access. Everything is derived from a single seed, so the same arguments
+ * always produce byte-identical files. */
+
+enum {
+    TABLE_DUMP_V2 = 13,
+    TABLE_DUMP_V2_PEER_INDEX_TABLE = 1,
+    TABLE_DUMP_V2_RIB_IPV4_UNICAST = 2,
+    TABLE_DUMP_V2_RIB_IPV6_UNICAST = 4,
+
+    MRT_HEADER_SIZE = 12,
+
+    PEER_TYPE_IPV6 = 0x01,
+    PEER_TYPE_AS4 = 0x02,
+
+    ATTR_FLAG_OPTIONAL = 0x80,
+    ATTR_FLAG_TRANSITIVE = 0x40,
+    ATTR_FLAG_EXTENDED = 0x10,
+
+    ATTR_ORIGIN = 1,
+    ATTR_AS_PATH = 2,
+    ATTR_NEXT_HOP = 3,
+    ATTR_COMMUNITIES = 8,
+    ATTR_MP_REACH_NLRI = 14,
+
+    AS_SEQUENCE = 2,
+    MAX_AS_PATH_LENGTH = 8
+};
+
+struct options_t {
+    uint64_t ipv4_count;
+    uint64_t ipv6_count;
+    unsigned peer_count;
+    unsigned entries;
+    unsigned attr_size;
+    unsigned origin_count;
+    unsigned level;
+    uint64_t seed;
+    uint32_t timestamp;
+};
+
+struct peer_t {
+    uint8_t type;
+    uint32_t bgp_id;
+    uint8_t addr[16];
+    uint32_t asn;
+};
+
+struct generator_t {
+    struct options_t opts;
+    gzFile out;
+    uint64_t rng;
+    uint32_t sequence;
+    struct peer_t *peers;
+    uint32_t *selected;
+    uint16_t *entry_peers;
+    uint32_t stamp;
+    uint8_t *record;
+    size_t record_cap;
+    size_t record_len;
+    uint64_t bytes_written;
+};
+
+static void errexit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+static void usageexit(const char *program) {
+    errexit(
+        "usage: %s <output-file> [-4 <count>] [-6 <count>] [-p <peers>] "
+        "[-e <entries>] [-a <attr-bytes>] [-o <origins>] [-z <level>] "
+        "[-s <seed>] [-t <timestamp>]\n"
+        "\t-4: number of IPv4 prefixes (default: 100000)\n"
+        "\t-6: number of IPv6 prefixes (default: 10000)\n"
+        "\t-p: number of peers in the peer index table (default: 32)\n"
+        "\t-e: average number of RIB entries per prefix (default: peers)\n"
+        "\t-a: target path attribute bytes per RIB entry (default: 0, "
+        "minimal attributes)\n"
+        "\t-o: number of distinct origin ASes (default: 50000)\n"
+        "\t-z: gzip compression level, 0-9 (default: 6)\n"
+        "\t-s: random seed (default: 1)\n"
+        "\t-t: MRT timestamp of the dump (default: 1514764800)\n"
+        "\toutput file '-' writes to stdout\n",
+        program);
+}
+
+/* splitmix64; small, fast and identical on every platform. */
+static uint64_t rng_next(struct generator_t *gen) {
+    uint64_t z = (gen->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rng_below(struct generator_t *gen, uint64_t bound) {
+    return bound ? rng_next(gen) % bound : 0;
+}
+
+static void record_reserve(struct generator_t *gen, size_t extra) {
+    if (gen->record_len + extra <= gen->record_cap) return;
+    size_t cap = gen->record_cap ? gen->record_cap : 4096;
+    while (cap < gen->record_len + extra) cap *= 2;
+    gen->record = realloc(gen->record, cap);
+    if (gen->record == NULL) errexit("error: out of memory\n");
+    gen->record_cap = cap;
+}
+
+static void put_bytes(struct generator_t *gen, const void *data, size_t len) {
+    record_reserve(gen, len);
+    memcpy(gen->record + gen->record_len, data, len);
+    gen->record_len += len;
+}
+
+static void put_u8(struct generator_t *gen, uint8_t v) {
+    put_bytes(gen, &v, 1);
+}
+
+static void put_u16(struct generator_t *gen, uint16_t v) {
+    v = htons(v);
+    put_bytes(gen, &v, 2);
+}
+
+static void put_u32(struct generator_t *gen, uint32_t v) {
+    v = htonl(v);
+    put_bytes(gen, &v, 4);
+}
+
+static void patch_u16(struct generator_t *gen, size_t at, uint16_t v) {
+    v = htons(v);
+    memcpy(gen->record + at, &v, 2);
+}
+
+static void patch_u32(struct generator_t *gen, size_t at, uint32_t v) {
+    v = htonl(v);
+    memcpy(gen->record + at, &v, 4);
+}
+
+static void begin_record(struct generator_t *gen, uint16_t subtype) {
+    gen->record_len = 0;
+    put_u32(gen, gen->opts.timestamp);
+    put_u16(gen, TABLE_DUMP_V2);
+    put_u16(gen, subtype);
+    put_u32(gen, 0);  // length, patched by end_record
+}
+
+static void end_record(struct generator_t *gen) {
+    patch_u32(gen, 8, gen->record_len - MRT_HEADER_SIZE);
+    if (gzwrite(gen->out, gen->record, gen->record_len) !=
+        (int)gen->record_len)
+        errexit("error: couldn't write output\n");
+    gen->bytes_written += gen->record_len;
+}
+
+static void write_peer_index_table(struct generator_t *gen) {
+    begin_record(gen, TABLE_DUMP_V2_PEER_INDEX_TABLE);
+    put_u32(gen, 0xC0000201U);  // collector BGP ID, 192.0.2.1
+    static const char view_name[] = "mrtgen";
+    put_u16(gen, sizeof(view_name) - 1);
+    put_bytes(gen, view_name, sizeof(view_name) - 1);
+    put_u16(gen, gen->opts.peer_count);
+    for (unsigned i = 0; i < gen->opts.peer_count; i++) {
+        const struct peer_t *peer = &gen->peers[i];
+        put_u8(gen, peer->type);
+        put_u32(gen, peer->bgp_id);
+        put_bytes(gen, peer->addr, peer->type & PEER_TYPE_IPV6 ? 16 : 4);
+        put_u32(gen, peer->asn);
+    }
+    end_record(gen);
+}
+
+static void init_peers(struct generator_t *gen) {
+    unsigned count = gen->opts.peer_count;
+    gen->peers = calloc(count, sizeof(*gen->peers));
+    gen->selected = calloc(count, sizeof(*gen->selected));
+    gen->entry_peers = calloc(count, sizeof(*gen->entry_peers));
+    if (!gen->peers || !gen->selected || !gen->entry_peers)
+        errexit("error: out of memory\n");
+    for (unsigned i = 0; i < count; i++) {
+        struct peer_t *peer = &gen->peers[i];
+        /* Every fourth peer is an IPv6 session, like most RIS collectors. */
+        peer->type = PEER_TYPE_AS4 | (i % 4 == 3 ? PEER_TYPE_IPV6 : 0);
+        peer->bgp_id = 0x0A000000U | (i + 1);
+        if (peer->type & PEER_TYPE_IPV6) {
+            static const uint8_t ixp[8] = {0x20, 0x01, 0x07, 0xf8,
+                                           0x00, 0x04, 0x00, 0x00};
+            memcpy(peer->addr, ixp, sizeof(ixp));
+            peer->addr[14] = (i + 1) >> 8;
+            peer->addr[15] = (i + 1) & 0xFF;
+        } else {
+            uint32_t addr = htonl(0xC0000200U + ((i + 1) & 0xFFFF) * 256 +
+                                  (i + 1) % 251);
+            memcpy(peer->addr, &addr, 4);
+        }
+        peer->asn = 1000 + rng_below(gen, 400000);
+    }
+}
+
+/* Picks the peers announcing the current prefix, ascending like real dumps. */
+static unsigned select_peers(struct generator_t *gen) {
+    unsigned count = gen->opts.peer_count;
+    unsigned mean = gen->opts.entries;
+    unsigned lo = mean / 2 ? mean / 2 : 1;
+    unsigned hi = mean + mean / 2;
+    if (hi > count) hi = count;
+    if (lo > hi) lo = hi;
+    unsigned k = lo + rng_below(gen, hi - lo + 1);
+
+    /* Floyd's sampling; stamps avoid clearing the marks for every record. */
+    if (++gen->stamp == 0) {
+        memset(gen->selected, 0, count * sizeof(*gen->selected));
+        gen->stamp = 1;
+    }
+    for (unsigned j = count - k; j < count; j++) {
+        unsigned t = rng_below(gen, j + 1);
+        if (gen->selected[t] == gen->stamp) t = j;
+        gen->selected[t] = gen->stamp;
+    }
+    unsigned n = 0;
+    for (unsigned i = 0; i < count && n < k; i++)
+        if (gen->selected[i] == gen->stamp) gen->entry_peers[n++] = i;
+    return n;
+}
+
+static void put_attributes(struct generator_t *gen, const struct peer_t *peer,
+                           uint32_t origin_as, int ipv6) {
+    size_t attr_start = gen->record_len;
+
+    put_u8(gen, ATTR_FLAG_TRANSITIVE);
+    put_u8(gen, ATTR_ORIGIN);
+    put_u8(gen, 1);
+    put_u8(gen, rng_below(gen, 8) ? 0 : 2);  // mostly IGP, some INCOMPLETE
+
+    unsigned hops = 1 + rng_below(gen, MAX_AS_PATH_LENGTH - 1);
+    put_u8(gen, ATTR_FLAG_TRANSITIVE);
+    put_u8(gen, ATTR_AS_PATH);
+    put_u8(gen, 2 + 4 * (hops + 1));
+    put_u8(gen, AS_SEQUENCE);
+    put_u8(gen, hops + 1);
+    put_u32(gen, peer->asn);
+    for (unsigned h = 1; h < hops; h++)
+        put_u32(gen, 1000 + rng_below(gen, 64000));
+    put_u32(gen, origin_as);
+
+    if (!ipv6) {
+        put_u8(gen, ATTR_FLAG_TRANSITIVE);
+        put_u8(gen, ATTR_NEXT_HOP);
+        put_u8(gen, 4);
+        if (peer->type & PEER_TYPE_IPV6)
+            put_u32(gen, 0xC0000200U);
+        else
+            put_bytes(gen, peer->addr, 4);
+    } else {
+        /* RFC 6396 4.3.4: only next hop length and next hop are dumped. */
+        put_u8(gen, ATTR_FLAG_OPTIONAL);
+        put_u8(gen, ATTR_MP_REACH_NLRI);
+        put_u8(gen, 17);
+        put_u8(gen, 16);
+        if (peer->type & PEER_TYPE_IPV6) {
+            put_bytes(gen, peer->addr, 16);
+        } else {
+            static const uint8_t mapped[12] = {0, 0, 0, 0, 0,    0,
+                                               0, 0, 0, 0, 0xFF, 0xFF};
+            put_bytes(gen, mapped, sizeof(mapped));
+            put_bytes(gen, peer->addr, 4);
+        }
+    }
+
+    size_t used = gen->record_len - attr_start;
+    if (gen->opts.attr_size > used + 4) {
+        size_t count = (gen->opts.attr_size - used - 4) / 4;
+        if (count > 0x3FFF) count = 0x3FFF;
+        put_u8(gen, ATTR_FLAG_OPTIONAL | ATTR_FLAG_TRANSITIVE |
+                        ATTR_FLAG_EXTENDED);
+        put_u8(gen, ATTR_COMMUNITIES);
+        put_u16(gen, count * 4);
+        for (size_t c = 0; c < count; c++)
+            put_u32(gen, (peer->asn & 0xFFFF) << 16 | rng_below(gen, 65536));
+    }
+}
+
+static void write_rib(struct generator_t *gen, int ipv6, const uint8_t *addr,
+                      uint8_t len, uint32_t origin_as) {
+    begin_record(gen, ipv6 ? TABLE_DUMP_V2_RIB_IPV6_UNICAST
+                           : TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+    put_u32(gen, gen->sequence++);
+    put_u8(gen, len);
+    put_bytes(gen, addr, (len + 7) / 8);
+
+    unsigned n = select_peers(gen);
+    put_u16(gen, n);
+    for (unsigned i = 0; i < n; i++) {
+        const struct peer_t *peer = &gen->peers[gen->entry_peers[i]];
+        put_u16(gen, gen->entry_peers[i]);
+        put_u32(gen, gen->opts.timestamp - rng_below(gen, 30 * 86400));
+        size_t attr_len_at = gen->record_len;
+        put_u16(gen, 0);
+        put_attributes(gen, peer, origin_as, ipv6);
+        patch_u16(gen, attr_len_at, gen->record_len - attr_len_at - 2);
+    }
+    end_record(gen);
+}
+
+static uint8_t random_length(struct generator_t *gen, int ipv6) {
+    unsigned r = rng_below(gen, 100);
+    if (!ipv6) {
+        if (r < 60) return 24;
+        if (r < 80) return 22 + rng_below(gen, 2);
+        if (r < 95) return 16 + rng_below(gen, 6);
+        return 8 + rng_below(gen, 8);
+    }
+    if (r < 50) return 48;
+    if (r < 70) return 32;
+    if (r < 95) return 29 + rng_below(gen, 19);
+    return 19 + rng_below(gen, 10);
+}
+
+/* Walks the address space upwards so prefixes come out already sorted by
+ * (address, length) without holding them in memory. IPv4 uses the low 32
+ * bits of the cursor, IPv6 the upper 64 bits of the address within 2000::/3,
+ * which caps IPv6 prefix lengths at 64. */
+static uint64_t write_afi(struct generator_t *gen, int ipv6, uint64_t count) {
+    const unsigned width = ipv6 ? 64 : 32;
+    const uint64_t space = (uint64_t)1 << (ipv6 ? 61 : 32);
+    uint64_t per_prefix = count ? space / count : space;
+    if (per_prefix == 0) per_prefix = 1;
+
+    /* Keep the largest blocks within reach of the average spacing, otherwise
+     * a handful of short prefixes would eat the whole space. */
+    unsigned min_len = ipv6 ? 3 : 1;
+    while (min_len < width &&
+           ((uint64_t)1 << (width - min_len)) / 16 > per_prefix)
+        min_len++;
+
+    uint64_t cursor = 0;
+    uint64_t written = 0;
+    int nested = 0;
+    uint8_t outer_len = 0;
+    uint64_t outer_addr = 0;
+
+    while (written < count) {
+        uint8_t len = random_length(gen, ipv6);
+        if (len < min_len) len = min_len;
+        uint64_t addr;
+        if (nested) {
+            if (len <= outer_len) len = outer_len + 1 + rng_below(gen, 8);
+            if (len > width) len = width;
+            uint64_t block = (uint64_t)1 << (width - len);
+            uint64_t outer_block = (uint64_t)1 << (width - outer_len);
+            addr = outer_addr + rng_below(gen, outer_block / block) * block;
+        } else {
+            /* Aim at the evenly spaced position of this prefix, so the
+             * leftover space is spread instead of running out early. */
+            uint64_t block = (uint64_t)1 << (width - len);
+            uint64_t step = space / (count ? count : 1);
+            uint64_t target = written * step + step / 2;
+            while (len < width && cursor + block > target + step) {
+                len++;
+                block >>= 1;
+            }
+            uint64_t gap = target > cursor + block ? target - cursor - block
+                                                   : 0;
+            uint64_t next = cursor + rng_below(gen, 2 * gap + 1);
+            next = (next + block - 1) & ~(block - 1);
+            if (next < cursor || next >= space) break;
+            addr = next;
+        }
+
+        uint8_t bytes[16] = {0};
+        uint64_t full = ipv6 ? ((uint64_t)1 << 61) | addr : addr;
+        for (unsigned b = 0; b < width / 8; b++)
+            bytes[b] = full >> (width - 8 * (b + 1));
+
+        uint32_t origin_as =
+            64512 + (uint32_t)((full * 0x9E3779B97F4A7C15ULL) >> 40) %
+                        gen->opts.origin_count;
+        write_rib(gen, ipv6, bytes, len, origin_as);
+        written++;
+
+        nested = !nested && len < width && rng_below(gen, 8) == 0;
+        if (nested) {
+            outer_addr = addr;
+            outer_len = len;
+            cursor = addr;
+        } else {
+            cursor = addr + ((uint64_t)1 << (width - len));
+        }
+    }
+    return written;
+}
+
+static unsigned long long parse_number(const char *program, const char *arg) {
+    if (arg == NULL) usageexit(program);
+    char *end;
+    unsigned long long v = strtoull(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || *arg == '-')
+        errexit("error: expected a non-negative number, got '%s'\n", arg);
+    return v;
+}
+
+int main(int argc, char **argv) {
+    const char *program = argv[0];
+    if (argc < 2) usageexit(program);
+
+    const char *output_path = argv[1];
+    struct generator_t gen;
+    memset(&gen, 0, sizeof(gen));
+    gen.opts = (struct options_t){100000, 10000, 32, 0, 0, 50000, 6, 1,
+                                  1514764800U};
+
+    for (int i = 2; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "-4"))
+            gen.opts.ipv4_count = parse_number(program, value);
+        else if (!strcmp(argv[i], "-6"))
+            gen.opts.ipv6_count = parse_number(program, value);
+        else if (!strcmp(argv[i], "-p"))
+            gen.opts.peer_count = parse_number(program, value);
+        else if (!strcmp(argv[i], "-e"))
+            gen.opts.entries = parse_number(program, value);
+        else if (!strcmp(argv[i], "-a"))
+            gen.opts.attr_size = parse_number(program, value);
+        else if (!strcmp(argv[i], "-o"))
+            gen.opts.origin_count = parse_number(program, value);
+        else if (!strcmp(argv[i], "-z"))
+            gen.opts.level = parse_number(program, value);
+        else if (!strcmp(argv[i], "-s"))
+            gen.opts.seed = parse_number(program, value);
+        else if (!strcmp(argv[i], "-t"))
+            gen.opts.timestamp = parse_number(program, value);
+        else
+            usageexit(program);
+        i++;
+    }
+
+    if (gen.opts.peer_count == 0 || gen.opts.peer_count > 65535)
+        errexit("error: peer count should be in the range of [1, 65535]\n");
+    if (gen.opts.entries == 0) gen.opts.entries = gen.opts.peer_count;
+    if (gen.opts.entries > gen.opts.peer_count)
+        errexit("error: entries per prefix can't exceed the peer count\n");
+    if (gen.opts.origin_count == 0)
+        errexit("error: origin AS count should be positive\n");
+    if (gen.opts.level > 9)
+        errexit("error: gzip level should be in the range of [0, 9]\n");
+    if (gen.opts.attr_size > 60000)
+        errexit("error: attribute size shouldn't be more than 60000\n");
+    if ((uint64_t)gen.opts.entries * 3 / 2 * (gen.opts.attr_size + 64) >
+        UINT32_MAX / 2)
+        errexit("error: entries times attribute size overflows a record\n");
+
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%u", gen.opts.level);
+    gen.out = strcmp(output_path, "-") ? gzopen(output_path, mode)
+                                       : gzdopen(fileno(stdout), mode);
+    if (gen.out == NULL)
+        errexit("error: couldn't open output '%s'\n", output_path);
+    if (gzbuffer(gen.out, 1 << 20) != 0)
+        errexit("error: couldn't set output buffer size\n");
+
+    gen.rng = gen.opts.seed;
+    init_peers(&gen);
+    write_peer_index_table(&gen);
+
+    uint64_t ipv4 = write_afi(&gen, 0, gen.opts.ipv4_count);
+    uint64_t ipv6 = write_afi(&gen, 1, gen.opts.ipv6_count);
+
+    if (gzclose(gen.out) != Z_OK) errexit("error: couldn't close output\n");
+
+    if (ipv4 < gen.opts.ipv4_count || ipv6 < gen.opts.ipv6_count)
+        fprintf(stderr,
+                "warning: address space exhausted, wrote %llu IPv4 and %llu "
+                "IPv6 prefixes\n",
+                (unsigned long long)ipv4, (unsigned long long)ipv6);
+    fprintf(stderr, "%llu records, %llu uncompressed bytes\n",
+            (unsigned long long)(ipv4 + ipv6 + 1),
+            (unsigned long long)gen.bytes_written);
+
+    free(gen.record);
+    free(gen.peers);
+    free(gen.selected);
+    free(gen.entry_peers);
+    return 0;
+}
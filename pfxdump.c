@@ -0,0 +1,537 @@
+#include "pfxdump.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <streamlike/file.h>
+#include <streamlike/http.h>
+#include <zidx.h>
+
+//
+#include "find_prefix.h"
+#include "mapped_input.h"
+#include "mrt_frames.h"
+#include "mrt_index.h"
+#include "mrt_reader.h"
+#include "mrt_walker.h"
+#include "span_cache.h"
+
+#define PFXDUMP_BUFFER_SIZE (1 << 20)
+
+enum stream_kind_t { STREAM_FILE, STREAM_URL, STREAM_MAPPED };
+
+struct pfxdump_t {
+    pthread_mutex_t lock;
+    streamlike_t *stream;
+    enum stream_kind_t kind;
+    int use_index;
+
+    /* Input is read through zidx, through an MRT reader with a
+     * self-contained MRT index, or frame by frame for transcoded files. */
+    zidx_index *index;
+    struct mrt_index_t mrt_index;
+    int has_mrt_index;
+    struct mrt_reader_t reader;
+    int has_reader;
+    struct mrt_frames_t frames;
+    int is_framed;
+    struct mrt_frames_reader_t frames_reader;
+
+    /* Points into the index or the frames, or to a copy taken while
+     * scanning, in which case it is owned. */
+    const uint8_t *peer_index_table;
+    size_t peer_index_table_len;
+    uint8_t *owned_peer_index_table;
+
+    /* Spans shared with other processes, see pfxdump_set_span_cache. The
+     * key is kept filled in but for the checkpoint. */
+    struct span_cache_t *cache;
+    struct span_cache_key_t cache_key;
+    uint8_t *span;
+
+    struct mrt_walker_t walker;
+    uint8_t *buffer;
+    int debug;
+    /* See find_prefix_checkpoint_kary. */
+    int probe_ways;
+    const char *error;
+};
+
+struct query_t {
+    struct pfxdump_t *handle;
+    struct afi_prefix_t from_prefix;
+    struct afi_prefix_t to_prefix;
+    struct prefix_key_t from;
+    struct prefix_key_t to;
+    /* Lookups stop at the first match, like pfxdump does. */
+    int first_only;
+    pfxdump_record_callback callback;
+    void *context;
+    long count;
+};
+
+enum { QUERY_DONE = 1 };
+
+static int startswith(const char *string, const char *prefix) {
+    while (*prefix)
+        if (*prefix++ != *string++) return 0;
+    return 1;
+}
+
+/* Lookups only touch a few windows, so local files are mapped and every seek
+ * hints the extent that follows, see mapped_input.h. */
+static streamlike_t *open_stream(const char *path, enum stream_kind_t *kind) {
+    if (startswith(path, "http") &&
+        (startswith(path + 4, "://") || startswith(path + 4, "s://"))) {
+        *kind = STREAM_URL;
+        return sl_http_create(path);
+    }
+    *kind = STREAM_MAPPED;
+    streamlike_t *stream = mapped_input_open(path, MAPPED_INPUT_RANDOM);
+    if (stream) return stream;
+    *kind = STREAM_FILE;
+    return sl_fopen(path, "rb");
+}
+
+static void close_stream(streamlike_t *stream, enum stream_kind_t kind) {
+    if (kind == STREAM_URL)
+        sl_http_destroy(stream);
+    else if (kind == STREAM_MAPPED)
+        mapped_input_close(stream);
+    else
+        sl_fclose(stream);
+}
+
+static long input_read(struct pfxdump_t *handle, void *buffer, size_t len) {
+    if (handle->is_framed)
+        return mrt_frames_reader_read(&handle->frames_reader, buffer, len);
+    if (handle->has_reader)
+        return mrt_reader_read(&handle->reader, buffer, len);
+    return zidx_read(handle->index, buffer, len);
+}
+
+static int input_seek(struct pfxdump_t *handle, off_t offset) {
+    if (handle->has_reader) return mrt_reader_seek(&handle->reader, offset);
+    return zidx_seek(handle->index, offset) == ZX_RET_OK ? 0 : -1;
+}
+
+static const char *open_index(struct pfxdump_t *handle,
+                              const char *index_path) {
+    streamlike_t *index_stream = sl_fopen(index_path, "rb");
+    if (index_stream == NULL) return "couldn't open index stream";
+
+    if (mrt_index_is_mrt_index(index_stream)) {
+        // self-contained index, windows are inflated on demand
+        int ok = mrt_index_import(&handle->mrt_index, index_stream) == 0 &&
+                 handle->mrt_index.has_windows;
+        sl_fclose(index_stream);
+        if (!ok) return "couldn't import mrt index";
+        if (mrt_reader_init(&handle->reader, handle->stream,
+                            &handle->mrt_index) != 0)
+            return "couldn't initialize mrt reader";
+        handle->has_reader = 1;
+        handle->has_mrt_index = 1;
+        return NULL;
+    }
+
+    int ret = zidx_import(handle->index, index_stream);
+    sl_fclose(index_stream);
+    if (ret != ZX_RET_OK) return "couldn't import zidx index";
+
+    // record offsets are optional, fall back to scanning windows
+    char *mrt_index_file = mrt_index_path(index_path);
+    if (mrt_index_file == NULL) return "out of memory";
+    index_stream = sl_fopen(mrt_index_file, "rb");
+    if (index_stream != NULL) {
+        handle->has_mrt_index =
+            mrt_index_import(&handle->mrt_index, index_stream) == 0 &&
+            mrt_index_matches(&handle->mrt_index, handle->index);
+        if (!handle->has_mrt_index)
+            fprintf(stderr, "warning: ignoring stale or invalid '%s'\n",
+                    mrt_index_file);
+        sl_fclose(index_stream);
+    }
+    free(mrt_index_file);
+    return NULL;
+}
+
+struct pfxdump_t *pfxdump_open(const char *path, const char *index_path,
+                               const char **error) {
+    const char *reason = NULL;
+    struct pfxdump_t *handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        if (error) *error = "out of memory";
+        return NULL;
+    }
+    pthread_mutex_init(&handle->lock, NULL);
+    mrt_index_init(&handle->mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+    mrt_walker_init(&handle->walker, 0, NULL, NULL);
+    handle->use_index = index_path != NULL;
+
+    handle->stream = open_stream(path, &handle->kind);
+    if (handle->stream == NULL) {
+        reason = "couldn't open gzip stream";
+        goto fail;
+    }
+    handle->buffer = malloc(PFXDUMP_BUFFER_SIZE);
+    handle->index = zidx_index_create();
+    if (handle->buffer == NULL || handle->index == NULL) {
+        reason = "out of memory";
+        goto fail;
+    }
+    if (zidx_index_init(handle->index, handle->stream) != ZX_RET_OK) {
+        reason = "couldn't initialize zidx index";
+        goto fail;
+    }
+    span_cache_identify(path, sl_length(handle->stream),
+                        &handle->cache_key.file);
+    if (index_path != NULL)
+        span_cache_identify(index_path, -1, &handle->cache_key.index);
+
+    handle->is_framed = mrt_frames_open(&handle->frames, handle->stream);
+    if (handle->is_framed < 0) {
+        handle->is_framed = 0;
+        reason = "couldn't read frame tables";
+        goto fail;
+    }
+    if (handle->is_framed) {
+        // frames are record aligned, so there are no windows to probe
+        if (mrt_frames_reader_init(&handle->frames_reader, &handle->frames,
+                                   handle->stream) != 0) {
+            mrt_frames_destroy(&handle->frames);
+            handle->is_framed = 0;
+            reason = "couldn't initialize frame reader";
+            goto fail;
+        }
+        handle->peer_index_table = handle->frames.peer_index_table;
+        handle->peer_index_table_len = handle->frames.peer_index_table_len;
+    } else if (index_path != NULL) {
+        reason = open_index(handle, index_path);
+        if (reason != NULL) goto fail;
+        // peers cached at index time spare reading the head of the file
+        if (handle->has_mrt_index) {
+            handle->peer_index_table = handle->mrt_index.peer_index_table;
+            handle->peer_index_table_len =
+                handle->mrt_index.peer_index_table_len;
+        }
+    }
+    return handle;
+
+fail:
+    if (error) *error = reason;
+    pfxdump_close(handle);
+    return NULL;
+}
+
+void pfxdump_close(struct pfxdump_t *handle) {
+    if (handle == NULL) return;
+    if (handle->has_reader) mrt_reader_destroy(&handle->reader);
+    if (handle->is_framed) {
+        mrt_frames_reader_destroy(&handle->frames_reader);
+        mrt_frames_destroy(&handle->frames);
+    }
+    if (handle->index) zidx_index_destroy(handle->index);
+    free(handle->index);
+    mrt_index_destroy(&handle->mrt_index);
+    if (handle->stream) close_stream(handle->stream, handle->kind);
+    mrt_walker_destroy(&handle->walker);
+    span_cache_close(handle->cache);
+    free(handle->span);
+    free(handle->owned_peer_index_table);
+    free(handle->buffer);
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+}
+
+static int capture_peer_index_table(struct pfxdump_t *handle,
+                                    const uint8_t *record, size_t len) {
+    if (handle->peer_index_table != NULL) return 0;
+    handle->owned_peer_index_table = malloc(len);
+    if (handle->owned_peer_index_table == NULL) return -1;
+    memcpy(handle->owned_peer_index_table, record, len);
+    handle->peer_index_table = handle->owned_peer_index_table;
+    handle->peer_index_table_len = len;
+    return 0;
+}
+
+static int query_record(void *context, off_t offset,
+                        const struct mrt_header_t *header,
+                        const uint8_t *record) {
+    (void)offset;
+    struct query_t *query = context;
+    size_t len = sizeof(struct mrt_header_t) + header->length;
+    if (is_tdv2_peer_index_header(header))
+        return capture_peer_index_table(query->handle, record, len);
+    if (!is_tdv2_rib_header(header)) return 0;
+
+    struct prefix_key_t key = get_prefix_key(record);
+    if (query->handle->debug) {
+        printf("debug: ");
+        prefix_printf(prefix_key_prefix(&key));
+        printf("\n");
+    }
+    int from_cmp = prefix_key_cmp(&key, &query->from);
+    int to_cmp = prefix_key_cmp(&key, &query->to);
+#ifndef NDEBUG
+    struct afi_prefix_t prefix = get_prefix(record);
+    int expected = afi_prefix_cmp(&prefix, &query->from_prefix);
+    assert((from_cmp > 0) - (from_cmp < 0) ==
+           (expected > 0) - (expected < 0));
+    expected = afi_prefix_cmp(&prefix, &query->to_prefix);
+    assert((to_cmp > 0) - (to_cmp < 0) == (expected > 0) - (expected < 0));
+#endif
+    if (from_cmp < 0) return 0;
+    if (to_cmp > 0) return QUERY_DONE;
+
+    query->count++;
+    if (query->callback(query->context, record, len) != 0) return QUERY_DONE;
+    return query->first_only ? QUERY_DONE : 0;
+}
+
+/* Where the span of checkpoint `idx` ends, and whether that is the end of
+ * the file. Returns -1 if the size of the file isn't known. */
+static off_t span_end(struct pfxdump_t *handle, int idx, int *last) {
+    *last = 0;
+    if (handle->has_reader && idx + 1 < handle->mrt_index.count)
+        return handle->mrt_index.checkpoints[idx + 1].offset;
+    if (!handle->has_reader && idx + 1 < zidx_checkpoint_count(handle->index))
+        return zidx_get_checkpoint_offset(
+            zidx_get_checkpoint(handle->index, idx + 1));
+    *last = 1;
+    return handle->has_mrt_index ? handle->mrt_index.uncomp_size : -1;
+}
+
+/* Positions the input at `offset`, where checkpoint `idx` starts. With a span
+ * cache, the span up to the next checkpoint is fed to the walker out of the
+ * cache instead, or inflated whole and cached on a miss, and the input is
+ * positioned after it for the walker to go on if it needs to. */
+static int seek_span(struct pfxdump_t *handle, int idx, off_t offset) {
+    int last = 0;
+    off_t end = handle->cache ? span_end(handle, idx, &last) : -1;
+    if (end <= offset ||
+        (size_t)(end - offset) > span_cache_slot_size(handle->cache)) {
+        if (input_seek(handle, offset) != 0) {
+            handle->error = "couldn't seek to mrt record";
+            return -1;
+        }
+        return 0;
+    }
+
+    size_t len = end - offset;
+    handle->cache_key.checkpoint = idx;
+    if (span_cache_get(handle->cache, &handle->cache_key, handle->span,
+                       len) == (long)len) {
+        int walked = mrt_walker_feed(&handle->walker, handle->span, len);
+        if (walked != 0) return walked;
+        // nothing follows the last span to seek to
+        if (last) return QUERY_DONE;
+        if (input_seek(handle, end) != 0) {
+            handle->error = "couldn't seek to mrt record";
+            return -1;
+        }
+        return 0;
+    }
+
+    if (input_seek(handle, offset) != 0) {
+        handle->error = "couldn't seek to mrt record";
+        return -1;
+    }
+    size_t filled = 0;
+    while (filled < len) {
+        long read = input_read(handle, handle->span + filled, len - filled);
+        if (read < 0) {
+            handle->error = "couldn't read mrt records";
+            return -1;
+        }
+        if (read == 0) break;
+        filled += read;
+    }
+    // a short span means the index doesn't match the file, don't keep it
+    if (filled == len)
+        span_cache_put(handle->cache, &handle->cache_key, handle->span, len);
+    return mrt_walker_feed(&handle->walker, handle->span, filled);
+}
+
+/* Positions the input before the first record that may be `from` and feeds
+ * the walker whatever precedes that position in memory already. */
+static int seek_query(struct pfxdump_t *handle, struct query_t *query) {
+    if (handle->is_framed) {
+        int frame = handle->use_index
+                        ? mrt_frames_find(&handle->frames, &query->from)
+                        : 0;
+        if (mrt_frames_reader_seek_frame(&handle->frames_reader, frame)) {
+            handle->error = "couldn't seek to frame";
+            return -1;
+        }
+        return 0;
+    }
+
+    struct prefix_checkpoint_t pfx_chkp = {-1, 0};
+    if (handle->use_index) {
+        pfx_chkp = find_prefix_checkpoint_kary(
+            &query->from_prefix, handle->has_reader ? NULL : handle->index,
+            handle->has_mrt_index ? &handle->mrt_index : NULL,
+            handle->probe_ways);
+        if (pfx_chkp.index < -1) {
+            handle->error = "couldn't find checkpoint";
+            return -1;
+        }
+    }
+    if (pfx_chkp.index < 0) {
+        if (input_seek(handle, 0) != 0) {
+            handle->error = "couldn't seek to start";
+            return -1;
+        }
+        return 0;
+    }
+
+    // the window holds the records right before the checkpoint
+    const void *window;
+    size_t len;
+    off_t offset;
+    if (handle->has_reader) {
+        len = mrt_index_window(&handle->mrt_index, pfx_chkp.index, &window);
+        offset = handle->mrt_index.checkpoints[pfx_chkp.index].offset;
+    } else {
+        zidx_checkpoint *chkp =
+            zidx_get_checkpoint(handle->index, pfx_chkp.index);
+        len = zidx_get_checkpoint_window(chkp, &window);
+        offset = zidx_get_checkpoint_offset(chkp);
+    }
+    size_t off = pfx_chkp.first_mrt_offset;
+    if (off < len) {
+        int walked = mrt_walker_feed(&handle->walker,
+                                     (const uint8_t *)window + off, len - off);
+        if (walked != 0) return walked;
+    }
+    return seek_span(handle, pfx_chkp.index, offset);
+}
+
+static long run_query(struct pfxdump_t *handle, struct query_t *query) {
+    handle->walker.callback = query_record;
+    handle->walker.context = query;
+    mrt_walker_reset(&handle->walker, 0);
+
+    int walked = seek_query(handle, query);
+    long read = 0;
+    while (walked == 0 &&
+           (read = input_read(handle, handle->buffer, PFXDUMP_BUFFER_SIZE)) >
+               0)
+        walked = mrt_walker_feed(&handle->walker, handle->buffer, read);
+
+    if (walked < 0) {
+        if (handle->error == NULL) handle->error = "couldn't walk mrt records";
+        return -1;
+    }
+    if (walked == 0 && read < 0) {
+        handle->error = "couldn't read mrt records";
+        return -1;
+    }
+    return query->count;
+}
+
+static int parse_query_prefix(struct pfxdump_t *handle, const char *str,
+                              struct afi_prefix_t *prefix,
+                              struct prefix_key_t *key) {
+    if (afi_prefix_parse(str, prefix, &handle->error) != 0) return -1;
+    *key = prefix_key_make(prefix);
+    return 0;
+}
+
+int pfxdump_lookup(struct pfxdump_t *handle, const char *prefix,
+                   pfxdump_record_callback callback, void *context) {
+    struct query_t query;
+    memset(&query, 0, sizeof(query));
+    query.handle = handle;
+    query.first_only = 1;
+    query.callback = callback;
+    query.context = context;
+
+    pthread_mutex_lock(&handle->lock);
+    handle->error = NULL;
+    long ret = -1;
+    if (parse_query_prefix(handle, prefix, &query.from_prefix, &query.from) ==
+        0) {
+        query.to_prefix = query.from_prefix;
+        query.to = query.from;
+        ret = run_query(handle, &query);
+    }
+    pthread_mutex_unlock(&handle->lock);
+    return ret < 0 ? -1 : ret > 0;
+}
+
+long pfxdump_range(struct pfxdump_t *handle, const char *from, const char *to,
+                   pfxdump_record_callback callback, void *context) {
+    struct query_t query;
+    memset(&query, 0, sizeof(query));
+    query.handle = handle;
+    query.callback = callback;
+    query.context = context;
+
+    pthread_mutex_lock(&handle->lock);
+    handle->error = NULL;
+    long ret = -1;
+    if (parse_query_prefix(handle, from, &query.from_prefix, &query.from) ==
+            0 &&
+        parse_query_prefix(handle, to, &query.to_prefix, &query.to) == 0)
+        ret = run_query(handle, &query);
+    pthread_mutex_unlock(&handle->lock);
+    return ret;
+}
+
+int pfxdump_set_span_cache(struct pfxdump_t *handle, const char *path) {
+    pthread_mutex_lock(&handle->lock);
+    span_cache_close(handle->cache);
+    free(handle->span);
+    handle->cache = NULL;
+    handle->span = NULL;
+    handle->error = NULL;
+    if (path != NULL) {
+        handle->cache = span_cache_open(path);
+        if (handle->cache == NULL) {
+            handle->error = "couldn't map span cache";
+        } else {
+            handle->span = malloc(span_cache_slot_size(handle->cache));
+            if (handle->span == NULL) {
+                span_cache_close(handle->cache);
+                handle->cache = NULL;
+                handle->error = "out of memory";
+            }
+        }
+    }
+    int ret = path != NULL && handle->cache == NULL ? -1 : 0;
+    pthread_mutex_unlock(&handle->lock);
+    return ret;
+}
+
+const char *pfxdump_error(struct pfxdump_t *handle) {
+    pthread_mutex_lock(&handle->lock);
+    const char *error = handle->error ? handle->error : "no error";
+    pthread_mutex_unlock(&handle->lock);
+    return error;
+}
+
+const uint8_t *pfxdump_peer_index_table(struct pfxdump_t *handle,
+                                        size_t *len) {
+    pthread_mutex_lock(&handle->lock);
+    const uint8_t *table = handle->peer_index_table;
+    *len = handle->peer_index_table_len;
+    pthread_mutex_unlock(&handle->lock);
+    return table;
+}
+
+void pfxdump_set_debug(struct pfxdump_t *handle, int debug) {
+    pthread_mutex_lock(&handle->lock);
+    handle->debug = debug;
+    pthread_mutex_unlock(&handle->lock);
+}
+
+void pfxdump_set_probe_ways(struct pfxdump_t *handle, int ways) {
+    pthread_mutex_lock(&handle->lock);
+    handle->probe_ways = ways;
+    pthread_mutex_unlock(&handle->lock);
+}
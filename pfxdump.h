@@ -0,0 +1,65 @@
+#ifndef PFXDUMP_H
+#define PFXDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Prefix lookups as a library, for services that would otherwise run the
+ * pfxdump binary once per query. A handle opens the MRT file and imports its
+ * index once, then answers any number of queries reusing its buffers and
+ * decompression state. Queries on one handle are serialized by a lock held
+ * for the whole query, so a handle can be shared between threads; threads
+ * wanting to query in parallel open a handle each.
+ *
+ * Every input pfxdump reads is accepted: gzipped MRT files and URLs with a
+ * zidx index, with or without its .mrtx sidecar, with a self-contained index
+ * built by zidx -z, and files written by pfxdump-transcode, which carry their
+ * own index. Prefixes are given as "<ip-address>/<prefix-length>". */
+
+struct pfxdump_t;
+
+/* Called with every matching RIB record, `record` being the whole MRT record,
+ * header included, and only valid during the call. A non-zero return value
+ * ends the query. Callbacks must not query the handle they are called from. */
+typedef int (*pfxdump_record_callback)(void *context, const uint8_t *record,
+                                       size_t len);
+
+/* Returns NULL on failure and points `error` at the reason, if given. A NULL
+ * `index_path` scans from the start of the file on every query, as pfxdump -i
+ * does. */
+struct pfxdump_t *pfxdump_open(const char *path, const char *index_path,
+                               const char **error);
+void pfxdump_close(struct pfxdump_t *handle);
+
+/* Calls `callback` with the RIB record of `prefix`. Returns 1 if it was found,
+ * 0 if it wasn't and -1 on error, see pfxdump_error. */
+int pfxdump_lookup(struct pfxdump_t *handle, const char *prefix,
+                   pfxdump_record_callback callback, void *context);
+/* Calls `callback` with the RIB records of all prefixes from `from` to `to`,
+ * both included, in file order. Returns the number of records passed to the
+ * callback, or -1 on error. */
+long pfxdump_range(struct pfxdump_t *handle, const char *from, const char *to,
+                   pfxdump_record_callback callback, void *context);
+
+/* Shares inflated checkpoint spans with other processes through the cache at
+ * `path`, created if missing, see span_cache.h. Lookups landing in a cached
+ * span skip seeking and inflating it, and on a miss inflate the whole span to
+ * cache it. A NULL `path` stops caching. Returns 0, or -1 if the cache can't
+ * be mapped, see pfxdump_error. */
+int pfxdump_set_span_cache(struct pfxdump_t *handle, const char *path);
+
+/* Message of the last failed query on `handle`. */
+const char *pfxdump_error(struct pfxdump_t *handle);
+/* The PEER_INDEX_TABLE record RIB entries refer to, header included, or NULL
+ * if neither the index had it nor any query has come across it yet. The copy
+ * is valid until the handle is closed. */
+const uint8_t *pfxdump_peer_index_table(struct pfxdump_t *handle, size_t *len);
+/* Prints every prefix compared against while searching, like pfxdump -d. */
+void pfxdump_set_debug(struct pfxdump_t *handle, int debug);
+/* Searches checkpoints `ways` at a time on as many threads instead of
+ * bisecting, see find_prefix_checkpoint_kary. Lowers latency when probes are
+ * slow, e.g. with self-contained indexes whose windows are inflated on
+ * demand. Off (2) by default. */
+void pfxdump_set_probe_ways(struct pfxdump_t *handle, int ways);
+
+#endif
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "span_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPAN_CACHE_MAGIC 0x434e5053 /* "SPNC" */
+#define SPAN_CACHE_VERSION 1
+#define SPAN_CACHE_HEADER_SIZE 4096
+#define SPAN_CACHE_READ_ATTEMPTS 2
+
+/* The file is only ever mapped on the machine that created it, so its
+ * structures are laid out natively rather than in little-endian. */
+struct cache_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t ways;
+    uint64_t slot_size;
+    /* Ticks on every hit or store, the last tick of a slot orders LRU. */
+    uint64_t clock;
+};
+
+/* `sequence` is 0 for a slot never written and odd while it is written. */
+struct cache_slot_t {
+    uint64_t sequence;
+    uint64_t last_used;
+    struct span_cache_key_t key;
+    uint64_t len;
+};
+
+struct span_cache_t {
+    uint8_t *data;
+    size_t len;
+    struct cache_header_t *header;
+    struct cache_slot_t *slots;
+    uint8_t *spans;
+};
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+/* Size of the whole file, slot headers and spans starting at page
+ * boundaries. */
+static size_t layout_size(uint32_t slot_count, uint64_t slot_size,
+                          size_t *spans_offset) {
+    size_t page = SPAN_CACHE_HEADER_SIZE;
+    size_t slots_len = slot_count * sizeof(struct cache_slot_t);
+    *spans_offset = page + (slots_len + page - 1) / page * page;
+    return *spans_offset + slot_count * slot_size;
+}
+
+/* The cache is set up in a temporary file and linked in place, so no process
+ * ever maps a half-initialized one. Losing the race to another process is
+ * fine, its cache is used instead. */
+static int create_file(const char *path) {
+    char *temp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (temp == NULL) return -1;
+    sprintf(temp, "%s.XXXXXX", path);
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        free(temp);
+        return -1;
+    }
+
+    int ret = -1;
+    size_t spans_offset;
+    size_t size =
+        layout_size(SPAN_CACHE_SLOTS, SPAN_CACHE_SLOT_SIZE, &spans_offset);
+    struct cache_header_t header = {SPAN_CACHE_MAGIC, SPAN_CACHE_VERSION,
+                                    SPAN_CACHE_SLOTS, SPAN_CACHE_WAYS,
+                                    SPAN_CACHE_SLOT_SIZE, 0};
+    if (ftruncate(fd, size) == 0 &&
+        pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        (link(temp, path) == 0 || errno == EEXIST))
+        ret = 0;
+    unlink(temp);
+    close(fd);
+    free(temp);
+    return ret;
+}
+
+struct span_cache_t *span_cache_open(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0 && errno == ENOENT && create_file(path) == 0)
+        fd = open(path, O_RDWR);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= SPAN_CACHE_HEADER_SIZE)
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                    0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    struct cache_header_t *header = data;
+    size_t spans_offset;
+    struct span_cache_t *cache = NULL;
+    if (header->magic == SPAN_CACHE_MAGIC &&
+        header->version == SPAN_CACHE_VERSION && header->ways > 0 &&
+        header->slot_count > 0 && header->slot_count % header->ways == 0 &&
+        layout_size(header->slot_count, header->slot_size, &spans_offset) ==
+            (size_t)st.st_size)
+        cache = malloc(sizeof(*cache));
+    if (cache == NULL) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    cache->data = data;
+    cache->len = st.st_size;
+    cache->header = header;
+    cache->slots =
+        (struct cache_slot_t *)(cache->data + SPAN_CACHE_HEADER_SIZE);
+    cache->spans = cache->data + spans_offset;
+    return cache;
+}
+
+void span_cache_close(struct span_cache_t *cache) {
+    if (cache == NULL) return;
+    munmap(cache->data, cache->len);
+    free(cache);
+}
+
+size_t span_cache_slot_size(const struct span_cache_t *cache) {
+    return cache->header->slot_size;
+}
+
+static struct cache_slot_t *find_set(struct span_cache_t *cache,
+                                     const struct span_cache_key_t *key) {
+    uint32_t ways = cache->header->ways;
+    uint32_t sets = cache->header->slot_count / ways;
+    uint64_t hash = fnv1a(key, sizeof(*key), FNV_OFFSET_BASIS);
+    return &cache->slots[hash % sets * ways];
+}
+
+static uint8_t *slot_span(struct span_cache_t *cache,
+                          const struct cache_slot_t *slot) {
+    return cache->spans + (slot - cache->slots) * cache->header->slot_size;
+}
+
+static void touch(struct span_cache_t *cache, struct cache_slot_t *slot) {
+    uint64_t tick = __atomic_add_fetch(&cache->header->clock, 1,
+                                       __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->last_used, tick, __ATOMIC_RELAXED);
+}
+
+long span_cache_get(struct span_cache_t *cache,
+                   const struct span_cache_key_t *key, uint8_t *buffer,
+                   size_t capacity) {
+    struct cache_slot_t *set = find_set(cache, key);
+    for (uint32_t i = 0; i < cache->header->ways; i++) {
+        struct cache_slot_t *slot = &set[i];
+        for (int attempt = 0; attempt < SPAN_CACHE_READ_ATTEMPTS; attempt++) {
+            uint64_t sequence =
+                __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+            if (sequence == 0 || sequence & 1) break;
+            // anything read here may be torn until the sequence is checked
+            struct span_cache_key_t slot_key = slot->key;
+            uint64_t len = slot->len;
+            if (memcmp(&slot_key, key, sizeof(*key)) != 0 ||
+                len > capacity || len > cache->header->slot_size)
+                break;
+            memcpy(buffer, slot_span(cache, slot), len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) !=
+                sequence)
+                continue;
+            touch(cache, slot);
+            return len;
+        }
+    }
+    return -1;
+}
+
+int span_cache_put(struct span_cache_t *cache,
+                   const struct span_cache_key_t *key, const uint8_t *data,
+                   size_t len) {
+    if (len > cache->header->slot_size) return -1;
+    struct cache_slot_t *set = find_set(cache, key);
+    struct cache_slot_t *victim = NULL;
+    uint64_t victim_sequence = 0;
+    uint64_t victim_used = UINT64_MAX;
+    for (uint32_t i = 0; i < cache->header->ways; i++) {
+        struct cache_slot_t *slot = &set[i];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) continue;
+        if (sequence == 0) {
+            victim = slot;
+            victim_sequence = 0;
+            break;
+        }
+        // another process may have cached it meanwhile
+        if (memcmp(&slot->key, key, sizeof(*key)) == 0) return 0;
+        uint64_t used = __atomic_load_n(&slot->last_used, __ATOMIC_RELAXED);
+        if (used < victim_used) {
+            victim = slot;
+            victim_sequence = sequence;
+            victim_used = used;
+        }
+    }
+    if (victim == NULL ||
+        !__atomic_compare_exchange_n(&victim->sequence, &victim_sequence,
+                                     victim_sequence + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return -1;
+    // the odd sequence has to be visible before any byte of the span
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    victim->key = *key;
+    victim->len = len;
+    memcpy(slot_span(cache, victim), data, len);
+    __atomic_store_n(&victim->sequence, victim_sequence + 2,
+                     __ATOMIC_RELEASE);
+    touch(cache, victim);
+    return 0;
+}
+
+void span_cache_identify(const char *path, off_t length,
+                         struct span_cache_identity_t *identity) {
+    struct stat st;
+    memset(identity, 0, sizeof(*identity));
+    if (stat(path, &st) == 0) {
+        identity->words[0] = st.st_dev;
+        identity->words[1] = st.st_ino;
+        identity->words[2] = st.st_size;
+        identity->words[3] =
+            (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    } else {
+        identity->words[1] = fnv1a(path, strlen(path), FNV_OFFSET_BASIS);
+        identity->words[2] = length;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef SPAN_CACHE_H
+#define SPAN_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Decompressed checkpoint spans shared between processes through a file
+ * mapped by all of them, best kept on a tmpfs such as /dev/shm. Lookups of
+ * hot prefixes keep landing in the same few spans, so a process finding a
+ * span cached by another one copies it out instead of seeking and inflating
+ * it again.
+ *
+ * The file is a fixed number of slots of a fixed size, grouped in sets of
+ * SPAN_CACHE_WAYS by the hash of their key. Within a set the least recently
+ * used slot is evicted. Readers take no lock: every slot has a sequence
+ * number, odd while the slot is written, which a reader checks before and
+ * after copying the span out and retries or misses on if it moved. Writers
+ * claim a slot by making its sequence odd with a compare-and-swap and give
+ * up if another writer got there first, so nothing ever waits. A writer
+ * dying mid-copy leaves its slot claimed until the file is removed.
+ *
+ * Spans are keyed by the identity of the compressed file, that of the index
+ * whose checkpoints they start at and the checkpoint, see
+ * span_cache_identify. */
+
+#define SPAN_CACHE_SLOTS 128
+#define SPAN_CACHE_SLOT_SIZE (4 << 20)
+#define SPAN_CACHE_WAYS 8
+
+struct span_cache_t;
+
+/* Device, inode, size and modification time of a local file, or a hash of
+ * the path and `length` for URLs, which can't be stat'ed. */
+struct span_cache_identity_t {
+    uint64_t words[4];
+};
+
+struct span_cache_key_t {
+    struct span_cache_identity_t file;
+    struct span_cache_identity_t index;
+    int64_t checkpoint;
+};
+
+/* Maps the cache at `path`, creating it first if there is none. Returns NULL
+ * if it can't be mapped or was created with another layout. */
+struct span_cache_t *span_cache_open(const char *path);
+void span_cache_close(struct span_cache_t *cache);
+size_t span_cache_slot_size(const struct span_cache_t *cache);
+
+/* Copies the span of `key` into `buffer`, which holds `capacity` bytes.
+ * Returns its length, or -1 if it isn't cached. */
+long span_cache_get(struct span_cache_t *cache,
+                   const struct span_cache_key_t *key, uint8_t *buffer,
+                   size_t capacity);
+/* Caches `len` bytes as the span of `key`. Returns 0 if they were stored
+ * and -1 if they didn't fit or the set was busy being written. */
+int span_cache_put(struct span_cache_t *cache,
+                   const struct span_cache_key_t *key, const uint8_t *data,
+                   size_t len);
+
+void span_cache_identify(const char *path, off_t length,
+                         struct span_cache_identity_t *identity);
+
+#endif
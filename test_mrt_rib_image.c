@@ -0,0 +1,274 @@
+/* Checks longest matches of mrt_rib_image.h against a linear scan over the
+ * RIB records of a dump, usually written by mrtgen. Routes that mrtgen never
+ * generates are added: default routes, host routes, multicast ones that must
+ * not match, and a chain of lengths around every trie stride boundary.
+ *
+ * Usage: test_mrt_rib_image <gzipped-mrt-file> <image-file> */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <arpa/inet.h>
+#include <zlib.h>
+
+//
+#include "find_prefix.h"
+#include "mrt_rib_image.h"
+
+enum {
+    MRT_HEADER_SIZE = 12,
+    TABLE_DUMP_V2 = 13,
+    TABLE_DUMP_V2_RIB_IPV4_UNICAST = 2,
+    TABLE_DUMP_V2_RIB_IPV4_MULTICAST = 3,
+    TABLE_DUMP_V2_RIB_IPV6_UNICAST = 4,
+    EXTRA_RECORD_SIZE = MRT_HEADER_SIZE + 5 + 16 + 2 + 8,
+    RANDOM_QUERIES = 20000
+};
+
+static const uint8_t multicast[4] = {233, 252, 0, 0};
+
+struct routes_t {
+    struct prefix_key_t *keys;
+    size_t count;
+    size_t cap;
+};
+
+static int add_key(struct routes_t *routes, const struct prefix_key_t *key) {
+    if (routes->count == routes->cap) {
+        size_t cap = routes->cap ? routes->cap * 2 : 1024;
+        struct prefix_key_t *keys =
+            realloc(routes->keys, cap * sizeof(*keys));
+        if (keys == NULL) return -1;
+        routes->keys = keys;
+        routes->cap = cap;
+    }
+    routes->keys[routes->count++] = *key;
+    return 0;
+}
+
+static int width(const struct prefix_key_t *key) {
+    return key->afi == AFI_TYPE_IPV6 ? 128 : 32;
+}
+
+static void truncate_key(struct prefix_key_t *key, int len) {
+    key->len = len;
+    for (int bit = len; bit < 128; bit++)
+        key->addr[bit / 8] &= ~(0x80U >> bit % 8);
+}
+
+static int covers(const struct prefix_key_t *outer,
+                  const struct prefix_key_t *inner) {
+    if (outer->afi != inner->afi || outer->len > inner->len) return 0;
+    for (int bit = 0; bit < outer->len; bit++) {
+        unsigned mask = 0x80U >> bit % 8;
+        if ((outer->addr[bit / 8] ^ inner->addr[bit / 8]) & mask) return 0;
+    }
+    return 1;
+}
+
+static const struct prefix_key_t *linear_lookup(const struct routes_t *routes,
+                                                const struct prefix_key_t
+                                                    *key) {
+    const struct prefix_key_t *best = NULL;
+    for (size_t i = 0; i < routes->count; i++)
+        if (covers(&routes->keys[i], key) &&
+            (best == NULL || routes->keys[i].len > best->len))
+            best = &routes->keys[i];
+    return best;
+}
+
+/* A RIB record of `key` with one entry without attributes. */
+static size_t make_record(uint8_t *record, const struct prefix_key_t *key,
+                          int subtype) {
+    size_t prefix_bytes = (key->len + 7) / 8;
+    size_t len = MRT_HEADER_SIZE + 5 + prefix_bytes + 2 + 8;
+    memset(record, 0, len);
+    record[5] = TABLE_DUMP_V2;
+    record[7] = subtype;
+    record[11] = len - MRT_HEADER_SIZE;
+    uint8_t *p = record + MRT_HEADER_SIZE;
+    p[4] = key->len;
+    memcpy(p + 5, key->addr, prefix_bytes);
+    p[5 + prefix_bytes + 1] = 1;
+    return len;
+}
+
+static int add_extra(struct mrt_rib_image_builder_t *builder,
+                     struct routes_t *routes, int afi, const uint8_t *addr,
+                     int len, int subtype) {
+    uint8_t record[EXTRA_RECORD_SIZE];
+    struct prefix_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.afi = afi;
+    memcpy(key.addr, addr, afi == AFI_TYPE_IPV6 ? 16 : 4);
+    truncate_key(&key, len);
+    make_record(record, &key, subtype);
+    struct mrt_header_t header = get_header(record);
+    if (mrt_rib_image_builder_record(builder, &header, record) != 0) return -1;
+    if (subtype == TABLE_DUMP_V2_RIB_IPV4_MULTICAST) return 0;
+    return add_key(routes, &key);
+}
+
+static int add_extras(struct mrt_rib_image_builder_t *builder,
+                      struct routes_t *routes) {
+    static const uint8_t v4[4] = {198, 51, 100, 77};
+    static const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0xa5, 0x5a,
+                                   0xf0, 0x0f, 0x12, 0x34, 0x56, 0x78,
+                                   0x9a, 0xbc, 0xde, 0xf1};
+    int ret = 0;
+    ret |= add_extra(builder, routes, AFI_TYPE_IPV4, v4, 0,
+                     TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+    ret |= add_extra(builder, routes, AFI_TYPE_IPV6, v6, 0,
+                     TABLE_DUMP_V2_RIB_IPV6_UNICAST);
+    ret |= add_extra(builder, routes, AFI_TYPE_IPV4, v4, 32,
+                     TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+    ret |= add_extra(builder, routes, AFI_TYPE_IPV6, v6, 128,
+                     TABLE_DUMP_V2_RIB_IPV6_UNICAST);
+    ret |= add_extra(builder, routes, AFI_TYPE_IPV4, multicast, 24,
+                     TABLE_DUMP_V2_RIB_IPV4_MULTICAST);
+    // one below, at and above every stride boundary
+    for (int len = MRT_RIB_IMAGE_STRIDE; len < 128;
+         len += MRT_RIB_IMAGE_STRIDE)
+        for (int d = -1; d <= 1; d++) {
+            if (len + d < 32)
+                ret |= add_extra(builder, routes, AFI_TYPE_IPV4, v4, len + d,
+                                 TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+            ret |= add_extra(builder, routes, AFI_TYPE_IPV6, v6, len + d,
+                             TABLE_DUMP_V2_RIB_IPV6_UNICAST);
+        }
+    return ret;
+}
+
+static int read_dump(const char *path,
+                     struct mrt_rib_image_builder_t *builder,
+                     struct routes_t *routes) {
+    gzFile gz = gzopen(path, "rb");
+    if (gz == NULL) return -1;
+    uint8_t *record = NULL;
+    size_t cap = 0;
+    int ret = -1;
+    for (;;) {
+        uint8_t head[MRT_HEADER_SIZE];
+        int read = gzread(gz, head, sizeof(head));
+        if (read == 0) {
+            ret = 0;
+            break;
+        }
+        if (read != (int)sizeof(head)) break;
+        struct mrt_header_t header = get_header(head);
+        size_t len = MRT_HEADER_SIZE + (size_t)header.length;
+        if (len > cap) {
+            uint8_t *grown = realloc(record, len);
+            if (grown == NULL) break;
+            record = grown;
+            cap = len;
+        }
+        memcpy(record, head, sizeof(head));
+        if (gzread(gz, record + MRT_HEADER_SIZE, header.length) !=
+            (int)header.length)
+            break;
+        if (mrt_rib_image_builder_record(builder, &header, record) != 0) break;
+        if (header.type == TABLE_DUMP_V2 &&
+            (header.subtype == TABLE_DUMP_V2_RIB_IPV4_UNICAST ||
+             header.subtype == TABLE_DUMP_V2_RIB_IPV6_UNICAST)) {
+            struct prefix_key_t key = get_prefix_key(record);
+            if (add_key(routes, &key) != 0) break;
+        }
+    }
+    free(record);
+    gzclose(gz);
+    return ret;
+}
+
+static void print_key(const char *what, const struct prefix_key_t *key) {
+    char dst[INET6_ADDRSTRLEN];
+    inet_ntop(key->afi ? AF_INET6 : AF_INET, key->addr, dst, sizeof(dst));
+    fprintf(stderr, "%s %s/%u", what, dst, key->len);
+}
+
+static int check(const struct mrt_rib_image_t *image,
+                 const struct routes_t *routes,
+                 const struct prefix_key_t *key) {
+    const struct prefix_key_t *expected = linear_lookup(routes, key);
+    uint32_t route = mrt_rib_image_lookup(image, key);
+    const struct prefix_key_t *found =
+        route == MRT_RIB_IMAGE_NO_ROUTE ? NULL : &image->routes[route].key;
+    if (expected == NULL && found == NULL) return 0;
+    if (expected != NULL && found != NULL &&
+        prefix_key_cmp(expected, found) == 0)
+        return 0;
+    print_key("lookup of", key);
+    if (found) print_key(" found", found);
+    if (expected) print_key(" instead of", expected);
+    fprintf(stderr, "%s\n", expected ? "" : " instead of nothing");
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <gzipped-mrt-file> <image-file>\n",
+                argv[0]);
+        return 1;
+    }
+    struct mrt_rib_image_builder_t builder;
+    struct routes_t routes = {NULL, 0, 0};
+    mrt_rib_image_builder_init(&builder);
+    if (read_dump(argv[1], &builder, &routes) != 0 ||
+        add_extras(&builder, &routes) != 0 ||
+        mrt_rib_image_builder_write(&builder, argv[2]) != 0) {
+        fprintf(stderr, "error: couldn't build image from '%s'\n", argv[1]);
+        return 1;
+    }
+    mrt_rib_image_builder_destroy(&builder);
+    struct mrt_rib_image_t image;
+    if (mrt_rib_image_open(&image, argv[2]) != 0) {
+        fprintf(stderr, "error: couldn't open image '%s'\n", argv[2]);
+        return 1;
+    }
+
+    // every route at every length, which covers /0 and full lengths, then
+    // random addresses near routes and anywhere
+    long queries = 0, failures = 0;
+    for (size_t i = 0; i < routes.count; i += 1 + i / 64) {
+        for (int len = 0; len <= width(&routes.keys[i]); len++) {
+            struct prefix_key_t key = routes.keys[i];
+            truncate_key(&key, len);
+            failures += check(&image, &routes, &key) != 0;
+            queries++;
+        }
+    }
+    srand(1);
+    for (int i = 0; i < RANDOM_QUERIES; i++) {
+        struct prefix_key_t key;
+        memset(&key, 0, sizeof(key));
+        if (i % 2) {
+            key = routes.keys[rand() % routes.count];
+            key.addr[rand() % (width(&key) / 8)] ^= 1U << rand() % 8;
+        } else {
+            key.afi = rand() % 2;
+            for (int b = 0; b < 16; b++) key.addr[b] = rand();
+        }
+        truncate_key(&key, width(&key) - (rand() % 2 ? rand() % 8 : 0));
+        failures += check(&image, &routes, &key) != 0;
+        queries++;
+    }
+    // only the default route covers the multicast one
+    struct prefix_key_t key;
+    memset(&key, 0, sizeof(key));
+    memcpy(key.addr, multicast, sizeof(multicast));
+    for (int len = 24; len <= 32; len++) {
+        truncate_key(&key, len);
+        failures += check(&image, &routes, &key) != 0;
+        queries++;
+    }
+    mrt_rib_image_close(&image);
+    free(routes.keys);
+
+    printf("%ld lookups over %zu routes, %ld wrong\n", queries, routes.count,
+           failures);
+    return failures > 0;
+}
@@ -0,0 +1,70 @@
+/* Checks prefix_key_cmp against afi_prefix_cmp on every pair of a set of
+ * prefixes around byte and AFI boundaries. Pairs of address bytes are varied
+ * at sites that put them in the first 64-bit word of a key, across the first
+ * and the second, and across the second and the trailing length bytes, at
+ * lengths up to and past each site, so each term of the compare decides some
+ * pairs.
+ *
+ * Usage: test_prefix_key */
+
+#include <stdio.h>
+#include <string.h>
+
+//
+#include "find_prefix.h"
+
+static const uint8_t patterns[] = {0x00, 0x01, 0x7F, 0x80, 0xFF};
+// first of two varied address bytes, at key bytes 1-2, 3-4, 7-8 and 15-16
+static const int sites[] = {0, 2, 6, 14};
+
+enum {
+    PATTERNS = sizeof(patterns),
+    SITES = sizeof(sites) / sizeof(sites[0]),
+    // from one bit before the first varied byte to one past the second
+    LENGTHS = 19,
+    PREFIXES = 2 * SITES * PATTERNS * PATTERNS * LENGTHS
+};
+
+static int sign(int cmp) { return (cmp > 0) - (cmp < 0); }
+
+int main(void) {
+    static struct afi_prefix_t pfxs[PREFIXES];
+    static struct prefix_key_t keys[PREFIXES];
+    int count = 0;
+    for (int type = AFI_TYPE_IPV4; type <= AFI_TYPE_IPV6; type++) {
+        int width = type == AFI_TYPE_IPV6 ? 128 : 32;
+        for (int s = 0; s < SITES; s++) {
+            int site = sites[s];
+            if (site * 8 >= width) continue;
+            for (int a = 0; a < PATTERNS; a++)
+                for (int b = 0; b < PATTERNS; b++)
+                    for (int l = 0; l < LENGTHS; l++) {
+                        int len = site * 8 - 1 + l;
+                        if (len < 0 || len > width) continue;
+                        struct afi_prefix_t *pfx = &pfxs[count];
+                        // host bits are garbage, as in records and user input
+                        memset(pfx->prefix.addr, 0xAB,
+                               sizeof(pfx->prefix.addr));
+                        pfx->type = type;
+                        pfx->prefix.len = len;
+                        pfx->prefix.addr[site] = patterns[a];
+                        pfx->prefix.addr[site + 1] = patterns[b];
+                        keys[count++] = prefix_key_make(pfx);
+                    }
+        }
+    }
+
+    long failures = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < count; j++) {
+            int expected = sign(afi_prefix_cmp(&pfxs[i], &pfxs[j]));
+            int actual = sign(prefix_key_cmp(&keys[i], &keys[j]));
+            if (expected == actual) continue;
+            if (failures++ < 10)
+                fprintf(stderr, "prefixes %d and %d compare as %d, not %d\n",
+                        i, j, actual, expected);
+        }
+    }
+    printf("%ld comparisons, %ld wrong\n", (long)count * count, failures);
+    return failures > 0;
+}
@@ -0,0 +1,197 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+#include <streamlike.h>
+#include <streamlike/file.h>
+#include <zidx.h>
+#include <zlib.h>
+#include <zstd.h>
+
+//
+#include "find_prefix.h"
+#include "mrt_frames.h"
+#include "mrt_walker.h"
+
+/* Rewrites a gzipped MRT file into record aligned, independently compressed
+ * zstd frames or gzip members with an embedded first-prefix key table, see
+ * mrt_frames.h. */
+
+struct transcoder_t {
+    struct mrt_frames_writer_t writer;
+    size_t frame_size;
+    uint8_t *frame;
+    size_t frame_len;
+    size_t frame_cap;
+    int has_key;
+    struct prefix_key_t key;
+    int has_peer_index_table;
+};
+
+static void errexit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+static void usageexit(const char *program) {
+    errexit(
+        "usage: %s <gzipped-mrt-file> <output-file> [-g] [-f <frame-bytes>] "
+        "[-l <level>]\n"
+        "\t-g: write independent gzip members instead of zstd frames\n"
+        "\t-f: target uncompressed bytes per frame, frames end on record "
+        "boundaries (default: 1048576)\n"
+        "\t-l: compression level (default: 19 for zstd, 6 for gzip)\n",
+        program);
+}
+
+static int flush_frame(struct transcoder_t *tc) {
+    if (tc->frame_len == 0) return 0;
+    int ret = mrt_frames_writer_frame(&tc->writer, tc->frame, tc->frame_len,
+                                      tc->has_key ? &tc->key : NULL);
+    tc->frame_len = 0;
+    tc->has_key = 0;
+    return ret;
+}
+
+static int frame_append(struct transcoder_t *tc, const uint8_t *data,
+                        size_t len) {
+    if (tc->frame_len + len > tc->frame_cap) {
+        size_t cap = tc->frame_cap ? tc->frame_cap : 1 << 16;
+        while (cap < tc->frame_len + len) cap *= 2;
+        uint8_t *frame = realloc(tc->frame, cap);
+        if (frame == NULL) return -1;
+        tc->frame = frame;
+        tc->frame_cap = cap;
+    }
+    memcpy(tc->frame + tc->frame_len, data, len);
+    tc->frame_len += len;
+    return 0;
+}
+
+static int transcode_record(void *context, off_t offset,
+                            const struct mrt_header_t *header,
+                            const uint8_t *record) {
+    (void)offset;
+    struct transcoder_t *tc = context;
+    size_t len = sizeof(struct mrt_header_t) + header->length;
+
+    if (tc->frame_len > 0 && tc->frame_len + len > tc->frame_size &&
+        flush_frame(tc) != 0)
+        return -1;
+    if (frame_append(tc, record, len) != 0) return -1;
+
+    if (is_tdv2_rib_header(header) && !tc->has_key) {
+        tc->key = get_prefix_key(record);
+        tc->has_key = 1;
+    } else if (is_tdv2_peer_index_header(header) &&
+               !tc->has_peer_index_table) {
+        if (mrt_frames_writer_set_peer_index_table(&tc->writer, record, len))
+            return -1;
+        tc->has_peer_index_table = 1;
+    }
+    return 0;
+}
+
+static unsigned long long parse_number(const char *program, const char *arg) {
+    if (arg == NULL) usageexit(program);
+    char *end;
+    unsigned long long v = strtoull(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || *arg == '-')
+        errexit("error: expected a non-negative number, got '%s'\n", arg);
+    return v;
+}
+
+int main(int argc, char **argv) {
+    const char *program = argv[0];
+    if (argc < 3) usageexit(program);
+
+    const char *input_path = argv[1];
+    const char *output_path = argv[2];
+    struct transcoder_t tc;
+    memset(&tc, 0, sizeof(tc));
+    tc.frame_size = 1 << 20;
+    enum mrt_frames_type_t type = MRT_FRAMES_ZSTD;
+    int has_level = 0;
+    unsigned long long level_arg = 0;
+
+    for (int i = 3; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "-g")) {
+            type = MRT_FRAMES_GZIP;
+            continue;
+        }
+        if (!strcmp(argv[i], "-f")) {
+            tc.frame_size = parse_number(program, value);
+        } else if (!strcmp(argv[i], "-l")) {
+            level_arg = parse_number(program, value);
+            has_level = 1;
+        } else {
+            usageexit(program);
+        }
+        i++;
+    }
+    if (tc.frame_size == 0 || tc.frame_size > UINT32_MAX / 2)
+        errexit("error: frame size should be in the range of [1, 2^31)\n");
+    // checked once the format is known, -g may follow -l
+    int max_level =
+        type == MRT_FRAMES_GZIP ? Z_BEST_COMPRESSION : ZSTD_maxCLevel();
+    int level = type == MRT_FRAMES_GZIP ? 6 : 19;
+    if (has_level) {
+        if (level_arg > (unsigned long long)max_level) {
+            fprintf(stderr, "error: level should be in the range of [0, %d]\n",
+                    max_level);
+            usageexit(program);
+        }
+        level = level_arg;
+    }
+
+    streamlike_t *input = sl_fopen(input_path, "rb");
+    if (input == NULL) errexit("error: couldn't open '%s'\n", input_path);
+    streamlike_t *output = sl_fopen(output_path, "wb");
+    if (output == NULL) errexit("error: couldn't open '%s'\n", output_path);
+
+    zidx_index *index = zidx_index_create();
+    if (index == NULL || zidx_index_init(index, input) != ZX_RET_OK)
+        errexit("error: couldn't initialize zidx index\n");
+    if (mrt_frames_writer_init(&tc.writer, output, type, level))
+        errexit("error: couldn't initialize the compressor\n");
+
+    struct mrt_walker_t walker;
+    mrt_walker_init(&walker, 0, transcode_record, &tc);
+
+    const size_t buffer_size = 1 << 20;
+    uint8_t *buffer = malloc(buffer_size);
+    if (buffer == NULL) errexit("error: out of memory\n");
+    int read;
+    while ((read = zidx_read(index, buffer, buffer_size)) > 0)
+        if (mrt_walker_feed(&walker, buffer, read) != 0)
+            errexit("error: couldn't split records into frames\n");
+    if (read < 0) errexit("error: couldn't inflate '%s'\n", input_path);
+
+    // a truncated last record is kept as is, so the output restores the
+    // input byte for byte
+    if ((walker.pending_len > 0 &&
+         frame_append(&tc, walker.pending, walker.pending_len) != 0) ||
+        flush_frame(&tc) != 0 || mrt_frames_writer_finish(&tc.writer) != 0)
+        errexit("error: couldn't write '%s'\n", output_path);
+
+    fprintf(stderr, "%d frames, %lld bytes\n", tc.writer.frames.count,
+            (long long)tc.writer.uncomp_offset);
+
+    mrt_walker_destroy(&walker);
+    mrt_frames_writer_destroy(&tc.writer);
+    free(tc.frame);
+    free(buffer);
+    zidx_index_destroy(index);
+    free(index);
+    sl_fclose(input);
+    if (sl_fclose(output) != 0)
+        errexit("error: couldn't write '%s'\n", output_path);
+    return 0;
+}
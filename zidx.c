@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <streamlike.h>
@@ -6,6 +7,11 @@
 #include <zidx.h>
 #include <zlib.h>
 
+#include "mapped_input.h"
+#include "mrt_as_index.h"
+#include "mrt_index.h"
+#include "mrt_reader.h"
+
 
 uint32_t get_gzip_checksum(const char *filename)
 {
@@ -39,50 +45,899 @@ uint32_t get_gzip_checksum(const char *filename)
 	return file_checksum;
 }
 
-void create_index(const char *gzfile, const char *indexfile, long int span, int is_uncompressed)
+/* Local gzip files are mapped, see mapped_input.h, anything else goes
+ * through stdio. */
+static streamlike_t *open_gzip(const char *gzfile,
+                               enum mapped_input_advice_t advice)
+{
+    streamlike_t *stream = mapped_input_open(gzfile, advice);
+    return stream ? stream : sl_fopen(gzfile, "rb");
+}
+
+static int close_gzip(streamlike_t *stream)
+{
+    size_t len;
+    if (mapped_input_data(stream, &len)) return mapped_input_close(stream);
+    return sl_fclose(stream);
+}
+
+/* Indexes are written next to the old ones and moved in place once complete,
+ * so a failed build or extension leaves the old ones usable. */
+static char *temp_path(const char *path)
+{
+    char *temp = malloc(strlen(path) + sizeof(".tmp"));
+    if (temp) sprintf(temp, "%s.tmp", path);
+    return temp;
+}
+
+static void remove_temp(const char *temp)
+{
+    if (temp) remove(temp);
+}
+
+/* Returns 0, or 1 once an error is printed, leaving any old index as is. */
+int create_index(const char *gzfile, const char *indexfile, long int span, int is_uncompressed)
 {
     streamlike_t *gzf    = NULL;
     streamlike_t *indexf = NULL;
     zidx_index *zidx     = NULL;
+    char *temp           = NULL;
     const size_t len = 128*1024;
+    int ret, code = 1;
+
+    gzf = open_gzip(gzfile, MAPPED_INPUT_SEQUENTIAL);
+    if (gzf == NULL) {
+        printf("Error opening file (%s)\n", gzfile);
+        return 1;
+    }
+
+    temp = temp_path(indexfile);
+    zidx = zidx_index_create();
+    if (temp == NULL || zidx == NULL) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+
+    ret = zidx_index_init_ex(zidx, gzf, ZX_STREAM_GZIP_OR_ZLIB,
+                             ZX_CHECKSUM_DEFAULT, NULL,
+                             ZX_DEFAULT_INITIAL_LIST_CAPACITY,
+                             ZX_DEFAULT_WINDOW_SIZE,
+                             len, len);
+    /* ret = zidx_index_init(zidx, gzf); */
+    if (ret != ZX_RET_OK) {
+        printf("Error initializing index over %s\n", gzfile);
+        goto done;
+    }
+
+    ret = zidx_build_index(zidx, span, is_uncompressed ? 1 : 0);
+    if (ret != ZX_RET_OK) {
+        printf("Error building index over %s\n", gzfile);
+        goto done;
+    }
+
+    indexf = sl_fopen(temp, "wb");
+    if (indexf == NULL || zidx_export(zidx, indexf) != ZX_RET_OK) {
+        printf("Error writing index (%s)\n", temp);
+        goto done;
+    }
+    ret = sl_fclose(indexf);
+    indexf = NULL;
+    if (ret != ZX_RET_OK || rename(temp, indexfile) != 0) {
+        printf("Error writing index (%s)\n", indexfile);
+        goto done;
+    }
+    code = 0;
+
+done:
+    if (indexf) sl_fclose(indexf);
+    if (code != 0) remove_temp(temp);
+    if (zidx) zidx_index_destroy(zidx);
+    free(zidx);
+    free(temp);
+    close_gzip(gzf);
+    return code;
+}
+
+struct mrt_build_t {
+    struct mrt_index_builder_t builder;
+    struct mrt_spacing_t spacing;
+    int self_contained;
+    const uint8_t *buf;
+    /* Where the stream zidx inflates starts within the file, and the end of
+     * what an extended index covered already, see extend_mrt_index. */
+    off_t uncomp_base;
+    off_t comp_base;
+    off_t indexed_size;
+};
+
+/* Places checkpoints according to the spacing policy, and announces each of
+ * them to the MRT index builder so its record offsets can be resolved. A
+ * self-contained index keeps its own windows, so no zidx checkpoint is made. */
+static int mrt_block_callback(void *context, zidx_index *zidx,
+                              zidx_checkpoint_offset *offset, int is_last_block)
+{
+    struct mrt_build_t *build = context;
+    zidx_checkpoint *ckp;
+    size_t tail_len;
+    off_t uncomp = build->uncomp_base + offset->uncomp;
+    off_t comp = build->comp_base + offset->comp;
     int ret;
 
-    gzf = sl_fopen(gzfile, "rb");
-    assert(gzf);
+    if (is_last_block || uncomp <= build->indexed_size) return ZX_RET_OK;
+    if (!mrt_spacing_should_checkpoint(&build->spacing, &build->builder,
+                                       uncomp, comp))
+        return ZX_RET_OK;
 
-    indexf = sl_fopen(indexfile, "wb");
-    assert(indexf);
+    if (!build->self_contained) {
+        ckp = zidx_create_checkpoint();
+        if (ckp == NULL) return -1;
+        ret = zidx_fill_checkpoint(zidx, ckp, offset);
+        if (ret == ZX_RET_OK) ret = zidx_add_checkpoint(zidx, ckp);
+        free(ckp);
+        if (ret != ZX_RET_OK) return ret;
+    }
+
+    /* Bytes of the current read before the checkpoint, not yet fed. */
+    tail_len = uncomp - mrt_index_builder_position(&build->builder);
+    if (mrt_index_builder_checkpoint(&build->builder, uncomp, comp,
+                                     offset->comp_bits_count,
+                                     build->buf, tail_len) != 0)
+        return -1;
+    mrt_spacing_placed(&build->spacing, &build->builder, uncomp, comp);
+    return ZX_RET_OK;
+}
+
+static int as_index_record(void *context, off_t offset,
+                           const struct mrt_header_t *header,
+                           const uint8_t *record)
+{
+    return mrt_as_index_builder_record(context, offset, header, record);
+}
 
+/* `as_scope` is an enum mrt_as_scope_t, or -1 for no AS index. Returns 0, or
+ * 1 once an error is printed, leaving any old indexes as they are. */
+int create_mrt_index(const char *gzfile, const char *indexfile, const struct mrt_spacing_t *spacing, int self_contained, int as_scope)
+{
+    streamlike_t *gzf    = NULL;
+    streamlike_t *indexf = NULL;
+    streamlike_t *mrtf   = NULL;
+    zidx_index *zidx     = NULL;
+    struct mrt_index_t mrt_index;
+    struct mrt_build_t build;
+    struct mrt_as_index_builder_t as_builder;
+    struct mrt_walker_t as_walker;
+    streamlike_t *asf    = NULL;
+    char *asfile         = NULL;
+    char *mrtfile        = NULL;
+    char *temp           = NULL;
+    char *mrttemp        = NULL;
+    char *astemp         = NULL;
+    const size_t len = 128*1024;
+    const size_t read_len = 16*1024;
+    uint8_t *buf         = NULL;
+    int has_builder = 0, has_as_builder = 0;
+    int ret, read, code = 1;
+
+    gzf = open_gzip(gzfile, MAPPED_INPUT_SEQUENTIAL);
+    if (gzf == NULL) {
+        printf("Error opening file (%s)\n", gzfile);
+        return 1;
+    }
+    mrt_index_init(&mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+
+    if (self_contained) {
+        mrttemp = temp_path(indexfile);
+    } else {
+        temp = temp_path(indexfile);
+        mrtfile = mrt_index_path(indexfile);
+        if (mrtfile) mrttemp = temp_path(mrtfile);
+    }
     zidx = zidx_index_create();
-    assert(zidx);
+    buf = malloc(read_len);
+    if ((!self_contained && temp == NULL) || mrttemp == NULL ||
+        zidx == NULL || buf == NULL) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+    build.buf = buf;
 
     ret = zidx_index_init_ex(zidx, gzf, ZX_STREAM_GZIP_OR_ZLIB,
                              ZX_CHECKSUM_DEFAULT, NULL,
                              ZX_DEFAULT_INITIAL_LIST_CAPACITY,
                              ZX_DEFAULT_WINDOW_SIZE,
                              len, len);
-    /* ret = zidx_index_init(zidx, gzf); */
+    if (ret != ZX_RET_OK) {
+        printf("Error initializing index over %s\n", gzfile);
+        goto done;
+    }
+
+    build.spacing = *spacing;
+    build.self_contained = self_contained;
+    build.uncomp_base = 0;
+    build.comp_base = 0;
+    build.indexed_size = -1;
+    if (mrt_index_builder_init(&build.builder, &mrt_index) != 0) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+    has_builder = 1;
+
+    if (self_contained &&
+        mrt_index_builder_capture_windows(&build.builder, Z_BEST_COMPRESSION) != 0) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+
+    if (as_scope >= 0) {
+        asfile = mrt_as_index_path(indexfile);
+        if (asfile) astemp = temp_path(asfile);
+        if (astemp == NULL ||
+            mrt_as_index_builder_init(&as_builder, as_scope) != 0) {
+            printf("Error: out of memory\n");
+            goto done;
+        }
+        mrt_walker_init(&as_walker, 0, as_index_record, &as_builder);
+        has_as_builder = 1;
+    }
+
+    /* One inflate pass places checkpoints and walks records at once. Reads
+     * are kept short so record density seen by the spacing policy is
+     * current. */
+    while ((read = zidx_read_ex(zidx, buf, read_len, mrt_block_callback, &build)) > 0) {
+        if (mrt_index_builder_feed(&build.builder, buf, read) != 0) {
+            printf("Error indexing the records of %s\n", gzfile);
+            goto done;
+        }
+        mrt_index.uncomp_crc = crc32(mrt_index.uncomp_crc, buf, read);
+        if (has_as_builder && mrt_walker_feed(&as_walker, buf, read) != 0) {
+            printf("Error indexing the ASes of %s\n", gzfile);
+            goto done;
+        }
+    }
+    if (read < 0) {
+        printf("Error inflating %s\n", gzfile);
+        goto done;
+    }
+    mrt_index.uncomp_size = mrt_index_builder_position(&build.builder);
+    mrt_index.comp_size = sl_length(gzf);
+    if (mrt_index.comp_size < 0 ||
+        mrt_index_tail_crc(gzf, mrt_index.comp_size, &mrt_index.comp_tail_crc) != 0) {
+        printf("Error reading %s\n", gzfile);
+        goto done;
+    }
+
+    if (!self_contained) {
+        indexf = sl_fopen(temp, "wb");
+        if (indexf == NULL || zidx_export(zidx, indexf) != ZX_RET_OK) {
+            printf("Error writing index (%s)\n", temp);
+            goto done;
+        }
+        ret = sl_fclose(indexf);
+        indexf = NULL;
+        if (ret != ZX_RET_OK) {
+            printf("Error writing index (%s)\n", temp);
+            goto done;
+        }
+    }
+
+    mrtf = sl_fopen(mrttemp, "wb");
+    if (mrtf == NULL || mrt_index_export(&mrt_index, mrtf) != 0) {
+        printf("Error writing MRT index (%s)\n", mrttemp);
+        goto done;
+    }
+    ret = sl_fclose(mrtf);
+    mrtf = NULL;
+    if (ret != ZX_RET_OK) {
+        printf("Error writing MRT index (%s)\n", mrttemp);
+        goto done;
+    }
+
+    if (has_as_builder) {
+        asf = sl_fopen(astemp, "wb");
+        if (asf == NULL ||
+            mrt_as_index_builder_export(&as_builder, mrt_index.uncomp_size, asf) != 0) {
+            printf("Error writing AS index (%s)\n", astemp);
+            goto done;
+        }
+        ret = sl_fclose(asf);
+        asf = NULL;
+        if (ret != ZX_RET_OK) {
+            printf("Error writing AS index (%s)\n", astemp);
+            goto done;
+        }
+    }
+
+    if ((temp && rename(temp, indexfile) != 0) ||
+        rename(mrttemp, self_contained ? indexfile : mrtfile) != 0 ||
+        (astemp && rename(astemp, asfile) != 0)) {
+        printf("Error moving index in place (%s)\n", indexfile);
+        goto done;
+    }
+    code = 0;
+
+done:
+    if (indexf) sl_fclose(indexf);
+    if (mrtf) sl_fclose(mrtf);
+    if (asf) sl_fclose(asf);
+    if (code != 0) {
+        remove_temp(temp);
+        remove_temp(mrttemp);
+        remove_temp(astemp);
+    }
+    if (has_as_builder) {
+        mrt_walker_destroy(&as_walker);
+        mrt_as_index_builder_destroy(&as_builder);
+    }
+    if (has_builder) mrt_index_builder_destroy(&build.builder);
+    mrt_index_destroy(&mrt_index);
+    if (zidx) zidx_index_destroy(zidx);
+    free(zidx);
+    close_gzip(gzf);
+    free(asfile);
+    free(mrtfile);
+    free(temp);
+    free(mrttemp);
+    free(astemp);
+    free(buf);
+    return code;
+}
+
+/* The part of a stream from `base` on as a stream of its own, so that zidx
+ * inflates the gzip members appended to an indexed file like a new file. */
+struct tail_stream_t {
+    streamlike_t *input;
+    off_t base;
+};
+
+static size_t tail_read(void *context, void *buffer, size_t size)
+{
+    return sl_read(((struct tail_stream_t *)context)->input, buffer, size);
+}
+
+static int tail_seek(void *context, off_t offset, sl_seek_whence_t whence)
+{
+    struct tail_stream_t *tail = context;
+    if (whence == SL_SEEK_SET) offset += tail->base;
+    return sl_seek(tail->input, offset, whence);
+}
+
+static off_t tail_tell(void *context)
+{
+    struct tail_stream_t *tail = context;
+    off_t offset = sl_tell(tail->input);
+    return offset < 0 ? offset : offset - tail->base;
+}
+
+static int tail_eof(void *context)
+{
+    return sl_eof(((struct tail_stream_t *)context)->input);
+}
+
+static int tail_error(void *context)
+{
+    return sl_error(((struct tail_stream_t *)context)->input);
+}
+
+static off_t tail_length(void *context)
+{
+    struct tail_stream_t *tail = context;
+    off_t length = sl_length(tail->input);
+    return length < 0 ? length : length - tail->base;
+}
+
+static sl_seekable_t tail_seekable(void *context)
+{
+    streamlike_t *input = ((struct tail_stream_t *)context)->input;
+    return input->seekable(input->context);
+}
+
+/* Feeds the builder until zidx runs out of data, checksumming the bytes past
+ * what the index covered already. Returns 0, or 1 once an error is printed. */
+static int extend_records(zidx_index *zidx, struct mrt_build_t *build,
+                          uint8_t *buf, size_t read_len, uint32_t *crc)
+{
+    int read;
+
+    while ((read = zidx_read_ex(zidx, buf, read_len, mrt_block_callback, build)) > 0) {
+        off_t position = mrt_index_builder_position(&build->builder);
+        off_t old = build->indexed_size - position;
+        if (old < 0) old = 0;
+        if (old < read) *crc = crc32(*crc, buf + old, read - old);
+        if (mrt_index_builder_feed(&build->builder, buf, read) != 0) {
+            printf("Error indexing the new records\n");
+            return 1;
+        }
+    }
+    if (read < 0) {
+        printf("Error inflating the new members\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Extends an index built with -m or -z over the gzip members appended to the
+ * file since, once its size and the checksum of its last bytes show the file
+ * still starts with the indexed one. Indexing resumes at the last record known
+ * to start a window before the old end, so the windows and records of new
+ * checkpoints there are complete, and the work is that of the new members and
+ * about one span. Returns 0, or 1 if the index can't be extended, and sets
+ * `self_contained` to the kind of index found. The old index stays in place
+ * unless the new one is complete. */
+int extend_mrt_index(const char *gzfile, const char *indexfile, const struct mrt_spacing_t *spacing, int *self_contained)
+{
+    streamlike_t *gzf    = NULL;
+    streamlike_t *indexf = NULL;
+    streamlike_t *mrtf   = NULL;
+    streamlike_t *outf   = NULL;
+    zidx_index *zidx     = NULL;
+    struct mrt_index_t mrt_index;
+    struct mrt_build_t build;
+    struct mrt_reader_t reader;
+    struct tail_stream_t tail;
+    streamlike_t tail_stream;
+    char *mrtfile        = NULL;
+    char *asfile         = NULL;
+    char *temp           = NULL;
+    char *mrttemp        = NULL;
+    const size_t len = 128*1024;
+    const size_t read_len = 16*1024;
+    uint8_t *buf         = NULL;
+    uint32_t tail_crc, crc = crc32(0, NULL, 0);
+    off_t comp_size, indexed, resume = 0;
+    int ret, x, old_count, had_timestamps, code = 1;
+    int has_builder = 0, has_reader = 0;
+    FILE *fp;
+
+    gzf = open_gzip(gzfile, MAPPED_INPUT_SEQUENTIAL);
+    if (gzf == NULL) {
+        printf("Error opening file (%s)\n", gzfile);
+        return 1;
+    }
+    mrt_index_init(&mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+
+    indexf = sl_fopen(indexfile, "rb");
+    if (indexf == NULL) {
+        printf("Error opening index (%s)\n", indexfile);
+        goto done;
+    }
+    *self_contained = mrt_index_is_mrt_index(indexf);
+
+    if (*self_contained) {
+        mrtf = indexf;
+        indexf = NULL;
+    } else {
+        mrtfile = mrt_index_path(indexfile);
+        if (mrtfile == NULL) {
+            printf("Error: out of memory\n");
+            goto done;
+        }
+        mrtf = sl_fopen(mrtfile, "rb");
+        if (mrtf == NULL) {
+            printf("Error opening MRT index (%s), only indexes built with -m or -z can be extended\n", mrtfile);
+            goto done;
+        }
+    }
+
+    if (mrt_index_import(&mrt_index, mrtf) != 0) {
+        printf("Error reading MRT index (%s)\n", *self_contained ? indexfile : mrtfile);
+        goto done;
+    }
+    sl_fclose(mrtf);
+    mrtf = NULL;
+
+    indexed = mrt_index.uncomp_size;
+    comp_size = sl_length(gzf);
+    if (mrt_index.comp_size < 0 || indexed < 0) {
+        printf("Error: index (%s) doesn't record the file it was built over, rebuild it\n", indexfile);
+        goto done;
+    }
+    if (comp_size < mrt_index.comp_size ||
+        mrt_index_tail_crc(gzf, mrt_index.comp_size, &tail_crc) != 0 ||
+        tail_crc != mrt_index.comp_tail_crc) {
+        printf("Error: %s doesn't start with the file indexed by %s anymore, rebuild the index\n", gzfile, indexfile);
+        goto done;
+    }
+    if (comp_size == mrt_index.comp_size) {
+        printf("Index (%s) is up to date\n", indexfile);
+        code = 0;
+        goto done;
+    }
+
+    /* Resume at the next record of the last checkpoint that has one a whole
+     * window before the old end. Checkpoints no record was found after are
+     * all at the end and get theirs from the new records. */
+    for (x = mrt_index.count - 1; x >= 0; x--) {
+        const struct mrt_checkpoint_t *ckp = &mrt_index.checkpoints[x];
+        if (ckp->next_record != MRT_INDEX_NO_RECORD &&
+            ckp->next_record + (off_t)mrt_index.window_size <= indexed) {
+            resume = ckp->next_record;
+            break;
+        }
+    }
+
+    buf = malloc(read_len);
+    temp = *self_contained ? NULL : temp_path(indexfile);
+    mrttemp = temp_path(*self_contained ? indexfile : mrtfile);
+    asfile = mrt_as_index_path(indexfile);
+    if (buf == NULL || (!*self_contained && temp == NULL) ||
+        mrttemp == NULL || asfile == NULL) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+
+    old_count = mrt_index.count;
+    had_timestamps = mrt_index.has_timestamps;
+    build.spacing = *spacing;
+    build.self_contained = *self_contained;
+    build.uncomp_base = 0;
+    build.comp_base = 0;
+    build.indexed_size = indexed;
+    build.buf = buf;
+    if (mrt_index_builder_init(&build.builder, &mrt_index) != 0) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+    has_builder = 1;
+    mrt_index.has_timestamps = had_timestamps;
+    mrt_index_builder_resume(&build.builder, resume);
+
+    if (*self_contained &&
+        mrt_index_builder_capture_windows(&build.builder, Z_BEST_COMPRESSION) != 0) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+
+    zidx = zidx_index_create();
+    if (zidx == NULL) {
+        printf("Error: out of memory\n");
+        goto done;
+    }
+
+    if (*self_contained) {
+        /* The indexed part is read back through the index itself, then zidx
+         * inflates the new members, which start without a window. */
+        if (mrt_reader_init(&reader, gzf, &mrt_index) != 0) {
+            printf("Error: out of memory\n");
+            goto done;
+        }
+        has_reader = 1;
+        if (mrt_reader_seek(&reader, resume) != 0) {
+            printf("Error reading %s through its index\n", gzfile);
+            goto done;
+        }
+        while (mrt_index_builder_position(&build.builder) < indexed) {
+            off_t left = indexed - mrt_index_builder_position(&build.builder);
+            long read = mrt_reader_read(&reader, buf, left < (off_t)read_len ? (size_t)left : read_len);
+            if (read <= 0) {
+                printf("Error reading %s through its index\n", gzfile);
+                goto done;
+            }
+            if (mrt_index_builder_feed(&build.builder, buf, read) != 0) {
+                printf("Error indexing the records of %s\n", gzfile);
+                goto done;
+            }
+        }
+        mrt_reader_destroy(&reader);
+        has_reader = 0;
+
+        tail = (struct tail_stream_t){gzf, mrt_index.comp_size};
+        memset(&tail_stream, 0, sizeof(tail_stream));
+        tail_stream.context = &tail;
+        tail_stream.read = tail_read;
+        tail_stream.seek = tail_seek;
+        tail_stream.tell = tail_tell;
+        tail_stream.eof = tail_eof;
+        tail_stream.error = tail_error;
+        tail_stream.length = tail_length;
+        tail_stream.seekable = tail_seekable;
+        build.uncomp_base = indexed;
+        build.comp_base = mrt_index.comp_size;
+
+        if (sl_seek(gzf, mrt_index.comp_size, SL_SEEK_SET) != 0 ||
+            zidx_index_init_ex(zidx, &tail_stream, ZX_STREAM_GZIP_OR_ZLIB,
+                               ZX_CHECKSUM_DEFAULT, NULL,
+                               ZX_DEFAULT_INITIAL_LIST_CAPACITY,
+                               ZX_DEFAULT_WINDOW_SIZE,
+                               len, len) != ZX_RET_OK) {
+            printf("Error initializing index over the new members of %s\n", gzfile);
+            goto done;
+        }
+    } else {
+        if (sl_seek(gzf, 0, SL_SEEK_SET) != 0 ||
+            zidx_index_init_ex(zidx, gzf, ZX_STREAM_GZIP_OR_ZLIB,
+                               ZX_CHECKSUM_DEFAULT, NULL,
+                               ZX_DEFAULT_INITIAL_LIST_CAPACITY,
+                               ZX_DEFAULT_WINDOW_SIZE,
+                               len, len) != ZX_RET_OK) {
+            printf("Error initializing index over %s\n", gzfile);
+            goto done;
+        }
+        if (zidx_import(zidx, indexf) != ZX_RET_OK) {
+            printf("Error reading index (%s)\n", indexfile);
+            goto done;
+        }
+        if (!mrt_index_matches(&mrt_index, zidx)) {
+            printf("Error: index (%s) and MRT index (%s) don't match, rebuild them\n", indexfile, mrtfile);
+            goto done;
+        }
+        if (zidx_seek(zidx, resume) != ZX_RET_OK) {
+            printf("Error seeking %s to %lld\n", gzfile, (long long)resume);
+            goto done;
+        }
+    }
+
+    if (old_count > 0) {
+        const struct mrt_checkpoint_t *last = &mrt_index.checkpoints[old_count - 1];
+        off_t last_comp = *self_contained ? last->comp_offset
+            : zidx_get_checkpoint_comp_offset(zidx_get_checkpoint(zidx, old_count - 1));
+        mrt_spacing_placed(&build.spacing, &build.builder, last->offset, last_comp);
+    }
+
+    if (extend_records(zidx, &build, buf, read_len, &crc) != 0)
+        goto done;
+    mrt_index.uncomp_size = mrt_index_builder_position(&build.builder);
+    mrt_index.uncomp_crc = crc32_combine(mrt_index.uncomp_crc, crc, mrt_index.uncomp_size - indexed);
+    mrt_index.comp_size = comp_size;
+    if (mrt_index_tail_crc(gzf, comp_size, &mrt_index.comp_tail_crc) != 0) {
+        printf("Error reading %s\n", gzfile);
+        goto done;
+    }
+
+    if (temp) {
+        outf = sl_fopen(temp, "wb");
+        if (outf == NULL || zidx_export(zidx, outf) != ZX_RET_OK) {
+            printf("Error writing index (%s)\n", temp);
+            goto done;
+        }
+        ret = sl_fclose(outf);
+        outf = NULL;
+        if (ret != ZX_RET_OK) {
+            printf("Error writing index (%s)\n", temp);
+            goto done;
+        }
+    }
+
+    outf = sl_fopen(mrttemp, "wb");
+    if (outf == NULL || mrt_index_export(&mrt_index, outf) != 0) {
+        printf("Error writing MRT index (%s)\n", mrttemp);
+        goto done;
+    }
+    ret = sl_fclose(outf);
+    outf = NULL;
+    if (ret != ZX_RET_OK) {
+        printf("Error writing MRT index (%s)\n", mrttemp);
+        goto done;
+    }
+
+    if ((temp && rename(temp, indexfile) != 0) ||
+        rename(mrttemp, *self_contained ? indexfile : mrtfile) != 0) {
+        printf("Error moving index in place (%s)\n", indexfile);
+        goto done;
+    }
+    code = 0;
+
+    printf("Extended index (%s) over %lld new bytes with %d checkpoints\n",
+           indexfile, (long long)(mrt_index.uncomp_size - indexed),
+           mrt_index.count - old_count);
+
+    fp = fopen(asfile, "rb");
+    if (fp) {
+        printf("Warning: AS index (%s) doesn't cover the new members, rebuild it with -a or -A\n", asfile);
+        fclose(fp);
+    }
+
+done:
+    if (indexf) sl_fclose(indexf);
+    if (mrtf) sl_fclose(mrtf);
+    if (outf) sl_fclose(outf);
+    if (code != 0) {
+        remove_temp(temp);
+        remove_temp(mrttemp);
+    }
+    if (has_reader) mrt_reader_destroy(&reader);
+    if (has_builder) mrt_index_builder_destroy(&build.builder);
+    mrt_index_destroy(&mrt_index);
+    if (zidx) zidx_index_destroy(zidx);
+    free(zidx);
+    close_gzip(gzf);
+    free(asfile);
+    free(temp);
+    free(mrttemp);
+    free(mrtfile);
+    free(buf);
+    return code;
+}
+
+#ifndef NDEBUG
+/* Checks the sizes and checksums of the file an index was built over against
+ * the file, inflated in one go. */
+static void verify_file_sums(const char *gzfile, const struct mrt_index_t *mrt_index)
+{
+    streamlike_t *gzf = NULL;
+    gzFile gz = NULL;
+    const size_t len = 64*1024;
+    char buf[len];
+    uint32_t crc = crc32(0, NULL, 0);
+    off_t size = 0;
+    int ret, read;
+
+    if (mrt_index->comp_size < 0) return;
+
+    gz = gzopen(gzfile, "rb");
+    assert(gz);
+    while ((read = gzread(gz, buf, len)) > 0) {
+        crc = crc32(crc, (const Bytef*)buf, read);
+        size += read;
+    }
+    assert(read == 0);
+    gzclose(gz);
+    assert(size == mrt_index->uncomp_size);
+    assert(crc == mrt_index->uncomp_crc);
+
+    gzf = sl_fopen(gzfile, "rb");
+    assert(gzf);
+    assert(sl_length(gzf) == mrt_index->comp_size);
+    ret = mrt_index_tail_crc(gzf, mrt_index->comp_size, &crc);
+    assert(ret == 0);
+    assert(crc == mrt_index->comp_tail_crc);
+    sl_fclose(gzf);
+}
+
+void verify_self_contained_index(const char *gzfile, const char *indexfile)
+{
+    streamlike_t *gzf    = NULL;
+    streamlike_t *mrtf   = NULL;
+    struct mrt_index_t mrt_index;
+    struct mrt_reader_t reader;
+    gzFile gz = NULL;
+    const size_t len = 64*1024;
+    char buf1[len];
+    char buf2[len];
+    int ret, x;
+    long read1, read2;
+
+    gzf = open_gzip(gzfile, MAPPED_INPUT_RANDOM);
+    assert(gzf);
+
+    mrtf = sl_fopen(indexfile, "rb");
+    assert(mrtf);
+    assert(mrt_index_is_mrt_index(mrtf));
+
+    ret = mrt_index_init(&mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+    assert(ret == 0);
+
+    ret = mrt_index_import(&mrt_index, mrtf);
+    assert(ret == 0);
+    assert(mrt_index.has_windows);
+    verify_file_sums(gzfile, &mrt_index);
+
+    ret = mrt_reader_init(&reader, gzf, &mrt_index);
+    assert(ret == 0);
+
+    gz = gzopen(gzfile, "rb");
+    assert(gz);
+
+    /* Backwards, so every checkpoint is reached through its own window. */
+    for(x=mrt_index.count-1;x>=0;x--)
+    {
+        const struct mrt_checkpoint_t *ckp = &mrt_index.checkpoints[x];
+        struct mrt_header_t header;
+
+        ret = mrt_reader_seek(&reader, ckp->offset);
+        assert(ret == 0);
+        read2 = mrt_reader_read(&reader, buf2, len);
+        assert(gzseek(gz, ckp->offset, SEEK_SET) == ckp->offset);
+        read1 = gzread(gz, buf1, len);
+        assert(read1 == read2);
+        assert(!memcmp(buf1, buf2, read1));
+
+        if (ckp->next_record == MRT_INDEX_NO_RECORD) continue;
+        ret = mrt_reader_seek(&reader, ckp->next_record);
+        assert(ret == 0);
+        read2 = mrt_reader_read(&reader, buf2, 12);
+        assert(read2 == 12);
+        header = get_header(buf2);
+        assert(is_tdv2_rib_header(&header) || is_bgp4mp_header(&header));
+        printf("Checkpoint %d at %lu: window %u bytes deflated to %u, next record %lu\n",
+               x, (unsigned long) ckp->offset, ckp->window_len, ckp->packed_len,
+               (unsigned long) ckp->next_record);
+    }
+
+    gzclose(gz);
+
+    ret = close_gzip(gzf);
     assert(ret == ZX_RET_OK);
 
-    ret = zidx_build_index(zidx, span, is_uncompressed ? 1 : 0);
+    ret = sl_fclose(mrtf);
     assert(ret == ZX_RET_OK);
 
-    ret = zidx_export(zidx, indexf);
+    mrt_reader_destroy(&reader);
+    mrt_index_destroy(&mrt_index);
+}
+
+void verify_mrt_index(const char *gzfile, const char *indexfile)
+{
+    streamlike_t *gzf    = NULL;
+    streamlike_t *indexf = NULL;
+    streamlike_t *mrtf   = NULL;
+    zidx_index *zidx     = NULL;
+    struct mrt_index_t mrt_index;
+    char *mrtfile        = NULL;
+    uint8_t header_buf[12];
+    int ret, x;
+
+    gzf = open_gzip(gzfile, MAPPED_INPUT_RANDOM);
+    assert(gzf);
+
+    indexf = sl_fopen(indexfile, "rb");
+    assert(indexf);
+
+    mrtfile = mrt_index_path(indexfile);
+    assert(mrtfile);
+
+    mrtf = sl_fopen(mrtfile, "rb");
+    assert(mrtf);
+
+    zidx = zidx_index_create();
+    assert(zidx);
+
+    ret = zidx_index_init(zidx, gzf);
+    assert(ret == ZX_RET_OK);
+
+    ret = zidx_import(zidx, indexf);
     assert(ret == ZX_RET_OK);
 
-    ret = sl_fclose(gzf);
+    ret = mrt_index_init(&mrt_index, ZX_DEFAULT_WINDOW_SIZE);
+    assert(ret == 0);
+
+    ret = mrt_index_import(&mrt_index, mrtf);
+    assert(ret == 0);
+    assert(mrt_index_matches(&mrt_index, zidx));
+    verify_file_sums(gzfile, &mrt_index);
+
+    for(x=0;x<mrt_index.count;x++)
+    {
+        const struct mrt_checkpoint_t *ckp = &mrt_index.checkpoints[x];
+        const void *window;
+        size_t window_len = zidx_get_checkpoint_window(zidx_get_checkpoint(zidx, x), &window);
+        off_t off = mrt_index_window_offset(&mrt_index, x, window_len);
+        struct mrt_header_t header;
+
+        if (off >= 0 && off + sizeof(header_buf) <= window_len) {
+            header = get_header((const uint8_t*)window + off);
+            assert(is_tdv2_rib_header(&header) || is_bgp4mp_header(&header));
+        }
+        if (ckp->next_record == MRT_INDEX_NO_RECORD) continue;
+        assert(ckp->window_record <= ckp->next_record);
+
+        ret = zidx_seek(zidx, ckp->next_record);
+        assert(ret == ZX_RET_OK);
+        ret = zidx_read(zidx, header_buf, sizeof(header_buf));
+        assert(ret == sizeof(header_buf));
+        header = get_header(header_buf);
+        assert(is_tdv2_rib_header(&header) || is_bgp4mp_header(&header));
+        printf("Checkpoint %d at %lu: first record in window %ld, next record %lu\n",
+               x, (unsigned long) ckp->offset, (long) off,
+               (unsigned long) ckp->next_record);
+    }
+
+    ret = close_gzip(gzf);
     assert(ret == ZX_RET_OK);
 
     ret = sl_fclose(indexf);
     assert(ret == ZX_RET_OK);
 
+    ret = sl_fclose(mrtf);
+    assert(ret == ZX_RET_OK);
+
     ret = zidx_index_destroy(zidx);
     assert(ret == ZX_RET_OK);
 
+    mrt_index_destroy(&mrt_index);
+    free(mrtfile);
     free(zidx);
 }
 
-#ifndef NDEBUG
 void verify_index(const char *gzfile, const char *indexfile)
 {
 
@@ -95,7 +950,7 @@ void verify_index(const char *gzfile, const char *indexfile)
     char buf2[len];
     int ret, read1, read2;
 
-    gzf = sl_fopen(gzfile, "rb");
+    gzf = open_gzip(gzfile, MAPPED_INPUT_RANDOM);
     assert(gzf);
 
     indexf = sl_fopen(indexfile, "rb");
@@ -140,7 +995,7 @@ void verify_index(const char *gzfile, const char *indexfile)
     assert(gzip_checksum==zidx_checksum);
 
 
-    ret = sl_fclose(gzf);
+    ret = close_gzip(gzf);
     assert(ret == ZX_RET_OK);
 
     ret = sl_fclose(indexf);
@@ -153,17 +1008,122 @@ void verify_index(const char *gzfile, const char *indexfile)
 }
 #endif
 
+long get_file_size(const char *filename)
+{
+	FILE *comp;
+
+	comp=fopen(filename,"rb");
+	if(comp==NULL)
+		return -1;
+	fseek(comp,0,SEEK_END);
+	long comp_size=ftell(comp);
+	fclose(comp);
+	return comp_size;
+}
+
+void usage(const char *program)
+{
+    printf("Usage: %s <gzip-file> <index-file> <checkpoint-span> <is-spans-based-on-uncompressed-size> "
+           "[-m] [-z] [-a] [-A] [-e] [-l <max-lookup-bytes>] [-s <max-index-bytes>] [-r <record-cost>]\n"
+           "\t-m: also record MRT record offsets per checkpoint in <index-file>%s\n"
+           "\t-z: write <index-file> as a self-contained MRT index with compressed windows instead (implies -m)\n"
+           "\t-l: place checkpoints so a lookup inflates and parses at most this many bytes, overrides span (implies -m)\n"
+           "\t-s: spread checkpoints evenly by lookup cost within this index size, overrides span (implies -m)\n"
+           "\t-r: cost of parsing one record in inflated bytes for -l and -s (default: 32)\n"
+           "\t-a: also map origin ASes to their RIB records in <index-file>%s (implies -m)\n"
+           "\t-A: like -a, but for every AS on the AS path (implies -m)\n"
+           "\t-e: extend <index-file>, built with -m or -z, over the gzip members appended to <gzip-file> since, "
+           "placing new checkpoints by span, -l or -r\n",
+           program, MRT_INDEX_SUFFIX, MRT_AS_INDEX_SUFFIX);
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 5) {
-        printf("Usage: %s <gzip-file> <index-file> <checkpoint-span> <is-spans-based-on-uncompressed-size>\n", argv[0]);
+    if (argc < 5) {
+        usage(argv[0]);
         return 1;
     }
     long int span = atol(argv[3]);
     int is_uncompressed = atoi(argv[4]);
+    int mrt_aware = 0;
+    int self_contained = 0;
+    int as_scope = -1;
+    int extend = 0;
+    struct mrt_spacing_t spacing;
+    mrt_spacing_init(&spacing, is_uncompressed ? MRT_SPACING_UNCOMP : MRT_SPACING_COMP);
+    spacing.span = span;
+
+    for (int i = 5; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "-z")) {
+            mrt_aware = 1;
+            if (argv[i][1] == 'z') self_contained = 1;
+            continue;
+        }
+        if (!strcmp(argv[i], "-e")) {
+            extend = 1;
+            continue;
+        }
+        if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "-A")) {
+            mrt_aware = 1;
+            as_scope = argv[i][1] == 'A' ? MRT_AS_INDEX_PATH : MRT_AS_INDEX_ORIGIN;
+            continue;
+        }
+        if (value == NULL || atof(value) <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!strcmp(argv[i], "-l")) {
+            spacing.type = MRT_SPACING_LOOKUP_COST;
+            spacing.max_lookup_cost = atof(value);
+        } else if (!strcmp(argv[i], "-s")) {
+            /* Every checkpoint costs a full window plus its offsets. */
+            spacing.type = MRT_SPACING_INDEX_SIZE;
+            spacing.max_checkpoints = atof(value) / (ZX_DEFAULT_WINDOW_SIZE + 64);
+            if (spacing.max_checkpoints < 1) spacing.max_checkpoints = 1;
+        } else if (!strcmp(argv[i], "-r")) {
+            spacing.record_cost = atof(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        mrt_aware = 1;
+        i++;
+    }
+
+    /* -s budgets checkpoints for a whole file, and AS indexes are rebuilt
+     * from scratch. */
+    if (extend && (as_scope >= 0 || spacing.type == MRT_SPACING_INDEX_SIZE)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (spacing.type == MRT_SPACING_INDEX_SIZE) {
+        spacing.comp_size = get_file_size(argv[1]);
+        if (spacing.comp_size < 0) {
+            printf("Error opening file (%s)\n", argv[1]);
+            return 1;
+        }
+    }
+
+    if (extend) {
+        if (extend_mrt_index(argv[1], argv[2], &spacing, &self_contained) != 0)
+            return 1;
+        mrt_aware = 1;
+    } else if (mrt_aware) {
+        if (create_mrt_index(argv[1], argv[2], &spacing, self_contained, as_scope) != 0)
+            return 1;
+    } else if (create_index(argv[1], argv[2], span, is_uncompressed) != 0) {
+        return 1;
+    }
 #ifndef NDEBUG
-    create_index(argv[1], argv[2], span, is_uncompressed);
-    verify_index(argv[1], argv[2]);
+    if (self_contained) {
+        verify_self_contained_index(argv[1], argv[2]);
+    } else {
+        verify_index(argv[1], argv[2]);
+        if (mrt_aware)
+            verify_mrt_index(argv[1], argv[2]);
+    }
 #endif
     return 0;
 